@@ -57,6 +57,18 @@ class MVP {
 
   virtual smat compute(smat u_ia, double omega = 0.0) = 0;
 
+  /* Sigma vectors of several trial vectors. MVPs which build the J/K
+   * matrices of all vectors in one pass over the integrals override this,
+   * the default computes one vector after another.
+   */
+  virtual std::vector<smat> compute_block(
+      std::vector<smat>& u_ia, double omega = 0.0)
+  {
+    std::vector<smat> sigmas;
+    for (auto& u : u_ia) { sigmas.push_back(compute(u, omega)); }
+    return sigmas;
+  }
+
   virtual void init() = 0;
 
   virtual ~MVP()
@@ -119,6 +131,9 @@ class MVP_AORIADC1 : public MVP {
 
   smat compute(smat u_ia, double omega) override;
 
+  std::vector<smat> compute_block(
+      std::vector<smat>& u_ia, double omega) override;
+
   void print_info() override
   {
     LOG.os<>("Timings for AO-ADC(1): \n");
@@ -177,8 +192,13 @@ class MVP_AORISOSADC2 : public MVP {
   std::shared_ptr<Eigen::MatrixXi> m_shellpairs;
   dbcsr::shared_matrix<double> m_s_sqrt_bb, m_s_invsqrt_bb;
 
+  // sigma of one vector, given its pseudo J and K
+  smat compute_sigma(
+      smat& u_ia, smat& u_ao, std::pair<smat, smat>& jkpair, double omega);
+
   // adc 1
-  std::pair<smat, smat> compute_jk(smat& u_ia, smat& u_ao);
+  std::vector<std::pair<smat, smat>> compute_jk(
+      std::vector<smat>& u_ia, std::vector<smat>& u_ao);
   smat compute_sigma_1(smat& jmat, smat& kmat);
 
   // adc 2
@@ -280,6 +300,9 @@ class MVP_AORISOSADC2 : public MVP {
 
   smat compute(smat u_ia, double omega) override;
 
+  std::vector<smat> compute_block(
+      std::vector<smat>& u_ia, double omega) override;
+
   void print_info() override
   {
     LOG.os<>("Timings for AO-ADC(2): \n");
@@ -76,34 +76,45 @@ void MVP_AORIADC1::init()
   LOG.os<>("Done with setting up.\n");
 }
 
-smat MVP_AORIADC1::compute(smat u_ia, [[maybe_unused]] double omega)
+smat MVP_AORIADC1::compute(smat u_ia, double omega)
+{
+  std::vector<smat> u_ias = {u_ia};
+  return compute_block(u_ias, omega)[0];
+}
+
+std::vector<smat> MVP_AORIADC1::compute_block(
+    std::vector<smat>& u_ia, [[maybe_unused]] double omega)
 {
   TIME.start();
 
-  LOG.os<1>("Computing ADC0.\n");
-  // compute ADC0 part in MO basis
-  smat sig_0 = compute_sigma_0(u_ia, m_eps_occ, m_eps_vir);
+  const int nvecs = u_ia.size();
 
-  // transform u to ao coordinated
+  // transform u to ao coordinates
 
-  LOG.os<1>("Computing ADC1.\n");
-  smat u_ao = u_transform(u_ia, 'N', m_c_bo, 'T', m_c_bv);
+  LOG.os<1>("Computing ADC1 for ", nvecs, " vectors.\n");
 
-  // LOG.os<>("U transformed: \n");
-  // dbcsr::print(*u_ao);
+  std::vector<smat> u_ao(nvecs);
 
-  u_ao->filter(dbcsr::global::filter_eps);
+  for (int i = 0; i != nvecs; ++i) {
+    u_ao[i] = u_transform(u_ia[i], 'N', m_c_bo, 'T', m_c_bv);
+    u_ao[i]->filter(dbcsr::global::filter_eps);
+  }
 
-  m_jbuilder->set_density_alpha(u_ao);
+  // J and K of all vectors in one pass over the integrals
+  m_jbuilder->set_density_stack(u_ao);
 
   if (m_kmethod != fock::kmethod::dflmo) {
-    m_kbuilder->set_density_alpha(u_ao);
+    m_kbuilder->set_density_stack(u_ao);
   }
   else {
-    auto o = u_ia->row_blk_sizes();
+    auto o = u_ia[0]->row_blk_sizes();
     auto b = m_c_bv->row_blk_sizes();
 
-    auto uc_ob = dbcsr::matrix<double>::create()
+    std::vector<smat> c_ob(nvecs, m_c_bo);
+    std::vector<smat> uc_ob(nvecs);
+
+    for (int i = 0; i != nvecs; ++i) {
+      uc_ob[i] = dbcsr::matrix<double>::create()
                      .set_cart(m_world.dbcsr_grid())
                      .name("uc_ob")
                      .row_blk_sizes(o)
@@ -111,43 +122,44 @@ smat MVP_AORIADC1::compute(smat u_ia, [[maybe_unused]] double omega)
                      .matrix_type(dbcsr::type::no_symmetry)
                      .build();
 
-    dbcsr::multiply('N', 'T', 1.0, *u_ia, *m_c_bv, 0.0, *uc_ob).perform();
+      dbcsr::multiply('N', 'T', 1.0, *u_ia[i], *m_c_bv, 0.0, *uc_ob[i])
+          .perform();
+    }
 
-    m_kbuilder->set_coeff_left_alpha(m_c_bo);
-    m_kbuilder->set_coeff_right_alpha(uc_ob);
+    m_kbuilder->set_coeff_left_stack(c_ob);
+    m_kbuilder->set_coeff_right_stack(uc_ob);
   }
 
-  m_jbuilder->compute_J();
-  m_kbuilder->compute_K();
+  m_jbuilder->compute_J_stack();
+  m_kbuilder->compute_K_stack();
+
+  auto jmats = m_jbuilder->get_J_stack();
+  auto kmats = m_kbuilder->get_K_stack();
 
-  auto jmat = m_jbuilder->get_J();
-  auto kmat = m_kbuilder->get_K_A();
+  std::vector<smat> sigmas(nvecs);
 
-  // recycle u_ao
-  u_ao->add(0.0, 1.0, *jmat);
-  u_ao->add(1.0, 1.0, *kmat);
+  for (int i = 0; i != nvecs; ++i) {
+    // compute ADC0 part in MO basis
+    smat sig_0 = compute_sigma_0(u_ia[i], m_eps_occ, m_eps_vir);
 
-  // LOG.os<>("Sigma adc1 ao:\n");
-  // dbcsr::print(*u_ao);
+    // recycle u_ao
+    u_ao[i]->add(0.0, 1.0, *jmats[i]);
+    u_ao[i]->add(1.0, 1.0, *kmats[i]);
 
-  // transform back
-  smat sig_1 = u_transform(u_ao, 'T', m_c_bo, 'N', m_c_bv);
+    // transform back
+    smat sig_1 = u_transform(u_ao[i], 'T', m_c_bo, 'N', m_c_bv);
 
 #ifdef _DLOG
-  dbcsr::print(*sig_1);
+    dbcsr::print(*sig_1);
 #endif
 
-  // LOG.os<>("Sigma adc1 mo:\n");
-  // dbcsr::print(*sig_1);
-
-  sig_0->add(1.0, 1.0, *sig_1);
-
-  // LOG.os<>("Sigma adc1 tot:\n");
-  // dbcsr::print(*sig_0);
+    sig_0->add(1.0, 1.0, *sig_1);
+    sigmas[i] = sig_0;
+  }
 
   TIME.finish();
 
-  return sig_0;
+  return sigmas;
 }
 
 }  // namespace adc
@@ -178,19 +178,25 @@ void MVP_AORISOSADC2::init()
  *                          MVP FUNCTIONS (ADC1)
  * ====================================================================*/
 
-// Computes the pseudo J and K matrices with the excited state density
-std::pair<smat, smat> MVP_AORISOSADC2::compute_jk(smat& u_ia, smat& u_ao)
+// Computes the pseudo J and K matrices with the excited state densities,
+// for all trial vectors in one pass over the integrals
+std::vector<std::pair<smat, smat>> MVP_AORISOSADC2::compute_jk(
+    std::vector<smat>& u_ia, std::vector<smat>& u_ao)
 {
   auto& t_jk = TIME.sub("Computing pseudo-JK");
   t_jk.start();
 
-  m_jbuilder->set_density_alpha(u_ao);
+  m_jbuilder->set_density_stack(u_ao);
 
   if (m_kmethod != fock::kmethod::dflmo) {
-    m_kbuilder->set_density_alpha(u_ao);
+    m_kbuilder->set_density_stack(u_ao);
   }
   else {
-    auto uc_ob = dbcsr::matrix<double>::create()
+    std::vector<smat> c_ob(u_ia.size(), m_c_bo);
+    std::vector<smat> uc_ob(u_ia.size());
+
+    for (size_t i = 0; i != u_ia.size(); ++i) {
+      uc_ob[i] = dbcsr::matrix<double>::create()
                      .set_cart(m_world.dbcsr_grid())
                      .name("uc_ob")
                      .row_blk_sizes(m_o)
@@ -198,19 +204,24 @@ std::pair<smat, smat> MVP_AORISOSADC2::compute_jk(smat& u_ia, smat& u_ao)
                      .matrix_type(dbcsr::type::no_symmetry)
                      .build();
 
-    dbcsr::multiply('N', 'T', 1.0, *u_ia, *m_c_bv, 0.0, *uc_ob).perform();
+      dbcsr::multiply('N', 'T', 1.0, *u_ia[i], *m_c_bv, 0.0, *uc_ob[i])
+          .perform();
+    }
 
-    m_kbuilder->set_coeff_left_alpha(m_c_bo);
-    m_kbuilder->set_coeff_right_alpha(uc_ob);
+    m_kbuilder->set_coeff_left_stack(c_ob);
+    m_kbuilder->set_coeff_right_stack(uc_ob);
   }
 
-  m_jbuilder->compute_J();
-  m_kbuilder->compute_K();
+  m_jbuilder->compute_J_stack();
+  m_kbuilder->compute_K_stack();
 
-  auto jmat = m_jbuilder->get_J();
-  auto kmat = m_kbuilder->get_K_A();
+  auto jmats = m_jbuilder->get_J_stack();
+  auto kmats = m_kbuilder->get_K_stack();
 
-  std::pair<smat, smat> out = {jmat, kmat};
+  std::vector<std::pair<smat, smat>> out;
+  for (size_t i = 0; i != jmats.size(); ++i) {
+    out.push_back({jmats[i], kmats[i]});
+  }
 
   t_jk.finish();
 
@@ -2307,13 +2318,47 @@ smat MVP_AORISOSADC2::compute_sigma_2e_OV(smat& u_ao, double omega)
  * ====================================================================*/
 
 smat MVP_AORISOSADC2::compute(smat u_ia, double omega)
+{
+  std::vector<smat> u_ias = {u_ia};
+  return compute_block(u_ias, omega)[0];
+}
+
+std::vector<smat> MVP_AORISOSADC2::compute_block(
+    std::vector<smat>& u_ia, double omega)
 {
   auto& time_com = TIME.sub("Computing sigma ADC(2)");
 
   TIME.start();
   time_com.start();
 
-  LOG.os<1>("Computing AO-ADC(2) MVP product... \n");
+  LOG.os<1>("Computing AO-ADC(2) MVP product for ", u_ia.size(), " vectors\n");
+
+  std::vector<smat> u_ao(u_ia.size());
+  for (size_t i = 0; i != u_ia.size(); ++i) {
+    u_ao[i] = u_transform(u_ia[i], 'N', m_c_bo, 'T', m_c_bv);
+  }
+
+  auto jkpairs = compute_jk(u_ia, u_ao);
+
+  std::vector<smat> sigmas;
+  for (size_t i = 0; i != u_ia.size(); ++i) {
+    sigmas.push_back(compute_sigma(u_ia[i], u_ao[i], jkpairs[i], omega));
+  }
+
+  time_com.finish();
+  TIME.finish();
+
+  if (TEST_MVP) {
+    TIME.print_info();
+    exit(0);
+  }
+
+  return sigmas;
+}
+
+smat MVP_AORISOSADC2::compute_sigma(
+    smat& u_ia, smat& u_ao, std::pair<smat, smat>& jkpair, double omega)
+{
   LOG.os<1>("Computing sigma_0 of AO-ADC(2) ... \n");
 
   auto sigma_0 = compute_sigma_0(u_ia, m_eps_occ, m_eps_vir);
@@ -2325,8 +2370,6 @@ smat MVP_AORISOSADC2::compute(smat u_ia, double omega)
 
   LOG.os<1>("Computing sigma_1 of AO-ADC(2) ... \n");
 
-  auto u_ao = u_transform(u_ia, 'N', m_c_bo, 'T', m_c_bv);
-  auto jkpair = compute_jk(u_ia, u_ao);
   auto sigma_1 = compute_sigma_1(jkpair.first, jkpair.second);
 
 #ifdef _DLOG
@@ -2383,16 +2426,8 @@ smat MVP_AORISOSADC2::compute(smat u_ia, double omega)
   dbcsr::print(*sigma_0);
 #endif
 
-  time_com.finish();
-  TIME.finish();
-
   LOG.os<>("DOT: ", u_ia->dot(*sigma_0), '\n');
 
-  if (TEST_MVP) {
-    TIME.print_info();
-    exit(0);
-  }
-
   return sigma_0;
 }
 
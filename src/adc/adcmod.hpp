@@ -48,6 +48,9 @@ inline adcmethod str_to_adcmethod(std::string str)
    ((util::optional<bool>), balanced, false), \
    ((util::optional<std::string>), method, "ri_ao_adc1"), \
    ((util::optional<std::string>), df_metric, "coulomb"), \
+   ((util::optional<std::string>), screening, "schwarz"), \
+   ((util::optional<std::string>), int_cache, ""), \
+   ((util::optional<double>), int_memory, 0.0), \
    ((util::optional<double>), conv, 1e-5), \
    ((util::optional<int>), dav_max_iter, 40), \
    ((util::optional<int>), diis_max_iter, 40), \
@@ -0,0 +1,427 @@
+#include <mpi.h>
+#include <algorithm>
+#include <cstdint>
+#include <dbcsr_btensor.hpp>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "megalochem.hpp"
+#include "utils/json.hpp"
+#include "utils/mpi_time.hpp"
+
+/* Micro-benchmark of dbcsr::btensor. Synthetic block-sparse 3-index
+ * tensors are compressed and read back for all combinations of storage
+ * type, number of batches and number of ranks, once in the layout they
+ * were written in and once through a reordered view. The results are
+ * printed as JSON.
+ *
+ * Usage: mpirun -n <p> ./chem_btensor_bench [--option value]...
+ *   --nblocks    blocks per dimension (default 24)
+ *   --blksize    elements per block and dimension (default 8)
+ *   --occupation fraction of non-zero blocks (default 0.3)
+ *   --nbatches   comma separated batch counts per dimension (default 1,2,4)
+ *   --types      comma separated storage types (default core,disk,direct)
+ *   --ranks      comma separated rank counts (default: powers of two up to
+ *                the number of processes, and the number of processes)
+ *   --repeat     number of passes over all batches per view (default 2)
+ *   --workdir    directory for the disk files (default .)
+ *   --output     file for the JSON output (default: stdout)
+ */
+
+using namespace megalochem;
+
+using json = nlohmann::json;
+
+namespace {
+
+struct settings {
+  int nblocks = 24;
+  int blksize = 8;
+  double occupation = 0.3;
+  vec<int> nbatches = {1, 2, 4};
+  vec<std::string> types = {"core", "disk", "direct"};
+  vec<int> ranks;
+  int repeat = 2;
+  std::string workdir = ".";
+  std::string output;
+};
+
+vec<std::string> split(const std::string& str)
+{
+  vec<std::string> out;
+  std::stringstream ss(str);
+  std::string item;
+  while (std::getline(ss, item, ',')) { out.push_back(item); }
+  return out;
+}
+
+vec<int> split_int(const std::string& str)
+{
+  vec<int> out;
+  for (auto& s : split(str)) { out.push_back(std::stoi(s)); }
+  return out;
+}
+
+settings parse_args(int argc, char** argv, int nproc)
+{
+  settings out;
+
+  for (int i = 1; i < argc; i += 2) {
+    std::string key = argv[i];
+    if (i + 1 == argc) {
+      throw std::runtime_error("Missing value for option " + key);
+    }
+    std::string value = argv[i + 1];
+
+    if (key == "--nblocks")
+      out.nblocks = std::stoi(value);
+    else if (key == "--blksize")
+      out.blksize = std::stoi(value);
+    else if (key == "--occupation")
+      out.occupation = std::stod(value);
+    else if (key == "--nbatches")
+      out.nbatches = split_int(value);
+    else if (key == "--types")
+      out.types = split(value);
+    else if (key == "--ranks")
+      out.ranks = split_int(value);
+    else if (key == "--repeat")
+      out.repeat = std::stoi(value);
+    else if (key == "--workdir")
+      out.workdir = value;
+    else if (key == "--output")
+      out.output = value;
+    else
+      throw std::runtime_error("Unknown option " + key);
+  }
+
+  if (out.ranks.empty()) {
+    for (int p = 1; p < nproc; p *= 2) { out.ranks.push_back(p); }
+    out.ranks.push_back(nproc);
+  }
+
+  for (auto p : out.ranks) {
+    if (p < 1 || p > nproc) {
+      throw std::runtime_error("Invalid number of ranks");
+    }
+  }
+
+  return out;
+}
+
+// reproducible pseudo-random number in [0,1) for a block index
+double block_hash(int i, int j, int k, int salt)
+{
+  uint64_t h = 14695981039346656037ull;
+  for (int v : {i, j, k, salt}) {
+    h ^= (uint64_t)(uint32_t)v;
+    h *= 1099511628211ull;
+  }
+  h ^= h >> 33;
+  return (double)(h >> 11) / (double)(uint64_t(1) << 53);
+}
+
+/* Fills the local blocks of t inside the block bounds. Whether a block is
+ * present, and its values, only depend on the block index, so direct
+ * tensors regenerate the same data.
+ */
+void fill(
+    dbcsr::stensor<3, double>& t,
+    vec<vec<int>>& bounds,
+    double occupation)
+{
+  auto blks = t->blks_local();
+  arrvec<int, 3> res;
+
+  for (auto i : blks[0]) {
+    if (i < bounds[0][0] || i > bounds[0][1])
+      continue;
+    for (auto j : blks[1]) {
+      if (j < bounds[1][0] || j > bounds[1][1])
+        continue;
+      for (auto k : blks[2]) {
+        if (k < bounds[2][0] || k > bounds[2][1])
+          continue;
+        if (block_hash(i, j, k, 0) >= occupation)
+          continue;
+        res[0].push_back(i);
+        res[1].push_back(j);
+        res[2].push_back(k);
+      }
+    }
+  }
+
+  t->reserve(res);
+
+  dbcsr::iterator_t<3, double> iter(*t);
+  iter.start();
+
+  while (iter.blocks_left()) {
+    iter.next();
+
+    auto& idx = iter.idx();
+    auto& size = iter.size();
+    int64_t ntot = (int64_t)size[0] * size[1] * size[2];
+
+    bool found = false;
+    double* data = t->get_block_p(idx, found);
+    double scale = block_hash(idx[0], idx[1], idx[2], 1);
+
+    for (int64_t n = 0; n != ntot; ++n) {
+      data[n] = scale * block_hash(idx[0], idx[1], idx[2], (int)(2 + n));
+    }
+  }
+
+  iter.stop();
+}
+
+double max_time(double t, MPI_Comm comm)
+{
+  MPI_Allreduce(MPI_IN_PLACE, &t, 1, MPI_DOUBLE, MPI_MAX, comm);
+  return t;
+}
+
+int64_t sum_bytes(int64_t b, MPI_Comm comm)
+{
+  MPI_Allreduce(MPI_IN_PLACE, &b, 1, MPI_INT64_T, MPI_SUM, comm);
+  return b;
+}
+
+json latency(const vec<double>& times)
+{
+  double sum = 0.0;
+  for (auto t : times) { sum += t; }
+  double mean = (times.empty()) ? 0.0 : sum / times.size();
+  double max = (times.empty()) ? 0.0 :
+                                 *std::max_element(times.begin(), times.end());
+  return {{"mean_s", mean}, {"max_s", max}};
+}
+
+// reads all batches of btensor bt through the view with batch dimensions
+// dims and maps map1/map2
+json run_read(
+    dbcsr::sbtensor<3, double>& bt,
+    vec<int> dims,
+    vec<int> map1,
+    vec<int> map2,
+    int repeat,
+    int64_t bytes,
+    MPI_Comm comm)
+{
+  MPI_Barrier(comm);
+  double t0 = MPI_Wtime();
+  bt->decompress_init(dims, map1, map2);
+  double setup = max_time(MPI_Wtime() - t0, comm);
+
+  vec<double> times;
+  double total = 0.0;
+
+  for (int r = 0; r != repeat; ++r) {
+    for (auto& idx : bt->batch_indices(dims)) {
+      MPI_Barrier(comm);
+      double tb = MPI_Wtime();
+      bt->decompress(idx);
+      double t = max_time(MPI_Wtime() - tb, comm);
+      times.push_back(t);
+      total += t;
+    }
+  }
+
+  bt->decompress_finalize();
+
+  double gbs = (total > 0.0) ? repeat * bytes / total / 1e9 : 0.0;
+
+  return {
+      {"batch_dims", dims},
+      {"nbatches", times.size() / std::max(repeat, 1)},
+      {"setup_s", setup},
+      {"total_s", total},
+      {"gb_per_s", gbs},
+      {"batch_latency", latency(times)}};
+}
+
+json run_case(
+    const settings& opt,
+    dbcsr::shared_pgrid<3> spgrid,
+    dbcsr::btype type,
+    int nbatches)
+{
+  MPI_Comm comm = spgrid->comm();
+
+  vec<int> sizes(opt.nblocks, opt.blksize);
+  arrvec<int, 3> blksizes = {sizes, sizes, sizes};
+  arrvec<int, 3> blkmaps;
+
+  for (auto& m : blkmaps) {
+    m.resize(opt.nblocks);
+    std::iota(m.begin(), m.end(), 0);
+  }
+
+  std::array<int, 3> bdims = {nbatches, nbatches, nbatches};
+
+  auto bt = dbcsr::btensor<3, double>::create()
+                .name("bench_" + dbcsr::btype_name(type))
+                .set_pgrid(spgrid)
+                .blk_sizes(blksizes)
+                .blk_maps(blkmaps)
+                .batch_dims(bdims)
+                .btensor_type(type)
+                .build();
+
+  double occupation = opt.occupation;
+
+  std::function<void(dbcsr::stensor<3, double>&, vec<vec<int>>&)> gen =
+      [occupation](dbcsr::stensor<3, double>& t, vec<vec<int>>& bounds) {
+        fill(t, bounds, occupation);
+      };
+
+  bt->set_generator(gen);
+
+  auto t_batch = dbcsr::tensor<3, double>::create()
+                     .name("bench_batch")
+                     .set_pgrid(*spgrid)
+                     .map1({0})
+                     .map2({1, 2})
+                     .blk_sizes(blksizes)
+                     .build();
+
+  // write
+  vec<double> times;
+  double total = 0.0;
+  double fill_time = 0.0;
+  int64_t nze = 0;
+
+  MPI_Barrier(comm);
+  double t0 = MPI_Wtime();
+  bt->compress_init({0}, vec<int>{0}, vec<int>{1, 2});
+  double setup = max_time(MPI_Wtime() - t0, comm);
+
+  for (int ix = 0; ix != bt->nbatches(0); ++ix) {
+    vec<vec<int>> bounds = {
+        bt->blk_bounds(0, ix), bt->full_blk_bounds(1), bt->full_blk_bounds(2)};
+
+    // direct tensors drop the batch, it is only filled to count the data
+    double tf = MPI_Wtime();
+    fill(t_batch, bounds, occupation);
+    fill_time += max_time(MPI_Wtime() - tf, comm);
+    nze += t_batch->num_nze_total();
+
+    MPI_Barrier(comm);
+    double tb = MPI_Wtime();
+    bt->compress({ix}, t_batch);
+    double t = max_time(MPI_Wtime() - tb, comm);
+    times.push_back(t);
+    total += t;
+  }
+
+  MPI_Barrier(comm);
+  t0 = MPI_Wtime();
+  bt->compress_finalize();
+  double finalize = max_time(MPI_Wtime() - t0, comm);
+
+  int64_t bytes = nze * sizeof(double);
+
+  json write = {
+      {"setup_s", setup},
+      {"finalize_s", finalize},
+      {"fill_s", fill_time},
+      {"total_s", total},
+      {"gb_per_s", (total > 0.0) ? bytes / total / 1e9 : 0.0},
+      {"batch_latency", latency(times)}};
+
+  json reads = json::array();
+  reads.push_back(run_read(
+      bt, {0}, vec<int>{0}, vec<int>{1, 2}, opt.repeat, bytes, comm));
+  reads.back()["view"] = "contiguous";
+
+  reads.push_back(run_read(
+      bt, {2, 0}, vec<int>{1}, vec<int>{0, 2}, opt.repeat, bytes, comm));
+  reads.back()["view"] = "reordered";
+
+  return {
+      {"type", dbcsr::btype_name(type)},
+      {"nbatches_per_dim", nbatches},
+      {"bytes", bytes},
+      {"stored_bytes", sum_bytes(bt->stored_bytes(), comm)},
+      {"metadata_bytes", sum_bytes(bt->metadata_bytes(), comm)},
+      {"memory_bytes", sum_bytes(bt->local_memory(), comm)},
+      {"write", write},
+      {"read", reads}};
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+  MPI_Init(&argc, &argv);
+  MPI_Comm comm = MPI_COMM_WORLD;
+
+  int rank = 0, nproc = 1;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &nproc);
+
+  util::mpi_log LOG(comm, 0);
+
+  try {
+    auto opt = parse_args(argc, argv, nproc);
+
+    megalochem::init(comm, opt.workdir);
+
+    json results = json::array();
+
+    for (auto p : opt.ranks) {
+      MPI_Comm subcomm;
+      MPI_Comm_split(comm, (rank < p) ? 0 : MPI_UNDEFINED, rank, &subcomm);
+
+      if (subcomm != MPI_COMM_NULL) {
+        auto spgrid = dbcsr::pgrid<3>::create(subcomm).build();
+
+        for (auto& tstr : opt.types) {
+          for (auto nb : opt.nbatches) {
+            LOG.os<>(
+                "Running ", tstr, " with ", nb, " batches on ", p,
+                " ranks\n");
+            auto res = run_case(opt, spgrid, dbcsr::get_btype(tstr), nb);
+            res["nranks"] = p;
+            results.push_back(res);
+          }
+        }
+
+        spgrid.reset();
+        MPI_Comm_free(&subcomm);
+      }
+
+      MPI_Barrier(comm);
+    }
+
+    if (rank == 0) {
+      json out = {
+          {"nblocks", opt.nblocks},
+          {"blksize", opt.blksize},
+          {"occupation", opt.occupation},
+          {"repeat", opt.repeat},
+          {"nprocs", nproc},
+          {"results", results}};
+
+      if (opt.output.empty()) {
+        std::cout << out.dump(2) << std::endl;
+      }
+      else {
+        std::ofstream file(opt.output);
+        file << out.dump(2) << std::endl;
+      }
+    }
+  }
+  catch (std::exception& e) {
+    std::cerr << "ERROR: " << e.what() << std::endl;
+    MPI_Abort(comm, MPI_ERR_OTHER);
+  }
+
+  MPI_Finalize();
+
+  return 0;
+}
@@ -2,24 +2,31 @@
 #define DBCSR_BTENSOR_HPP
 
 #ifndef TEST_MACRO
+  #include <fcntl.h>
   #include <mpi.h>
+  #include <unistd.h>
+  #include <cmath>
   #include <cstdlib>
+  #include <cstring>
   #include <dbcsr_tensor_ops.hpp>
   #include <filesystem>
+  #include <fstream>
   #include <functional>
+  #include <future>
+  #include <limits>
   #include <map>
   #include <memory>
+  #include <tuple>
+  #include "utils/codec.hpp"
   #include "utils/mpi_time.hpp"
   #include "utils/unique.hpp"
 #endif
 
 #include "utils/ppdirs.hpp"
 
-//#define _CORE_VECTOR
-
 namespace dbcsr {
 
-enum class btype { core, disk, direct };
+enum class btype { core, disk, direct, hybrid };
 
 inline btype get_btype(std::string str)
 {
@@ -29,9 +36,51 @@ inline btype get_btype(std::string str)
     return btype::disk;
   if (str == "direct")
     return btype::direct;
+  if (str == "hybrid")
+    return btype::hybrid;
   throw std::runtime_error("Invalid btensor type.");
 }
 
+inline std::string btype_name(btype type)
+{
+  switch (type) {
+    case btype::core: return "core";
+    case btype::disk: return "disk";
+    case btype::hybrid: return "hybrid";
+    default: return "direct";
+  }
+}
+
+// precision of the stored batches: double, single, or single for blocks
+// with a small norm
+enum class bprecision { full, single, mixed };
+
+inline bprecision get_bprecision(std::string str)
+{
+  if (str == "double")
+    return bprecision::full;
+  if (str == "single")
+    return bprecision::single;
+  if (str == "mixed")
+    return bprecision::mixed;
+  throw std::runtime_error("Invalid btensor precision.");
+}
+
+// compression of the blocks in files: none, lossless, or lossless after
+// rounding to the filter threshold
+enum class bcodec { none, lossless, lossy };
+
+inline bcodec get_bcodec(std::string str)
+{
+  if (str == "none")
+    return bcodec::none;
+  if (str == "lossless")
+    return bcodec::lossless;
+  if (str == "lossy")
+    return bcodec::lossy;
+  throw std::runtime_error("Invalid btensor codec.");
+}
+
 inline vec<vec<int>> make_blk_bounds(
     std::vector<int> blksizes,
     int nbatches,
@@ -96,6 +145,19 @@ inline vec<vec<int>> make_blk_bounds(
 
 struct btensor_global {
   static inline bool error_flag = false;
+  // default for the prefetching of disk tensors
+  static inline bool prefetch = false;
+  // default node-local scratch directory of disk tensors, empty to use
+  // only the shared file
+  static inline std::string scratch = "";
+  // default memory per process in GB for batches of hybrid tensors
+  static inline double hybrid_memory = 0.0;
+  // default precision of stored batches
+  static inline bprecision precision = bprecision::full;
+  // blocks with a smaller norm are stored in single precision (mixed)
+  static inline double mixed_threshold = 1e-6;
+  // default compression of disk tensors
+  static inline bcodec codec = bcodec::none;
 };
 
 template <
@@ -115,10 +177,6 @@ class btensor {
   dbcsr::stensor<N, T> m_work_tensor;
   // underlying shared tensor for contraction/copying
 
-#ifdef _CORE_VECTOR
-  std::vector<dbcsr::stensor<N, T>> m_core_vector;
-#endif
-
   std::string m_name;
   dbcsr::shared_pgrid<N> m_spgrid_N;
   arrvec<int, N> m_blk_sizes, m_blk_maps;
@@ -135,7 +193,7 @@ class btensor {
   // number of local blocks
   int m_nblkloc_global = 0;
   // number og local blocks in non-sparse tensor
-  int m_nzeloc = 0;
+  int64_t m_nzeloc = 0;
   // number of local non-zero elements
   int64_t m_nblktot_global = 0;
   // total number of blocks in non-sparse tensor
@@ -168,11 +226,423 @@ class btensor {
     vec<vec<int>> nblksprocbatch;
     vec<vec<int>> nzeprocbatch;
     std::string file_name;
+    // file holding the data of a materialised read view, stored batch by
+    // batch like the write view. Empty if the view reads from m_filename
+    std::string data_file;
+
+    // block indices and offsets of the local blocks of all batches, read
+    // from file_name once. The blocks of batch i are the entries
+    // locblkstart[i] to locblkstart[i+1]-1
+    bool info_loaded = false;
+    arrvec<int, N> locblkidx;
+    vec<MPI_Offset> locblkoff;
+    vec<int64_t> locblkstart;
+    // stored sizes in bytes of the local blocks, only with a codec
+    vec<int64_t> locblksize;
   };
 
   view m_wrview;
   std::map<vec<int>, view> m_rdviewmap;
 
+  /* ========== PREFETCHING ========== */
+
+  // data of one batch read from file, possibly still in flight
+  struct batch_read {
+    int ibatch = -1;
+    vec<int> dims;
+    bool active = false;
+    bool in_tensor = false;
+    bool has_type = false;
+    int nze = 0;
+    arrvec<int, N> blkidx;
+    vec<MPI_Offset> blkoff;
+    vec<int64_t> blksize;
+    vec<T> buffer;
+    MPI_File fh;
+    MPI_Request request;
+    MPI_Datatype type;
+    // reads from the node-local file run in a separate thread
+    bool local = false;
+    std::future<void> pending;
+  };
+
+  // if set, decompressing batch i of a disk tensor starts reading batch
+  // i+1 into a second buffer
+  bool m_prefetch;
+  batch_read m_next_read;
+
+  /* ========== NODE-LOCAL SCRATCH ========== */
+
+  // Each rank writes its blocks to its own file in m_scratch and reads them
+  // back with pread, without any collective I/O. Only possible if the
+  // tensors passed to compress have the distribution of the read tensor,
+  // otherwise the shared file is used.
+  std::string m_scratch;
+  std::string m_local_filename;
+  int m_local_fd = -1;
+  bool m_local = false;
+  arrvec<int, N> m_local_dist;
+  std::array<int, N> m_local_pdims;
+
+  static void pwrite_all(int fd, const char* buf, size_t n, off_t off)
+  {
+    while (n > 0) {
+      ssize_t w = ::pwrite(fd, buf, n, off);
+      if (w <= 0) {
+        throw std::runtime_error("btensor: error writing scratch file");
+      }
+      buf += w;
+      n -= w;
+      off += w;
+    }
+  }
+
+  static void pread_all(int fd, char* buf, size_t n, off_t off)
+  {
+    while (n > 0) {
+      ssize_t r = ::pread(fd, buf, n, off);
+      if (r <= 0) {
+        throw std::runtime_error("btensor: error reading scratch file");
+      }
+      buf += r;
+      n -= r;
+      off += r;
+    }
+  }
+
+  /* ========== HYBRID STORAGE ========== */
+
+  // Hybrid tensors are written to disk like disk tensors. In addition, as
+  // many batches of the read views as fit into m_hybrid_budget are kept in
+  // memory. A batch which is not held is read from disk or regenerated,
+  // whichever was cheaper per element so far, and replaces held batches
+  // which were accessed less often. All decisions use quantities which are
+  // the same on all processes.
+  struct hybrid_entry {
+    stensor<N, T> tensor;
+    int64_t bytes;  // maximum over all processes
+    int64_t last;
+  };
+
+  using hybrid_key = std::pair<std::string, int>;
+
+  int64_t m_hybrid_budget = 0;
+  int64_t m_hybrid_used = 0;
+  int64_t m_hybrid_clock = 0;
+  std::string m_hybrid_view;
+  std::map<hybrid_key, hybrid_entry> m_hybrid_cache;
+  std::map<hybrid_key, int64_t> m_hybrid_naccess;
+  stensor<N, T> m_gen_tensor;
+  // m_work_tensor is held in m_hybrid_cache and must not be overwritten
+  bool m_work_is_cached = false;
+
+  // time and number of elements of all reads and regenerations
+  double m_disk_time = 0.0, m_gen_time = 0.0;
+  int64_t m_disk_nze = 0, m_gen_nze = 0;
+
+  bool on_disk() const
+  {
+    return m_type == btype::disk || m_type == btype::hybrid;
+  }
+
+  /* ========== REDUCED PRECISION ========== */
+
+  // If m_packed is set, batches are stored as floats. Blocks in single
+  // precision take one float per element, blocks kept in double precision
+  // take two. Offsets and numbers of elements in the views and files are
+  // then counted in floats, and the lowest bit of a block offset is set if
+  // the block is kept in double precision.
+  struct packed_batch {
+    arrvec<int, N> blkidx;
+    vec<MPI_Offset> blkoff;
+    vec<float> data;
+  };
+
+  bprecision m_precision;
+  double m_mixed_threshold;
+  bool m_packed = false;
+
+  // batches of a core tensor, laid out for one set of batch dimensions
+  struct core_layout {
+    vec<int> map1, map2;
+    std::vector<dbcsr::stensor<N, T>> batches;
+    std::vector<std::shared_ptr<packed_batch>> packed;
+  };
+
+  std::map<vec<int>, core_layout> m_core_layouts;
+  // one layout per batch dimensions of the views read so far, the layout
+  // of the write view is always kept
+
+  // error of the conversion since compress_init
+  int64_t m_single_blocks = 0, m_packed_blocks = 0;
+  double m_single_err2 = 0.0, m_single_maxerr = 0.0, m_packed_norm2 = 0.0;
+
+  /* ========== COMPRESSION ========== */
+
+  // If a codec is set, every block of a batch is encoded on its own before
+  // it is written to file. Offsets and numbers of elements in the files are
+  // then counted in bytes. The stored size of a block is not kept in the
+  // index files, it follows from the offset of the next block.
+  bcodec m_codec = bcodec::none;
+
+  // bytes before and after encoding since compress_init
+  int64_t m_codec_raw = 0, m_codec_stored = 0;
+
+  // bytes per element of a batch before encoding
+  int raw_unit_bytes() const
+  {
+    return (m_packed) ? sizeof(float) : sizeof(T);
+  }
+
+  // bytes per element of a batch in the files
+  int unit_bytes() const
+  {
+    return (m_codec != bcodec::none) ? 1 : raw_unit_bytes();
+  }
+
+  MPI_Datatype unit_type() const
+  {
+    if (m_codec != bcodec::none)
+      return MPI_BYTE;
+    return (m_packed) ? MPI_FLOAT : MPI_DOUBLE;
+  }
+
+  MPI_Offset blk_offset(MPI_Offset off) const
+  {
+    return (m_packed) ? off / 2 : off;
+  }
+
+  int64_t blk_units(MPI_Offset off, int64_t size) const
+  {
+    return (m_packed && off % 2 == 1) ? 2 * size : size;
+  }
+
+  MPI_Offset shift_offset(MPI_Offset off, int64_t units) const
+  {
+    return (m_packed) ? off + 2 * units : off + units;
+  }
+
+  // converts one block of n elements, returns the start of the next one
+  static const float* unpack_block(
+      const float* src, bool is_double, int64_t n, T* dest)
+  {
+    if (is_double) {
+      std::memcpy(dest, src, n * sizeof(T));
+      return src + 2 * n;
+    }
+    std::copy(src, src + n, dest);
+    return src + n;
+  }
+
+  // appends a block to a packed batch, in single precision if requested
+  void pack_block(
+      packed_batch& out, const index<N>& idx, const T* blk, int64_t ntot)
+  {
+    double norm2 = 0.0;
+    for (int64_t i = 0; i != ntot; ++i) { norm2 += blk[i] * blk[i]; }
+
+    bool single = m_precision == bprecision::single ||
+        std::sqrt(norm2) < m_mixed_threshold;
+
+    for (int i = 0; i != N; ++i) { out.blkidx[i].push_back(idx[i]); }
+    out.blkoff.push_back(2 * (MPI_Offset)out.data.size() + !single);
+
+    m_packed_norm2 += norm2;
+    ++m_packed_blocks;
+
+    if (!single) {
+      size_t pos = out.data.size();
+      out.data.resize(pos + 2 * ntot);
+      std::memcpy(out.data.data() + pos, blk, ntot * sizeof(T));
+      return;
+    }
+
+    ++m_single_blocks;
+
+    for (int64_t i = 0; i != ntot; ++i) {
+      float f = blk[i];
+      double err = std::fabs(blk[i] - (double)f);
+      m_single_err2 += err * err;
+      m_single_maxerr = std::max(m_single_maxerr, err);
+      out.data.push_back(f);
+    }
+  }
+
+  std::shared_ptr<packed_batch> pack(stensor<N, T>& t)
+  {
+    auto out = std::make_shared<packed_batch>();
+    out->data.reserve(t->num_nze());
+
+    dbcsr::iterator_t<N, T> iter(*t);
+    iter.start();
+
+    while (iter.blocks_left()) {
+      iter.next();
+
+      auto& idx = iter.idx();
+      auto& size = iter.size();
+      int64_t ntot = std::accumulate(
+          size.begin(), size.end(), (int64_t)1, std::multiplies<int64_t>());
+
+      bool found = false;
+      const T* blk = t->get_block_p(idx, found);
+
+      pack_block(*out, idx, blk, ntot);
+    }
+
+    iter.stop();
+
+    return out;
+  }
+
+  void unpack(packed_batch& pb, stensor<N, T>& t)
+  {
+    t->reserve(pb.blkidx);
+
+    index<N> idx;
+    for (size_t iblk = 0; iblk != pb.blkoff.size(); ++iblk) {
+      int64_t ntot = 1;
+      for (int i = 0; i != N; ++i) {
+        idx[i] = pb.blkidx[i][iblk];
+        ntot *= m_blk_sizes[i][idx[i]];
+      }
+
+      bool found = false;
+      T* dest = t->get_block_p(idx, found);
+      auto off = pb.blkoff[iblk];
+      unpack_block(pb.data.data() + off / 2, off % 2, ntot, dest);
+    }
+  }
+
+  int64_t blk_ntot(const arrvec<int, N>& blkidx, size_t iblk) const
+  {
+    int64_t ntot = 1;
+    for (int i = 0; i != N; ++i) { ntot *= m_blk_sizes[i][blkidx[i][iblk]]; }
+    return ntot;
+  }
+
+  // width of the elements of a block as passed to the codec
+  size_t codec_width(MPI_Offset off) const
+  {
+    return (m_packed && off % 2 == 0) ? sizeof(float) : sizeof(T);
+  }
+
+  /* Encodes the blocks of a batch with the given offsets, which are
+   * replaced by the offsets of the encoded blocks. In lossy mode, double
+   * precision blocks are rounded to global::filter_eps first.
+   */
+  vec<char> encode_batch(
+      const char* data, const arrvec<int, N>& blkidx, vec<MPI_Aint>& blkoff)
+  {
+    vec<char> out;
+    vec<double> rounded;
+
+    for (size_t iblk = 0; iblk != blkoff.size(); ++iblk) {
+      MPI_Offset off = blkoff[iblk];
+      int64_t ntot = blk_ntot(blkidx, iblk);
+      size_t width = codec_width(off);
+      const char* blk = data + blk_offset(off) * raw_unit_bytes();
+
+      if (m_codec == bcodec::lossy && width == sizeof(double)) {
+        rounded.resize(ntot);
+        std::memcpy(rounded.data(), blk, ntot * sizeof(double));
+        util::codec::quantise(rounded.data(), ntot, dbcsr::global::filter_eps);
+        blk = (const char*)rounded.data();
+      }
+
+      MPI_Aint pos = out.size();
+      blkoff[iblk] = (m_packed) ? 2 * pos + off % 2 : pos;
+
+      util::codec::encode(blk, ntot, width, out);
+      m_codec_raw += ntot * width;
+    }
+
+    m_codec_stored += out.size();
+
+    if (out.size() > (size_t)std::numeric_limits<int>::max()) {
+      throw std::runtime_error("btensor: encoded batch exceeds 2 GB");
+    }
+
+    return out;
+  }
+
+  // decodes the batch read into rd.buffer
+  void decode_batch(batch_read& rd)
+  {
+    int nblk = rd.blkoff.size();
+    int64_t nbytes = 0;
+
+    for (int i = 0; i != nblk; ++i) {
+      nbytes += blk_ntot(rd.blkidx, i) * codec_width(rd.blkoff[i]);
+    }
+
+    vec<T> decoded((nbytes + sizeof(T) - 1) / sizeof(T));
+    const char* in = (const char*)rd.buffer.data();
+    char* out = (char*)decoded.data();
+
+    for (int i = 0; i != nblk; ++i) {
+      int64_t ntot = blk_ntot(rd.blkidx, i);
+      size_t width = codec_width(rd.blkoff[i]);
+      util::codec::decode(in, rd.blksize[i], ntot, width, out);
+      in += rd.blksize[i];
+      out += ntot * width;
+    }
+
+    rd.buffer = std::move(decoded);
+  }
+
+  /* Stored sizes of the local blocks of v in the shared file. The blocks of
+   * a rank and batch of the write view (or of a materialised view) are
+   * stored one after the other, so a block ends where the next one or the
+   * data of the rank ends.
+   */
+  void derive_block_sizes(view& v)
+  {
+    vec<int64_t> chunk_end;
+    int64_t pos = 0;
+
+    auto& layout = (v.data_file.empty()) ? m_wrview : v;
+
+    for (auto& nzeproc : layout.nzeprocbatch) {
+      int64_t start = pos +
+          std::accumulate(nzeproc.begin(), nzeproc.begin() + m_mpirank,
+                          int64_t(0));
+      chunk_end.push_back(start + nzeproc[m_mpirank]);
+      pos += std::accumulate(nzeproc.begin(), nzeproc.end(), int64_t(0));
+    }
+
+    size_t nblk = v.locblkoff.size();
+    vec<size_t> order(nblk);
+    std::iota(order.begin(), order.end(), (size_t)0);
+    std::sort(order.begin(), order.end(), [&](size_t i0, size_t i1) {
+      return v.locblkoff[i0] < v.locblkoff[i1];
+    });
+
+    v.locblksize.resize(nblk);
+
+    for (size_t k = 0; k != nblk; ++k) {
+      int64_t start = blk_offset(v.locblkoff[order[k]]);
+      int64_t end =
+          *std::upper_bound(chunk_end.begin(), chunk_end.end(), start);
+      if (k + 1 != nblk) {
+        end = std::min(end, (int64_t)blk_offset(v.locblkoff[order[k + 1]]));
+      }
+      v.locblksize[order[k]] = end - start;
+    }
+  }
+
+  void report_codec()
+  {
+    int64_t bytes[2] = {m_codec_raw, m_codec_stored};
+    MPI_Allreduce(MPI_IN_PLACE, bytes, 2, MPI_INT64_T, MPI_SUM, m_comm);
+
+    double ratio = (bytes[0] > 0) ? (double)bytes[1] / bytes[0] : 1.0;
+
+    LOG.os<>(
+        "Compression of ", m_name, ": ", bytes[0], " bytes stored as ",
+        bytes[1], " bytes, ratio ", ratio, '\n');
+  }
+
   /* =========== FUNCTIONS ========== */
 
   using generator_type =
@@ -189,7 +659,12 @@ class btensor {
   (((shared_pgrid<N>), set_pgrid), ((arrvec<int, N>&), blk_sizes), \
    ((arrvec<int, N>&), blk_maps), ((std::array<int, N>), batch_dims), \
    ((std::string), name), ((dbcsr::btype), btensor_type), \
-   ((util::optional<int>), print))
+   ((util::optional<int>), print), ((util::optional<bool>), prefetch), \
+   ((util::optional<std::string>), scratch), \
+   ((util::optional<double>), hybrid_memory), \
+   ((util::optional<bprecision>), precision), \
+   ((util::optional<double>), mixed_threshold), \
+   ((util::optional<bcodec>), codec))
 
   MAKE_PARAM_STRUCT(create, BTENSOR_CREATE_LIST, ())
   MAKE_BUILDER_CLASS(btensor, create, BTENSOR_CREATE_LIST, ())
@@ -200,11 +675,26 @@ class btensor {
       m_mpisize(-1), m_name(p.p_name), m_spgrid_N(p.p_set_pgrid),
       m_blk_sizes(p.p_blk_sizes), m_blk_maps(p.p_blk_maps), m_filename(),
       m_type(p.p_btensor_type), m_is_compress_initialized(false),
-      m_is_decompress_initialized(false)
+      m_is_decompress_initialized(false),
+      m_prefetch((p.p_prefetch) ? *p.p_prefetch : btensor_global::prefetch),
+      m_scratch((p.p_scratch) ? *p.p_scratch : btensor_global::scratch),
+      m_hybrid_budget(
+          1e9 *
+          ((p.p_hybrid_memory) ? *p.p_hybrid_memory :
+                                 btensor_global::hybrid_memory)),
+      m_precision(
+          (p.p_precision) ? *p.p_precision : btensor_global::precision),
+      m_mixed_threshold(
+          (p.p_mixed_threshold) ? *p.p_mixed_threshold :
+                                  btensor_global::mixed_threshold),
+      m_codec((p.p_codec) ? *p.p_codec : btensor_global::codec)
   {
     MPI_Comm_rank(m_comm, &m_mpirank);
     MPI_Comm_size(m_comm, &m_mpisize);
 
+    m_packed = std::is_same<T, double>::value &&
+        m_precision != bprecision::full && m_type != btype::direct;
+
     LOG.os<1>("Setting up batch tensor information for ", m_name, +".\n");
 
     std::string path = std::filesystem::current_path();
@@ -216,6 +706,8 @@ class btensor {
     m_path = path;
     m_filename = path + m_name + ".dat";
 
+    set_local_filename();
+
     // divide dimensions
 
     arrvec<int, N> blkoffsets;
@@ -264,7 +756,7 @@ class btensor {
       LOG.os<1>('\n');
     }
 
-    if (m_type == btype::disk) {
+    if (on_disk()) {
       create_file();
     }
 
@@ -293,8 +785,15 @@ class btensor {
       m_name(p.p_name), m_spgrid_N(p.p_t_in.m_spgrid_N),
       m_blk_sizes(p.p_t_in.m_blk_sizes), m_blk_maps(p.p_t_in.m_blk_maps),
       m_filename(), m_type(p.p_btensor_type), m_is_compress_initialized(false),
-      m_is_decompress_initialized(false)
+      m_is_decompress_initialized(false), m_prefetch(p.p_t_in.m_prefetch),
+      m_scratch(p.p_t_in.m_scratch), m_hybrid_budget(p.p_t_in.m_hybrid_budget),
+      m_precision(p.p_t_in.m_precision),
+      m_mixed_threshold(p.p_t_in.m_mixed_threshold),
+      m_codec(p.p_t_in.m_codec)
   {
+    m_packed = std::is_same<T, double>::value &&
+        m_precision != bprecision::full && m_type != btype::direct;
+
     LOG.os<1>("Setting up batch tensor information for ", m_name, +".\n");
 
     m_path = util::unique("mega_batchtensor", "", m_comm) + "/";
@@ -302,6 +801,7 @@ class btensor {
       std::filesystem::create_directory(m_path);
     }
     m_filename = m_path + m_name + ".dat";
+    set_local_filename();
     m_blk_bounds = p.p_t_in.m_blk_bounds;
     m_bounds = p.p_t_in.m_bounds;
     m_full_blk_bounds = p.p_t_in.m_full_blk_bounds;
@@ -310,7 +810,7 @@ class btensor {
 
     MPI_Barrier(m_comm);
 
-    if (m_type == btype::disk) {
+    if (on_disk()) {
       create_file();
     }
 
@@ -324,12 +824,45 @@ class btensor {
     m_generator = func;
   }
 
+  // only has an effect for disk tensors
+  void set_prefetch(bool prefetch)
+  {
+    m_prefetch = prefetch;
+  }
+
+  // name of the node-local file, unique for each process on a node
+  void set_local_filename()
+  {
+    if (m_scratch.empty() || !on_disk())
+      return;
+
+    std::string dir = m_path;
+    dir.pop_back();
+    dir = std::filesystem::path(dir).filename();
+
+    m_local_filename = m_scratch + "/" + dir + "_" + m_name + "." +
+        std::to_string(getpid()) + ".dat";
+  }
+
   /* Create all necessary files.
    * !!! Deletes previous files and resets all variables !!! */
   void create_file()
   {
     delete_file();
 
+    if (!m_local_filename.empty()) {
+      LOG.os<1>("Creating scratch file ", m_local_filename, '\n');
+      std::filesystem::create_directories(m_scratch);
+
+      m_local_fd = ::open(
+          m_local_filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+
+      if (m_local_fd < 0) {
+        throw std::runtime_error(
+            "btensor: could not create scratch file " + m_local_filename);
+      }
+    }
+
     MPI_File fh;
 
     LOG.os<1>("Creating files for ", m_filename, '\n');
@@ -347,6 +880,13 @@ class btensor {
   {
     LOG.os<1>("Deleting files for ", m_filename, '\n');
     MPI_File_delete(m_filename.c_str(), MPI_INFO_NULL);
+
+    if (m_local_fd >= 0) {
+      ::close(m_local_fd);
+      if (!m_local_filename.empty())
+        ::unlink(m_local_filename.c_str());
+      m_local_fd = -1;
+    }
   }
 
   void reset_var()
@@ -360,23 +900,39 @@ class btensor {
 
     m_wrview.nblksprocbatch.clear();
     m_wrview.nzeprocbatch.clear();
+    clear_view_info(m_wrview);
+
+    m_local = !m_local_filename.empty();
+
+    // held batches belong to the previous contents
+    m_hybrid_cache.clear();
+    m_hybrid_naccess.clear();
+    m_hybrid_used = 0;
+    m_work_is_cached = false;
 
     MPI_File_delete(m_wrview.file_name.c_str(), MPI_INFO_NULL);
 
     for (auto& rview : m_rdviewmap) {
       MPI_File_delete(rview.second.file_name.c_str(), MPI_INFO_NULL);
+      if (!rview.second.data_file.empty())
+        MPI_File_delete(rview.second.data_file.c_str(), MPI_INFO_NULL);
     }
     m_rdviewmap.clear();
   }
 
   void reset()
   {
+    cancel_prefetch();
     if (m_work_tensor)
       m_work_tensor->clear();
+    for (auto& [dims, layout] : m_core_layouts) {
+      for (auto& t : layout.batches) { t->clear(); }
+    }
+    m_core_layouts.clear();
     if (m_read_tensor)
       m_read_tensor->clear();
     reset_var();
-    if (m_type == btype::disk) {
+    if (on_disk()) {
       delete_file();
       create_file();
     }
@@ -384,7 +940,8 @@ class btensor {
 
   ~btensor()
   {
-    if (m_type == btype::disk)
+    cancel_prefetch();
+    if (on_disk())
       delete_file();
     reset_var();
     if (m_mpirank == 0) {
@@ -404,7 +961,7 @@ class btensor {
 
     for (size_t i = 0; i != bsizes.size(); ++i) {
       int off = 1;
-      for (size_t n = bsizes.size() - 1; n > i; --n) { off *= bsizes[i]; }
+      for (size_t n = bsizes.size() - 1; n > i; --n) { off *= bsizes[n]; }
       flat_idx += idx[i] * off;
     }
 
@@ -457,9 +1014,12 @@ class btensor {
   void compress_init(
       std::initializer_list<int> dim_list, vec<int> map1, vec<int> map2)
   {
-    LOG.os<1>("Initializing compression for ", m_name, "...\n");
+    compress_init(vec<int>(dim_list), map1, map2);
+  }
 
-    vec<int> dims = dim_list;
+  void compress_init(vec<int> dims, vec<int> map1, vec<int> map2)
+  {
+    LOG.os<1>("Initializing compression for ", m_name, "...\n");
 
     fits_in_mem(dims);
 
@@ -475,32 +1035,45 @@ class btensor {
 
     reset_var();
 
-    if (m_type == btype::core) {
-#ifdef _CORE_VECTOR
-      LOG.os<1>("Allocating core work tensors.\n");
-      m_core_vector.resize(m_wrview.nbatches);
-      for (auto& t : m_core_vector) {
-        t = tensor<N, T>::create()
-                .name(m_name + "_work")
-                .set_pgrid(*m_spgrid_N)
-                .map1(map1)
-                .map2(map2)
-                .blk_sizes(m_blk_sizes)
-                .build();
-      }
+    if (m_local) {
+      // distribution the blocks are read back with
+      auto t_ref = tensor<N, T>::create()
+                       .name(m_name + "_dist")
+                       .set_pgrid(*m_spgrid_N)
+                       .map1(map1)
+                       .map2(map2)
+                       .blk_sizes(m_blk_sizes)
+                       .build();
+
+      m_local_dist = t_ref->proc_dist();
+      m_local_pdims = t_ref->pdims();
+    }
 
-#else
-      LOG.os<1>("Allocating core work tensor.\n");
-      m_work_tensor = tensor<N, T>::create()
-                          .name(m_name + "_work")
-                          .set_pgrid(*m_spgrid_N)
-                          .map1(map1)
-                          .map2(map2)
-                          .blk_sizes(m_blk_sizes)
-                          .build();
-#endif
+    m_single_blocks = 0;
+    m_packed_blocks = 0;
+    m_single_err2 = 0.0;
+    m_single_maxerr = 0.0;
+    m_packed_norm2 = 0.0;
+    m_codec_raw = 0;
+    m_codec_stored = 0;
+
+    m_core_layouts.clear();
+
+    if (m_type == btype::core) {
+      auto& layout = m_core_layouts[dims];
+      layout.map1 = map1;
+      layout.map2 = map2;
 
-      // m_work_tensor->batched_contract_init();
+      if (m_packed) {
+        layout.packed.assign(m_wrview.nbatches, nullptr);
+      }
+      else {
+        LOG.os<1>("Allocating core work tensors.\n");
+        layout.batches.resize(m_wrview.nbatches);
+        for (auto& t : layout.batches) {
+          t = get_template(m_name + "_work", map1, map2);
+        }
+      }
     }
 
     m_is_compress_initialized = true;
@@ -546,6 +1119,11 @@ class btensor {
 
   /* ... */
   void compress(std::initializer_list<int> idx_list, stensor<N, T> tensor_in)
+  {
+    compress(vec<int>(idx_list), tensor_in);
+  }
+
+  void compress(vec<int> idx, stensor<N, T> tensor_in)
   {
     LOG.os<1>("Compressing into ", m_name, "...\n");
 
@@ -558,8 +1136,6 @@ class btensor {
           "Compressing, but decompression is initailized\n");
     }
 
-    vec<int> idx = idx_list;
-
     auto map1 = tensor_in->map1_2d();
     auto map2 = tensor_in->map2_2d();
 
@@ -569,6 +1145,7 @@ class btensor {
 
     switch (m_type) {
       case btype::disk:
+      case btype::hybrid:
         compress_disk(idx, tensor_in);
         break;
       case btype::core:
@@ -594,23 +1171,34 @@ class btensor {
 
     auto b = get_bounds(idx, m_wrview.dims);
 
-    LOG.os<1>("Copying\n");
+    int ibatch = flatten(idx, m_wrview.dims);
+
+    LOG.os<1>("Copying to batch ", ibatch, '\n');
 
     m_nzetot += tensor_in->num_nze_total();
 
-#ifdef _CORE_VECTOR
-    LOG.os<1>("Index: ", ibatch, '\n');
-    copy(*tensor_in, *m_core_vector[ibatch])
-        .bounds(b)
-        .move_data(true)
-        .perform();
-#else
-    copy(*tensor_in, *m_work_tensor)
+    auto& layout = m_core_layouts.at(m_wrview.dims);
+
+    if (m_packed) {
+      auto t_pack = get_template(
+          m_name + "_pack", m_wrview.map1, m_wrview.map2);
+      if (layout.packed[ibatch])
+        unpack(*layout.packed[ibatch], t_pack);
+      copy(*tensor_in, *t_pack)
+          .bounds(b)
+          .move_data(true)
+          .sum(true)
+          .perform();
+      layout.packed[ibatch] = pack(t_pack);
+      LOG.os<1>("DONE.\n");
+      return;
+    }
+
+    copy(*tensor_in, *layout.batches[ibatch])
         .bounds(b)
         .move_data(true)
         .sum(true)
         .perform();
-#endif
 
     LOG.os<1>("DONE.\n");
   }
@@ -640,42 +1228,21 @@ class btensor {
 
     LOG.os<1>("NZE/NBLOCKS: ", nze, "/", nblocks, '\n');
 
-    auto& nblksprocbatch = m_wrview.nblksprocbatch;
-    auto& nzeprocbatch = m_wrview.nzeprocbatch;
-
-    nblksprocbatch.resize(nbatches);
-    nzeprocbatch.resize(nbatches);
-
-    nblksprocbatch[ibatch] = vec<int>(m_mpisize);
-    nzeprocbatch[ibatch] = vec<int>(m_mpisize);
-
-    // communicate nzes + blks to other processes
-
-    LOG.os<1>("Gathering nze and nblocks...\n");
-
-    MPI_Allgather(
-        &nze, 1, MPI_INT, nzeprocbatch[ibatch].data(), 1, MPI_INT, m_comm);
-    MPI_Allgather(
-        &nblocks, 1, MPI_INT, nblksprocbatch[ibatch].data(), 1, MPI_INT,
-        m_comm);
-
-    int64_t nblktotbatch = std::accumulate(
-        nblksprocbatch[ibatch].begin(), nblksprocbatch[ibatch].end(),
-        int64_t(0));
-
-    int64_t nzetotbatch = std::accumulate(
-        nzeprocbatch[ibatch].begin(), nzeprocbatch[ibatch].end(), int64_t(0));
-
-    m_nblkloc += nblksprocbatch[ibatch][m_mpirank];
-    m_nzeloc += nzeprocbatch[ibatch][m_mpirank];
-
-    m_nblktot += nblktotbatch;
+    // in reduced precision, the stored data is counted in floats, with a
+    // codec in bytes
+    std::shared_ptr<packed_batch> pb;
+    const char* data = nullptr;
+    int nstore = nze;
 
-    m_nzetot += nzetotbatch;
-
-    LOG(-1).os<1>("Local number of blocks: ", m_nblkloc, '\n');
-    LOG.os<1>("Total number of blocks: ", nblktotbatch, '\n');
-    LOG.os<1>("Total number of nze: ", nzetotbatch, '\n');
+    if (m_packed) {
+      pb = pack(write_tensor);
+      data = (const char*)pb->data.data();
+      nstore = pb->data.size();
+    }
+    else {
+      long long int datasize;
+      data = (const char*)write_tensor->data(datasize);
+    }
 
     // read blocks
 
@@ -712,14 +1279,89 @@ class btensor {
 
     iter.stop();
 
-    // filenames
-
-    std::string data_fname = m_filename;
+    if (m_packed) {
+      blkidxbatch = pb->blkidx;
+      std::copy(pb->blkoff.begin(), pb->blkoff.end(), blkoffbatch.begin());
+    }
 
-    LOG.os<1>("Computing offsets...\n");
+    vec<char> encoded;
 
-    // offsets
-    MPI_Offset data_batch_offset = 0;
+    if (m_codec != bcodec::none) {
+      encoded = encode_batch(data, blkidxbatch, blkoffbatch);
+      data = encoded.data();
+      nstore = encoded.size();
+    }
+
+    auto& nblksprocbatch = m_wrview.nblksprocbatch;
+    auto& nzeprocbatch = m_wrview.nzeprocbatch;
+
+    nblksprocbatch.resize(nbatches);
+    nzeprocbatch.resize(nbatches);
+
+    nblksprocbatch[ibatch] = vec<int>(m_mpisize);
+    nzeprocbatch[ibatch] = vec<int>(m_mpisize);
+
+    // communicate nzes + blks to other processes
+
+    LOG.os<1>("Gathering nze and nblocks...\n");
+
+    MPI_Allgather(
+        &nstore, 1, MPI_INT, nzeprocbatch[ibatch].data(), 1, MPI_INT, m_comm);
+    MPI_Allgather(
+        &nblocks, 1, MPI_INT, nblksprocbatch[ibatch].data(), 1, MPI_INT,
+        m_comm);
+
+    int64_t nblktotbatch = std::accumulate(
+        nblksprocbatch[ibatch].begin(), nblksprocbatch[ibatch].end(),
+        int64_t(0));
+
+    int64_t nzetotbatch = std::accumulate(
+        nzeprocbatch[ibatch].begin(), nzeprocbatch[ibatch].end(), int64_t(0));
+
+    m_nblkloc += nblksprocbatch[ibatch][m_mpirank];
+    m_nzeloc += nzeprocbatch[ibatch][m_mpirank];
+
+    m_nblktot += nblktotbatch;
+
+    if (m_packed || m_codec != bcodec::none) {
+      m_nzetot += write_tensor->num_nze_total();
+    }
+    else {
+      m_nzetot += nzetotbatch;
+    }
+
+    LOG(-1).os<1>("Local number of blocks: ", m_nblkloc, '\n');
+    LOG.os<1>("Total number of blocks: ", nblktotbatch, '\n');
+    LOG.os<1>("Total number of nze: ", nzetotbatch, '\n');
+
+    if (m_local &&
+        (write_tensor->proc_dist() != m_local_dist ||
+         write_tensor->pdims() != m_local_pdims)) {
+      if (!m_wrview.locblkstart.empty()) {
+        throw std::runtime_error(
+            "btensor: distribution changed while writing to scratch");
+      }
+      LOG.os<>(
+          "Distribution of ", m_name, " differs from the read distribution, ",
+          "using the shared file instead of node-local scratch.\n");
+      m_local = false;
+    }
+
+    if (m_local) {
+      write_local(data, nstore, blkidxbatch, blkoffbatch);
+      write_tensor->clear();
+      LOG.os<1>("Done with batch ", ibatch, '\n');
+      return;
+    }
+
+    // filenames
+
+    std::string data_fname = m_filename;
+
+    LOG.os<1>("Computing offsets...\n");
+
+    // offsets
+    MPI_Offset data_batch_offset = 0;
 
     int64_t nblkprev = 0;
     int64_t ndataprev = 0;
@@ -742,7 +1384,9 @@ class btensor {
     data_batch_offset = ndataprev;
 
     // add it to blkoffsets
-    for (auto& off : blkoffbatch) { off += data_batch_offset; }
+    for (auto& off : blkoffbatch) {
+      off = shift_offset(off, data_batch_offset);
+    }
 
     // write indices and offsets to file
     std::string idx_filename = m_path + m_name + "_idx_write.dat";
@@ -766,6 +1410,7 @@ class btensor {
         MPI_STATUS_IGNORE);
 
     m_wrview.file_name = idx_filename;
+    clear_view_info(m_wrview);
 
     MPI_File_close(&fh_info);
 
@@ -773,16 +1418,13 @@ class btensor {
 
     LOG.os<1>("Writing tensor data...\n");
 
-    long long int datasize;
-    T* data = write_tensor->data(datasize);
-
     MPI_File fh_data;
 
     MPI_File_open(
         m_comm, data_fname.c_str(), MPI_MODE_WRONLY, MPI_INFO_NULL, &fh_data);
 
     MPI_File_write_at_all(
-        fh_data, data_batch_offset * sizeof(T), data, nze, MPI_DOUBLE,
+        fh_data, data_batch_offset * unit_bytes(), data, nstore, unit_type(),
         MPI_STATUS_IGNORE);
 
     MPI_File_close(&fh_data);
@@ -800,16 +1442,85 @@ class btensor {
     LOG.os<1>("Done with batch ", ibatch, '\n');
   }
 
+  /* Appends the local blocks of a batch to the node-local file. The
+   * indices and offsets are only kept in the write view.
+   */
+  void write_local(
+      const char* data,
+      int nstore,
+      arrvec<int, N>& blkidx,
+      vec<MPI_Aint>& blkoff)
+  {
+    // m_nzeloc already includes this batch
+    int64_t data_offset = m_nzeloc - nstore;
+
+    pwrite_all(
+        m_local_fd, data, (size_t)nstore * unit_bytes(),
+        data_offset * unit_bytes());
+
+    auto& v = m_wrview;
+
+    if (v.locblkstart.empty())
+      v.locblkstart.push_back(0);
+
+    for (int i = 0; i != N; ++i) {
+      v.locblkidx[i].insert(
+          v.locblkidx[i].end(), blkidx[i].begin(), blkidx[i].end());
+    }
+    for (auto off : blkoff) {
+      v.locblkoff.push_back(shift_offset(off, data_offset));
+    }
+
+    if (m_codec != bcodec::none) {
+      for (size_t i = 0; i != blkoff.size(); ++i) {
+        int64_t end =
+            (i + 1 != blkoff.size()) ? blk_offset(blkoff[i + 1]) : nstore;
+        v.locblksize.push_back(end - blk_offset(blkoff[i]));
+      }
+    }
+
+    v.locblkstart.push_back(v.locblkoff.size());
+    v.info_loaded = true;
+  }
+
   void compress_finalize()
   {
     LOG.os<1>("Finalizing compression for ", m_name, "...\n");
 
+    if (m_packed) {
+      report_precision();
+    }
+
+    if (m_codec != bcodec::none && on_disk()) {
+      report_codec();
+    }
+
     // if (m_type == dbcsr::btype::core)
     // m_work_tensor->batched_contract_finalize();
 
     m_is_compress_initialized = false;
   }
 
+  // error of the single precision storage with respect to the double
+  // precision batches
+  void report_precision()
+  {
+    int64_t nblks[2] = {m_single_blocks, m_packed_blocks};
+    double err2[2] = {m_single_err2, m_packed_norm2};
+    double maxerr = m_single_maxerr;
+
+    MPI_Allreduce(MPI_IN_PLACE, nblks, 2, MPI_INT64_T, MPI_SUM, m_comm);
+    MPI_Allreduce(MPI_IN_PLACE, err2, 2, MPI_DOUBLE, MPI_SUM, m_comm);
+    MPI_Allreduce(MPI_IN_PLACE, &maxerr, 1, MPI_DOUBLE, MPI_MAX, m_comm);
+
+    double relerr = (err2[1] > 0.0) ? std::sqrt(err2[0] / err2[1]) : 0.0;
+
+    LOG.os<>(
+        "Single precision storage of ", m_name, ": ", nblks[0], " of ",
+        nblks[1], " blocks, max. error ", maxerr, ", rel. error ", relerr,
+        '\n');
+  }
+
   /*
   void reorder(vec<int> map1, vec<int> map2) {
 
@@ -883,52 +1594,13 @@ class btensor {
 
     // compute super indices
 
-    arrvec<int, N> rlocblkidx, wlocblkidx;
-    vec<MPI_Offset> rlocblkoff, wlocblkoff;
-
-    int nblkloctot = 0;
-
-    for (int ibatch = 0; ibatch != m_wrview.nbatches; ++ibatch) {
-      nblkloctot += m_wrview.nblksprocbatch[ibatch][m_mpirank];
-    }
-
-    for (auto& a : wlocblkidx) { a.resize(nblkloctot); }
-    wlocblkoff.resize(nblkloctot);
-
-    MPI_File fh_info;
-    MPI_File_open(
-        m_comm, m_wrview.file_name.c_str(), MPI_MODE_RDONLY, MPI_INFO_NULL,
-        &fh_info);
-
-    MPI_Offset idx_offset = 0;
-    size_t loc_offset = 0;
-
-    for (int ibatch = 0; ibatch != m_wrview.nbatches; ++ibatch) {
-      for (int r = 0; r != m_mpisize; ++r) {
-        int nblk = m_wrview.nblksprocbatch[ibatch][r];
-
-        for (int i = 0; i != N; ++i) {
-          if (r == m_mpirank) {
-            MPI_File_read_at_all(
-                fh_info, idx_offset, wlocblkidx[i].data() + loc_offset, nblk,
-                MPI_INT, MPI_STATUS_IGNORE);
-          }
-
-          idx_offset += nblk * sizeof(int);
-        }
-
-        if (r == m_mpirank) {
-          MPI_File_read_at_all(
-              fh_info, idx_offset, wlocblkoff.data() + loc_offset, nblk,
-              MPI_OFFSET, MPI_STATUS_IGNORE);
-          loc_offset += nblk;
-        }
+    load_view_info(m_wrview);
 
-        idx_offset += nblk * sizeof(MPI_Offset);
-      }
-    }
+    auto& wlocblkidx = m_wrview.locblkidx;
+    auto& wlocblkoff = m_wrview.locblkoff;
 
-    MPI_File_close(&fh_info);
+    arrvec<int, N> rlocblkidx;
+    vec<MPI_Offset> rlocblkoff;
 
     if (LOG.global_plev() >= 10) {
       for (int m = 0; m != m_mpisize; ++m) {
@@ -1031,7 +1703,9 @@ class btensor {
       for (int i = 0; i != N; ++i) { blksize *= sizes[i][blk_idx[i]]; }
 
       nblksprocbatch[sbatch_idx][m_mpirank] += 1;
-      nzeprocbatch[sbatch_idx][m_mpirank] += blksize;
+      nzeprocbatch[sbatch_idx][m_mpirank] += (m_codec != bcodec::none) ?
+          m_wrview.locblksize[iblk] :
+          blk_units(wlocblkoff[iblk], blksize);
 
       batchidx[iblk] = sbatch_idx;
     }
@@ -1065,12 +1739,16 @@ class btensor {
 
     rlocblkidx = wlocblkidx;
     rlocblkoff = wlocblkoff;
+    rview.locblksize = m_wrview.locblksize;
 
     for (size_t i = 0; i != perm.size(); ++i) {
       for (int n = 0; n != N; ++n) {
         rlocblkidx[n][i] = wlocblkidx[n][perm[i]];
       }
       rlocblkoff[i] = wlocblkoff[perm[i]];
+      if (m_codec != bcodec::none) {
+        rview.locblksize[i] = m_wrview.locblksize[perm[i]];
+      }
     }
 
     if (LOG.global_plev() >= 10) {
@@ -1089,22 +1767,43 @@ class btensor {
 
     // std::cout << "FILENAME READ: " << rview.file_name << std::endl;
 
+    rview.map1 = map1;
+    rview.map2 = map2;
+
+    // keep the index information, no need to read it back
+    rview.locblkidx = std::move(rlocblkidx);
+    rview.locblkoff = std::move(rlocblkoff);
+    rview.locblkstart = local_block_starts(rview);
+    rview.info_loaded = true;
+
+    // node-local views only live in memory
+    if (!m_local) {
+      write_view_index(rview);
+    }
+
+    return rview;
+  }
+
+  // writes the block indices and offsets of the local blocks of v to
+  // v.file_name
+  void write_view_index(view& v)
+  {
     MPI_File fh_read;
     MPI_File_open(
-        m_comm, rview.file_name.c_str(), MPI_MODE_WRONLY | MPI_MODE_CREATE,
+        m_comm, v.file_name.c_str(), MPI_MODE_WRONLY | MPI_MODE_CREATE,
         MPI_INFO_NULL, &fh_read);
 
-    idx_offset = 0;
-    loc_offset = 0;
+    MPI_Offset idx_offset = 0;
+    size_t loc_offset = 0;
 
-    for (int ibatch = 0; ibatch != rview.nbatches; ++ibatch) {
+    for (int ibatch = 0; ibatch != v.nbatches; ++ibatch) {
       for (int r = 0; r != m_mpisize; ++r) {
-        int nblk = rview.nblksprocbatch[ibatch][r];
+        int nblk = v.nblksprocbatch[ibatch][r];
 
         for (int i = 0; i != N; ++i) {
           if (r == m_mpirank) {
             MPI_File_write_at_all(
-                fh_read, idx_offset, rlocblkidx[i].data() + loc_offset, nblk,
+                fh_read, idx_offset, v.locblkidx[i].data() + loc_offset, nblk,
                 MPI_INT, MPI_STATUS_IGNORE);
           }
 
@@ -1113,7 +1812,7 @@ class btensor {
 
         if (r == m_mpirank) {
           MPI_File_write_at_all(
-              fh_read, idx_offset, rlocblkoff.data() + loc_offset, nblk,
+              fh_read, idx_offset, v.locblkoff.data() + loc_offset, nblk,
               MPI_OFFSET, MPI_STATUS_IGNORE);
           loc_offset += nblk;
         }
@@ -1123,165 +1822,388 @@ class btensor {
     }
 
     MPI_File_close(&fh_read);
+  }
 
-    rview.map1 = map1;
-    rview.map2 = map2;
+  /* ========== MATERIALISED VIEWS ========== */
 
-    return rview;
+  // Read views of tensors in the shared file are written once more into
+  // their own file, batch by batch like the write view, so that reading a
+  // batch of any view is a single contiguous read. After save() or load(),
+  // these layouts are also stored next to the saved file, and load()
+  // restores them without recomputing the view.
+
+  // file passed to the last save() or load()
+  std::string m_persist_file;
+
+  static std::string dims_suffix(const vec<int>& dims)
+  {
+    std::string suffix;
+    for (auto v : dims) { suffix += std::to_string(v); }
+    return suffix;
   }
 
-  void decompress_init(
-      std::initializer_list<int> dims_list, vec<int> map1, vec<int> map2)
+  std::string persist_name(const vec<int>& dims) const
   {
-    vec<int> dims = dims_list;
+    return m_persist_file + ".view" + dims_suffix(dims) + "." +
+        std::to_string(m_mpirank);
+  }
 
-    fits_in_mem(dims);
+  // offsets of the blocks read into rd relative to the start of the data
+  // of this rank and batch
+  vec<MPI_Offset> relative_offsets(batch_read& rd)
+  {
+    vec<MPI_Offset> out(rd.blkoff.size());
+    int64_t pos = 0;
+
+    for (size_t i = 0; i != out.size(); ++i) {
+      MPI_Offset tag = (m_packed) ? rd.blkoff[i] % 2 : 0;
+      out[i] = shift_offset(tag, pos);
+      pos += (m_codec != bcodec::none) ?
+          rd.blksize[i] :
+          blk_units(rd.blkoff[i], blk_ntot(rd.blkidx, i));
+    }
 
-    LOG.os<1>("Initializing decompression for ", m_name, "...\n");
+    return out;
+  }
 
-    std::string vstr;
-    for (auto i : map1) { vstr += std::to_string(i); }
-    vstr += "|";
-    for (auto i : map2) { vstr += std::to_string(i); }
+  /* Appends the local blocks of batch ibatch to the materialised view v.
+   * The data of all ranks is stored one after the other, starting at
+   * file_pos, which is advanced past the batch.
+   */
+  void write_view_batch(
+      view& v,
+      MPI_File fh,
+      int ibatch,
+      int64_t& file_pos,
+      const char* data,
+      int nstore,
+      const arrvec<int, N>& blkidx,
+      const vec<MPI_Offset>& reloff)
+  {
+    int nblk = reloff.size();
 
-    LOG.os<1>("Requested view: ", vstr, '\n');
+    v.nzeprocbatch[ibatch].resize(m_mpisize);
+    v.nblksprocbatch[ibatch].resize(m_mpisize);
 
-    m_read_current_is_contiguous = (dims == m_wrview.dims) ? true : false;
-    m_read_current_dims = dims;
+    MPI_Allgather(
+        &nstore, 1, MPI_INT, v.nzeprocbatch[ibatch].data(), 1, MPI_INT,
+        m_comm);
+    MPI_Allgather(
+        &nblk, 1, MPI_INT, v.nblksprocbatch[ibatch].data(), 1, MPI_INT,
+        m_comm);
 
-    if (m_type == btype::core) {
-#ifdef _CORE_VECTOR
+    auto& nze = v.nzeprocbatch[ibatch];
+    int64_t rank_pos = file_pos +
+        std::accumulate(nze.begin(), nze.begin() + m_mpirank, int64_t(0));
 
-      if (m_wrview.dims != dims) {
-        LOG.os<1>("Reorganizing core tensors.\n");
+    for (int i = 0; i != N; ++i) {
+      v.locblkidx[i].insert(
+          v.locblkidx[i].end(), blkidx[i].begin(), blkidx[i].end());
+    }
+    for (auto off : reloff) {
+      v.locblkoff.push_back(shift_offset(off, rank_pos));
+    }
 
-        std::vector<dbcsr::shared_tensor<N, T>> newcorevec;
+    MPI_File_write_at_all(
+        fh, rank_pos * unit_bytes(), data, nstore, unit_type(),
+        MPI_STATUS_IGNORE);
 
-        newcorevec.resize(get_nbatches(dims));
+    file_pos += std::accumulate(nze.begin(), nze.end(), int64_t(0));
+  }
 
-        for (auto& t : newcorevec) {
-          t = tensor<N, T>::create_template(*m_core_vector[0])
-                  .map1(map1)
-                  .map2(map2)
-                  .name(m_name + "_work_core")
-                  .build();
+  // writes the data of a batch read into rd to the stream of a stored view
+  void persist_batch(std::ofstream& out, batch_read& rd)
+  {
+    auto reloff = relative_offsets(rd);
+    int nblk = reloff.size();
+    int nstore = rd.nze;
 
-          t->batched_contract_init();
-        }
+    out.write((const char*)&nblk, sizeof(int));
+    out.write((const char*)&nstore, sizeof(int));
+    for (int i = 0; i != N; ++i) {
+      out.write((const char*)rd.blkidx[i].data(), nblk * sizeof(int));
+    }
+    out.write((const char*)reloff.data(), nblk * sizeof(MPI_Offset));
+    out.write((const char*)rd.buffer.data(), (int64_t)nstore * unit_bytes());
+  }
 
-        for (auto& oldt : m_core_vector) {
-          if (dims.size() == 1) {
-            const int d0 = dims[0];
-
-            for (int ib0 = 0; ib0 != m_nbatches_dim[d0]; ++ib0) {
-              vec<vec<int>> bds(N);
-              for (int ii = 0; ii != N; ++ii) {
-                bds[ii] = (ii == d0) ? this->bounds(ii, ib0) :
-                                       bds[ii] = this->full_bounds(ii);
-              }
-              copy(*oldt, *newcorevec[ib0]).bounds(bds).sum(true).perform();
-            }
-          }
-          else if (dims.size() == 2) {
-            const int d0 = dims[0];
-            const int d1 = dims[1];
-
-            for (int ib0 = 0; ib0 != m_nbatches_dim[d0]; ++ib0) {
-              for (int ib1 = 0; ib1 != m_nbatches_dim[d1]; ++ib1) {
-                vec<vec<int>> bds(N);
-                for (int ii = 0; ii != N; ++ii) {
-                  if (ii == d0) {
-                    bds[ii] = this->bounds(ii, ib0);
-                  }
-                  else if (ii == d1) {
-                    bds[ii] = this->bounds(ii, ib1);
-                  }
-                  else {
-                    bds[ii] = this->full_bounds(ii);
-                  }
-                }  // endfor ii
-                std::vector<int> idx = {ib0, ib1};
-                int idxflat = flatten(idx, dims);
-                copy(*oldt, *newcorevec[idxflat])
-                    .bounds(bds)
-                    .sum(true)
-                    .perform();
-
-              }  // endfor ib1
-            }  // endfor ib0
-          }
-          else {
-            throw std::runtime_error("Batchtensor: nbatchdims > 3 NYI.");
+  std::ofstream open_persist(const vec<int>& dims)
+  {
+    std::ofstream out(persist_name(dims), std::ios::binary);
+
+    if (!out) {
+      throw std::runtime_error("Could not open file " + persist_name(dims));
+    }
+
+    int ndims = dims.size();
+    int format[2] = {m_packed, static_cast<int>(m_codec)};
+    out.write((const char*)&ndims, sizeof(int));
+    out.write((const char*)dims.data(), ndims * sizeof(int));
+    out.write((const char*)format, 2 * sizeof(int));
+
+    return out;
+  }
+
+  // records a completely written view in <m_persist_file>.views
+  void finish_persist(const vec<int>& dims)
+  {
+    MPI_Barrier(m_comm);
 
-          }  // end elseif
+    if (m_mpirank == 0) {
+      std::ofstream list(m_persist_file + ".views", std::ios::app);
+      list << dims_suffix(dims) << '\n';
+    }
+
+    MPI_Barrier(m_comm);
+  }
+
+  /* Writes the read view with batch dimensions dims, which has to be in
+   * m_rdviewmap, to its own file and replaces it by the materialised view.
+   * The stored blocks are copied as they are.
+   */
+  void materialise_view(vec<int> dims)
+  {
+    auto& rview = m_rdviewmap[dims];
+
+    LOG.os<1>("Materialising view ", dims_suffix(dims), " of ", m_name, '\n');
+
+    view out;
+    out.dims = dims;
+    out.is_contiguous = false;
+    out.nbatches = rview.nbatches;
+    out.map1 = rview.map1;
+    out.map2 = rview.map2;
+    out.file_name = rview.file_name;
+    out.data_file =
+        m_path + m_name + "_data_read_" + dims_suffix(dims) + ".dat";
+    out.nblksprocbatch.resize(out.nbatches);
+    out.nzeprocbatch.resize(out.nbatches);
+    out.locblksize = rview.locblksize;
+
+    MPI_File fh;
+    MPI_File_open(
+        m_comm, out.data_file.c_str(), MPI_MODE_WRONLY | MPI_MODE_CREATE,
+        MPI_INFO_NULL, &fh);
+
+    std::ofstream persist;
+    if (!m_persist_file.empty()) {
+      persist = open_persist(dims);
+    }
 
-          oldt->clear();
-          oldt->destroy();
+    auto read_dims = m_read_current_dims;
+    auto read_contiguous = m_read_current_is_contiguous;
+    m_read_current_dims = dims;
+    m_read_current_is_contiguous = false;
 
-        }  // endfor
+    int64_t file_pos = 0;
 
-        for (auto& t : newcorevec) { t->batched_contract_finalize(); }
+    for (int ibatch = 0; ibatch != out.nbatches; ++ibatch) {
+      batch_read rd;
+      start_read(ibatch, rd, false);
+      finish_read(rd);
 
-        m_core_vector = std::move(newcorevec);
+      write_view_batch(
+          out, fh, ibatch, file_pos, (const char*)rd.buffer.data(), rd.nze,
+          rd.blkidx, relative_offsets(rd));
 
-        // update
-        m_wrview.dims = dims;
-        m_wrview.map1 = map1;
-        m_wrview.map2 = map2;
-        m_wrview.nbatches = get_nbatches(dims);
+      if (persist.is_open()) {
+        persist_batch(persist, rd);
       }
-      else if (m_wrview.map1 != map1 || m_wrview.map2 != map2) {
-        LOG.os<1>("Reordering core tensors.\n");
+    }
+
+    m_read_current_dims = read_dims;
+    m_read_current_is_contiguous = read_contiguous;
 
-        std::vector<dbcsr::shared_tensor<N, T>> newcorevec;
-        newcorevec.resize(m_core_vector.size());
+    MPI_File_close(&fh);
 
-        for (int ii = 0; ii != m_core_vector.size(); ++ii) {
-          auto& told = m_core_vector[ii];
-          auto& tnew = newcorevec[ii];
+    out.locblkstart = local_block_starts(out);
+    out.info_loaded = true;
+    write_view_index(out);
 
-          tnew = tensor<N, T>::create_template(*m_core_vector[0])
-                     .map1(map1)
-                     .map2(map2)
-                     .name(m_name + "_work_core")
-                     .build();
+    rview = std::move(out);
 
-          copy(*told, *tnew).move_data(true).perform();
-        }
+    if (persist.is_open()) {
+      persist.close();
+      finish_persist(dims);
+    }
+  }
 
-        m_core_vector = std::move(newcorevec);
+  // stores the materialised views next to the file written by save()
+  void persist_views()
+  {
+    auto read_dims = m_read_current_dims;
+    auto read_contiguous = m_read_current_is_contiguous;
+
+    for (auto& [dims, v] : m_rdviewmap) {
+      if (v.data_file.empty())
+        continue;
+
+      auto persist = open_persist(dims);
+      m_read_current_dims = dims;
+      m_read_current_is_contiguous = false;
+
+      for (int ibatch = 0; ibatch != v.nbatches; ++ibatch) {
+        batch_read rd;
+        start_read(ibatch, rd, false);
+        finish_read(rd);
+        persist_batch(persist, rd);
       }
-      else {
-        LOG.os<1>("Core tensors are compatible.\n");
+
+      persist.close();
+      finish_persist(dims);
+    }
+
+    m_read_current_dims = read_dims;
+    m_read_current_is_contiguous = read_contiguous;
+  }
+
+  // dimensions of the views stored next to m_persist_file by all ranks
+  vec<vec<int>> persisted_views()
+  {
+    vec<int> flat;
+
+    if (m_mpirank == 0) {
+      std::ifstream list(m_persist_file + ".views");
+      std::string line;
+      while (std::getline(list, line)) {
+        flat.push_back(line.size());
+        for (char c : line) { flat.push_back(c - '0'); }
       }
+    }
+
+    int nflat = flat.size();
+    MPI_Bcast(&nflat, 1, MPI_INT, 0, m_comm);
+    flat.resize(nflat);
+    MPI_Bcast(flat.data(), nflat, MPI_INT, 0, m_comm);
 
-#else
+    vec<vec<int>> out;
+    for (int i = 0; i < nflat; i += flat[i] + 1) {
+      vec<int> dims(flat.begin() + i + 1, flat.begin() + i + 1 + flat[i]);
 
-      if (m_wrview.map1 != map1 || m_wrview.map2 != map2) {
-        LOG.os<1>("Reordering core tensor.\n");
+      // ranks might not share a file system
+      int found = std::filesystem::exists(persist_name(dims));
+      MPI_Allreduce(MPI_IN_PLACE, &found, 1, MPI_INT, MPI_LAND, m_comm);
 
-        auto new_work_tensor = tensor<N, T>::create_template(*m_work_tensor)
-                                   .map1(map1)
-                                   .map2(map2)
-                                   .name(m_name + "_work_core")
-                                   .build();
+      if (found && std::find(out.begin(), out.end(), dims) == out.end())
+        out.push_back(dims);
+    }
+
+    return out;
+  }
+
+  // restores a view stored by materialise_view or persist_views
+  void load_view(vec<int> dims)
+  {
+    std::ifstream in(persist_name(dims), std::ios::binary);
+
+    int ndims = 0;
+    in.read((char*)&ndims, sizeof(int));
+    vec<int> fdims(ndims);
+    in.read((char*)fdims.data(), ndims * sizeof(int));
+    int format[2] = {-1, -1};
+    in.read((char*)format, 2 * sizeof(int));
+
+    // the stored blocks depend on the precision and codec
+    int valid = in && fdims == dims && format[0] == m_packed &&
+        format[1] == static_cast<int>(m_codec);
+    MPI_Allreduce(MPI_IN_PLACE, &valid, 1, MPI_INT, MPI_LAND, m_comm);
+
+    if (!valid) {
+      LOG.os<>(
+          "Stored view ", dims_suffix(dims), " of ", m_name,
+          " does not match, computing it again.\n");
+      return;
+    }
+
+    LOG.os<1>("Loading view ", dims_suffix(dims), " of ", m_name, '\n');
+
+    view out;
+    out.dims = dims;
+    out.is_contiguous = false;
+    out.nbatches = get_nbatches(dims);
+    out.map1 = m_wrview.map1;
+    out.map2 = m_wrview.map2;
+    out.file_name =
+        m_path + m_name + "_idx_read_" + dims_suffix(dims) + ".dat";
+    out.data_file =
+        m_path + m_name + "_data_read_" + dims_suffix(dims) + ".dat";
+    out.nblksprocbatch.resize(out.nbatches);
+    out.nzeprocbatch.resize(out.nbatches);
 
-        copy(*m_work_tensor, *new_work_tensor).move_data(true).perform();
+    MPI_File fh;
+    MPI_File_open(
+        m_comm, out.data_file.c_str(), MPI_MODE_WRONLY | MPI_MODE_CREATE,
+        MPI_INFO_NULL, &fh);
+
+    int64_t file_pos = 0;
+    vec<char> data;
 
-        // update
-        m_wrview.dims = dims;
-        m_wrview.map1 = map1;
-        m_wrview.map2 = map2;
-        m_wrview.nbatches = get_nbatches(dims);
+    for (int ibatch = 0; ibatch != out.nbatches; ++ibatch) {
+      int nblk = 0, nstore = 0;
+      in.read((char*)&nblk, sizeof(int));
+      in.read((char*)&nstore, sizeof(int));
 
-        m_work_tensor.reset();
-        m_work_tensor = new_work_tensor;
+      arrvec<int, N> blkidx;
+      for (int i = 0; i != N; ++i) {
+        blkidx[i].resize(nblk);
+        in.read((char*)blkidx[i].data(), nblk * sizeof(int));
       }
-      else {
-        LOG.os<1>("Core tensor is compatible.\n");
+      vec<MPI_Offset> reloff(nblk);
+      in.read((char*)reloff.data(), nblk * sizeof(MPI_Offset));
+
+      data.resize((int64_t)nstore * unit_bytes());
+      in.read(data.data(), data.size());
+
+      if (!in) {
+        throw std::runtime_error(
+            "Error while reading file " + persist_name(dims));
       }
 
-#endif
+      write_view_batch(
+          out, fh, ibatch, file_pos, data.data(), nstore, blkidx, reloff);
+    }
+
+    MPI_File_close(&fh);
+
+    out.locblkstart = local_block_starts(out);
+    if (m_codec != bcodec::none) {
+      derive_block_sizes(out);
+    }
+    out.info_loaded = true;
+    write_view_index(out);
+
+    m_rdviewmap[dims] = std::move(out);
+  }
+
+  void decompress_init(
+      std::initializer_list<int> dims_list, vec<int> map1, vec<int> map2)
+  {
+    decompress_init(vec<int>(dims_list), map1, map2);
+  }
+
+  void decompress_init(vec<int> dims, vec<int> map1, vec<int> map2)
+  {
+    fits_in_mem(dims);
+
+    cancel_prefetch();
+
+    LOG.os<1>("Initializing decompression for ", m_name, "...\n");
+
+    std::string vstr;
+    for (auto i : map1) { vstr += std::to_string(i); }
+    vstr += "|";
+    for (auto i : map2) { vstr += std::to_string(i); }
+
+    LOG.os<1>("Requested view: ", vstr, '\n');
+
+    m_read_current_is_contiguous = (dims == m_wrview.dims) ? true : false;
+    m_read_current_dims = dims;
+
+    if (m_type == btype::core) {
+      set_core_layout(dims, map1, map2);
+      m_read_current_is_contiguous = true;
+      if (m_packed)
+        m_work_tensor = get_template(m_name + "_work_core", map1, map2);
     }
 
     if (m_type == btype::direct) {
@@ -1306,7 +2228,7 @@ class btensor {
       m_wrview.nbatches = get_nbatches(dims);
     }
 
-    if (m_type == btype::disk) {
+    if (on_disk()) {
       LOG.os<1>("Creating disk work and read tensors.\n");
 
       m_work_tensor = tensor<N, T>::create()
@@ -1324,8 +2246,21 @@ class btensor {
                           .build();
     }
 
-    if (m_type == btype::disk && !m_read_current_is_contiguous) {
-      LOG.os<1>(
+    if (m_type == btype::hybrid) {
+      std::string dstr;
+      for (auto i : dims) { dstr += std::to_string(i); }
+      m_hybrid_view = dstr + ":" + vstr;
+      m_work_is_cached = false;
+
+      if (m_generator) {
+        m_gen_tensor = tensor<N, T>::create_template(*m_work_tensor)
+                           .name(m_name + "_gen_hybrid")
+                           .build();
+      }
+    }
+
+    if (on_disk() && !m_read_current_is_contiguous) {
+      LOG.os<1>(
           "Reading will be non-contiguous. ",
           "Setting view of local block indices.\n");
 
@@ -1335,6 +2270,10 @@ class btensor {
       else {
         LOG.os<1>("View not yet computed. Doing it now...\n");
         m_rdviewmap[dims] = set_view(dims);
+
+        if (!m_local) {
+          materialise_view(dims);
+        }
       }
     }
 
@@ -1347,8 +2286,175 @@ class btensor {
     // std::cout << "NATCHED." << std::endl;
   }
 
+  /* Makes the batches of a core tensor available for reading with the
+   * given batch dimensions and maps. One layout is kept per set of batch
+   * dimensions, so that going back to a view read before does not move
+   * any data, and decompressing a batch stays a lookup.
+   */
+  void set_core_layout(vec<int> dims, vec<int> map1, vec<int> map2)
+  {
+    auto iter = m_core_layouts.find(dims);
+
+    if (iter == m_core_layouts.end()) {
+      LOG.os<1>("Building core layout.\n");
+      m_core_layouts[dims] = build_core_layout(dims, map1, map2);
+      return;
+    }
+
+    auto& layout = iter->second;
+
+    if (layout.map1 == map1 && layout.map2 == map2) {
+      LOG.os<1>("Core tensors are compatible.\n");
+      return;
+    }
+
+    LOG.os<1>("Reordering core tensors.\n");
+
+    if (m_packed) {
+      auto t_old = get_template(m_name + "_unpack", layout.map1, layout.map2);
+      auto t_new = get_template(m_name + "_repack", map1, map2);
+
+      for (auto& pb : layout.packed) {
+        if (!pb)
+          continue;
+        unpack(*pb, t_old);
+        copy(*t_old, *t_new).move_data(true).perform();
+        pb = pack(t_new);
+        t_new->clear();
+      }
+    }
+    else {
+      for (auto& t : layout.batches) {
+        auto t_new = get_template(m_name + "_work_core", map1, map2);
+        copy(*t, *t_new).move_data(true).perform();
+        t = t_new;
+      }
+    }
+
+    layout.map1 = map1;
+    layout.map2 = map2;
+  }
+
+  /* Lays out the batches of the write view for the batch dimensions dims.
+   * Each batch of the write view is copied once into the new maps, and
+   * its blocks are then moved locally into the batches they belong to.
+   */
+  core_layout build_core_layout(vec<int> dims, vec<int> map1, vec<int> map2)
+  {
+    auto& src = m_core_layouts.at(m_wrview.dims);
+    int nbatches = get_nbatches(dims);
+
+    core_layout out;
+    out.map1 = map1;
+    out.map2 = map2;
+
+    if (m_packed) {
+      out.packed.resize(nbatches);
+      for (auto& pb : out.packed) { pb = std::make_shared<packed_batch>(); }
+    }
+    else {
+      out.batches.resize(nbatches);
+      for (auto& t : out.batches) {
+        t = get_template(m_name + "_work_core", map1, map2);
+      }
+    }
+
+    // batch of each block along the batch dimensions
+    vec<vec<int>> blk_batch(dims.size());
+    for (size_t i = 0; i != dims.size(); ++i) {
+      int idim = dims[i];
+      blk_batch[i].resize(m_blk_sizes[idim].size());
+      for (int ib = 0; ib != m_nbatches_dim[idim]; ++ib) {
+        auto& b = m_blk_bounds[idim][ib];
+        for (int iblk = b[0]; iblk <= b[1]; ++iblk) {
+          blk_batch[i][iblk] = ib;
+        }
+      }
+    }
+
+    auto t_old = (m_packed) ?
+        get_template(m_name + "_unpack", src.map1, src.map2) :
+        nullptr;
+    auto t_new = get_template(m_name + "_route", map1, map2);
+
+    vec<int> bidx(dims.size());
+    std::vector<arrvec<int, N>> blkidx(nbatches);
+
+    int nold = (m_packed) ? src.packed.size() : src.batches.size();
+
+    for (int iold = 0; iold != nold; ++iold) {
+      if (m_packed) {
+        if (!src.packed[iold])
+          continue;
+        unpack(*src.packed[iold], t_old);
+        copy(*t_old, *t_new).move_data(true).perform();
+      }
+      else {
+        copy(*src.batches[iold], *t_new).perform();
+      }
+
+      // sort the local blocks by target batch
+      for (auto& b : blkidx) {
+        for (auto& v : b) { v.clear(); }
+      }
+
+      dbcsr::iterator_t<N, T> iter(*t_new);
+      iter.start();
+
+      while (iter.blocks_left()) {
+        iter.next();
+        auto& idx = iter.idx();
+        for (size_t i = 0; i != dims.size(); ++i) {
+          bidx[i] = blk_batch[i][idx[dims[i]]];
+        }
+        int inew = flatten(bidx, dims);
+        for (int i = 0; i != N; ++i) { blkidx[inew][i].push_back(idx[i]); }
+      }
+
+      iter.stop();
+
+      for (int inew = 0; inew != nbatches; ++inew) {
+        auto& bi = blkidx[inew];
+        if (bi[0].empty())
+          continue;
+
+        if (!m_packed)
+          out.batches[inew]->reserve(bi);
+
+        index<N> idx;
+        for (size_t iblk = 0; iblk != bi[0].size(); ++iblk) {
+          int64_t ntot = 1;
+          for (int i = 0; i != N; ++i) {
+            idx[i] = bi[i][iblk];
+            ntot *= m_blk_sizes[i][idx[i]];
+          }
+
+          bool found = false;
+          const T* blk = t_new->get_block_p(idx, found);
+
+          if (m_packed) {
+            pack_block(*out.packed[inew], idx, blk, ntot);
+          }
+          else {
+            T* dest = out.batches[inew]->get_block_p(idx, found);
+            std::copy(blk, blk + ntot, dest);
+          }
+        }
+      }
+
+      t_new->clear();
+    }
+
+    return out;
+  }
+
   // if tensor_in nullptr, then gives back m_stensor
   void decompress(std::initializer_list<int> idx_list)
+  {
+    decompress(vec<int>(idx_list));
+  }
+
+  void decompress(vec<int> idx)
   {
     LOG.os<1>("Decompressing ", m_name, "...\n");
 
@@ -1361,17 +2467,18 @@ class btensor {
           "Decompressing, but compression is initailized\n");
     }
 
-    vec<int> idx = idx_list;
-
     switch (m_type) {
       case btype::disk:
         decompress_disk(idx);
         break;
+      case btype::hybrid:
+        decompress_hybrid(idx);
+        break;
       case btype::direct:
         decompress_direct(idx);
         break;
       case btype::core:
-        decompress_core();
+        decompress_core(idx);
         break;
     }
 
@@ -1379,375 +2486,772 @@ class btensor {
   }
 
   void decompress_direct(vec<int> idx)
+  {
+    generate(idx, m_read_tensor);
+  }
+
+  // fills the work tensor with batch idx of the current read view
+  void generate(vec<int> idx, stensor<N, T>& gen_tensor)
   {
     LOG.os<1>("Generating tensor entries.\n");
 
     auto b = get_blk_bounds(idx, m_read_current_dims);
 
-    m_generator(m_read_tensor, b);
-    m_read_tensor->filter(dbcsr::global::filter_eps);
+    m_generator(gen_tensor, b);
+    gen_tensor->filter(dbcsr::global::filter_eps);
 
-    vec<vec<int>> copy_bounds = get_bounds(idx, m_wrview.dims);
+    vec<vec<int>> copy_bounds = get_bounds(idx, m_read_current_dims);
 
     LOG.os<1>("Copying to work tensor.\n");
 
-    copy(*m_read_tensor, *m_work_tensor)
+    copy(*gen_tensor, *m_work_tensor)
         .bounds(copy_bounds)
         .move_data(true)
         .perform();
   }
 
-  void decompress_core()
+  void decompress_hybrid(vec<int> idx)
   {
-    LOG.os<1>("Decompressing from core.\n");
+    int ibatch = flatten(idx, m_read_current_dims);
+    hybrid_key key = {m_hybrid_view, ibatch};
 
-#ifdef _CORE_VECTOR
-    // std::cout << "Getting: " << flatten(idx, m_wrview.dims) << std::endl;
-    m_work_tensor = m_core_vector[flatten(idx, m_wrview.dims)];
-// dbcsr::print(*m_work_tensor);
-#endif
+    int64_t count = ++m_hybrid_naccess[key];
+    ++m_hybrid_clock;
 
-    return;
+    auto iter = m_hybrid_cache.find(key);
+
+    if (iter != m_hybrid_cache.end()) {
+      LOG.os<1>("Batch ", ibatch, " is held in memory.\n");
+      iter->second.last = m_hybrid_clock;
+      m_work_tensor = iter->second.tensor;
+      m_work_is_cached = true;
+      return;
+    }
+
+    if (m_work_is_cached) {
+      m_work_tensor = tensor<N, T>::create_template(*m_work_tensor)
+                          .name(m_name + "_work_disk")
+                          .build();
+      m_work_is_cached = false;
+    }
+
+    // measure both ways once, then take the cheaper one
+    bool regenerate = false;
+    if (m_generator && m_disk_nze != 0) {
+      regenerate = (m_gen_nze == 0) ||
+          (m_gen_time / m_gen_nze < m_disk_time / m_disk_nze);
+    }
+
+    double time = MPI_Wtime();
+
+    if (regenerate) {
+      LOG.os<1>("Regenerating batch ", ibatch, '\n');
+      generate(idx, m_gen_tensor);
+    }
+    else {
+      decompress_disk(idx);
+    }
+
+    time = MPI_Wtime() - time;
+    MPI_Allreduce(MPI_IN_PLACE, &time, 1, MPI_DOUBLE, MPI_MAX, m_comm);
+
+    // count at least one element, so that empty batches are timed too
+    int64_t nze = std::max((int64_t)m_work_tensor->num_nze_total(), (int64_t)1);
+
+    if (regenerate) {
+      m_gen_time += time;
+      m_gen_nze += nze;
+    }
+    else {
+      m_disk_time += time;
+      m_disk_nze += nze;
+    }
+
+    int64_t bytes = (int64_t)m_work_tensor->num_nze() * sizeof(T);
+    MPI_Allreduce(MPI_IN_PLACE, &bytes, 1, MPI_INT64_T, MPI_MAX, m_comm);
+
+    if (!hybrid_admit(count, bytes))
+      return;
+
+    LOG.os<1>("Keeping batch ", ibatch, " in memory.\n");
+
+    m_hybrid_cache[key] = hybrid_entry{m_work_tensor, bytes, m_hybrid_clock};
+    m_hybrid_used += bytes;
+    m_work_is_cached = true;
   }
 
-  void decompress_disk(vec<int> idx)
+  /* Makes room for a batch of the given size which was accessed count
+   * times. Held batches which were accessed less often are dropped, least
+   * recently used first. Returns false if the batch should not be kept.
+   */
+  bool hybrid_admit(int64_t count, int64_t bytes)
   {
-    vec<int> dims = (m_read_current_is_contiguous) ?
-        m_wrview.dims :
-        m_rdviewmap[m_read_current_dims].dims;
+    if (bytes > m_hybrid_budget)
+      return false;
 
-    int ibatch = flatten(idx, dims);
-    LOG.os<1>("Reading batch ", ibatch, '\n');
+    using entry_iter = typename std::map<hybrid_key, hybrid_entry>::iterator;
+    vec<std::tuple<int64_t, int64_t, entry_iter>> candidates;
 
-    m_work_tensor->clear();
-    m_read_tensor->clear();
+    for (auto iter = m_hybrid_cache.begin(); iter != m_hybrid_cache.end();
+         ++iter) {
+      int64_t n = m_hybrid_naccess[iter->first];
+      if (n < count)
+        candidates.push_back({n, iter->second.last, iter});
+    }
 
-    // if reading is done in same way as writing
-    if (m_read_current_is_contiguous) {
-      LOG.os<1>("Same dimensions for writing and reading.\n");
+    std::sort(candidates.begin(), candidates.end(), [](auto& a, auto& b) {
+      return std::tie(std::get<0>(a), std::get<1>(a)) <
+          std::tie(std::get<0>(b), std::get<1>(b));
+    });
 
-      auto& nzeprocbatch = m_wrview.nzeprocbatch;
-      auto& nblksprocbatch = m_wrview.nblksprocbatch;
+    int64_t free = m_hybrid_budget - m_hybrid_used;
+    size_t nevict = 0;
 
-      int nze = nzeprocbatch[ibatch][m_mpirank];
-      int nblk = nblksprocbatch[ibatch][m_mpirank];
+    while (free < bytes && nevict != candidates.size()) {
+      free += std::get<2>(candidates[nevict++])->second.bytes;
+    }
 
-      // === Allocating blocks for tensor ===
-      //// offsets
+    if (free < bytes)
+      return false;
 
-      int64_t blkoff = 0;
+    for (size_t i = 0; i != nevict; ++i) {
+      auto iter = std::get<2>(candidates[i]);
+      LOG.os<1>("Dropping batch ", iter->first.second, " from memory.\n");
+      m_hybrid_used -= iter->second.bytes;
+      m_hybrid_cache.erase(iter);
+    }
 
-      for (int i = 0; i < ibatch; ++i) {
-        blkoff += nblksprocbatch[i][m_mpirank];
-      }
+    return true;
+  }
 
-      // read idx and offset
+  void decompress_core(vec<int> idx)
+  {
+    LOG.os<1>("Decompressing from core.\n");
 
-      int64_t nblk_prev = 0;
+    int ibatch = flatten(idx, m_read_current_dims);
+    auto& layout = m_core_layouts.at(m_read_current_dims);
 
-      // global offset
-      for (int i = 0; i != ibatch; ++i) {
-        for (int m = 0; m != m_mpisize; ++m) {
-          nblk_prev += nblksprocbatch[i][m];
-        }
-      }
-      // local offset
-      for (int m = 0; m != m_mpirank; ++m) {
-        nblk_prev += nblksprocbatch[ibatch][m];
-      }
+    if (m_packed) {
+      m_work_tensor->clear();
+      unpack(*layout.packed[ibatch], m_work_tensor);
+      return;
+    }
+
+    m_work_tensor = layout.batches[ibatch];
+  }
+
+  // prefix sums of the number of local blocks over the batches of v
+  vec<int64_t> local_block_starts(view& v)
+  {
+    vec<int64_t> out(v.nbatches + 1, 0);
+    for (int ibatch = 0; ibatch != v.nbatches; ++ibatch) {
+      out[ibatch + 1] = out[ibatch] + v.nblksprocbatch[ibatch][m_mpirank];
+    }
+    return out;
+  }
+
+  void clear_view_info(view& v)
+  {
+    v.info_loaded = false;
+    for (auto& a : v.locblkidx) { a = vec<int>(); }
+    v.locblkoff = vec<MPI_Offset>();
+    v.locblkstart = vec<int64_t>();
+    v.locblksize = vec<int64_t>();
+  }
+
+  // reads the block indices and file offsets of all local blocks of view v,
+  // if not done before
+  void load_view_info(view& v)
+  {
+    if (v.info_loaded)
+      return;
+
+    LOG.os<1>("Reading block indices from ", v.file_name, '\n');
+
+    v.locblkstart = local_block_starts(v);
+    int64_t nblkloc = v.locblkstart.back();
+
+    for (auto& a : v.locblkidx) { a.resize(nblkloc); }
+    v.locblkoff.resize(nblkloc);
 
-      arrvec<int, N> newlocblkidx;
-      vec<MPI_Offset> newlocblkoff;
+    MPI_File fh_idx;
 
-      for (auto& l : newlocblkidx) l.resize(nblk);
-      newlocblkoff.resize(nblk);
+    MPI_File_open(
+        m_comm, v.file_name.c_str(), MPI_MODE_RDONLY, MPI_INFO_NULL, &fh_idx);
+
+    // blocks of all batches and ranks before the local blocks of a batch
+    int64_t nblk_prev = 0;
 
-      MPI_File fh_idx;
+    for (int ibatch = 0; ibatch != v.nbatches; ++ibatch) {
+      auto& nblkproc = v.nblksprocbatch[ibatch];
+      int nblk = nblkproc[m_mpirank];
+      int64_t start = v.locblkstart[ibatch];
 
-      MPI_File_open(
-          m_comm, m_wrview.file_name.c_str(), MPI_MODE_RDONLY, MPI_INFO_NULL,
-          &fh_idx);
+      int64_t nblk_before =
+          nblk_prev + std::accumulate(
+                          nblkproc.begin(), nblkproc.begin() + m_mpirank,
+                          int64_t(0));
 
       MPI_Offset idx_offset =
-          nblk_prev * (N * sizeof(int) + sizeof(MPI_Offset));
+          nblk_before * (N * sizeof(int) + sizeof(MPI_Offset));
 
-      for (auto& l : newlocblkidx) {
+      for (auto& l : v.locblkidx) {
         MPI_File_read_at_all(
-            fh_idx, idx_offset, l.data(), nblk, MPI_INT, MPI_STATUS_IGNORE);
+            fh_idx, idx_offset, l.data() + start, nblk, MPI_INT,
+            MPI_STATUS_IGNORE);
         idx_offset += nblk * sizeof(int);
       }
       MPI_File_read_at_all(
-          fh_idx, idx_offset, newlocblkoff.data(), nblk, MPI_OFFSET,
+          fh_idx, idx_offset, v.locblkoff.data() + start, nblk, MPI_OFFSET,
           MPI_STATUS_IGNORE);
 
-      MPI_File_close(&fh_idx);
+      nblk_prev +=
+          std::accumulate(nblkproc.begin(), nblkproc.end(), int64_t(0));
+    }
 
-      if (LOG.global_plev() >= 10) {
-        MPI_Barrier(m_comm);
+    MPI_File_close(&fh_idx);
 
-        for (int i = 0; i != m_mpisize; ++i) {
-          if (i == m_mpirank) {
-            // std::cout << "NEW" << std::endl;
-            for (auto a : newlocblkidx) {
-              for (auto l : a) { std::cout << l << " "; }
-              std::cout << std::endl;
-            }
-          }
+    if (m_codec != bcodec::none) {
+      derive_block_sizes(v);
+    }
+
+    v.info_loaded = true;
+  }
+
+  // block indices, file offsets and stored sizes (only with a codec) of the
+  // local blocks of batch ibatch
+  void read_batch_info(
+      view& v,
+      int ibatch,
+      arrvec<int, N>& blkidx,
+      vec<MPI_Offset>& blkoff,
+      vec<int64_t>& blksize)
+  {
+    load_view_info(v);
+
+    auto first = v.locblkstart[ibatch];
+    auto last = v.locblkstart[ibatch + 1];
+
+    for (int i = 0; i != N; ++i) {
+      blkidx[i].assign(
+          v.locblkidx[i].begin() + first, v.locblkidx[i].begin() + last);
+    }
+    blkoff.assign(v.locblkoff.begin() + first, v.locblkoff.begin() + last);
+    if (m_codec != bcodec::none) {
+      blksize.assign(
+          v.locblksize.begin() + first, v.locblksize.begin() + last);
+    }
+
+    if (LOG.global_plev() >= 10) {
+      MPI_Barrier(m_comm);
 
-          MPI_Barrier(m_comm);
+      for (int i = 0; i != m_mpisize; ++i) {
+        if (i == m_mpirank) {
+          for (auto a : blkidx) {
+            for (auto l : a) { std::cout << l << " "; }
+            std::cout << std::endl;
+          }
+          for (auto a : blkoff) { std::cout << a << " "; }
+          std::cout << std::endl;
         }
+
+        MPI_Barrier(m_comm);
       }
+    }
+  }
 
-      //// reserving
-      m_read_tensor->reserve(newlocblkidx);
+  /* Starts a non-blocking read of the data of batch ibatch of the current
+   * read view. If to_tensor is set, the data goes directly into the
+   * reserved blocks of the read tensor (only for contiguous views),
+   * otherwise into the buffer of rd.
+   */
+  void start_read(int ibatch, batch_read& rd, bool to_tensor)
+  {
+    auto& v = (m_read_current_is_contiguous) ?
+        m_wrview :
+        m_rdviewmap[m_read_current_dims];
 
-      for (auto& v : newlocblkidx) v.resize(0);
+    rd.ibatch = ibatch;
+    rd.dims = m_read_current_dims;
+    rd.nze = v.nzeprocbatch[ibatch][m_mpirank];
+    rd.in_tensor = to_tensor && m_read_current_is_contiguous && !m_packed &&
+        m_codec == bcodec::none;
 
-      // === Reading from file ===
-      //// Allocating
+    read_batch_info(v, ibatch, rd.blkidx, rd.blkoff, rd.blksize);
 
-      //// Offset
-      MPI_Offset data_batch_offset = (nblk == 0) ? 0 : newlocblkoff[0];
+    int nblk = rd.blkoff.size();
+    char* dest = nullptr;
 
-      //// Opening File
-      std::string fname = m_filename;
+    if (rd.in_tensor) {
+      m_read_tensor->reserve(rd.blkidx);
+      long long int datasize;
+      dest = (char*)m_read_tensor->data(datasize);
+    }
+    else {
+      rd.buffer.resize(
+          ((int64_t)rd.nze * unit_bytes() + sizeof(T) - 1) / sizeof(T));
+      dest = (char*)rd.buffer.data();
+    }
 
-      MPI_File fh_data;
+    // sizes of the stored blocks
+    vec<int64_t> units(nblk);
+    for (int i = 0; i != nblk; ++i) {
+      units[i] = (m_codec != bcodec::none) ?
+          rd.blksize[i] :
+          blk_units(rd.blkoff[i], blk_ntot(rd.blkidx, i));
+    }
 
-      MPI_File_open(
-          m_comm, fname.c_str(), MPI_MODE_RDONLY, MPI_INFO_NULL, &fh_data);
+    rd.local = m_local;
 
-      //// Reading
-      long long int datasize;
-      T* data = m_read_tensor->data(datasize);
+    if (m_local) {
+      // blocks of a batch are sorted by offset, merge adjacent ones
+      vec<std::pair<int64_t, int64_t>> ranges;
 
-      MPI_File_read_at_all(
-          fh_data, data_batch_offset * sizeof(T), data, nze, MPI_DOUBLE,
-          MPI_STATUS_IGNORE);
+      for (int i = 0; i != nblk; ++i) {
+        int64_t off = blk_offset(rd.blkoff[i]);
+        if (!ranges.empty() &&
+            ranges.back().first + ranges.back().second == off) {
+          ranges.back().second += units[i];
+        }
+        else {
+          ranges.push_back({off, units[i]});
+        }
+      }
 
-      MPI_File_close(&fh_data);
+      int fd = m_local_fd;
+      int64_t ubytes = unit_bytes();
 
-      LOG.os<1>("Copying to work tensor\n");
+      rd.pending = std::async(std::launch::async, [=]() {
+        char* out = dest;
+        for (auto& r : ranges) {
+          pread_all(fd, out, r.second * ubytes, r.first * ubytes);
+          out += r.second * ubytes;
+        }
+      });
 
-      auto copy_bounds = get_bounds(idx, m_read_current_dims);
-      dbcsr::copy(*m_read_tensor, *m_work_tensor)
-          .move_data(true)
-          .bounds(copy_bounds)
-          .perform();
+      rd.active = true;
+      return;
+    }
+
+    // materialised views are stored batch by batch in their own file
+    bool stored_contiguous =
+        m_read_current_is_contiguous || !v.data_file.empty();
+    const std::string& file =
+        (v.data_file.empty()) ? m_filename : v.data_file;
+
+    MPI_File_open(
+        m_comm, file.c_str(), MPI_MODE_RDONLY, MPI_INFO_NULL, &rd.fh);
+
+    MPI_Offset offset = 0;
+    rd.has_type = !stored_contiguous;
 
-      // needs special offsets
+    if (stored_contiguous) {
+      // blocks of a batch are stored one after the other
+      offset = (nblk == 0) ? 0 : blk_offset(rd.blkoff[0]) * unit_bytes();
     }
     else {
-      LOG.os<1>("Different dimension, but faster indices.\n");
+      vec<int> blksizes(nblk);
+      vec<MPI_Aint> blkoffsets(nblk);
 
-      auto& rdview = m_rdviewmap[m_read_current_dims];
+      for (int i = 0; i != nblk; ++i) {
+        blksizes[i] = units[i];
+        blkoffsets[i] = blk_offset(rd.blkoff[i]) * unit_bytes();
+      }
 
-      auto& nzeprocbatch = rdview.nzeprocbatch;
-      auto& nblksprocbatch = rdview.nblksprocbatch;
+      MPI_Type_create_hindexed(
+          nblk, blksizes.data(), blkoffsets.data(), unit_type(), &rd.type);
+      MPI_Type_commit(&rd.type);
 
-      int nze = nzeprocbatch[ibatch][m_mpirank];
-      int nblk = nblksprocbatch[ibatch][m_mpirank];
+      MPI_File_set_view(
+          rd.fh, 0, unit_type(), rd.type, "native", MPI_INFO_NULL);
+    }
 
-      // read idx and offset
-      int64_t blkoff = 0;
+    MPI_File_iread_at(rd.fh, offset, dest, rd.nze, unit_type(), &rd.request);
 
-      for (int i = 0; i < ibatch; ++i) {
-        blkoff += nblksprocbatch[i][m_mpirank];
-      }
+    rd.active = true;
+  }
 
-      int64_t nblk_prev = 0;
+  // waits for a read started with start_read
+  void finish_read(batch_read& rd)
+  {
+    if (rd.local) {
+      rd.pending.get();
+      rd.active = false;
+      return;
+    }
 
-      // global offset
-      for (int i = 0; i != ibatch; ++i) {
-        for (int m = 0; m != m_mpisize; ++m) {
-          nblk_prev += nblksprocbatch[i][m];
-        }
-      }
-      // local offset
-      for (int m = 0; m != m_mpirank; ++m) {
-        nblk_prev += nblksprocbatch[ibatch][m];
-      }
+    MPI_Wait(&rd.request, MPI_STATUS_IGNORE);
+    MPI_File_close(&rd.fh);
 
-      arrvec<int, N> newlocblkidx;
-      vec<MPI_Offset> newlocblkoff;
+    if (rd.has_type)
+      MPI_Type_free(&rd.type);
 
-      for (auto& l : newlocblkidx) l.resize(nblk);
-      newlocblkoff.resize(nblk);
+    rd.active = false;
+  }
 
-      MPI_File fh_idx;
+  // waits for an outstanding prefetch and drops its data
+  void cancel_prefetch()
+  {
+    if (!m_next_read.active)
+      return;
 
-      MPI_File_open(
-          m_comm, rdview.file_name.c_str(), MPI_MODE_RDONLY, MPI_INFO_NULL,
-          &fh_idx);
+    LOG.os<1>("Dropping prefetched batch ", m_next_read.ibatch, '\n');
 
-      MPI_Offset idx_offset =
-          nblk_prev * (N * sizeof(int) + sizeof(MPI_Offset));
+    finish_read(m_next_read);
+    m_next_read = batch_read();
+  }
 
-      for (auto& l : newlocblkidx) {
-        MPI_File_read_at_all(
-            fh_idx, idx_offset, l.data(), nblk, MPI_INT, MPI_STATUS_IGNORE);
-        idx_offset += nblk * sizeof(int);
-      }
-      MPI_File_read_at_all(
-          fh_idx, idx_offset, newlocblkoff.data(), nblk, MPI_OFFSET,
-          MPI_STATUS_IGNORE);
+  void decompress_disk(vec<int> idx)
+  {
+    auto& v = (m_read_current_is_contiguous) ?
+        m_wrview :
+        m_rdviewmap[m_read_current_dims];
 
-      MPI_File_close(&fh_idx);
+    int ibatch = flatten(idx, v.dims);
+    LOG.os<1>("Reading batch ", ibatch, '\n');
 
-      vec<MPI_Aint> blkoffsets(nblk);
+    m_work_tensor->clear();
+    m_read_tensor->clear();
 
-      for (int i = 0; i != nblk; ++i) {
-        blkoffsets[i] = newlocblkoff[i] * sizeof(T);
-      }
+    batch_read rd;
 
-      if (LOG.global_plev() >= 10) {
-        MPI_Barrier(m_comm);
+    if (m_next_read.active && m_next_read.ibatch == ibatch &&
+        m_next_read.dims == m_read_current_dims) {
+      LOG.os<1>("Using prefetched batch.\n");
+      rd = std::move(m_next_read);
+      m_next_read = batch_read();
+    }
+    else {
+      cancel_prefetch();
+      start_read(ibatch, rd, !m_prefetch);
+    }
+
+    finish_read(rd);
 
-        LOG.os<>("LOC IDX AND OFFS\n");
+    if (m_codec != bcodec::none) {
+      decode_batch(rd);
+    }
 
-        for (int i = 0; i != m_mpisize; ++i) {
-          if (i == m_mpirank) {
-            std::cout << "NEW" << std::endl;
-            for (auto a : newlocblkidx) {
-              for (auto l : a) { std::cout << l << " "; }
-              std::cout << std::endl;
-            }
+    // read the next batch while this one is used, unless it is held in
+    // memory
+    bool next_held = m_hybrid_cache.count({m_hybrid_view, ibatch + 1});
+    if (m_prefetch && ibatch + 1 < v.nbatches && !next_held) {
+      LOG.os<1>("Prefetching batch ", ibatch + 1, '\n');
+      start_read(ibatch + 1, m_next_read, false);
+    }
 
-            for (auto a : blkoffsets) { std::cout << a << " "; }
-            std::cout << std::endl;
-          }
+    LOG.os<1>("Copying to work tensor\n");
 
-          MPI_Barrier(m_comm);
+    if (m_read_current_is_contiguous) {
+      if (m_packed) {
+        m_read_tensor->reserve(rd.blkidx);
+
+        // the blocks were read one after the other
+        const float* src = (const float*)rd.buffer.data();
+        index<N> bidx;
+
+        for (size_t iblk = 0; iblk != rd.blkoff.size(); ++iblk) {
+          int64_t size = 1;
+          for (int i = 0; i != N; ++i) {
+            bidx[i] = rd.blkidx[i][iblk];
+            size *= m_blk_sizes[i][bidx[i]];
+          }
+          bool found = false;
+          T* dest = m_read_tensor->get_block_p(bidx, found);
+          src = unpack_block(src, rd.blkoff[iblk] % 2, size, dest);
         }
+
+        rd.buffer = vec<T>();
+      }
+      else if (!rd.in_tensor) {
+        m_read_tensor->reserve(rd.blkidx);
+        long long int datasize;
+        T* data = m_read_tensor->data(datasize);
+        std::copy(rd.buffer.begin(), rd.buffer.end(), data);
+        rd.buffer = vec<T>();
       }
 
-      //// reserving
-      T* buffer = new T[nze];
-      // m_read_tensor->reserve(newlocblkidx);
+      auto copy_bounds = get_bounds(idx, m_read_current_dims);
+      dbcsr::copy(*m_read_tensor, *m_work_tensor)
+          .move_data(true)
+          .bounds(copy_bounds)
+          .perform();
 
-      vec<int> blksizes(nblk);
-      auto& tsizes = m_blk_sizes;
+      return;
+    }
 
-      LOG.os<1>("Computing block sizes.\n");
+    // blocks were written with the maps of the write view
+    m_work_tensor->reserve(rd.blkidx);
 
-      for (int i = 0; i != nblk; ++i) {
-        int size = 1;
-        for (int n = 0; n != N; ++n) { size *= tsizes[n][newlocblkidx[n][i]]; }
-        blksizes[i] = size;
-      }
+    int nblk = rd.blkoff.size();
+    MPI_Offset buffer_offset = 0;
+    std::array<int, N> blkidx, blksize;
+    const float* src = (const float*)rd.buffer.data();
+    vec<T> converted;
 
-      LOG.os<1>("Reserving.\n");
+    for (int iblk = 0; iblk != nblk; ++iblk) {
+      for (int i = 0; i != N; ++i) {
+        blkidx[i] = rd.blkidx[i][iblk];
+        blksize[i] = m_blk_sizes[i][blkidx[i]];
+      }
 
-      // for (auto& a : newlocblkidx) a.clear();
+      bool found = false;
+      auto blk_work = m_work_tensor->get_block(blkidx, blksize, found);
 
-      // now adjust the file view
-      // nze = m_read_tensor->num_nze();
+      if (!found) {
+        throw std::runtime_error("Block not found...");
+      }
 
-      LOG.os<1>("Creating MPI TYPE.\n");
+      T* data = rd.buffer.data() + buffer_offset;
 
-      if (LOG.global_plev() >= 10) {
-        std::cout << "BLOCK SIZES + OFF: " << std::endl;
-        for (int i = 0; i != nblk; ++i) {
-          std::cout << blksizes[i] << " " << blkoffsets[i] << std::endl;
-        }
+      if (m_packed) {
+        converted.resize(blk_work.ntot());
+        src = unpack_block(
+            src, rd.blkoff[iblk] % 2, blk_work.ntot(), converted.data());
+        data = converted.data();
       }
 
-      MPI_Datatype MPI_HINDEXED;
+      blk_work.reshape_2d(data, m_wrview.map1, m_wrview.map2);
 
-      MPI_Type_create_hindexed(
-          nblk, blksizes.data(), blkoffsets.data(), MPI_DOUBLE, &MPI_HINDEXED);
-      MPI_Type_commit(&MPI_HINDEXED);
+      m_work_tensor->put_block(blkidx, blk_work);
 
-      std::string fname = m_filename;
-      MPI_File fh_data;
+      buffer_offset += blk_work.ntot();
+    }
+  }
 
-      MPI_File_open(
-          m_comm, fname.c_str(), MPI_MODE_RDONLY, MPI_INFO_NULL, &fh_data);
+  void decompress_finalize()
+  {
+    cancel_prefetch();
 
-      LOG.os<1>("Setting file view.\n");
+    // m_work_tensor->batched_contract_finalize();
+    if (m_type != btype::core) {
+      if (!m_work_is_cached)
+        m_work_tensor->clear();
+      m_read_tensor->clear();
+    }
 
-      MPI_File_set_view(
-          fh_data, 0, MPI_DOUBLE, MPI_HINDEXED, "native", MPI_INFO_NULL);
+    // the batches stay in m_core_layouts
+    if (m_type == btype::core) {
+      m_work_tensor.reset();
+    }
 
-      LOG.os<1>("Reading from file...\n");
+    m_is_decompress_initialized = false;
+  }
 
-      MPI_File_read_at_all(
-          fh_data, 0, buffer, nze, MPI_DOUBLE, MPI_STATUS_IGNORE);
+  // batch indices over the given dimensions, last dimension running fastest
+  vec<vec<int>> batch_indices(vec<int> dims)
+  {
+    vec<vec<int>> out;
+    vec<int> idx(dims.size(), 0);
 
-      MPI_File_close(&fh_data);
+    for (int ibatch = 0; ibatch != get_nbatches(dims); ++ibatch) {
+      out.push_back(idx);
+      for (int i = (int)dims.size() - 1; i >= 0; --i) {
+        if (++idx[i] != m_nbatches_dim[dims[i]])
+          break;
+        idx[i] = 0;
+      }
+    }
 
-      LOG.os<1>("Done!!\n");
+    return out;
+  }
 
-      MPI_Type_free(&MPI_HINDEXED);
+  vec<vec<int>> write_batch_indices()
+  {
+    return batch_indices(m_wrview.dims);
+  }
 
-      LOG.os<1>("Copying to work tensor\n");
+  /* Writes the local blocks to the file <filename>.<rank>, batch by batch in
+   * the order of the write view. Layout: dims, map1 and map2 of the write
+   * view, then for each batch the number of blocks, their indices and
+   * their data. Only a tensor with the same block sizes, batching and
+   * process grid can load the file again.
+   * Materialised read views are stored in <filename>.view<dims>.<rank>,
+   * now and whenever they are computed later on, and listed in
+   * <filename>.views.
+   */
+  void save(std::string filename)
+  {
+    if (m_type == btype::direct) {
+      throw std::runtime_error("Cannot save direct batch tensor " + m_name);
+    }
 
-      m_work_tensor->reserve(newlocblkidx);
+    if (m_is_compress_initialized || m_is_decompress_initialized) {
+      throw std::runtime_error(
+          "Cannot save batch tensor " + m_name + " during (de)compression");
+    }
 
-      MPI_Offset buffer_offset = 0;
+    LOG.os<1>("Saving ", m_name, " to ", filename, '\n');
 
-      auto map1 = m_work_tensor->map1_2d();
-      auto map2 = m_work_tensor->map2_2d();
+    std::ofstream out(
+        filename + "." + std::to_string(m_mpirank), std::ios::binary);
 
-      auto rmap1 = rdview.map1;
-      auto rmap2 = rdview.map2;
+    if (!out) {
+      throw std::runtime_error("Could not open file " + filename);
+    }
 
-      std::array<int, N> idx, blksize;
-      /*std::cout << "MAP: " << std::endl;
-      for (auto m : map1) std::cout << m << " ";
-      for (auto m : map2) std::cout << m << " ";
-      std::cout << std::endl;*/
+    auto write_vec = [&out](const vec<int>& v) {
+      int n = v.size();
+      out.write((const char*)&n, sizeof(int));
+      out.write((const char*)v.data(), n * sizeof(int));
+    };
 
-      for (int iblk = 0; iblk != nblk; ++iblk) {
-        for (int i = 0; i != N; ++i) {
-          idx[i] = newlocblkidx[i][iblk];
-          blksize[i] = m_blk_sizes[i][idx[i]];
-        }
+    auto dims = m_wrview.dims;
+    auto map1 = m_wrview.map1;
+    auto map2 = m_wrview.map2;
 
-        int rowsize = 1;
-        int colsize = 1;
+    write_vec(dims);
+    write_vec(map1);
+    write_vec(map2);
 
-        for (auto m : m_wrview.map1) { rowsize *= m_blk_sizes[m][idx[m]]; }
+    decompress_init(dims, map1, map2);
 
-        for (auto m : m_wrview.map2) { colsize *= m_blk_sizes[m][idx[m]]; }
+    for (auto& idx : write_batch_indices()) {
+      decompress(idx);
 
-        // get work tensor block
-        bool found = false;
-        auto blk_work = m_work_tensor->get_block(idx, blksize, found);
+      // keep only the blocks inside the batch
+      auto b = get_blk_bounds(idx, dims);
+
+      arrvec<int, N> blkidx;
+      vec<const T*> blkdata;
+      vec<int64_t> blksize;
+
+      dbcsr::iterator_t<N, T> iter(*m_work_tensor);
+      iter.start();
 
-        if (!found) {
-          throw std::runtime_error("Block not found...");
+      while (iter.blocks_left()) {
+        iter.next();
+
+        auto& bidx = iter.idx();
+        auto& size = iter.size();
+
+        bool inside = true;
+        for (int i = 0; i != N; ++i) {
+          inside = inside && bidx[i] >= b[i][0] && bidx[i] <= b[i][1];
         }
 
-        T* data = buffer + buffer_offset;
+        if (!inside)
+          continue;
 
-        blk_work.reshape_2d(data, m_wrview.map1, m_wrview.map2);
+        bool found = false;
+        for (int i = 0; i != N; ++i) { blkidx[i].push_back(bidx[i]); }
+        blkdata.push_back(m_work_tensor->get_block_p(bidx, found));
+        blksize.push_back(std::accumulate(
+            size.begin(), size.end(), (int64_t)1,
+            std::multiplies<int64_t>()));
+      }
 
-        m_work_tensor->put_block(idx, blk_work);
+      iter.stop();
 
-        buffer_offset += blk_work.ntot();
+      int nblocks = blkdata.size();
+      out.write((const char*)&nblocks, sizeof(int));
+      for (int i = 0; i != N; ++i) {
+        out.write((const char*)blkidx[i].data(), nblocks * sizeof(int));
+      }
+      for (int iblk = 0; iblk != nblocks; ++iblk) {
+        out.write((const char*)blkdata[iblk], blksize[iblk] * sizeof(T));
       }
+    }
+
+    decompress_finalize();
+
+    if (!out) {
+      throw std::runtime_error("Error while writing file " + filename);
+    }
+
+    out.close();
+
+    // layouts computed from now on are stored as well
+    m_persist_file = filename;
 
-      delete[] buffer;
+    if (m_mpirank == 0) {
+      std::filesystem::remove(filename + ".views");
+    }
 
-    }  // end if-else
+    if (on_disk() && !m_local) {
+      persist_views();
+    }
   }
 
-  void decompress_finalize()
+  /* Reads a file written by save() and compresses its contents into this
+   * tensor, together with the stored read views. Previous contents are
+   * discarded.
+   */
+  void load(std::string filename)
   {
-    // m_work_tensor->batched_contract_finalize();
-    if (m_type != btype::core) {
-      m_work_tensor->clear();
-      m_read_tensor->clear();
+    if (m_type == btype::direct) {
+      throw std::runtime_error("Cannot load direct batch tensor " + m_name);
     }
 
-#ifdef _CORE_VECTOR
-    if (m_type == btype::core) {
-      // m_work_tensor.reset();
+    LOG.os<1>("Loading ", m_name, " from ", filename, '\n');
+
+    std::ifstream in(
+        filename + "." + std::to_string(m_mpirank), std::ios::binary);
+
+    if (!in) {
+      throw std::runtime_error("Could not open file " + filename);
     }
-#endif
 
-    m_is_decompress_initialized = false;
+    auto read_vec = [&in]() {
+      int n = 0;
+      in.read((char*)&n, sizeof(int));
+      vec<int> v(n);
+      in.read((char*)v.data(), n * sizeof(int));
+      return v;
+    };
+
+    auto dims = read_vec();
+    auto map1 = read_vec();
+    auto map2 = read_vec();
+
+    if (on_disk()) {
+      create_file();
+    }
+
+    compress_init(dims, map1, map2);
+
+    auto t_load = get_template(m_name + "_load", map1, map2);
+
+    for (auto& idx : write_batch_indices()) {
+      int nblocks = 0;
+      in.read((char*)&nblocks, sizeof(int));
+
+      arrvec<int, N> blkidx;
+      for (int i = 0; i != N; ++i) {
+        blkidx[i].resize(nblocks);
+        in.read((char*)blkidx[i].data(), nblocks * sizeof(int));
+      }
+
+      t_load->reserve(blkidx);
+
+      for (int iblk = 0; iblk != nblocks; ++iblk) {
+        index<N> bidx;
+        int64_t size = 1;
+        for (int i = 0; i != N; ++i) {
+          bidx[i] = blkidx[i][iblk];
+          size *= m_blk_sizes[i][bidx[i]];
+        }
+
+        bool found = false;
+        T* data = t_load->get_block_p(bidx, found);
+        in.read((char*)data, size * sizeof(T));
+      }
+
+      if (!in) {
+        throw std::runtime_error("Error while reading file " + filename);
+      }
+
+      compress(idx, t_load);
+      t_load->clear();
+    }
+
+    compress_finalize();
+
+    m_persist_file = filename;
+
+    if (on_disk() && !m_local) {
+      for (auto& dims : persisted_views()) { load_view(dims); }
+    }
   }
 
   dbcsr::stensor<N, T> get_work_tensor()
@@ -1793,6 +3297,70 @@ class btensor {
     return (double)m_nzetot / (double)tot;
   }
 
+  // memory held in core by this process, in bytes
+  int64_t local_memory()
+  {
+    if (m_type == btype::hybrid) {
+      int64_t out = 0;
+      for (auto& [key, entry] : m_hybrid_cache) {
+        out += (int64_t)entry.tensor->num_nze() * sizeof(T);
+      }
+      return out;
+    }
+    if (m_type != btype::core)
+      return 0;
+    int64_t out = 0;
+    for (auto& [dims, layout] : m_core_layouts) {
+      for (auto& t : layout.batches) {
+        out += (int64_t)t->num_nze() * sizeof(T);
+      }
+      for (auto& pb : layout.packed) {
+        if (pb)
+          out += (int64_t)pb->data.size() * sizeof(float);
+      }
+    }
+    return out;
+  }
+
+  // data stored in files by this process, in bytes
+  int64_t stored_bytes()
+  {
+    if (!on_disk())
+      return 0;
+    int64_t out = m_nzeloc * unit_bytes();
+    for (auto& [dims, v] : m_rdviewmap) {
+      if (v.data_file.empty())
+        continue;
+      for (auto& nze : v.nzeprocbatch) {
+        out += (int64_t)nze[m_mpirank] * unit_bytes();
+      }
+    }
+    return out;
+  }
+
+  // block indices, offsets and batch sizes of all views held or stored by
+  // this process, in bytes
+  int64_t metadata_bytes()
+  {
+    if (!on_disk())
+      return 0;
+
+    const int64_t entry = N * sizeof(int) + sizeof(MPI_Offset);
+    int64_t out = 0;
+
+    auto add = [&](view& v) {
+      for (size_t i = 0; i != v.nblksprocbatch.size(); ++i) {
+        out += v.nblksprocbatch[i][m_mpirank] * entry;
+        out += (int64_t)m_mpisize * 2 * sizeof(int);
+      }
+    };
+
+    add(m_wrview);
+    for (auto& [dims, v] : m_rdviewmap) { add(v); }
+
+    return out;
+  }
+
   void print_info()
   {
     std::array<int, N> full;
@@ -1871,12 +3439,24 @@ class btensor {
       out->m_work_tensor = m_work_tensor;  // for now
     }
 
+    out->m_core_layouts = m_core_layouts;
+
     out->m_name = m_name;
     out->m_spgrid_N = m_spgrid_N;
     out->m_blk_sizes = m_blk_sizes;
     out->m_filename = m_filename;
     out->m_path = m_path;
     out->m_type = m_type;
+    out->m_precision = m_precision;
+    out->m_packed = m_packed;
+    out->m_codec = m_codec;
+
+    // the duplicate reads through its own descriptor, but does not own the
+    // scratch file
+    out->m_local = m_local;
+    out->m_local_fd = (m_local_fd >= 0) ? ::dup(m_local_fd) : -1;
+    out->m_local_dist = m_local_dist;
+    out->m_local_pdims = m_local_pdims;
 
     out->m_nblkloc = m_nblkloc;
     out->m_nblkloc_global = m_nblkloc_global;
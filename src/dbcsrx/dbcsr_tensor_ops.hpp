@@ -453,9 +453,10 @@ void copy_3Dtensor_to_2Dtensor(
   t3.finalize();
 }
 
+// islice: block index along the last mode of t the matrix is copied to
 template <typename T>
 void copy_matrix_to_3Dtensor_new(
-    matrix<T>& m, tensor<3, T>& t, bool sym = false)
+    matrix<T>& m, tensor<3, T>& t, bool sym = false, int islice = 0)
 {
   auto w = m.get_cart();
 
@@ -477,7 +478,7 @@ void copy_matrix_to_3Dtensor_new(
   }
 
   iterator iter(*m_ptr);
-  idx3 idxt = {0, 0, 0};
+  idx3 idxt = {0, 0, islice};
 
   iter.start();
 
@@ -569,6 +570,7 @@ void copy_matrix_to_3Dtensor_new(
   vec<double> recv_blk_data(recv_nzetot);
 
   for (auto& v : recv_blkidx) { v.resize(recv_blktot); }
+  std::fill(recv_blkidx[2].begin(), recv_blkidx[2].end(), islice);
 
   // send over block indices
 
@@ -629,8 +631,9 @@ void copy_matrix_to_3Dtensor_new(
   // exit(0);
 }
 
+// islice: block index along the last mode of t which is copied
 template <typename T>
-void copy_3Dtensor_to_matrix_new(tensor<3, T>& t, matrix<T>& m)
+void copy_3Dtensor_to_matrix_new(tensor<3, T>& t, matrix<T>& m, int islice = 0)
 {
   auto w = m.get_cart();
   int mpisize = w.size();
@@ -650,6 +653,9 @@ void copy_3Dtensor_to_matrix_new(tensor<3, T>& t, matrix<T>& m)
     auto& idxt = itert.idx();
     auto& size = itert.size();
 
+    if (idxt[2] != islice)
+      continue;
+
     int nze = size[0] * size[1];
 
     int dest_p = m.proc(idxt[0], idxt[1]);
@@ -749,6 +755,9 @@ void copy_3Dtensor_to_matrix_new(tensor<3, T>& t, matrix<T>& m)
     auto& idxt = itert.idx();
     auto& size = itert.size();
 
+    if (idxt[2] != islice)
+      continue;
+
     int nze = size[0] * size[1];
     int dest_p = m.proc(idxt[0], idxt[1]);
 
@@ -0,0 +1,148 @@
+#include "fock/cfmm.hpp"
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+namespace megalochem {
+
+namespace fock {
+
+namespace cfmm {
+
+int expansion_order(double eps)
+{
+  const int p = (int)std::ceil(std::log(eps) / std::log(THETA)) - 1;
+  return std::min(std::max(p, 4), MAX_ORDER);
+}
+
+// order of the expansions with the exponents exps
+static int order_of(const std::vector<exponents>& exps)
+{
+  auto& e = exps.back();
+  return e[0] + e[1] + e[2];
+}
+
+// index of D_tuv in the tables of derivatives of 1/r, with ndim entries
+// in each cartesian direction
+static int flat(int t, int u, int v, int ndim)
+{
+  return (t * ndim + u) * ndim + v;
+}
+
+/* Derivatives D_tuv = d^t/dx^t d^u/dy^u d^v/dz^v 1/|r| for
+ * t + u + v <= nmax by the McMurchie-Davidson recurrence
+ * R^n_{t+1,u,v} = t R^{n+1}_{t-1,u,v} + x R^{n+1}_{t,u,v}, starting from
+ * R^n_000 = (-1)^n (2n-1)!! / r^(2n+1), with D = R^0.
+ */
+static void coulomb_derivatives(
+    const point& r, int nmax, std::vector<double>& d)
+{
+  const int ndim = nmax + 1;
+  const double r2 = r[0] * r[0] + r[1] * r[1] + r[2] * r[2];
+  const double rinv = 1.0 / std::sqrt(r2);
+
+  std::vector<double> prev(ndim * ndim * ndim, 0.0);
+  d.assign(ndim * ndim * ndim, 0.0);
+
+  for (int n = nmax; n >= 0; --n) {
+    double g = rinv;
+    for (int k = 1; k <= n; ++k) { g *= -(2 * k - 1) / r2; }
+
+    for (int t = 0; t <= nmax - n; ++t) {
+      for (int u = 0; u <= nmax - n - t; ++u) {
+        for (int v = 0; v <= nmax - n - t - u; ++v) {
+          double val = g;
+          if (t > 0) {
+            val = r[0] * prev[flat(t - 1, u, v, ndim)];
+            if (t > 1)
+              val += (t - 1) * prev[flat(t - 2, u, v, ndim)];
+          }
+          else if (u > 0) {
+            val = r[1] * prev[flat(0, u - 1, v, ndim)];
+            if (u > 1)
+              val += (u - 1) * prev[flat(0, u - 2, v, ndim)];
+          }
+          else if (v > 0) {
+            val = r[2] * prev[flat(0, 0, v - 1, ndim)];
+            if (v > 1)
+              val += (v - 1) * prev[flat(0, 0, v - 2, ndim)];
+          }
+          d[flat(t, u, v, ndim)] = val;
+        }
+      }
+    }
+
+    std::swap(prev, d);
+  }
+
+  std::swap(prev, d);
+}
+
+double scaled_power(const point& d, const exponents& e)
+{
+  double out = 1.0;
+  for (int c = 0; c != 3; ++c) {
+    for (int k = 1; k <= e[c]; ++k) { out *= d[c] / k; }
+  }
+  return out;
+}
+
+static bool less_equal(const exponents& a, const exponents& b)
+{
+  return a[0] <= b[0] && a[1] <= b[1] && a[2] <= b[2];
+}
+
+static exponents minus(const exponents& a, const exponents& b)
+{
+  return {a[0] - b[0], a[1] - b[1], a[2] - b[2]};
+}
+
+void m2m(
+    const double* m, const point& d, const std::vector<exponents>& exps,
+    double* mout)
+{
+  for (size_t in = 0; in != exps.size(); ++in) {
+    for (size_t im = 0; im != exps.size(); ++im) {
+      if (less_equal(exps[im], exps[in]))
+        mout[in] += m[im] * scaled_power(d, minus(exps[in], exps[im]));
+    }
+  }
+}
+
+void m2l(
+    const double* m, const point& r, const std::vector<exponents>& exps,
+    std::vector<double>& d, double* l)
+{
+  const int ndim = 2 * order_of(exps) + 1;
+  coulomb_derivatives(r, ndim - 1, d);
+
+  for (size_t ik = 0; ik != exps.size(); ++ik) {
+    auto& k = exps[ik];
+    double sum = 0.0;
+    for (size_t in = 0; in != exps.size(); ++in) {
+      auto& n = exps[in];
+      const double sign = ((n[0] + n[1] + n[2]) % 2) ? -1.0 : 1.0;
+      sum += sign * m[in] *
+          d[flat(n[0] + k[0], n[1] + k[1], n[2] + k[2], ndim)];
+    }
+    l[ik] += sum;
+  }
+}
+
+void l2l(
+    const double* l, const point& d, const std::vector<exponents>& exps,
+    double* lout)
+{
+  for (size_t ij = 0; ij != exps.size(); ++ij) {
+    for (size_t ik = 0; ik != exps.size(); ++ik) {
+      if (less_equal(exps[ij], exps[ik]))
+        lout[ij] += l[ik] * scaled_power(d, minus(exps[ik], exps[ij]));
+    }
+  }
+}
+
+}  // namespace cfmm
+
+}  // namespace fock
+
+}  // namespace megalochem
@@ -0,0 +1,71 @@
+#ifndef FOCK_CFMM_H
+#define FOCK_CFMM_H
+
+#include <array>
+#include <vector>
+
+/* Translation operators of the cartesian multipole expansions used by
+ * CFMM_J. Moments and local expansions are stored for the exponents
+ * (t, u, v) of ints::multipole_exponents(p) for the order p of the
+ * expansions, which the operators take from exps. The moments of a charge
+ * distribution about C being M_tuv = int rho(r) (r-C)^tuv / (t! u! v!).
+ * The potential near a centre T is sum_k L_k (r-T)^k / k!.
+ */
+
+namespace megalochem {
+
+namespace fock {
+
+namespace cfmm {
+
+using point = std::array<double, 3>;
+using exponents = std::array<int, 3>;
+
+// highest order of the expansions, that of the pair multipole integrals
+// (ints::MAX_MULTIPOLE_ORDER)
+const int MAX_ORDER = 15;
+
+// two boxes are well separated if the distance of their centres times
+// THETA is at least the sum of their radii. The error of an interaction
+// truncated at order p goes roughly with THETA^(p + 1)
+const double THETA = 0.3;
+
+// lowest order p >= 4 with THETA^(p + 1) <= eps, at most MAX_ORDER
+int expansion_order(double eps);
+
+// multipoles about the parent centre from those about the child centre,
+// M'_n += sum_{m <= n} M_m d^(n-m) / (n-m)! with d = child - parent
+void m2m(
+    const double* m,
+    const point& d,
+    const std::vector<exponents>& exps,
+    double* mout);
+
+// local expansion of the potential of the multipoles m, with
+// r = target - source centre: L_k += sum_n (-1)^|n| M_n D_{n+k}(r).
+// d is scratch space for the derivatives D of 1/r
+void m2l(
+    const double* m,
+    const point& r,
+    const std::vector<exponents>& exps,
+    std::vector<double>& d,
+    double* l);
+
+// local expansion about the child centre from the one about the parent
+// centre, L'_j += sum_{k >= j} L_k d^(k-j) / (k-j)! with d = child - parent
+void l2l(
+    const double* l,
+    const point& d,
+    const std::vector<exponents>& exps,
+    double* lout);
+
+// d^e / e! for the multi-index e
+double scaled_power(const point& d, const exponents& e);
+
+}  // namespace cfmm
+
+}  // namespace fock
+
+}  // namespace megalochem
+
+#endif
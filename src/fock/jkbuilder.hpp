@@ -6,6 +6,7 @@
   #include <dbcsr_matrix.hpp>
   #include "desc/molecule.hpp"
   #include "ints/aoloader.hpp"
+  #include "ints/molgrid.hpp"
   #include "ints/registry.hpp"
   #include "megalochem.hpp"
   #include "utils/mpi_time.hpp"
@@ -17,9 +18,9 @@ namespace megalochem {
 
 namespace fock {
 
-enum class jmethod { exact, dfao };
+enum class jmethod { exact, dfao, direct, cfmm };
 
-enum class kmethod { exact, dfao, dfmo, dfmem, dfrobust, dflmo };
+enum class kmethod { exact, dfao, dfmo, dfmem, dfrobust, dflmo, direct, cosx };
 
 inline jmethod str_to_jmethod(std::string s)
 {
@@ -29,6 +30,12 @@ inline jmethod str_to_jmethod(std::string s)
   else if (s == "dfao") {
     return jmethod::dfao;
   }
+  else if (s == "direct") {
+    return jmethod::direct;
+  }
+  else if (s == "cfmm") {
+    return jmethod::cfmm;
+  }
   else {
     throw std::runtime_error("Invalid jmethod");
   }
@@ -54,6 +61,12 @@ inline kmethod str_to_kmethod(std::string s)
   else if (s == "dflmo") {
     return kmethod::dflmo;
   }
+  else if (s == "direct") {
+    return kmethod::direct;
+  }
+  else if (s == "cosx") {
+    return kmethod::cosx;
+  }
   else {
     throw std::runtime_error("Invalid kmethod");
   }
@@ -76,11 +89,42 @@ class JK_common {
   dbcsr::shared_matrix<double> m_u_A, m_u_B;
   dbcsr::shared_matrix<double> m_v_A, m_v_B;
 
+  // densities or left/right coefficients of several closed-shell states,
+  // e.g. the trial vectors of a block Davidson iteration
+  std::vector<dbcsr::shared_matrix<double>> m_p_stack;
+  std::vector<dbcsr::shared_matrix<double>> m_u_stack, m_v_stack;
+
   bool m_SAD_iter;
   int m_SAD_rank;
 
   bool m_sym = true;
 
+  using batch_mask = Eigen::Array<bool, Eigen::Dynamic, 1>;
+  using batch_pair_mask = Eigen::Array<bool, Eigen::Dynamic, Eigen::Dynamic>;
+
+  // largest block norm of p between each pair of batches, given by the
+  // block bounds of a batched integral tensor, over all ranks
+  Eigen::MatrixXd density_batch_norms(
+      dbcsr::matrix<double>& p, const vec<vec<int>>& blk_bounds);
+
+  /* Pairs of batches of dimension idim of eri which only meet blocks of p
+   * below filter_eps. Integral batches are skipped for these, which keeps
+   * builds from small difference densities cheap. A batch that is skipped
+   * for all partners is given by density_skip_mask(...).rowwise().all().
+   */
+  template <int N>
+  batch_pair_mask density_skip_mask(
+      dbcsr::matrix<double>& p, dbcsr::btensor<N, double>& eri, int idim)
+  {
+    vec<vec<int>> blkbounds(eri.nbatches(idim));
+    for (int i = 0; i != (int)blkbounds.size(); ++i) {
+      blkbounds[i] = eri.blk_bounds(idim, i);
+    }
+
+    return density_batch_norms(p, blkbounds).array() <
+        dbcsr::global::filter_eps;
+  }
+
  public:
   JK_common(
       megalochem::world w,
@@ -128,6 +172,21 @@ class JK_common {
     m_v_B = irB;
   }
 
+  void set_density_stack(std::vector<dbcsr::shared_matrix<double>>& ips)
+  {
+    m_p_stack = ips;
+  }
+
+  void set_coeff_left_stack(std::vector<dbcsr::shared_matrix<double>>& ils)
+  {
+    m_u_stack = ils;
+  }
+
+  void set_coeff_right_stack(std::vector<dbcsr::shared_matrix<double>>& irs)
+  {
+    m_v_stack = irs;
+  }
+
   void set_sym(bool sym)
   {
     m_sym = sym;
@@ -152,6 +211,7 @@ class JK_common {
 class J : public JK_common {
  protected:
   dbcsr::shared_matrix<double> m_J;
+  std::vector<dbcsr::shared_matrix<double>> m_J_stack;
   std::shared_ptr<J> m_builder;
 
   void init_base();
@@ -169,18 +229,31 @@ class J : public JK_common {
   }
   virtual void compute_J() = 0;
 
+  /* J of each density of the stack, taken as the alpha density of a
+   * closed-shell state as in compute_J. Builders which can contract all
+   * densities with one pass over their integrals override this, the
+   * default calls compute_J for one density after another.
+   */
+  virtual void compute_J_stack();
+
   virtual void init() = 0;
 
   dbcsr::shared_matrix<double> get_J()
   {
     return m_J;
   }
+
+  std::vector<dbcsr::shared_matrix<double>> get_J_stack()
+  {
+    return m_J_stack;
+  }
 };
 
 class K : public JK_common {
  protected:
   dbcsr::shared_matrix<double> m_K_A;
   dbcsr::shared_matrix<double> m_K_B;
+  std::vector<dbcsr::shared_matrix<double>> m_K_stack;
 
   void init_base();
 
@@ -197,8 +270,58 @@ class K : public JK_common {
   }
   virtual void compute_K() = 0;
 
+  /* K of each density of the stack, or of each pair of left/right
+   * coefficients if the builder works with those. See compute_J_stack.
+   */
+  virtual void compute_K_stack();
+
+  virtual void init() = 0;
+
+  dbcsr::shared_matrix<double> get_K_A()
+  {
+    return m_K_A;
+  }
+  dbcsr::shared_matrix<double> get_K_B()
+  {
+    return m_K_B;
+  }
+
+  std::vector<dbcsr::shared_matrix<double>> get_K_stack()
+  {
+    return m_K_stack;
+  }
+};
+
+/* Builds J and K together, so that integral batches needed by both are
+ * read or computed only once per build.
+ */
+class JK : public JK_common {
+ protected:
+  dbcsr::shared_matrix<double> m_J;
+  dbcsr::shared_matrix<double> m_K_A;
+  dbcsr::shared_matrix<double> m_K_B;
+
+  void init_base();
+
+ public:
+  JK(megalochem::world w,
+     desc::shared_molecule smol,
+     int print,
+     std::string name) :
+      JK_common(w, smol, print, name)
+  {
+  }
+  virtual ~JK()
+  {
+  }
+  virtual void compute_JK() = 0;
+
   virtual void init() = 0;
 
+  dbcsr::shared_matrix<double> get_J()
+  {
+    return m_J;
+  }
   dbcsr::shared_matrix<double> get_K_A()
   {
     return m_K_A;
@@ -274,6 +397,16 @@ class DF_J : public J {
   dbcsr::shared_pgrid<3> m_spgrid_bbd;
   dbcsr::shared_pgrid<2> m_spgrid_xd, m_spgrid2;
 
+  /* J_bbd = (MN|X) V^-1_XY (Y|LS) p_bbd, where the last mode of p_bbd and
+   * J_bbd runs over the densities. Skipped nu batches are not fetched.
+   */
+  void contract_J(
+      dbcsr::tensor<3, double>& p_bbd,
+      dbcsr::tensor<2, double>& gp_xd,
+      dbcsr::tensor<2, double>& gq_xd,
+      dbcsr::tensor<3, double>& J_bbd,
+      const batch_mask& skip);
+
  public:
 #define DF_J_LIST \
   (((dbcsr::sbtensor<3, double>), eri3c2e_batched), \
@@ -288,6 +421,7 @@ class DF_J : public J {
   {
   }
   void compute_J() override;
+  void compute_J_stack() override;
   void init() override;
 
   ~DF_J()
@@ -365,6 +499,7 @@ class DFAO_K : public K {
   }
 
   void compute_K() override;
+  void compute_K_stack() override;
   void init() override;
 
   ~DFAO_K()
@@ -487,6 +622,7 @@ class DFLMO_K : public K {
   }
 
   void compute_K() override;
+  void compute_K_stack() override;
   void init() override;
 
   ~DFLMO_K()
@@ -494,6 +630,232 @@ class DFLMO_K : public K {
   }
 };
 
+/* Integral-direct J and K from the 4c2e integrals, computed shell quartet
+ * by shell quartet and digested right away, so no integrals are stored.
+ * The densities are replicated block-sparse on all ranks. Quartets are
+ * skipped with Schwarz bounds times the largest density element they are
+ * contracted with, so the cost drops with the sparsity of the (difference)
+ * density.
+ */
+class direct_engine {
+ private:
+  std::shared_ptr<ints::aofactory> m_fac;
+  Eigen::MatrixXd m_q;
+  double m_threshold;
+
+ public:
+  void init(megalochem::world w, desc::shared_molecule mol);
+
+  /* J of p_j and K of each of p_k, skipped if p_j is null or p_k empty,
+   * from all significant shell quartets. The results replace the content
+   * of j_out and k_out, K with the sign of the builders (-K).
+   */
+  void compute(
+      dbcsr::shared_matrix<double> p_j,
+      std::vector<dbcsr::shared_matrix<double>> p_k,
+      dbcsr::shared_matrix<double> j_out,
+      std::vector<dbcsr::shared_matrix<double>> k_out,
+      util::mpi_log& LOG);
+
+  /* As above, from the quartets of the tasks over the shell pairs i >= j,
+   * see ints::calc_jk_direct.
+   */
+  void compute(
+      dbcsr::shared_matrix<double> p_j,
+      std::vector<dbcsr::shared_matrix<double>> p_k,
+      dbcsr::shared_matrix<double> j_out,
+      std::vector<dbcsr::shared_matrix<double>> k_out,
+      util::mpi_log& LOG,
+      const std::vector<std::array<int, 2>>& pairs,
+      const std::vector<ints::jk_task>& tasks);
+
+  std::shared_ptr<ints::aofactory> factory()
+  {
+    return m_fac;
+  }
+
+  // Schwarz bounds of the shell pairs
+  const Eigen::MatrixXd& schwarz() const
+  {
+    return m_q;
+  }
+
+  double threshold() const
+  {
+    return m_threshold;
+  }
+};
+
+class DIRECT_J : public J {
+ private:
+  direct_engine m_engine;
+
+ public:
+  MAKE_PARAM_STRUCT(create, BASE_LIST, ())
+  MAKE_BUILDER_CLASS(DIRECT_J, create, BASE_LIST, ())
+
+  DIRECT_J(create_pack&& p) : BASE_INIT(J, DIRECT_J)
+  {
+  }
+  void compute_J() override;
+  void init() override;
+};
+
+class DIRECT_K : public K {
+ private:
+  direct_engine m_engine;
+
+ public:
+  MAKE_PARAM_STRUCT(create, BASE_LIST, ())
+  MAKE_BUILDER_CLASS(DIRECT_K, create, BASE_LIST, ())
+
+  DIRECT_K(create_pack&& p) : BASE_INIT(K, DIRECT_K)
+  {
+  }
+  void compute_K() override;
+  void init() override;
+};
+
+class DIRECT_JK : public JK {
+ private:
+  direct_engine m_engine;
+
+ public:
+  MAKE_PARAM_STRUCT(create, BASE_LIST, ())
+  MAKE_BUILDER_CLASS(DIRECT_JK, create, BASE_LIST, ())
+
+  DIRECT_JK(create_pack&& p) : BASE_INIT(JK, DIRECT_JK)
+  {
+  }
+  void compute_JK() override;
+  void init() override;
+};
+
+/* Seminumerical exchange in the chain-of-spheres form: the integration
+ * over one electron is done on an atom-centred molecular grid, the one
+ * over the other analytically with potential integrals at the grid points,
+ * so no auxiliary basis is needed. The error of the grid is reduced by
+ * overlap fitting, K = S S_grid^-1 K_grid with the analytic and numerical
+ * overlap matrices.
+ */
+class COSX_K : public K {
+ private:
+  std::shared_ptr<ints::aofactory> m_fac;
+  std::shared_ptr<ints::molecular_grid> m_grid;
+  // S S_grid^-1
+  dbcsr::shared_matrix<double> m_fit;
+  double m_threshold;
+
+ public:
+  MAKE_PARAM_STRUCT(create, BASE_LIST, ())
+  MAKE_BUILDER_CLASS(COSX_K, create, BASE_LIST, ())
+
+  COSX_K(create_pack&& p) : BASE_INIT(K, COSX_K)
+  {
+  }
+  void compute_K() override;
+  void init() override;
+};
+
+/* Continuous fast multipole J. The significant shell pairs are sorted by
+ * their charge centres into the leaves of an octree over the cluster
+ * centres of the basis. Leaves whose charge spheres are well separated
+ * interact through cartesian multipole expansions, which are translated
+ * up and down the tree, the near field is computed integral-direct.
+ */
+class CFMM_J : public J {
+ private:
+  struct box {
+    std::array<double, 3> centre;
+    // radius of the sphere around the centre which holds the charge
+    double radius = 0.0;
+    int parent = -1;
+    std::vector<int> children;
+    // boxes of the same level which are not well separated (sorted) and
+    // the well separated ones whose parents are not
+    std::vector<int> near, far;
+  };
+
+  direct_engine m_engine;
+
+  // boxes of each level, the root is level 0 and the leaves are last
+  std::vector<std::vector<box>> m_tree;
+
+  // significant shell pairs i >= j grouped by leaf, sorted by decreasing
+  // Schwarz bound within a leaf, their leaves and the first pair of each
+  // leaf
+  std::vector<std::array<int, 2>> m_pairs;
+  std::vector<int> m_pair_leaf;
+  std::vector<int64_t> m_leaf_pairs;
+  std::vector<std::array<double, 3>> m_leaf_centres;
+
+  // quartets of the near field, as tasks over m_pairs
+  std::vector<ints::jk_task> m_near_tasks;
+
+  // order of the multipole expansions, from the filter threshold
+  int m_order = 4;
+
+  void build_tree();
+
+ public:
+  MAKE_PARAM_STRUCT(create, BASE_LIST, ())
+  MAKE_BUILDER_CLASS(CFMM_J, create, BASE_LIST, ())
+
+  CFMM_J(create_pack&& p) : BASE_INIT(J, CFMM_J)
+  {
+  }
+  void compute_J() override;
+  void init() override;
+};
+
+/* J with dfao and K with dfao in one pass over the 3c2e integrals and the
+ * fitting coefficients. For each batch of the auxiliary basis, the
+ * integrals give the fitted density gp_X = (X|mn) P_mn, which is complete
+ * for that batch, and the fitting coefficients c_Xmn = (X|Y)^-1 (Y|mn)
+ * then give both J_mn += c_Xmn gp_X and the exchange terms.
+ * Only for metrics where the fitting coefficients are the inverse metric
+ * times the integrals, i.e. coulomb and erfc_coulomb.
+ */
+class DFAO_JK : public JK {
+ private:
+  dbcsr::sbtensor<3, double> m_eri3c2e_batched;
+  dbcsr::sbtensor<3, double> m_fitting_batched;
+
+  dbcsr::shared_tensor<3, double> m_J_bbd;
+  dbcsr::shared_tensor<3, double> m_ptot_bbd;
+  dbcsr::shared_tensor<2, double> m_gp_xd;
+
+  dbcsr::shared_tensor<3, double> m_cbar_xbb_01_2;
+  dbcsr::shared_tensor<3, double> m_cbar_xbb_1_02;
+
+  dbcsr::shared_tensor<2, double> m_K_01_A, m_K_01_B;
+  dbcsr::shared_tensor<2, double> m_p_bb_A, m_p_bb_B;
+
+  dbcsr::shared_pgrid<2> m_spgrid2, m_spgrid_xd;
+  dbcsr::shared_pgrid<3> m_spgrid_bbd;
+
+ public:
+#define DFAO_JK_LIST \
+  (((dbcsr::sbtensor<3, double>), eri3c2e_batched), \
+   ((dbcsr::sbtensor<3, double>), fitting_batched))
+
+  MAKE_PARAM_STRUCT(create, CONCAT(BASE_LIST, DFAO_JK_LIST), ())
+  MAKE_BUILDER_CLASS(DFAO_JK, create, CONCAT(BASE_LIST, DFAO_JK_LIST), ())
+
+  DFAO_JK(create_pack&& p) :
+      BASE_INIT(JK, DFAO_JK), m_eri3c2e_batched(p.p_eri3c2e_batched),
+      m_fitting_batched(p.p_fitting_batched)
+  {
+  }
+
+  void compute_JK() override;
+  void init() override;
+
+  ~DFAO_JK()
+  {
+  }
+};
+
 inline void load_jints(jmethod jmet, ints::metric metr, ints::aoloader& ao)
 {
   // set J
@@ -650,6 +1012,20 @@ class create_j_base {
                      .eri4c2e_batched(eris)
                      .build();
     }
+    else if (*c_method == jmethod::direct) {
+      jbuilder = DIRECT_J::create()
+                     .set_world(*c_set_world)
+                     .molecule(*c_molecule)
+                     .print(nprint)
+                     .build();
+    }
+    else if (*c_method == jmethod::cfmm) {
+      jbuilder = CFMM_J::create()
+                     .set_world(*c_set_world)
+                     .molecule(*c_molecule)
+                     .print(nprint)
+                     .build();
+    }
     else if (*c_method == jmethod::dfao) {
       dbcsr::sbtensor<3, double> eris;
       dbcsr::shared_matrix<double> v_inv;
@@ -728,6 +1104,20 @@ class create_k_base {
                      .eri4c2e_batched(eris)
                      .build();
     }
+    else if (*c_method == kmethod::direct) {
+      kbuilder = DIRECT_K::create()
+                     .set_world(*c_set_world)
+                     .molecule(*c_molecule)
+                     .print(nprint)
+                     .build();
+    }
+    else if (*c_method == kmethod::cosx) {
+      kbuilder = COSX_K::create()
+                     .set_world(*c_set_world)
+                     .molecule(*c_molecule)
+                     .print(nprint)
+                     .build();
+    }
     else if (*c_method == kmethod::dfao) {
       dbcsr::sbtensor<3, double> eris;
       dbcsr::sbtensor<3, double> cfit;
@@ -840,6 +1230,84 @@ inline create_k_base create_k()
   return create_k_base();
 }
 
+// true if J and K of the given methods can be built by a fused builder
+inline bool has_fused_jk(jmethod jmet, kmethod kmet, ints::metric metr)
+{
+  bool fit = (metr == ints::metric::coulomb ||
+              metr == ints::metric::erfc_coulomb);
+  return (jmet == jmethod::dfao && kmet == kmethod::dfao && fit) ||
+      (jmet == jmethod::direct && kmet == kmethod::direct);
+}
+
+#define CREATE_JK_LIST \
+  (((megalochem::world), set_world), ((desc::shared_molecule), molecule), \
+   ((jmethod), method_j), ((kmethod), method_k), \
+   ((ints::aoloader), aoloader), ((util::optional<int>), print), \
+   ((ints::metric), metric))
+
+class create_jk_base {
+ private:
+  typedef create_jk_base _create_base;
+  MAKE_BUILDER_MEMBERS(create, CREATE_JK_LIST)
+
+ public:
+  MAKE_BUILDER_SETS(create, CREATE_JK_LIST)
+
+  create_jk_base()
+  {
+  }
+
+  std::shared_ptr<JK> build()
+  {
+    CHECK_REQUIRED(CREATE_JK_LIST)
+
+    if (!has_fused_jk(*c_method_j, *c_method_k, *c_metric)) {
+      throw std::runtime_error("No fused JK builder for these methods");
+    }
+
+    std::shared_ptr<JK> jkbuilder;
+    auto aoreg = c_aoloader->get_registry();
+
+    int nprint = (c_print) ? *c_print : 0;
+
+    if (*c_method_j == jmethod::direct) {
+      jkbuilder = DIRECT_JK::create()
+                      .set_world(*c_set_world)
+                      .molecule(*c_molecule)
+                      .print(nprint)
+                      .build();
+      return jkbuilder;
+    }
+
+    dbcsr::sbtensor<3, double> eris;
+    dbcsr::sbtensor<3, double> cfit;
+
+    if (*c_metric == ints::metric::coulomb) {
+      eris = aoreg.get<decltype(eris)>(ints::key::coul_xbb);
+      cfit = aoreg.get<decltype(eris)>(ints::key::dfit_coul_xbb);
+    }
+    else {
+      eris = aoreg.get<decltype(eris)>(ints::key::erfc_xbb);
+      cfit = aoreg.get<decltype(eris)>(ints::key::dfit_erfc_xbb);
+    }
+
+    jkbuilder = DFAO_JK::create()
+                    .set_world(*c_set_world)
+                    .molecule(*c_molecule)
+                    .print(nprint)
+                    .eri3c2e_batched(eris)
+                    .fitting_batched(cfit)
+                    .build();
+
+    return jkbuilder;
+  }
+};
+
+inline create_jk_base create_jk()
+{
+  return create_jk_base();
+}
+
 }  // namespace fock
 
 }  // namespace megalochem
@@ -0,0 +1,399 @@
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <numeric>
+#include <set>
+#include "fock/cfmm.hpp"
+#include "fock/jkbuilder.hpp"
+#include "ints/integrals.hpp"
+
+namespace megalochem {
+
+namespace fock {
+
+static_assert(
+    cfmm::MAX_ORDER <= ints::MAX_MULTIPOLE_ORDER,
+    "CFMM needs multipole integrals up to its order");
+
+// the octree is refined until its leaves hold at most CFMM_LEAF_CLUSTERS
+// cluster centres on average
+static const double CFMM_LEAF_CLUSTERS = 2.0;
+static const int CFMM_MAX_DEPTH = 8;
+
+// shell pair charge distributions are cut off where their gaussian tails
+// fall below CFMM_EXTENT_EPS
+static const double CFMM_EXTENT_EPS = 1e-10;
+
+using cfmm::exponents;
+using cfmm::point;
+
+static point diff(const point& a, const point& b)
+{
+  return {a[0] - b[0], a[1] - b[1], a[2] - b[2]};
+}
+
+static double dist(const point& a, const point& b)
+{
+  auto d = diff(a, b);
+  return std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+}
+
+static double erfc_inv(double y)
+{
+  double lo = 0.0, hi = 10.0;
+  for (int i = 0; i != 100; ++i) {
+    double mid = 0.5 * (lo + hi);
+    if (std::erfc(mid) > y) {
+      lo = mid;
+    }
+    else {
+      hi = mid;
+    }
+  }
+  return 0.5 * (lo + hi);
+}
+
+void CFMM_J::build_tree()
+{
+  auto cbas = m_mol->c_basis();
+
+  // shells in the order of the basis, with their centres and the exponent
+  // of their most diffuse primitive
+  std::vector<point> sh_centres, cl_centres;
+  std::vector<double> sh_alpha;
+
+  for (auto& cltr : *cbas) {
+    cl_centres.push_back(cltr.O);
+    for (auto& shell : cltr.shells) {
+      sh_centres.push_back(shell.O);
+      sh_alpha.push_back(
+          *std::min_element(shell.alpha.begin(), shell.alpha.end()));
+    }
+  }
+
+  const int nsh = sh_centres.size();
+
+  // bounding cube of all cluster and shell centres
+  point lo = sh_centres[0], hi = sh_centres[0];
+  for (auto pts : {&sh_centres, &cl_centres}) {
+    for (auto& x : *pts) {
+      for (int c = 0; c != 3; ++c) {
+        lo[c] = std::min(lo[c], x[c]);
+        hi[c] = std::max(hi[c], x[c]);
+      }
+    }
+  }
+
+  double side = 1e-3;
+  for (int c = 0; c != 3; ++c) { side = std::max(side, hi[c] - lo[c]); }
+  side *= 1.001;
+
+  point corner;
+  for (int c = 0; c != 3; ++c) { corner[c] = 0.5 * (lo[c] + hi[c] - side); }
+
+  auto box_key = [&](const point& x, int level) {
+    const int n = 1 << level;
+    exponents k;
+    for (int c = 0; c != 3; ++c) {
+      int ik = (int)std::floor((x[c] - corner[c]) / side * n);
+      k[c] = std::clamp(ik, 0, n - 1);
+    }
+    return k;
+  };
+
+  auto box_centre = [&](const exponents& k, int level) {
+    const double w = side / (1 << level);
+    point out;
+    for (int c = 0; c != 3; ++c) { out[c] = corner[c] + (k[c] + 0.5) * w; }
+    return out;
+  };
+
+  int depth = 0;
+  while (depth < CFMM_MAX_DEPTH) {
+    std::set<exponents> occupied;
+    for (auto& x : cl_centres) { occupied.insert(box_key(x, depth)); }
+    if ((double)cl_centres.size() / occupied.size() <= CFMM_LEAF_CLUSTERS)
+      break;
+    ++depth;
+  }
+
+  // significant shell pairs, with the centre and extent of their most
+  // diffuse gaussian product
+  auto& q = m_engine.schwarz();
+  const double q_max = q.maxCoeff();
+  const double ext_fac = erfc_inv(CFMM_EXTENT_EPS) * std::sqrt(2.0);
+
+  m_pairs.clear();
+
+  std::vector<point> pair_centres;
+  std::vector<double> pair_extents;
+
+  for (int i = 0; i != nsh; ++i) {
+    for (int j = 0; j <= i; ++j) {
+      if (q(i, j) * q_max < m_engine.threshold())
+        continue;
+
+      const double a = sh_alpha[i], b = sh_alpha[j];
+      point pc;
+      for (int c = 0; c != 3; ++c) {
+        pc[c] = (a * sh_centres[i][c] + b * sh_centres[j][c]) / (a + b);
+      }
+
+      m_pairs.push_back({i, j});
+      pair_centres.push_back(pc);
+      pair_extents.push_back(ext_fac / std::sqrt(a + b));
+    }
+  }
+
+  // leaves, holding the pairs by their centres
+  m_tree.assign(depth + 1, {});
+  std::vector<std::map<exponents, int>> boxes(depth + 1);
+
+  auto get_box = [&](const exponents& k, int level) {
+    auto it = boxes[level].find(k);
+    if (it == boxes[level].end()) {
+      it = boxes[level].emplace(k, m_tree[level].size()).first;
+      box b;
+      b.centre = box_centre(k, level);
+      m_tree[level].push_back(b);
+    }
+    return it->second;
+  };
+
+  m_pair_leaf.resize(m_pairs.size());
+
+  for (size_t ip = 0; ip != m_pairs.size(); ++ip) {
+    const int ib = get_box(box_key(pair_centres[ip], depth), depth);
+    auto& b = m_tree[depth][ib];
+
+    m_pair_leaf[ip] = ib;
+
+    b.radius = std::max(
+        b.radius, dist(pair_centres[ip], b.centre) + pair_extents[ip]);
+  }
+
+  // group the pairs by leaf, by decreasing bound within a leaf, so that
+  // the near field can run over ranges of them
+  std::vector<int64_t> order(m_pairs.size());
+  std::iota(order.begin(), order.end(), 0);
+
+  std::stable_sort(order.begin(), order.end(), [&](int64_t a, int64_t b) {
+    if (m_pair_leaf[a] != m_pair_leaf[b])
+      return m_pair_leaf[a] < m_pair_leaf[b];
+    return q(m_pairs[a][0], m_pairs[a][1]) > q(m_pairs[b][0], m_pairs[b][1]);
+  });
+
+  std::vector<std::array<int, 2>> sorted_pairs;
+  std::vector<int> sorted_leaf;
+
+  for (auto ip : order) {
+    sorted_pairs.push_back(m_pairs[ip]);
+    sorted_leaf.push_back(m_pair_leaf[ip]);
+  }
+
+  m_pairs = std::move(sorted_pairs);
+  m_pair_leaf = std::move(sorted_leaf);
+
+  m_leaf_pairs.assign(m_tree[depth].size() + 1, 0);
+  for (int ib : m_pair_leaf) { ++m_leaf_pairs[ib + 1]; }
+  for (size_t ib = 0; ib != m_tree[depth].size(); ++ib) {
+    m_leaf_pairs[ib + 1] += m_leaf_pairs[ib];
+  }
+
+  // parents up to the root, their spheres enclose those of the children
+  for (int level = depth; level > 0; --level) {
+    for (auto& [k, ib] : boxes[level]) {
+      exponents kp = {k[0] >> 1, k[1] >> 1, k[2] >> 1};
+      const int ip = get_box(kp, level - 1);
+      m_tree[level][ib].parent = ip;
+      m_tree[level - 1][ip].children.push_back(ib);
+    }
+
+    for (auto& parent : m_tree[level - 1]) {
+      for (int ic : parent.children) {
+        auto& child = m_tree[level][ic];
+        parent.radius = std::max(
+            parent.radius, dist(child.centre, parent.centre) + child.radius);
+      }
+    }
+  }
+
+  // interaction lists: the children of the near boxes of the parent are
+  // either well separated, or near themselves. Whether boxes are well
+  // separated carries over to their children, so every pair of leaves is
+  // either near or has exactly one pair of ancestors which interacts
+  auto well_separated = [](const box& a, const box& b) {
+    return dist(a.centre, b.centre) * cfmm::THETA >= a.radius + b.radius;
+  };
+
+  if (!m_tree[0].empty())
+    m_tree[0][0].near = {0};
+
+  int64_t nfar = 0;
+
+  for (int level = 1; level <= depth; ++level) {
+    for (auto& a : m_tree[level]) {
+      for (int pn : m_tree[level - 1][a.parent].near) {
+        for (int ib : m_tree[level - 1][pn].children) {
+          if (well_separated(a, m_tree[level][ib])) {
+            a.far.push_back(ib);
+          }
+          else {
+            a.near.push_back(ib);
+          }
+        }
+      }
+      std::sort(a.near.begin(), a.near.end());
+      nfar += a.far.size();
+    }
+  }
+
+  m_leaf_centres.clear();
+  int64_t nnear = 0;
+  for (auto& leaf : m_tree[depth]) {
+    m_leaf_centres.push_back(leaf.centre);
+    nnear += leaf.near.size();
+  }
+
+  // near field: the pairs of each leaf with those of the near leaves, each
+  // pair of leaves once and the pairs of a leaf with themselves as i >= j
+  auto& leaves = m_tree[depth];
+  m_near_tasks.clear();
+
+  for (int a = 0; a != (int)leaves.size(); ++a) {
+    for (int64_t ij = m_leaf_pairs[a]; ij != m_leaf_pairs[a + 1]; ++ij) {
+      for (int b : leaves[a].near) {
+        if (b == a) {
+          m_near_tasks.push_back({ij, ij, m_leaf_pairs[a + 1]});
+        }
+        else if (b > a) {
+          m_near_tasks.push_back({ij, m_leaf_pairs[b], m_leaf_pairs[b + 1]});
+        }
+      }
+    }
+  }
+
+  LOG.os<1>(
+      "CFMM tree: ", depth, " levels, ", m_tree[depth].size(), " leaves, ",
+      m_pairs.size(), " shell pairs\n");
+  LOG.os<1>(
+      "CFMM interactions: ", nnear, " near leaf pairs, ", nfar,
+      " far box pairs\n");
+}
+
+void CFMM_J::init()
+{
+  if (!m_sym) {
+    throw std::runtime_error("CFMM J builder needs symmetric densities");
+  }
+
+  init_base();
+  m_engine.init(m_world, m_mol);
+  m_order = cfmm::expansion_order(dbcsr::global::filter_eps);
+  LOG.os<1>("CFMM expansion order: ", m_order, '\n');
+  build_tree();
+}
+
+void CFMM_J::compute_J()
+{
+  TIME.start();
+
+  auto ptot = dbcsr::matrix<>::copy(*m_p_A).name("ptot").build();
+
+  if (m_p_B) {
+    ptot->add(1.0, 1.0, *m_p_B);
+  }
+  else {
+    ptot->scale(2.0);
+  }
+
+  auto& time_near = TIME.sub("Near field");
+  auto& time_far = TIME.sub("Far field");
+
+  time_near.start();
+  m_engine.compute(ptot, {}, m_J, {}, LOG, m_pairs, m_near_tasks);
+  time_near.finish();
+
+  // far field: multipoles of the leaves, moved up the tree, converted into
+  // local expansions between well separated boxes and moved down again
+  time_far.start();
+
+  auto fac = m_engine.factory();
+
+  const auto exps = ints::multipole_exponents(m_order);
+  const int nmom = exps.size();
+  const int depth = m_tree.size() - 1;
+
+  std::vector<Eigen::MatrixXd> mpoles(depth + 1), locals(depth + 1);
+
+  for (int level = 0; level <= depth; ++level) {
+    mpoles[level] = Eigen::MatrixXd::Zero(nmom, m_tree[level].size());
+    locals[level] = Eigen::MatrixXd::Zero(nmom, m_tree[level].size());
+  }
+
+  mpoles[depth] = fac->ao_pair_multipoles(
+      *ptot, m_pairs, m_pair_leaf, m_leaf_centres, m_order);
+
+  for (int level = depth; level > 0; --level) {
+    for (size_t ib = 0; ib != m_tree[level].size(); ++ib) {
+      auto& child = m_tree[level][ib];
+      auto& parent = m_tree[level - 1][child.parent];
+      cfmm::m2m(
+          mpoles[level].col(ib).data(), diff(child.centre, parent.centre),
+          exps, mpoles[level - 1].col(child.parent).data());
+    }
+  }
+
+  for (int level = 1; level <= depth; ++level) {
+    auto& tree = m_tree[level];
+    const int nboxes = tree.size();
+
+#pragma omp parallel
+    {
+      std::vector<double> d;
+
+#pragma omp for schedule(dynamic)
+      for (int ia = 0; ia < nboxes; ++ia) {
+        for (int ib : tree[ia].far) {
+          cfmm::m2l(
+              mpoles[level].col(ib).data(),
+              diff(tree[ia].centre, tree[ib].centre), exps, d,
+              locals[level].col(ia).data());
+        }
+      }
+    }
+
+    // pass the local expansions down to the next level
+    if (level == depth)
+      continue;
+
+    for (size_t ib = 0; ib != m_tree[level + 1].size(); ++ib) {
+      auto& child = m_tree[level + 1][ib];
+      auto& parent = tree[child.parent];
+      cfmm::l2l(
+          locals[level].col(child.parent).data(),
+          diff(child.centre, parent.centre), exps,
+          locals[level + 1].col(ib).data());
+    }
+  }
+
+  auto j_far = dbcsr::matrix<>::create_template(*m_J).name("J_far").build();
+
+  fac->ao_pair_potential(
+      locals[depth], *j_far, m_pairs, m_pair_leaf, m_leaf_centres, m_order);
+
+  m_J->add(1.0, 1.0, *j_far);
+  m_J->filter(dbcsr::global::filter_eps);
+
+  time_far.finish();
+
+  TIME.finish();
+
+  if (LOG.global_plev() >= 2) {
+    dbcsr::print(*m_J);
+  }
+}
+
+}  // namespace fock
+
+}  // namespace megalochem
@@ -15,6 +15,42 @@ JK_common::JK_common(
 {
 }
 
+Eigen::MatrixXd JK_common::density_batch_norms(
+    dbcsr::matrix<double>& p, const vec<vec<int>>& blk_bounds)
+{
+  const int nbatches = blk_bounds.size();
+
+  vec<int> blk_to_batch(blk_bounds.back()[1] + 1);
+  for (int i = 0; i != nbatches; ++i) {
+    for (int iblk = blk_bounds[i][0]; iblk <= blk_bounds[i][1]; ++iblk) {
+      blk_to_batch[iblk] = i;
+    }
+  }
+
+  Eigen::MatrixXd norms = Eigen::MatrixXd::Zero(nbatches, nbatches);
+
+  dbcsr::iterator<double> iter(p);
+  iter.start();
+
+  while (iter.blocks_left()) {
+    iter.next_block();
+    int r = blk_to_batch[iter.row()];
+    int c = blk_to_batch[iter.col()];
+    double n = iter.norm();
+    // symmetric matrices only hold one triangle
+    norms(r, c) = std::max(norms(r, c), n);
+    norms(c, r) = std::max(norms(c, r), n);
+  }
+
+  iter.stop();
+
+  MPI_Allreduce(
+      MPI_IN_PLACE, norms.data(), norms.size(), MPI_DOUBLE, MPI_MAX,
+      m_cart.comm());
+
+  return norms;
+}
+
 void J::init_base()
 {
   // set up J
@@ -30,6 +66,26 @@ void J::init_base()
             .build();
 }
 
+void J::compute_J_stack()
+{
+  auto p_A = m_p_A;
+  auto p_B = m_p_B;
+  m_p_B = nullptr;
+
+  m_J_stack.clear();
+
+  for (size_t i = 0; i != m_p_stack.size(); ++i) {
+    m_p_A = m_p_stack[i];
+    compute_J();
+    m_J_stack.push_back(dbcsr::matrix<>::copy(*m_J)
+                            .name("J_bb_" + std::to_string(i))
+                            .build());
+  }
+
+  m_p_A = p_A;
+  m_p_B = p_B;
+}
+
 void K::init_base()
 {
   // set up K's
@@ -56,6 +112,62 @@ void K::init_base()
   }
 }
 
+void K::compute_K_stack()
+{
+  const bool coeffs = !m_u_stack.empty();
+  const size_t ndens = (coeffs) ? m_u_stack.size() : m_p_stack.size();
+
+  if (coeffs && m_v_stack.size() != ndens) {
+    throw std::runtime_error("K stack: left and right coefficients differ");
+  }
+
+  // only the alpha part is used, K_B is left alone
+  auto p_A = m_p_A;
+  auto u_A = m_u_A;
+  auto v_A = m_v_A;
+  auto K_B = m_K_B;
+  m_K_B = nullptr;
+
+  m_K_stack.clear();
+
+  for (size_t i = 0; i != ndens; ++i) {
+    if (coeffs) {
+      m_u_A = m_u_stack[i];
+      m_v_A = m_v_stack[i];
+    }
+    else {
+      m_p_A = m_p_stack[i];
+    }
+    compute_K();
+    m_K_stack.push_back(dbcsr::matrix<>::copy(*m_K_A)
+                            .name("K_bb_" + std::to_string(i))
+                            .build());
+  }
+
+  m_p_A = p_A;
+  m_u_A = u_A;
+  m_v_A = v_A;
+  m_K_B = K_B;
+}
+
+void JK::init_base()
+{
+  // K for beta is created once a beta density is set
+  auto b = m_mol->dims().b();
+
+  auto type = (m_sym) ? dbcsr::type::symmetric : dbcsr::type::no_symmetry;
+
+  m_J = dbcsr::matrix<>::create()
+            .name("J_bb")
+            .set_cart(m_cart)
+            .row_blk_sizes(b)
+            .col_blk_sizes(b)
+            .matrix_type(type)
+            .build();
+
+  m_K_A = dbcsr::matrix<>::create_template(*m_J).name("K_bb_A").build();
+}
+
 }  // namespace fock
 
 }  // namespace megalochem
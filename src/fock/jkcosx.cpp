@@ -0,0 +1,117 @@
+#include <dbcsr_matrix_ops.hpp>
+#include "fock/jkbuilder.hpp"
+#include "math/linalg/LLT.hpp"
+
+namespace megalochem {
+
+namespace fock {
+
+// potential integrals are skipped if their contribution to K is below
+// COSX_THRESHOLD * filter_eps
+static const double COSX_THRESHOLD = 1e-3;
+
+// radial points per atom of the molecular grid, and the threshold below
+// which grid weights and basis function values are dropped
+static const int COSX_NRADIAL = 30;
+static const double COSX_GRID_EPS = 1e-10;
+
+void COSX_K::init()
+{
+  // F and G are built from the rows of the density only
+  if (!m_sym) {
+    throw std::runtime_error("COSX K builder needs symmetric densities");
+  }
+
+  init_base();
+
+  m_fac = std::make_shared<ints::aofactory>(m_mol, m_world);
+
+  m_threshold = COSX_THRESHOLD * dbcsr::global::filter_eps;
+
+  m_grid = std::make_shared<ints::molecular_grid>(
+      m_mol, COSX_NRADIAL, COSX_GRID_EPS);
+  m_grid->compute();
+
+  LOG.os<1>(
+      "COSX grid: ", m_grid->npoints(), " points in ",
+      m_grid->batches().size(), " batches\n");
+
+  // overlap fitting: S S_grid^-1
+  auto b = m_mol->dims().b();
+
+  auto s = m_fac->ao_overlap();
+  auto s_grid = dbcsr::matrix<>::create_template(*s).name("s_grid").build();
+  m_fac->ao_grid_overlap(m_grid->batches(), *s_grid);
+
+  math::LLT llt(m_world, s_grid, LOG.global_plev());
+  llt.compute();
+  auto s_grid_inv = llt.inverse(b);
+  s_grid->release();
+
+  m_fit = dbcsr::matrix<>::create_template(*s)
+              .name("COSX fit")
+              .matrix_type(dbcsr::type::no_symmetry)
+              .build();
+
+  dbcsr::multiply('N', 'N', 1.0, *s, *s_grid_inv, 0.0, *m_fit).perform();
+  m_fit->filter(dbcsr::global::filter_eps);
+}
+
+void COSX_K::compute_K()
+{
+  TIME.start();
+
+  if (m_p_B && !m_K_B) {
+    m_K_B = dbcsr::matrix<>::create_template(*m_K_A).name("K_bb_B").build();
+  }
+
+  std::vector<dbcsr::shared_matrix<double>> p_k = {m_p_A};
+  std::vector<dbcsr::shared_matrix<double>> k_out = {m_K_A};
+
+  if (m_p_B) {
+    p_k.push_back(m_p_B);
+    k_out.push_back(m_K_B);
+  }
+
+  // K of the grid, without fitting and not symmetric
+  std::vector<dbcsr::shared_matrix<double>> k_grid;
+  std::vector<dbcsr::matrix<double>*> p_ptrs, k_ptrs;
+
+  for (size_t i = 0; i != p_k.size(); ++i) {
+    k_grid.push_back(
+        dbcsr::matrix<>::create_template(*m_fit).name("K_grid").build());
+    p_ptrs.push_back(p_k[i].get());
+    k_ptrs.push_back(k_grid[i].get());
+  }
+
+  auto npairs = m_fac->ao_k_seminumerical(
+      p_ptrs, k_ptrs, m_grid->batches(), m_grid->shell_extents(),
+      m_threshold);
+
+  LOG.os<1>(
+      "Computed potential integrals of ", npairs[0], " of ",
+      npairs[0] + npairs[1], " shell pair batches\n");
+
+  // K = -1/2 (Q K_grid + K_grid^T Q^T) with the fitting Q, only the
+  // stored triangle of the symmetric result is computed
+  for (size_t i = 0; i != k_out.size(); ++i) {
+    dbcsr::multiply('N', 'N', -0.5, *m_fit, *k_grid[i], 0.0, *k_out[i])
+        .perform();
+    dbcsr::multiply('T', 'T', -0.5, *k_grid[i], *m_fit, 1.0, *k_out[i])
+        .perform();
+    k_out[i]->filter(dbcsr::global::filter_eps);
+    k_grid[i]->release();
+  }
+
+  TIME.finish();
+
+  if (LOG.global_plev() >= 2) {
+    dbcsr::print(*m_K_A);
+    if (m_p_B)
+      dbcsr::print(*m_K_B);
+  }
+}
+
+}  // namespace fock
+
+}  // namespace megalochem
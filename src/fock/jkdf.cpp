@@ -66,7 +66,12 @@ void DF_J::init()
                    .build();
 }
 
-void DF_J::compute_J()
+void DF_J::contract_J(
+    dbcsr::tensor<3, double>& p_bbd,
+    dbcsr::tensor<2, double>& gp_xd,
+    dbcsr::tensor<2, double>& gq_xd,
+    dbcsr::tensor<3, double>& J_bbd,
+    const batch_mask& skip)
 {
   auto& con1 = TIME.sub("first contraction");
   auto& con2 = TIME.sub("second contraction");
@@ -74,41 +79,16 @@ void DF_J::compute_J()
   auto& fetch2 = TIME.sub("fetch ints (2)");
   auto& reoint = TIME.sub("Reordering ints");
 
-  TIME.start();
-
-  // copy over density
-
-  auto ptot = dbcsr::matrix<>::create_template(*m_p_A).name("ptot").build();
-
-  if (m_p_A && !m_p_B) {
-    ptot->copy_in(*m_p_A);
-    ptot->scale(2.0);
-    bool sym = ptot->has_symmetry();
-    // if (!sym) std::cout << "HAS NO SYMMETRY" << std::endl;
-    dbcsr::copy_matrix_to_3Dtensor_new(*ptot, *m_ptot_bbd, sym);
-    // dbcsr::print(ptot);
-    ptot->clear();
-  }
-  else {
-    ptot->copy_in(*m_p_A);
-    ptot->add(1.0, 1.0, *m_p_B);
-    bool sym = ptot->has_symmetry();
-    dbcsr::copy_matrix_to_3Dtensor_new<double>(*ptot, *m_ptot_bbd, sym);
-    ptot->clear();
-  }
-
-  m_ptot_bbd->filter(dbcsr::global::filter_eps);
-
-  // m_gp_xd->batched_contract_init();
-  // m_ptot_bbd->batched_contract_init();
+  int nbatches = m_eri3c2e_batched->nbatches(2);
 
   reoint.start();
   m_eri3c2e_batched->decompress_init({2}, vec<int>{0}, vec<int>{1, 2});
   reoint.finish();
 
-  int nbatches = m_eri3c2e_batched->nbatches(2);
-
   for (int inu = 0; inu != nbatches; ++inu) {
+    if (skip[inu])
+      continue;
+
     fetch1.start();
     m_eri3c2e_batched->decompress({inu});
     auto eri_0_12 = m_eri3c2e_batched->get_work_tensor();
@@ -119,7 +99,7 @@ void DF_J::compute_J()
     vec<vec<int>> bounds1 = {
         m_eri3c2e_batched->full_bounds(1), m_eri3c2e_batched->bounds(2, inu)};
 
-    dbcsr::contract(1.0, *eri_0_12, *m_ptot_bbd, 1.0, *m_gp_xd)
+    dbcsr::contract(1.0, *eri_0_12, p_bbd, 1.0, gp_xd)
         .bounds1(bounds1)
         .filter(dbcsr::global::filter_eps)
         .perform("XMN, MN_ -> X_");
@@ -129,24 +109,15 @@ void DF_J::compute_J()
 
   m_eri3c2e_batched->decompress_finalize();
 
-  // m_gp_xd->batched_contract_finalize();
-  // m_ptot_bbd->batched_contract_finalize();
-
   LOG.os<1>("X_, XY -> Y_\n");
 
   dbcsr::copy_matrix_to_tensor(*m_v_inv, *m_v_inv_01);
 
-  dbcsr::contract(1.0, *m_gp_xd, *m_v_inv_01, 0.0, *m_gq_xd)
+  dbcsr::contract(1.0, gp_xd, *m_v_inv_01, 0.0, gq_xd)
       .filter(dbcsr::global::filter_eps)
       .perform("X_, XY -> Y_");
 
   m_v_inv_01->clear();
-  // dbcsr::print(*m_gq_xd);
-
-  // dbcsr::print(*m_inv);
-
-  // m_J_bbd->batched_contract_init();
-  // m_gq_xd->batched_contract_init();
 
   m_eri3c2e_batched->decompress_init({2}, vec<int>{0}, vec<int>{1, 2});
 
@@ -161,7 +132,7 @@ void DF_J::compute_J()
     vec<vec<int>> bounds3 = {
         m_eri3c2e_batched->full_bounds(1), m_eri3c2e_batched->bounds(2, inu)};
 
-    dbcsr::contract(1.0, *m_gq_xd, *eri_0_12, 1.0, *m_J_bbd)
+    dbcsr::contract(1.0, gq_xd, *eri_0_12, 1.0, J_bbd)
         .bounds3(bounds3)
         .filter(dbcsr::global::filter_eps / nbatches)
         .perform("X_, XMN -> MN_");
@@ -170,9 +141,39 @@ void DF_J::compute_J()
   }
 
   m_eri3c2e_batched->decompress_finalize();
+}
+
+void DF_J::compute_J()
+{
+  TIME.start();
 
-  // m_J_bbd->batched_contract_finalize();
-  // m_gq_xd->batched_contract_finalize();
+  // copy over density
+
+  auto ptot = dbcsr::matrix<>::create_template(*m_p_A).name("ptot").build();
+
+  if (m_p_A && !m_p_B) {
+    ptot->copy_in(*m_p_A);
+    ptot->scale(2.0);
+    bool sym = ptot->has_symmetry();
+    dbcsr::copy_matrix_to_3Dtensor_new(*ptot, *m_ptot_bbd, sym);
+  }
+  else {
+    ptot->copy_in(*m_p_A);
+    ptot->add(1.0, 1.0, *m_p_B);
+    bool sym = ptot->has_symmetry();
+    dbcsr::copy_matrix_to_3Dtensor_new<double>(*ptot, *m_ptot_bbd, sym);
+  }
+
+  m_ptot_bbd->filter(dbcsr::global::filter_eps);
+
+  // nu batches without significant density blocks do not contribute
+  batch_mask skip =
+      density_skip_mask(*ptot, *m_eri3c2e_batched, 2).rowwise().all();
+  ptot->clear();
+
+  LOG.os<1>("Skipping ", skip.count(), " of ", skip.size(), " batches (J)\n");
+
+  contract_J(*m_ptot_bbd, *m_gp_xd, *m_gq_xd, *m_J_bbd, skip);
 
   LOG.os<1>("Copy over...\n");
 
@@ -189,6 +190,95 @@ void DF_J::compute_J()
   TIME.finish();
 }
 
+void DF_J::compute_J_stack()
+{
+  TIME.start();
+
+  const int ndens = m_p_stack.size();
+  m_J_stack.clear();
+
+  LOG.os<1>("Computing J for ", ndens, " densities\n");
+
+  // the densities are stacked along the last mode, one block each
+  auto b = m_mol->dims().b();
+  auto x = m_mol->dims().x();
+  vec<int> d(ndens, 1);
+
+  int nbf = std::accumulate(b.begin(), b.end(), 0);
+  int xnbf = std::accumulate(x.begin(), x.end(), 0);
+
+  arrvec<int, 3> bbd = {b, b, d};
+  arrvec<int, 2> xd = {x, d};
+
+  std::array<int, 2> tsizes2 = {xnbf, ndens};
+  std::array<int, 3> tsizes3 = {nbf, nbf, ndens};
+
+  auto spgrid_xd =
+      dbcsr::pgrid<2>::create(m_cart.comm()).tensor_dims(tsizes2).build();
+
+  auto spgrid_bbd =
+      dbcsr::pgrid<3>::create(m_cart.comm()).tensor_dims(tsizes3).build();
+
+  auto gp_xd = dbcsr::tensor<2>::create()
+                   .name("gp_xd_stack")
+                   .set_pgrid(*spgrid_xd)
+                   .map1({0})
+                   .map2({1})
+                   .blk_sizes(xd)
+                   .build();
+
+  auto gq_xd = dbcsr::tensor<2>::create_template(*gp_xd)
+                   .name("gq_xd_stack")
+                   .build();
+
+  auto J_bbd = dbcsr::tensor<3>::create()
+                   .name("J_bbd_stack")
+                   .set_pgrid(*spgrid_bbd)
+                   .map1({0, 1})
+                   .map2({2})
+                   .blk_sizes(bbd)
+                   .build();
+
+  auto p_bbd = dbcsr::tensor<3>::create_template(*J_bbd)
+                   .name("p_bbd_stack")
+                   .build();
+
+  // a nu batch is skipped if it is insignificant for all densities
+  const int nbatches = m_eri3c2e_batched->nbatches(2);
+  batch_mask skip = batch_mask::Constant(nbatches, true);
+
+  for (int i = 0; i != ndens; ++i) {
+    auto p = dbcsr::matrix<>::copy(*m_p_stack[i]).name("p_stack").build();
+    p->scale(2.0);
+    dbcsr::copy_matrix_to_3Dtensor_new(*p, *p_bbd, p->has_symmetry(), i);
+    skip = skip &&
+        density_skip_mask(*p, *m_eri3c2e_batched, 2).rowwise().all();
+  }
+
+  p_bbd->filter(dbcsr::global::filter_eps);
+
+  LOG.os<1>("Skipping ", skip.count(), " of ", skip.size(), " batches (J)\n");
+
+  contract_J(*p_bbd, *gp_xd, *gq_xd, *J_bbd, skip);
+
+  for (int i = 0; i != ndens; ++i) {
+    auto J_i = dbcsr::matrix<>::create_template(*m_J)
+                   .name("J_bb_" + std::to_string(i))
+                   .build();
+    dbcsr::copy_3Dtensor_to_matrix_new(*J_bbd, *J_i, i);
+    m_J_stack.push_back(J_i);
+  }
+
+  p_bbd->destroy();
+  J_bbd->destroy();
+  gp_xd->destroy();
+  gq_xd->destroy();
+  spgrid_xd->destroy();
+  spgrid_bbd->destroy();
+
+  TIME.finish();
+}
+
 void DFMO_K::init()
 {
   init_base();
@@ -542,11 +632,22 @@ void DFAO_K::compute_K()
     // int64_t nze_cbar_tot = (int64_t)full[0] * (int64_t)full[1] *
     // (int64_t)full[2];
 
+    // nu batches without significant density blocks do not contribute
+    const int nnu = m_eri3c2e_batched->nbatches(2);
+    batch_mask skip =
+        density_skip_mask(*p_bb, *m_eri3c2e_batched, 2).rowwise().all();
+    const int nskip = skip.count();
+
+    LOG.os<1>("Skipping ", nskip, " of ", nnu, " batches (K)\n");
+
     reo_int.start();
     m_eri3c2e_batched->decompress_init({0}, vec<int>{0, 1}, vec<int>{2});
     reo_int.finish();
 
     for (int ix = 0; ix != m_eri3c2e_batched->nbatches(0); ++ix) {
+      if (nskip == nnu)
+        break;
+
       // fetch integrals
       fetch.start();
       m_eri3c2e_batched->decompress({ix});
@@ -555,7 +656,10 @@ void DFAO_K::compute_K()
 
       // m_p_bb->batched_contract_init();
 
-      for (int inu = 0; inu != m_eri3c2e_batched->nbatches(2); ++inu) {
+      for (int inu = 0; inu != nnu; ++inu) {
+        if (skip[inu])
+          continue;
+
         vec<vec<int>> xm_bounds = {
             m_eri3c2e_batched->bounds(0, ix),
             m_eri3c2e_batched->full_bounds(1)};
@@ -647,6 +751,141 @@ void DFAO_K::compute_K()
   TIME.finish();
 }
 
+void DFAO_K::compute_K_stack()
+{
+  TIME.start();
+
+  auto& reo_int = TIME.sub("Reordering ints (stack)");
+  auto& reo_1_batch = TIME.sub("Reordering (1)/batch (stack)");
+  auto& con_1_batch = TIME.sub("Contraction (1)/batch (stack)");
+  auto& con_2_batch = TIME.sub("Contraction (2)/batch (stack)");
+  auto& fetch = TIME.sub("Fetching integrals/batch (stack)");
+  auto& fetch2 = TIME.sub("Fetching fitting coeffs/batch (stack)");
+
+  const int ndens = m_p_stack.size();
+  m_K_stack.clear();
+
+  LOG.os<1>("Computing K for ", ndens, " densities\n");
+
+  const int nnu = m_eri3c2e_batched->nbatches(2);
+  const int nx = m_eri3c2e_batched->nbatches(0);
+
+  // density and K of each state, and the nu batches each density needs
+  std::vector<dbcsr::shared_tensor<2, double>> p_bb(ndens), K_01(ndens);
+  std::vector<batch_mask> skip(ndens);
+  batch_mask skip_all = batch_mask::Constant(nnu, true);
+
+  for (int i = 0; i != ndens; ++i) {
+    p_bb[i] = dbcsr::tensor<2>::create_template(*m_p_bb)
+                  .name("p_bb_" + std::to_string(i))
+                  .build();
+    K_01[i] = dbcsr::tensor<2>::create_template(*m_K_01)
+                  .name("K_01_" + std::to_string(i))
+                  .build();
+
+    dbcsr::copy_matrix_to_tensor(*m_p_stack[i], *p_bb[i]);
+    p_bb[i]->filter(dbcsr::global::filter_eps);
+
+    skip[i] = density_skip_mask(*m_p_stack[i], *m_eri3c2e_batched, 2)
+                  .rowwise()
+                  .all();
+    skip_all = skip_all && skip[i];
+  }
+
+  const int nskip = skip_all.count();
+
+  LOG.os<1>("Skipping ", nskip, " of ", nnu, " batches (K)\n");
+
+  m_fitting_batched->decompress_init({2, 0}, vec<int>{1}, vec<int>{0, 2});
+
+  reo_int.start();
+  m_eri3c2e_batched->decompress_init({0}, vec<int>{0, 1}, vec<int>{2});
+  reo_int.finish();
+
+  // every batch of integrals and fitting coefficients is fetched once and
+  // contracted with all densities
+  for (int ix = 0; ix != nx; ++ix) {
+    if (nskip == nnu)
+      break;
+
+    fetch.start();
+    m_eri3c2e_batched->decompress({ix});
+    auto eri_01_2 = m_eri3c2e_batched->get_work_tensor();
+    fetch.finish();
+
+    for (int inu = 0; inu != nnu; ++inu) {
+      if (skip_all[inu])
+        continue;
+
+      fetch2.start();
+      m_fitting_batched->decompress({inu, ix});
+      auto c_xbb_1_02 = m_fitting_batched->get_work_tensor();
+      fetch2.finish();
+
+      vec<vec<int>> xm_bounds = {
+          m_eri3c2e_batched->bounds(0, ix), m_eri3c2e_batched->full_bounds(1)};
+
+      vec<vec<int>> n_bounds = {m_eri3c2e_batched->bounds(2, inu)};
+
+      vec<vec<int>> copy_bounds = {
+          m_eri3c2e_batched->bounds(0, ix), m_eri3c2e_batched->full_bounds(1),
+          m_eri3c2e_batched->bounds(2, inu)};
+
+      vec<vec<int>> xs_bounds = {
+          m_eri3c2e_batched->bounds(0, ix), m_eri3c2e_batched->bounds(2, inu)};
+
+      for (int i = 0; i != ndens; ++i) {
+        if (skip[i][inu])
+          continue;
+
+        con_1_batch.start();
+        dbcsr::contract(1.0, *eri_01_2, *p_bb[i], 0.0, *m_cbar_xbb_01_2)
+            .bounds2(xm_bounds)
+            .bounds3(n_bounds)
+            .filter(dbcsr::global::filter_eps)
+            .perform("XMN, NL -> XML");
+        con_1_batch.finish();
+
+        reo_1_batch.start();
+        dbcsr::copy(*m_cbar_xbb_01_2, *m_cbar_xbb_1_02)
+            .bounds(copy_bounds)
+            .move_data(true)
+            .perform();
+        reo_1_batch.finish();
+
+        con_2_batch.start();
+        dbcsr::contract(1.0, *c_xbb_1_02, *m_cbar_xbb_1_02, 1.0, *K_01[i])
+            .bounds1(xs_bounds)
+            .filter(dbcsr::global::filter_eps / nnu)
+            .perform("XNS, XMS -> MN");
+        con_2_batch.finish();
+
+        m_cbar_xbb_1_02->clear();
+      }
+    }
+  }
+
+  m_eri3c2e_batched->decompress_finalize();
+  m_fitting_batched->decompress_finalize();
+
+  for (int i = 0; i != ndens; ++i) {
+    auto K_i = dbcsr::matrix<>::create_template(*m_K_A)
+                   .name("K_bb_" + std::to_string(i))
+                   .build();
+
+    dbcsr::copy_tensor_to_matrix(*K_01[i], *K_i);
+    K_i->scale(-1.0);
+    m_K_stack.push_back(K_i);
+
+    K_01[i]->destroy();
+    p_bb[i]->destroy();
+  }
+
+  LOG.os<1>("Done with exchange.\n");
+
+  TIME.finish();
+}
+
 void DFMEM_K::init()
 {
   init_base();
@@ -1344,6 +1583,245 @@ void DFLMO_K::compute_K()
   TIME.finish();
 }
 
+void DFLMO_K::compute_K_stack()
+{
+  // stacked densities go through compute_K one by one, only pairs of
+  // left/right coefficients share the integral batches
+  if (m_u_stack.empty()) {
+    K::compute_K_stack();
+    return;
+  }
+
+  const int ndens = m_u_stack.size();
+  m_K_stack.clear();
+
+  if ((int)m_v_stack.size() != ndens) {
+    throw std::runtime_error("K stack: left and right coefficients differ");
+  }
+
+  TIME.start();
+
+  auto& time_reo1 = TIME.sub("First reordering (stack)");
+  auto& time_reo2 = TIME.sub("Second reordering (stack)");
+  auto& time_reo3 = TIME.sub("Third reordering (stack)");
+  auto& time_htint = TIME.sub("Forming half-transformed integrals (stack)");
+  auto& time_htvfit = TIME.sub("Contracting with v_xx (stack)");
+  auto& time_formk = TIME.sub("Final contraction (stack)");
+  auto& time_ints = TIME.sub("Fetching ints (stack)");
+
+  LOG.os<1>("Computing K for ", ndens, " coefficient pairs\n");
+
+  dbcsr::copy_matrix_to_tensor(*m_v_xx, *m_v_xx_01);
+  m_v_xx_01->filter(dbcsr::global::filter_eps);
+
+  // all pairs are batched alike along the occupied index
+  auto o = m_u_stack[0]->col_blk_sizes();
+
+  for (int i = 0; i != ndens; ++i) {
+    if (m_u_stack[i]->col_blk_sizes() != o) {
+      throw std::runtime_error("K stack: occupied blocks of pairs differ");
+    }
+  }
+
+  int nocc = std::accumulate(o.begin(), o.end(), 0);
+  int nbas = m_mol->c_basis()->nbf();
+  int nxbas = m_mol->c_dfbasis()->nbf();
+
+  auto x = m_mol->dims().x();
+  auto b = m_mol->dims().b();
+
+  auto o_bounds = dbcsr::make_blk_bounds(o, m_occ_nbatches);
+  int nobatches = o_bounds.size();
+
+  vec<int> o_offsets(o.size());
+  int off = 0;
+
+  for (size_t i = 0; i != o.size(); ++i) {
+    o_offsets[i] = off;
+    off += o[i];
+  }
+
+  for (size_t i = 0; i != o_bounds.size(); ++i) {
+    o_bounds[i][0] = o_offsets[o_bounds[i][0]];
+    o_bounds[i][1] = o_offsets[o_bounds[i][1]] + o[o_bounds[i][1]] - 1;
+  }
+
+  std::array<int, 3> dims3 = {nxbas, nbas, nocc};
+
+  arrvec<int, 3> xbm = {x, b, o};
+  arrvec<int, 2> bm = {b, o};
+  arrvec<int, 2> mb = {o, b};
+
+  auto spgrid2 = dbcsr::pgrid<2>::create(m_cart.comm()).build();
+
+  auto spgrid3_xbm =
+      dbcsr::pgrid<3>::create(m_cart.comm()).tensor_dims(dims3).build();
+
+  auto make_xbm = [&](std::string name, vec<int> map1, vec<int> map2) {
+    return dbcsr::tensor<3>::create()
+        .name(name)
+        .set_pgrid(*spgrid3_xbm)
+        .blk_sizes(xbm)
+        .map1(map1)
+        .map2(map2)
+        .build();
+  };
+
+  // half-transformed integrals of each pair
+  std::vector<dbcsr::shared_tensor<2, double>> u_bm_01(ndens), vt_mb_01(ndens);
+  std::vector<dbcsr::shared_tensor<3, double>> htu_xbm_01_2(ndens),
+      htu_xbm_02_1(ndens), htv_xbm_01_2(ndens), htv_xbm_0_12(ndens);
+  std::vector<dbcsr::shared_tensor<2, double>> K_01(ndens);
+
+  for (int i = 0; i != ndens; ++i) {
+    auto n = std::to_string(i);
+
+    u_bm_01[i] = dbcsr::tensor<2>::create()
+                     .name("u_bm_01_" + n)
+                     .set_pgrid(*spgrid2)
+                     .blk_sizes(bm)
+                     .map1({0})
+                     .map2({1})
+                     .build();
+
+    vt_mb_01[i] = dbcsr::tensor<2>::create()
+                      .name("vt_mb_01_" + n)
+                      .set_pgrid(*spgrid2)
+                      .blk_sizes(mb)
+                      .map1({0})
+                      .map2({1})
+                      .build();
+
+    htu_xbm_01_2[i] = make_xbm("htu_xbm_01_2_" + n, {0, 1}, {2});
+    htu_xbm_02_1[i] = make_xbm("htu_xbm_02_1_" + n, {0, 2}, {1});
+    htv_xbm_01_2[i] = make_xbm("htv_xbm_01_2_" + n, {0, 1}, {2});
+    htv_xbm_0_12[i] = make_xbm("htv_xbm_0_12_" + n, {0}, {1, 2});
+
+    K_01[i] =
+        dbcsr::tensor<2>::create_template(*m_K_01).name("K_01_" + n).build();
+
+    dbcsr::copy_matrix_to_tensor(*m_u_stack[i], *u_bm_01[i]);
+    dbcsr::copy_matrix_to_tensor(*m_v_stack[i], *vt_mb_01[i]);
+
+    u_bm_01[i]->filter(dbcsr::global::filter_eps);
+    vt_mb_01[i]->filter(dbcsr::global::filter_eps);
+  }
+
+  auto htvfit_xbm_0_12 = make_xbm("htvfit_xbm_0_12", {0}, {1, 2});
+  auto htvfit_xbm_02_1 = make_xbm("htvfit_xbm_02_1", {0, 2}, {1});
+
+  int nxbatches = m_eri3c2e_batched->nbatches(0);
+  int nbbatches = m_eri3c2e_batched->nbatches(2);
+
+  for (int iocc = 0; iocc != nobatches; ++iocc) {
+    LOG.os<1>("Occ batch ", iocc, '\n');
+
+    auto obds = o_bounds[iocc];
+
+    m_eri3c2e_batched->decompress_init({2}, vec<int>{0, 1}, vec<int>{2});
+
+    // every integral batch is fetched once for all pairs
+    for (int inu = 0; inu != nbbatches; ++inu) {
+      time_ints.start();
+      m_eri3c2e_batched->decompress({inu});
+      auto eri3c2e_01_2 = m_eri3c2e_batched->get_work_tensor();
+      time_ints.finish();
+
+      vec<vec<int>> nu_bounds = {m_eri3c2e_batched->bounds(2, inu)};
+
+      vec<vec<int>> i_bounds = {obds};
+
+      time_htint.start();
+      for (int i = 0; i != ndens; ++i) {
+        dbcsr::contract(1.0, *eri3c2e_01_2, *vt_mb_01[i], 1.0, *htv_xbm_01_2[i])
+            .bounds1(nu_bounds)
+            .bounds3(i_bounds)
+            .filter(dbcsr::global::filter_eps / nbbatches)
+            .perform("Xmn, in -> Xmi");
+
+        dbcsr::contract(1.0, *eri3c2e_01_2, *u_bm_01[i], 1.0, *htu_xbm_01_2[i])
+            .bounds1(nu_bounds)
+            .bounds3(i_bounds)
+            .filter(dbcsr::global::filter_eps / nbbatches)
+            .perform("Xmn, ni -> Xmi");
+      }
+      time_htint.finish();
+    }
+
+    m_eri3c2e_batched->decompress_finalize();
+
+    for (int i = 0; i != ndens; ++i) {
+      time_reo1.start();
+      dbcsr::copy(*htv_xbm_01_2[i], *htv_xbm_0_12[i]).move_data(true).perform();
+      time_reo1.finish();
+
+      time_reo2.start();
+      dbcsr::copy(*htu_xbm_01_2[i], *htu_xbm_02_1[i]).move_data(true).perform();
+      time_reo2.finish();
+    }
+
+    for (int ix = 0; ix != nxbatches; ++ix) {
+      vec<vec<int>> x_bounds = {m_eri3c2e_batched->bounds(0, ix)};
+
+      vec<vec<int>> mi_bounds = {m_eri3c2e_batched->full_bounds(1), obds};
+
+      vec<vec<int>> xni_bounds = {
+          m_eri3c2e_batched->bounds(0, ix), m_eri3c2e_batched->full_bounds(1),
+          obds};
+
+      vec<vec<int>> xi_bounds = {m_eri3c2e_batched->bounds(0, ix), obds};
+
+      for (int i = 0; i != ndens; ++i) {
+        time_htvfit.start();
+        dbcsr::contract(
+            1.0, *m_v_xx_01, *htv_xbm_0_12[i], 0.0, *htvfit_xbm_0_12)
+            .bounds2(x_bounds)
+            .bounds3(mi_bounds)
+            .filter(dbcsr::global::filter_eps)
+            .perform("XY, Ymi -> Xmi");
+        time_htvfit.finish();
+
+        time_reo3.start();
+        dbcsr::copy(*htvfit_xbm_0_12, *htvfit_xbm_02_1)
+            .bounds(xni_bounds)
+            .move_data(true)
+            .perform();
+        time_reo3.finish();
+
+        time_formk.start();
+        dbcsr::contract(1.0, *htu_xbm_02_1[i], *htvfit_xbm_02_1, 1.0, *K_01[i])
+            .bounds1(xi_bounds)
+            .filter(dbcsr::global::filter_eps / nxbatches)
+            .perform("Xmi, Xni -> mn");
+        time_formk.finish();
+
+        htvfit_xbm_02_1->clear();
+      }
+    }
+
+    for (int i = 0; i != ndens; ++i) {
+      htv_xbm_0_12[i]->clear();
+      htu_xbm_02_1[i]->clear();
+    }
+  }
+
+  for (int i = 0; i != ndens; ++i) {
+    auto K_i = dbcsr::matrix<>::create_template(*m_K_A)
+                   .name("K_bb_" + std::to_string(i))
+                   .build();
+
+    dbcsr::copy_tensor_to_matrix(*K_01[i], *K_i);
+    K_i->scale(-1.0);
+    m_K_stack.push_back(K_i);
+  }
+
+  m_v_xx_01->clear();
+
+  LOG.os<1>("Done with exchange.\n");
+
+  TIME.finish();
+}
+
 }  // namespace fock
 
 }  // end namespace megalochem
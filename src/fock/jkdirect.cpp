@@ -0,0 +1,197 @@
+#include <dbcsr_conversions.hpp>
+#include <algorithm>
+#include "fock/jkbuilder.hpp"
+
+namespace megalochem {
+
+namespace fock {
+
+// quartets are skipped if their contribution to J or K is below
+// DIRECT_THRESHOLD * filter_eps, so that the results are accurate to
+// filter_eps even though many small contributions add up
+static const double DIRECT_THRESHOLD = 1e-3;
+
+void direct_engine::init(megalochem::world w, desc::shared_molecule mol)
+{
+  m_fac = std::make_shared<ints::aofactory>(mol, w);
+
+  auto z = m_fac->ao_schwarz();
+  m_q = dbcsr::matrix_to_eigen(*z);
+  z->release();
+
+  m_threshold = DIRECT_THRESHOLD * dbcsr::global::filter_eps;
+}
+
+void direct_engine::compute(
+    dbcsr::shared_matrix<double> p_j,
+    std::vector<dbcsr::shared_matrix<double>> p_k,
+    dbcsr::shared_matrix<double> j_out,
+    std::vector<dbcsr::shared_matrix<double>> k_out,
+    util::mpi_log& LOG)
+{
+  double d_max = (p_j) ? p_j->norm(dbcsr_norm_maxabs) : 0.0;
+  for (auto& p : p_k) { d_max = std::max(d_max, p->norm(dbcsr_norm_maxabs)); }
+
+  // shell pairs which can contribute at all, by decreasing bound. Every
+  // pair meets itself and the pairs after it, so each quartet is computed
+  // once and the ket loops stop early
+  const double q_max = m_q.maxCoeff();
+  std::vector<std::array<int, 2>> pairs;
+
+  for (int i = 0; i != m_q.rows(); ++i) {
+    for (int j = 0; j <= i; ++j) {
+      if (m_q(i, j) * q_max * d_max >= m_threshold)
+        pairs.push_back({i, j});
+    }
+  }
+
+  std::stable_sort(pairs.begin(), pairs.end(), [this](auto& a, auto& b) {
+    return m_q(a[0], a[1]) > m_q(b[0], b[1]);
+  });
+
+  const int64_t npairs = pairs.size();
+  std::vector<ints::jk_task> tasks(npairs);
+
+  for (int64_t ij = 0; ij != npairs; ++ij) { tasks[ij] = {ij, ij, npairs}; }
+
+  compute(p_j, p_k, j_out, k_out, LOG, pairs, tasks);
+}
+
+void direct_engine::compute(
+    dbcsr::shared_matrix<double> p_j,
+    std::vector<dbcsr::shared_matrix<double>> p_k,
+    dbcsr::shared_matrix<double> j_out,
+    std::vector<dbcsr::shared_matrix<double>> k_out,
+    util::mpi_log& LOG,
+    const std::vector<std::array<int, 2>>& pairs,
+    const std::vector<ints::jk_task>& tasks)
+{
+  std::vector<dbcsr::matrix<double>*> pk_ptrs, k_ptrs;
+
+  for (size_t i = 0; i != p_k.size(); ++i) {
+    pk_ptrs.push_back(p_k[i].get());
+    k_ptrs.push_back(k_out[i].get());
+  }
+
+  auto nquartets = m_fac->ao_4c_jk(
+      p_j.get(), pk_ptrs, j_out.get(), k_ptrs, pairs, tasks, m_q,
+      m_threshold);
+
+  LOG.os<1>(
+      "Computed ", nquartets[0], " of ", nquartets[0] + nquartets[1],
+      " shell quartets\n");
+
+  if (p_j)
+    j_out->filter(dbcsr::global::filter_eps);
+
+  for (auto& k : k_out) {
+    k->scale(-1.0);
+    k->filter(dbcsr::global::filter_eps);
+  }
+}
+
+// the 8-fold symmetry of the digestion assumes symmetric densities
+static void check_sym(bool sym)
+{
+  if (!sym) {
+    throw std::runtime_error(
+        "Integral-direct J/K builders need symmetric densities");
+  }
+}
+
+void DIRECT_J::init()
+{
+  check_sym(m_sym);
+  init_base();
+  m_engine.init(m_world, m_mol);
+}
+
+void DIRECT_J::compute_J()
+{
+  auto ptot = dbcsr::matrix<>::copy(*m_p_A).name("ptot").build();
+
+  if (m_p_B) {
+    ptot->add(1.0, 1.0, *m_p_B);
+  }
+  else {
+    ptot->scale(2.0);
+  }
+
+  m_engine.compute(ptot, {}, m_J, {}, LOG);
+
+  if (LOG.global_plev() >= 2) {
+    dbcsr::print(*m_J);
+  }
+}
+
+void DIRECT_K::init()
+{
+  check_sym(m_sym);
+  init_base();
+  m_engine.init(m_world, m_mol);
+}
+
+void DIRECT_K::compute_K()
+{
+  if (m_p_B && !m_K_B) {
+    m_K_B = dbcsr::matrix<>::create_template(*m_K_A).name("K_bb_B").build();
+  }
+
+  std::vector<dbcsr::shared_matrix<double>> p_k = {m_p_A};
+  std::vector<dbcsr::shared_matrix<double>> k_out = {m_K_A};
+
+  if (m_p_B) {
+    p_k.push_back(m_p_B);
+    k_out.push_back(m_K_B);
+  }
+
+  m_engine.compute(nullptr, p_k, nullptr, k_out, LOG);
+
+  if (LOG.global_plev() >= 2) {
+    dbcsr::print(*m_K_A);
+    if (m_p_B)
+      dbcsr::print(*m_K_B);
+  }
+}
+
+void DIRECT_JK::init()
+{
+  check_sym(m_sym);
+  init_base();
+  m_engine.init(m_world, m_mol);
+}
+
+void DIRECT_JK::compute_JK()
+{
+  if (m_p_B && !m_K_B) {
+    m_K_B = dbcsr::matrix<>::create_template(*m_K_A).name("K_bb_B").build();
+  }
+
+  auto ptot = dbcsr::matrix<>::copy(*m_p_A).name("ptot").build();
+
+  std::vector<dbcsr::shared_matrix<double>> p_k = {m_p_A};
+  std::vector<dbcsr::shared_matrix<double>> k_out = {m_K_A};
+
+  if (m_p_B) {
+    ptot->add(1.0, 1.0, *m_p_B);
+    p_k.push_back(m_p_B);
+    k_out.push_back(m_K_B);
+  }
+  else {
+    ptot->scale(2.0);
+  }
+
+  // one pass over the shell quartets for J and all K's
+  m_engine.compute(ptot, p_k, m_J, k_out, LOG);
+
+  if (LOG.global_plev() >= 2) {
+    dbcsr::print(*m_J);
+    dbcsr::print(*m_K_A);
+    if (m_p_B)
+      dbcsr::print(*m_K_B);
+  }
+}
+
+}  // namespace fock
+
+}  // namespace megalochem
@@ -68,15 +68,20 @@ void EXACT_J::compute_J()
     ptot->copy_in(*m_p_A);
     ptot->scale(2.0);
     dbcsr::copy_matrix_to_3Dtensor_new(*ptot, *m_ptot_bbd, m_sym);
-    ptot->clear();
   }
   else {
     ptot->copy_in(*m_p_A);
     ptot->add(1.0, 1.0, *m_p_B);
     dbcsr::copy_matrix_to_3Dtensor_new<double>(*ptot, *m_ptot_bbd, m_sym);
-    ptot->clear();
   }
 
+  // batches of ls without significant density blocks do not contribute
+  auto skip = density_skip_mask(*ptot, *m_eri4c2e_batched, 2);
+  ptot->clear();
+
+  LOG.os<1>(
+      "Skipping ", skip.count(), " of ", skip.size(), " batch pairs (J)\n");
+
   if (LOG.global_plev() >= 3) {
     dbcsr::print(*m_ptot_bbd);
   }
@@ -88,6 +93,9 @@ void EXACT_J::compute_J()
 
   for (int imu = 0; imu != m_eri4c2e_batched->nbatches(2); ++imu) {
     for (int inu = 0; inu != m_eri4c2e_batched->nbatches(3); ++inu) {
+      if (skip(imu, inu))
+        continue;
+
       m_eri4c2e_batched->decompress({imu, inu});
       auto eri_01_23 = m_eri4c2e_batched->get_work_tensor();
 
@@ -126,11 +134,21 @@ void EXACT_K::compute_K()
 
     LOG.os<1>("Computing exchange term (", x, ") ... \n");
 
+    // batches of ls without significant density blocks do not contribute
+    auto skip = density_skip_mask(*p, *m_eri4c2e_batched, 1);
+
+    LOG.os<1>(
+        "Skipping ", skip.count(), " of ", skip.size(), " batch pairs (", x,
+        ")\n");
+
     // m_K_bbd->batched_contract_init();
     m_eri4c2e_batched->decompress_init({1, 3}, vec<int>{0, 2}, vec<int>{1, 3});
 
     for (int imu = 0; imu != m_eri4c2e_batched->nbatches(1); ++imu) {
       for (int inu = 0; inu != m_eri4c2e_batched->nbatches(3); ++inu) {
+        if (skip(imu, inu))
+          continue;
+
         m_eri4c2e_batched->decompress({imu, inu});
 
         auto eri_02_13 = m_eri4c2e_batched->get_work_tensor();
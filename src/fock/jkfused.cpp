@@ -0,0 +1,271 @@
+#include <dbcsr_tensor_ops.hpp>
+#include "fock/fock_defaults.hpp"
+#include "fock/jkbuilder.hpp"
+
+namespace megalochem {
+
+namespace fock {
+
+void DFAO_JK::init()
+{
+  init_base();
+
+  auto b = m_mol->dims().b();
+  auto x = m_mol->dims().x();
+  vec<int> d = {1};
+
+  int nbf = std::accumulate(b.begin(), b.end(), 0);
+  int xnbf = std::accumulate(x.begin(), x.end(), 0);
+
+  arrvec<int, 3> bbd = {b, b, d};
+  arrvec<int, 2> xd = {x, d};
+  arrvec<int, 3> xbb = {x, b, b};
+  arrvec<int, 2> bb = {b, b};
+
+  std::array<int, 2> tsizes2 = {xnbf, 1};
+  std::array<int, 3> tsizes3 = {nbf, nbf, 1};
+
+  m_spgrid2 = dbcsr::pgrid<2>::create(m_cart.comm()).build();
+
+  m_spgrid_xd =
+      dbcsr::pgrid<2>::create(m_cart.comm()).tensor_dims(tsizes2).build();
+
+  m_spgrid_bbd =
+      dbcsr::pgrid<3>::create(m_cart.comm()).tensor_dims(tsizes3).build();
+
+  // coulomb
+
+  m_gp_xd = dbcsr::tensor<2>::create()
+                .name("gp_xd")
+                .set_pgrid(*m_spgrid_xd)
+                .map1({0})
+                .map2({1})
+                .blk_sizes(xd)
+                .build();
+
+  m_J_bbd = dbcsr::tensor<3>::create()
+                .name("J_bbd")
+                .set_pgrid(*m_spgrid_bbd)
+                .map1({0, 1})
+                .map2({2})
+                .blk_sizes(bbd)
+                .build();
+
+  m_ptot_bbd =
+      dbcsr::tensor<3>::create_template(*m_J_bbd).name("ptot_bbd").build();
+
+  // exchange
+
+  m_cbar_xbb_01_2 = dbcsr::tensor<3>::create()
+                        .name("Cbar_xbb_01_2")
+                        .set_pgrid(*m_eri3c2e_batched->spgrid())
+                        .blk_sizes(xbb)
+                        .map1({0, 1})
+                        .map2({2})
+                        .build();
+
+  m_cbar_xbb_1_02 = dbcsr::tensor<3>::create_template(*m_cbar_xbb_01_2)
+                        .name("Cbar_xbb_1_02")
+                        .map1({1})
+                        .map2({0, 2})
+                        .build();
+
+  m_K_01_A = dbcsr::tensor<2>::create()
+                 .set_pgrid(*m_spgrid2)
+                 .name("K_01_A")
+                 .map1({0})
+                 .map2({1})
+                 .blk_sizes(bb)
+                 .build();
+
+  m_K_01_B =
+      dbcsr::tensor<2>::create_template(*m_K_01_A).name("K_01_B").build();
+
+  m_p_bb_A =
+      dbcsr::tensor<2>::create_template(*m_K_01_A).name("p_bb_A").build();
+
+  m_p_bb_B =
+      dbcsr::tensor<2>::create_template(*m_K_01_A).name("p_bb_B").build();
+}
+
+void DFAO_JK::compute_JK()
+{
+  TIME.start();
+
+  auto& reo_int = TIME.sub("Reordering ints");
+  auto& fetch = TIME.sub("Fetching integrals/batch");
+  auto& fetch2 = TIME.sub("Fetching fitting coeffs/batch");
+  auto& con_j1 = TIME.sub("Contraction J (1)/batch");
+  auto& con_j2 = TIME.sub("Contraction J (2)/batch");
+  auto& con_k1 = TIME.sub("Contraction K (1)/batch");
+  auto& reo_k = TIME.sub("Reordering K/batch");
+  auto& con_k2 = TIME.sub("Contraction K (2)/batch");
+
+  const bool beta = (m_p_B != nullptr);
+
+  if (beta && !m_K_B) {
+    m_K_B = dbcsr::matrix<>::create_template(*m_K_A).name("K_bb_B").build();
+  }
+
+  // densities
+
+  auto ptot = dbcsr::matrix<>::create_template(*m_p_A).name("ptot").build();
+  ptot->copy_in(*m_p_A);
+
+  if (beta) {
+    ptot->add(1.0, 1.0, *m_p_B);
+  }
+  else {
+    ptot->scale(2.0);
+  }
+
+  dbcsr::copy_matrix_to_3Dtensor_new<double>(
+      *ptot, *m_ptot_bbd, ptot->has_symmetry());
+  m_ptot_bbd->filter(dbcsr::global::filter_eps);
+  ptot->release();
+
+  dbcsr::copy_matrix_to_tensor(*m_p_A, *m_p_bb_A);
+  m_p_bb_A->filter(dbcsr::global::filter_eps);
+
+  if (beta) {
+    dbcsr::copy_matrix_to_tensor(*m_p_B, *m_p_bb_B);
+    m_p_bb_B->filter(dbcsr::global::filter_eps);
+  }
+
+  // nu batches without significant density blocks do not contribute to K,
+  // the fitting coefficients are still needed for J
+  const int nnu = m_eri3c2e_batched->nbatches(2);
+  const int nx = m_eri3c2e_batched->nbatches(0);
+
+  batch_mask skip_A =
+      density_skip_mask(*m_p_A, *m_eri3c2e_batched, 2).rowwise().all();
+  batch_mask skip_B = batch_mask::Constant(nnu, true);
+  if (beta) {
+    skip_B = density_skip_mask(*m_p_B, *m_eri3c2e_batched, 2).rowwise().all();
+  }
+
+  LOG.os<1>(
+      "Skipping ", (skip_A && skip_B).count(), " of ", nnu,
+      " batches (K)\n");
+
+  reo_int.start();
+  m_eri3c2e_batched->decompress_init({0}, vec<int>{0, 1}, vec<int>{2});
+  m_fitting_batched->decompress_init({2, 0}, vec<int>{1}, vec<int>{0, 2});
+  reo_int.finish();
+
+  for (int ix = 0; ix != nx; ++ix) {
+    fetch.start();
+    m_eri3c2e_batched->decompress({ix});
+    auto eri_01_2 = m_eri3c2e_batched->get_work_tensor();
+    fetch.finish();
+
+    vec<vec<int>> x_bounds = {m_eri3c2e_batched->bounds(0, ix)};
+
+    // the fitted density is complete for the auxiliary functions of ix
+    con_j1.start();
+    dbcsr::contract(1.0, *eri_01_2, *m_ptot_bbd, 0.0, *m_gp_xd)
+        .bounds2(x_bounds)
+        .filter(dbcsr::global::filter_eps)
+        .perform("XMN, MN_ -> X_");
+    con_j1.finish();
+
+    for (int inu = 0; inu != nnu; ++inu) {
+      fetch2.start();
+      m_fitting_batched->decompress({inu, ix});
+      auto c_xbb_1_02 = m_fitting_batched->get_work_tensor();
+      fetch2.finish();
+
+      vec<vec<int>> mn_bounds = {
+          m_eri3c2e_batched->full_bounds(1),
+          m_eri3c2e_batched->bounds(2, inu)};
+
+      con_j2.start();
+      dbcsr::contract(1.0, *m_gp_xd, *c_xbb_1_02, 1.0, *m_J_bbd)
+          .bounds1(x_bounds)
+          .bounds3(mn_bounds)
+          .filter(dbcsr::global::filter_eps / nx)
+          .perform("X_, XMN -> MN_");
+      con_j2.finish();
+
+      auto exchange = [&](dbcsr::shared_tensor<2, double>& p_bb,
+                          dbcsr::shared_tensor<2, double>& k_01) {
+        vec<vec<int>> xm_bounds = {
+            m_eri3c2e_batched->bounds(0, ix),
+            m_eri3c2e_batched->full_bounds(1)};
+
+        vec<vec<int>> n_bounds = {m_eri3c2e_batched->bounds(2, inu)};
+
+        con_k1.start();
+        dbcsr::contract(1.0, *eri_01_2, *p_bb, 0.0, *m_cbar_xbb_01_2)
+            .bounds2(xm_bounds)
+            .bounds3(n_bounds)
+            .filter(dbcsr::global::filter_eps)
+            .perform("XMN, NL -> XML");
+        con_k1.finish();
+
+        vec<vec<int>> copy_bounds = {
+            m_eri3c2e_batched->bounds(0, ix), m_eri3c2e_batched->full_bounds(1),
+            m_eri3c2e_batched->bounds(2, inu)};
+
+        reo_k.start();
+        dbcsr::copy(*m_cbar_xbb_01_2, *m_cbar_xbb_1_02)
+            .bounds(copy_bounds)
+            .move_data(true)
+            .perform();
+        reo_k.finish();
+
+        vec<vec<int>> xs_bounds = {
+            m_eri3c2e_batched->bounds(0, ix),
+            m_eri3c2e_batched->bounds(2, inu)};
+
+        con_k2.start();
+        dbcsr::contract(1.0, *c_xbb_1_02, *m_cbar_xbb_1_02, 1.0, *k_01)
+            .bounds1(xs_bounds)
+            .filter(dbcsr::global::filter_eps / nnu)
+            .perform("XNS, XMS -> MN");
+        con_k2.finish();
+
+        m_cbar_xbb_1_02->clear();
+      };
+
+      if (!skip_A[inu])
+        exchange(m_p_bb_A, m_K_01_A);
+      if (!skip_B[inu])
+        exchange(m_p_bb_B, m_K_01_B);
+    }
+
+    m_gp_xd->clear();
+  }
+
+  m_eri3c2e_batched->decompress_finalize();
+  m_fitting_batched->decompress_finalize();
+
+  dbcsr::copy_3Dtensor_to_matrix_new(*m_J_bbd, *m_J);
+  m_J_bbd->clear();
+  m_ptot_bbd->clear();
+
+  dbcsr::copy_tensor_to_matrix(*m_K_01_A, *m_K_A);
+  m_K_A->scale(-1.0);
+  m_K_01_A->clear();
+  m_p_bb_A->clear();
+
+  if (beta) {
+    dbcsr::copy_tensor_to_matrix(*m_K_01_B, *m_K_B);
+    m_K_B->scale(-1.0);
+    m_K_01_B->clear();
+    m_p_bb_B->clear();
+  }
+
+  if (LOG.global_plev() >= 2) {
+    dbcsr::print(*m_J);
+    dbcsr::print(*m_K_A);
+    if (beta)
+      dbcsr::print(*m_K_B);
+  }
+
+  TIME.finish();
+}
+
+}  // namespace fock
+
+}  // namespace megalochem
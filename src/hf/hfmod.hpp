@@ -38,11 +38,17 @@ namespace hf {
    ((util::optional<int>), diis_min_vecs, 2), \
    ((util::optional<int>), diis_start, 1), \
    ((util::optional<bool>), do_diis_beta, true), \
+   ((util::optional<bool>), incremental_fock, false), \
+   ((util::optional<int>), fock_rebuild, 8), \
    ((util::optional<std::string>), build_J, "exact"), \
    ((util::optional<std::string>), build_K, "exact"), \
+   ((util::optional<bool>), fuse_JK, false), \
    ((util::optional<std::string>), eris, "core"), \
    ((util::optional<std::string>), imeds, "core"), \
    ((util::optional<std::string>), df_metric, "coulomb"), \
+   ((util::optional<std::string>), screening, "schwarz"), \
+   ((util::optional<std::string>), int_cache, ""), \
+   ((util::optional<double>), int_memory, 0.0), \
    ((util::optional<int>), print, 0), ((util::optional<int>), nbatches_b, 5), \
    ((util::optional<int>), nbatches_x, 5), \
    ((util::optional<int>), nbatches_occ, 3), \
@@ -89,9 +95,17 @@ class hfmod {
 
   svector<double> m_eps_A, m_eps_B;
 
+  // incremental fock builds: two-electron matrices accumulated since the
+  // last full build and the densities they belong to
+  dbcsr::shared_matrix<double> m_j_bb, m_k_bb_A, m_k_bb_B;
+  dbcsr::shared_matrix<double> m_p_last_A, m_p_last_B;
+  int m_nincr = 0;
+  bool m_force_full = true;
+
   std::shared_ptr<ints::aoloader> m_aoloader;
   std::shared_ptr<fock::J> m_jbuilder;
   std::shared_ptr<fock::K> m_kbuilder;
+  std::shared_ptr<fock::JK> m_jkbuilder;
 
   void init();
 
@@ -1,4 +1,5 @@
 #include "hf/hfmod.hpp"
+#include "ints/planner.hpp"
 #include "math/linalg/orthogonalizer.hpp"
 #include "math/linalg/piv_cd.hpp"
 #include "math/solvers/diis.hpp"
@@ -85,6 +86,38 @@ void hfmod::init()
     m_mol->set_cluster_dfbasis(m_df_basis);
   }
 
+  // the screener and the memory of hybrid tensors of the planner are
+  // passed on to the aoloader
+  ints::shared_screener scr;
+  double hybrid_memory = dbcsr::btensor_global::hybrid_memory;
+
+  // storage types given as "auto" and batch numbers of 0 are planned
+  if (m_eris == "auto" || m_imeds == "auto" || m_nbatches_b <= 0 ||
+      m_nbatches_x <= 0) {
+    // direct, multipole and seminumerical builders do not store any
+    // integrals
+    auto is_df = [](std::string m) {
+      return m != "exact" && m != "direct" && m != "cfmm" && m != "cosx";
+    };
+    bool df = (is_df(m_build_J) || is_df(m_build_K));
+    bool exact = (m_build_J == "exact" || m_build_K == "exact");
+
+    if (df || exact) {
+      scr = ints::create_screener(m_world, m_mol, m_screening);
+      scr->compute();
+    }
+
+    ints::batch_planner planner(m_world, m_mol, scr, LOG.global_plev());
+    auto plan =
+        planner.plan(df, exact, m_eris, m_imeds, m_nbatches_b, m_nbatches_x);
+
+    m_eris = dbcsr::btype_name(plan.eris);
+    m_imeds = dbcsr::btype_name(plan.intermeds);
+    m_nbatches_b = plan.nbatches_b;
+    m_nbatches_x = plan.nbatches_x;
+    hybrid_memory = plan.hybrid_memory;
+  }
+
   dbcsr::btype btype_e = dbcsr::get_btype(m_eris);
 
   dbcsr::btype btype_i = dbcsr::get_btype(m_imeds);
@@ -97,6 +130,11 @@ void hfmod::init()
                    .nbatches_x(m_nbatches_x)
                    .btype_eris(btype_e)
                    .btype_intermeds(btype_i)
+                   .screening(m_screening)
+                   .cache_dir(m_int_cache)
+                   .memory_budget(m_int_memory)
+                   .hybrid_memory(hybrid_memory)
+                   .screener(scr)
                    .build();
 }
 
@@ -198,27 +236,48 @@ void hfmod::two_electron()
 
   m_aoloader->compute();
 
-  m_jbuilder = fock::create_j()
-                   .set_world(m_world)
-                   .molecule(m_mol)
-                   .print(LOG.global_plev())
-                   .aoloader(*m_aoloader)
-                   .method(jmeth)
-                   .metric(metr)
-                   .build();
-
-  m_kbuilder = fock::create_k()
-                   .set_world(m_world)
-                   .molecule(m_mol)
-                   .print(LOG.global_plev())
-                   .aoloader(*m_aoloader)
-                   .method(kmeth)
-                   .metric(metr)
-                   .occ_nbatches(m_nbatches_occ)
-                   .build();
+  if (m_fuse_JK && fock::has_fused_jk(jmeth, kmeth, metr)) {
+    m_jkbuilder = fock::create_jk()
+                      .set_world(m_world)
+                      .molecule(m_mol)
+                      .print(LOG.global_plev())
+                      .aoloader(*m_aoloader)
+                      .method_j(jmeth)
+                      .method_k(kmeth)
+                      .metric(metr)
+                      .build();
+
+    m_jkbuilder->init();
+  }
+  else {
+    if (m_fuse_JK) {
+      LOG.os<>(
+          "No fused JK builder for ", m_build_J, "/", m_build_K,
+          ", building J and K separately.\n");
+    }
 
-  m_jbuilder->init();
-  m_kbuilder->init();
+    m_jbuilder = fock::create_j()
+                     .set_world(m_world)
+                     .molecule(m_mol)
+                     .print(LOG.global_plev())
+                     .aoloader(*m_aoloader)
+                     .method(jmeth)
+                     .metric(metr)
+                     .build();
+
+    m_kbuilder = fock::create_k()
+                     .set_world(m_world)
+                     .molecule(m_mol)
+                     .print(LOG.global_plev())
+                     .aoloader(*m_aoloader)
+                     .method(kmeth)
+                     .metric(metr)
+                     .occ_nbatches(m_nbatches_occ)
+                     .build();
+
+    m_jbuilder->init();
+    m_kbuilder->init();
+  }
 
   TIME_2e.finish();
 
@@ -238,25 +297,104 @@ void hfmod::form_fock(bool SAD_iter, int rank)
   LOG.os<1>("Ocupation of alpha density matrix: ", pA_copy->occupation(), '\n');
   pA_copy->release();
 
-  m_jbuilder->set_density_alpha(m_p_bb_A);
-  m_jbuilder->set_density_beta(m_p_bb_B);
-  m_jbuilder->set_coeff_alpha(m_c_bm_A);
-  m_jbuilder->set_coeff_beta(m_c_bm_B);
+  // K methods working on the orbital coefficients cannot use difference
+  // densities and are always built in full
+  bool k_incr = (m_build_K != "dfmo" && m_build_K != "dflmo");
+
+  bool full = !m_incremental_fock || SAD_iter || m_force_full ||
+      m_nincr >= m_fock_rebuild;
+
+  dbcsr::shared_matrix<double> p_A = m_p_bb_A;
+  dbcsr::shared_matrix<double> p_B = m_p_bb_B;
+
+  if (!full) {
+    // difference densities, filtered so the builders can skip batches
+    p_A = dbcsr::matrix<>::copy(*m_p_bb_A).name("dp_bb_A").build();
+    p_A->add(1.0, -1.0, *m_p_last_A);
+    p_A->filter(dbcsr::global::filter_eps);
+
+    if (m_p_bb_B) {
+      p_B = dbcsr::matrix<>::copy(*m_p_bb_B).name("dp_bb_B").build();
+      p_B->add(1.0, -1.0, *m_p_last_B);
+      p_B->filter(dbcsr::global::filter_eps);
+    }
+
+    LOG.os<1>(
+        "Incremental Fock build, max. density change (alpha): ",
+        p_A->norm(dbcsr_norm_maxabs), '\n');
+  }
+  else if (m_incremental_fock) {
+    LOG.os<1>("Full Fock build\n");
+  }
+
+  dbcsr::shared_matrix<double> j_bb, k_bb_A, k_bb_B;
+
+  if (m_jkbuilder) {
+    m_jkbuilder->set_density_alpha(p_A);
+    m_jkbuilder->set_density_beta(p_B);
+    m_jkbuilder->compute_JK();
+
+    j_bb = m_jkbuilder->get_J();
+    k_bb_A = m_jkbuilder->get_K_A();
+    k_bb_B = m_jkbuilder->get_K_B();
+  }
+  else {
+    m_jbuilder->set_density_alpha(p_A);
+    m_jbuilder->set_density_beta(p_B);
+    m_jbuilder->set_coeff_alpha(m_c_bm_A);
+    m_jbuilder->set_coeff_beta(m_c_bm_B);
+
+    if (full || k_incr) {
+      m_kbuilder->set_density_alpha(p_A);
+      m_kbuilder->set_density_beta(p_B);
+    }
+    else {
+      m_kbuilder->set_density_alpha(m_p_bb_A);
+      m_kbuilder->set_density_beta(m_p_bb_B);
+    }
+    m_kbuilder->set_coeff_alpha(m_c_bm_A);
+    m_kbuilder->set_coeff_beta(m_c_bm_B);
 
-  m_kbuilder->set_density_alpha(m_p_bb_A);
-  m_kbuilder->set_density_beta(m_p_bb_B);
-  m_kbuilder->set_coeff_alpha(m_c_bm_A);
-  m_kbuilder->set_coeff_beta(m_c_bm_B);
+    m_jbuilder->set_SAD(SAD_iter, rank);
+    m_kbuilder->set_SAD(SAD_iter, rank);
 
-  m_jbuilder->set_SAD(SAD_iter, rank);
-  m_kbuilder->set_SAD(SAD_iter, rank);
+    m_jbuilder->compute_J();
+    m_kbuilder->compute_K();
 
-  m_jbuilder->compute_J();
-  m_kbuilder->compute_K();
+    j_bb = m_jbuilder->get_J();
+    k_bb_A = m_kbuilder->get_K_A();
+    k_bb_B = m_kbuilder->get_K_B();
+  }
 
-  auto j_bb = m_jbuilder->get_J();
-  auto k_bb_A = m_kbuilder->get_K_A();
-  auto k_bb_B = m_kbuilder->get_K_B();
+  if (m_incremental_fock) {
+    // accumulate the contributions of the difference densities
+    auto update = [&](dbcsr::shared_matrix<double>& acc,
+                      dbcsr::shared_matrix<double>& in, bool incr) {
+      if (!in)
+        return;
+      if (incr) {
+        acc->add(1.0, 1.0, *in);
+      }
+      else {
+        acc = dbcsr::matrix<>::copy(*in).build();
+      }
+    };
+
+    update(m_j_bb, j_bb, !full);
+    update(m_k_bb_A, k_bb_A, !full && k_incr);
+    update(m_k_bb_B, k_bb_B, !full && k_incr);
+
+    j_bb = m_j_bb;
+    k_bb_A = m_k_bb_A;
+    k_bb_B = m_k_bb_B;
+
+    m_p_last_A = dbcsr::matrix<>::copy(*m_p_bb_A).build();
+    if (m_p_bb_B)
+      m_p_last_B = dbcsr::matrix<>::copy(*m_p_bb_B).build();
+
+    m_nincr = (full) ? 0 : m_nincr + 1;
+    m_force_full = false;
+  }
 
   m_f_bb_A->clear();
   m_f_bb_A->add(1.0, 1.0, *m_core_bb);
@@ -265,7 +403,7 @@ void hfmod::form_fock(bool SAD_iter, int rank)
 
   if (m_f_bb_B) {
     m_f_bb_B->clear();
-    m_f_bb_A->add(1.0, 1.0, *m_core_bb);
+    m_f_bb_B->add(1.0, 1.0, *m_core_bb);
     m_f_bb_B->add(1.0, 1.0, *j_bb);
     m_f_bb_B->add(1.0, 1.0, *k_bb_B);
   }
@@ -427,8 +565,17 @@ desc::shared_wavefunction hfmod::compute()
         .os<>('\n');
     LOG.reset();
 
-    if (norm_A < m_scf_threshold && norm_B < m_scf_threshold && iter > 0)
+    bool converged =
+        (norm_A < m_scf_threshold && norm_B < m_scf_threshold && iter > 0);
+
+    // confirm convergence reached with incremental builds by a full build
+    if (converged && m_incremental_fock && m_nincr != 0) {
+      LOG.os<1>("Converged with incremental Fock, rebuilding.\n");
+      m_force_full = true;
+    }
+    else if (converged) {
       break;
+    }
     if (iter > m_max_iter)
       break;
 
@@ -477,8 +624,13 @@ desc::shared_wavefunction hfmod::compute()
   TIME.print_info();
   m_aoloader->print_info();
 
-  m_jbuilder->print_info();
-  m_kbuilder->print_info();
+  if (m_jkbuilder) {
+    m_jkbuilder->print_info();
+  }
+  else {
+    m_jbuilder->print_info();
+    m_kbuilder->print_info();
+  }
 
   // separate occupied and virtual coefficient matrix
   auto separate = [&](dbcsr::shared_matrix<double>& in,
@@ -1,4 +1,6 @@
 #include "ints/aofactory.hpp"
+#include <omp.h>
+#include <algorithm>
 #include <stdexcept>
 #include <vector>
 #include "ints/integrals.hpp"
@@ -55,6 +57,7 @@ class aofactory::impl {
       shared_screener s_scr)
   {
     auto scr = s_scr.get();
+    auto stats = (scr) ? &scr->stats(t_in->name()) : nullptr;
 
     auto blksizes = t_in->blk_sizes();
 
@@ -97,8 +100,12 @@ class aofactory::impl {
               iblk[dim2] > blkbounds[dim2][1])
             continue;
 
-          if (scr && scr->skip_block_xbb(iblk[0], iblk[1], iblk[2])) {
-            continue;
+          if (scr) {
+            ++stats->blocks_considered;
+            if (scr->skip_block_xbb(iblk[0], iblk[1], iblk[2])) {
+              ++stats->blocks_skipped;
+              continue;
+            }
           }
 
           ++totblk;
@@ -140,14 +147,20 @@ class aofactory::impl {
       dbcsr::shared_tensor<3>& t_in, arrvec<int, 3>& idx, shared_screener s_scr)
   {
     auto scr = s_scr.get();
+    auto stats = (scr) ? &scr->stats(t_in->name()) : nullptr;
 
     arrvec<int, 3> newblks;
 
     for (auto x : idx[0]) {
       for (auto m : idx[1]) {
         for (auto n : idx[2]) {
-          if (scr && scr->skip_block_xbb(x, m, n))
-            continue;
+          if (scr) {
+            ++stats->blocks_considered;
+            if (scr->skip_block_xbb(x, m, n)) {
+              ++stats->blocks_skipped;
+              continue;
+            }
+          }
 
           newblks[0].push_back(x);
           newblks[1].push_back(m);
@@ -165,6 +178,7 @@ class aofactory::impl {
       shared_screener s_scr)
   {
     auto scr = s_scr.get();
+    auto stats = (scr) ? &scr->stats(t_in->name()) : nullptr;
 
     auto blksizes = t_in->blk_sizes();
 
@@ -214,8 +228,13 @@ class aofactory::impl {
                 iblk[dim3] > blkbounds[dim3][1])
               continue;
 
-            if (scr && scr->skip_block_bbbb(i0, i1, i2, i3))
-              continue;
+            if (scr) {
+              ++stats->blocks_considered;
+              if (scr->skip_block_bbbb(iblk[0], iblk[1], iblk[2], iblk[3])) {
+                ++stats->blocks_skipped;
+                continue;
+              }
+            }
 
             res[0].push_back(iblk[0]);
             res[1].push_back(iblk[1]);
@@ -241,6 +260,11 @@ class aofactory::impl {
     return gen;
   }
 
+  util::mpi_time& get_time()
+  {
+    return m_time;
+  }
+
  protected:
   world m_world;
 
@@ -260,6 +284,15 @@ class aofactory::impl {
   int m_cint_nbas;
 
   CINTIntegralFunction* m_intfunc;
+  CINTOptimizerFunction* m_optfunc;
+
+  // libcint optimizers, built once per operator/centre combination and
+  // shared read-only between threads
+  std::map<int, CINTOpt*> m_cint_opts;
+  CINTOpt* m_intopt = nullptr;
+
+  // per-thread scratch memory, reused by all integral calls
+  cint_arena m_arena;
 
   std::string m_intname;
   ctr m_ctr = ctr::invalid;
@@ -270,6 +303,9 @@ class aofactory::impl {
   std::vector<std::vector<int>> m_nshells;
   std::vector<std::vector<int>> m_tensor_sizes;
 
+  // timings of the integral kernels, including thread load balance
+  util::mpi_time m_time;
+
   double gaussian_int(int l, double alpha)
   {
     double l1 = (l + 1) * 0.5;
@@ -317,7 +353,8 @@ class aofactory::impl {
   impl(desc::shared_molecule mol, world w) :
       m_world(w), m_cart(w.dbcsr_grid()), m_atoms(mol->atoms()),
       m_cbas(mol->c_basis()), m_cdfbas(mol->c_dfbasis()),
-      m_cbas2(mol->c_basis2()), m_cint_natoms(0), m_cint_nbas(0), m_max_l(0)
+      m_cbas2(mol->c_basis2()), m_cint_natoms(0), m_cint_nbas(0), m_max_l(0),
+      m_time(w.comm(), "Integral kernels")
   {
     init();
   }
@@ -329,7 +366,8 @@ class aofactory::impl {
       desc::shared_cluster_basis cbas2) :
       m_world(w),
       m_cart(w.dbcsr_grid()), m_cbas(cbas), m_cdfbas(cdfbas), m_cbas2(cbas2),
-      m_cint_natoms(0), m_cint_nbas(0), m_max_l(0)
+      m_cint_natoms(0), m_cint_nbas(0), m_max_l(0),
+      m_time(w.comm(), "Integral kernels")
   {
     for (auto& cltr : *cbas) {
       for (auto shell : cltr.shells) {
@@ -352,6 +390,11 @@ class aofactory::impl {
     init();
   }
 
+  ~impl()
+  {
+    for (auto& [key, opt] : m_cint_opts) { CINTdel_optimizer(&opt); }
+  }
+
   void init()
   {
     // atoms
@@ -423,8 +466,6 @@ class aofactory::impl {
           m_cint_bas.insert(m_cint_bas.end(), bas_i.begin(), bas_i.end());
         }
       }
-
-      m_cint_nbas += cbas.nbf();
     };
 
     add_basis(*m_cbas);
@@ -433,6 +474,9 @@ class aofactory::impl {
     if (m_cbas2)
       add_basis(*m_cbas2);
 
+    // number of shells, including the unit shell
+    m_cint_nbas = m_cint_bas.size() / BAS_SLOTS;
+
     // std::cout << "MAX_L: " << m_max_l << std::endl;
 
     /*auto print = [](auto& v) {
@@ -536,59 +580,185 @@ class aofactory::impl {
     switch (combine(m_op, m_ctr)) {
       case combine(op::overlap, ctr::c_2c1e):
         m_intfunc = &int1e_ovlp_sph;
+        m_optfunc = &int1e_ovlp_optimizer;
         break;
 
       case combine(op::kinetic, ctr::c_2c1e):
         m_intfunc = &int1e_kin_sph;
+        m_optfunc = &int1e_kin_optimizer;
         break;
 
       case combine(op::nuclear, ctr::c_2c1e):
         m_intfunc = &int1e_nuc_sph;
+        m_optfunc = &int1e_nuc_optimizer;
         break;
 
       case combine(op::overlap, ctr::c_3c1e):
         m_intfunc = &int3c1e_sph;
+        m_optfunc = &int3c1e_optimizer;
         break;
 
       case combine(op::overlap, ctr::c_4c1e):
         m_intfunc = &int4c1e_sph;
+        m_optfunc = &int4c1e_optimizer;
         break;
 
       case combine(op::coulomb, ctr::c_2c2e):
         m_intfunc = &int2c2e_sph;
+        m_optfunc = &int2c2e_optimizer;
         break;
 
       case combine(op::coulomb, ctr::c_3c2e):
         m_cint_env[PTR_RANGE_OMEGA] = 0.0;
         m_intfunc = &int3c2e_sph;
+        m_optfunc = &int3c2e_optimizer;
         break;
 
       case combine(op::coulomb, ctr::c_4c2e):
         m_intfunc = &int2e_sph;
+        m_optfunc = &int2e_optimizer;
         break;
 
       case combine(op::erfc_coulomb, ctr::c_2c2e):
         m_cint_env[PTR_RANGE_OMEGA] = -global::omega;
         m_intfunc = &int2c2e_sph;
+        m_optfunc = &int2c2e_optimizer;
         break;
 
       case combine(op::erfc_coulomb, ctr::c_3c2e):
         m_cint_env[PTR_RANGE_OMEGA] = -global::omega;
         m_intfunc = &int3c2e_sph;
+        m_optfunc = &int3c2e_optimizer;
         break;
 
       case combine(op::erfc_coulomb, ctr::c_4c2e):
         m_cint_env[PTR_RANGE_OMEGA] = -global::omega;
         m_intfunc = &int2e_sph;
+        m_optfunc = &int2e_optimizer;
         break;
 
       case combine(op::emultipole, ctr::c_2c1e):
         m_intfunc = &int1e_r_sph;
+        m_optfunc = &int1e_r_optimizer;
         break;
 
       default:
         throw std::runtime_error("Operator/Centre combination not valid!");
     }
+
+    m_intopt = nullptr;
+
+    // build the optimizer only the first time this integral type is set
+    // up, unless they are turned off
+    if (global::cint_optimizers) {
+      const int key = combine(m_op, m_ctr);
+      auto it = m_cint_opts.find(key);
+
+      if (it == m_cint_opts.end()) {
+        CINTOpt* opt = nullptr;
+        m_optfunc(
+            &opt, m_cint_atm.data(), m_cint_natoms, m_cint_bas.data(),
+            m_cint_nbas, m_cint_env.data());
+        it = m_cint_opts.emplace(key, opt).first;
+      }
+
+      m_intopt = it->second;
+    }
+
+    setup_arena();
+  }
+
+  void setup_arena()
+  {
+    int ncentres = 0;
+
+    switch (m_ctr) {
+      case ctr::c_2c1e:
+      case ctr::c_2c2e:
+        ncentres = 2;
+        break;
+      case ctr::c_3c1e:
+      case ctr::c_3c2e:
+        ncentres = 3;
+        break;
+      case ctr::c_4c1e:
+      case ctr::c_4c2e:
+        ncentres = 4;
+        break;
+      default:
+        throw std::runtime_error("Invalid number of centres.");
+    }
+
+    const int ncomp = (m_op == op::emultipole) ? 3 : 1;
+
+    // The cache size grows with the angular momentum and the number of
+    // primitives of each shell, so it is enough to query the shells whose
+    // (l, nprim) is not dominated by any other shell in the basis
+    std::vector<int> cands;
+
+    auto is_dominated = [this](int s0, int s1) {
+      const int* b0 = &m_cint_bas[s0 * BAS_SLOTS];
+      const int* b1 = &m_cint_bas[s1 * BAS_SLOTS];
+      return b0[ANG_OF] <= b1[ANG_OF] && b0[NPRIM_OF] <= b1[NPRIM_OF];
+    };
+
+    for (size_t idim = 0; idim != m_shell_offsets.size(); ++idim) {
+      if (m_shell_offsets[idim].size() == 0)
+        continue;
+
+      const int sbegin = m_shell_offsets[idim].front();
+      const int send = m_shell_offsets[idim].back() + m_nshells[idim].back();
+
+      for (int s = sbegin; s != send; ++s) {
+        bool dominated = false;
+        for (auto c : cands) {
+          if (is_dominated(s, c)) {
+            dominated = true;
+            break;
+          }
+        }
+        if (dominated)
+          continue;
+
+        cands.erase(
+            std::remove_if(
+                cands.begin(), cands.end(),
+                [&](int c) { return is_dominated(c, s); }),
+            cands.end());
+
+        cands.push_back(s);
+      }
+    }
+
+    const size_t ncands = cands.size();
+    size_t ncombs = 1;
+    for (int i = 0; i != ncentres; ++i) { ncombs *= ncands; }
+
+    size_t max_buf_size = 0;
+    size_t max_cache_size = 0;
+    std::vector<int> shls(ncentres);
+
+    for (size_t icomb = 0; icomb != ncombs; ++icomb) {
+      size_t rem = icomb;
+      size_t bufsize = ncomp;
+
+      for (int ic = 0; ic != ncentres; ++ic) {
+        shls[ic] = cands[rem % ncands];
+        rem /= ncands;
+        bufsize *= CINTcgto_spheric(shls[ic], m_cint_bas.data());
+      }
+
+      // libcint returns the required cache size when out is null
+      size_t cachesize = m_intfunc(
+          nullptr, nullptr, shls.data(), m_cint_atm.data(), m_cint_natoms,
+          m_cint_bas.data(), m_cint_nbas, m_cint_env.data(), m_intopt,
+          nullptr);
+
+      max_buf_size = std::max(max_buf_size, bufsize);
+      max_cache_size = std::max(max_cache_size, cachesize);
+    }
+
+    m_arena.reserve(omp_get_max_threads(), max_buf_size, max_cache_size);
   }
 
   void finalize()
@@ -619,9 +789,9 @@ class aofactory::impl {
     }
 
     calc_ints(
-        *m_ints, m_shell_offsets, m_nshells, m_intfunc, m_cint_atm.data(),
-        m_cint_natoms, m_cint_bas.data(), m_cint_nbas, m_cint_env.data(),
-        m_max_l);
+        *m_ints, m_shell_offsets, m_nshells, m_intfunc, m_intopt,
+        m_cint_atm.data(), m_cint_natoms, m_cint_bas.data(), m_cint_nbas,
+        m_cint_env.data(), m_arena);
 
     return m_ints;
   }
@@ -654,8 +824,8 @@ class aofactory::impl {
 
     calc_ints(
         *ints_x, *ints_y, *ints_z, m_shell_offsets, m_nshells, m_intfunc,
-        m_cint_atm.data(), m_cint_natoms, m_cint_bas.data(), m_cint_nbas,
-        m_cint_env.data(), m_max_l);
+        m_intopt, m_cint_atm.data(), m_cint_natoms, m_cint_bas.data(),
+        m_cint_nbas, m_cint_env.data(), m_arena);
 
     std::array<dbcsr::shared_matrix<double>, 3> out = {ints_x, ints_y, ints_z};
 
@@ -669,18 +839,32 @@ class aofactory::impl {
   {
     reserve_3_partial(t_in, blkbounds, s_scr);
 
+    auto& time = m_time.sub("3c integrals");
+    m_time.start();
+    time.start();
+
     calc_ints(
-        *t_in, m_shell_offsets, m_nshells, m_intfunc, m_cint_atm.data(),
-        m_cint_natoms, m_cint_bas.data(), m_cint_nbas, m_cint_env.data(),
-        m_max_l);
+        *t_in, m_shell_offsets, m_nshells, m_intfunc, m_intopt,
+        m_cint_atm.data(), m_cint_natoms, m_cint_bas.data(), m_cint_nbas,
+        m_cint_env.data(), m_arena, s_scr.get(), time);
+
+    time.finish();
+    m_time.finish();
   }
 
   void compute_3_all(dbcsr::shared_tensor<3>& t_in)
   {
+    auto& time = m_time.sub("3c integrals");
+    m_time.start();
+    time.start();
+
     calc_ints(
-        *t_in, m_shell_offsets, m_nshells, m_intfunc, m_cint_atm.data(),
-        m_cint_natoms, m_cint_bas.data(), m_cint_nbas, m_cint_env.data(),
-        m_max_l);
+        *t_in, m_shell_offsets, m_nshells, m_intfunc, m_intopt,
+        m_cint_atm.data(), m_cint_natoms, m_cint_bas.data(), m_cint_nbas,
+        m_cint_env.data(), m_arena, nullptr, time);
+
+    time.finish();
+    m_time.finish();
   }
 
   void compute_3_partial_idx(
@@ -688,10 +872,17 @@ class aofactory::impl {
   {
     reserve_3_partial_idx(t_in, idx, s_scr);
 
+    auto& time = m_time.sub("3c integrals");
+    m_time.start();
+    time.start();
+
     calc_ints(
-        *t_in, m_shell_offsets, m_nshells, m_intfunc, m_cint_atm.data(),
-        m_cint_natoms, m_cint_bas.data(), m_cint_nbas, m_cint_env.data(),
-        m_max_l);
+        *t_in, m_shell_offsets, m_nshells, m_intfunc, m_intopt,
+        m_cint_atm.data(), m_cint_natoms, m_cint_bas.data(), m_cint_nbas,
+        m_cint_env.data(), m_arena, s_scr.get(), time);
+
+    time.finish();
+    m_time.finish();
   }
 
   void compute_4_partial(
@@ -701,10 +892,126 @@ class aofactory::impl {
   {
     reserve_4_partial(t_in, blkbounds, s_scr);
 
+    auto& time = m_time.sub("4c integrals");
+    m_time.start();
+    time.start();
+
     calc_ints(
-        *t_in, m_shell_offsets, m_nshells, m_intfunc, m_cint_atm.data(),
-        m_cint_natoms, m_cint_bas.data(), m_cint_nbas, m_cint_env.data(),
-        m_max_l);
+        *t_in, m_shell_offsets, m_nshells, m_intfunc, m_intopt,
+        m_cint_atm.data(), m_cint_natoms, m_cint_bas.data(), m_cint_nbas,
+        m_cint_env.data(), m_arena, s_scr.get(), time);
+
+    time.finish();
+    m_time.finish();
+  }
+
+  std::array<int64_t, 2> compute_4_jk(
+      dbcsr::matrix<double>* p_j,
+      const std::vector<dbcsr::matrix<double>*>& p_k,
+      dbcsr::matrix<double>* j_out,
+      const std::vector<dbcsr::matrix<double>*>& k_out,
+      const std::vector<std::array<int, 2>>& pairs,
+      const std::vector<jk_task>& tasks,
+      const Eigen::MatrixXd& q,
+      double threshold)
+  {
+    auto& time = m_time.sub("4c direct J/K");
+    m_time.start();
+    time.start();
+
+    auto out = calc_jk_direct(
+        p_j, p_k, j_out, k_out, pairs, tasks, q, m_shell_offsets[0],
+        m_nshells[0], m_intfunc, m_intopt, m_cint_atm.data(), m_cint_natoms,
+        m_cint_bas.data(), m_cint_nbas, m_cint_env.data(), m_arena,
+        threshold, m_world.comm(), time);
+
+    time.finish();
+    m_time.finish();
+
+    return out;
+  }
+
+  Eigen::MatrixXd compute_pair_multipoles(
+      dbcsr::matrix<double>& p,
+      const std::vector<std::array<int, 2>>& pairs,
+      const std::vector<int>& pair_group,
+      const std::vector<std::array<double, 3>>& centres,
+      int order)
+  {
+    auto& time = m_time.sub("Pair multipoles");
+    m_time.start();
+    time.start();
+
+    auto out = calc_pair_multipoles(
+        p, pairs, pair_group, centres, m_b_cint_offsets, m_cbas->nshells(),
+        order, m_cint_atm.data(), m_cint_natoms, m_cint_bas.data(),
+        m_cint_nbas, m_cint_env.data(), m_world.comm(), time);
+
+    time.finish();
+    m_time.finish();
+
+    return out;
+  }
+
+  void compute_pair_potential(
+      const Eigen::MatrixXd& l,
+      dbcsr::matrix<double>& v_out,
+      const std::vector<std::array<int, 2>>& pairs,
+      const std::vector<int>& pair_group,
+      const std::vector<std::array<double, 3>>& centres,
+      int order)
+  {
+    auto& time = m_time.sub("Pair potential");
+    m_time.start();
+    time.start();
+
+    calc_pair_potential(
+        l, v_out, pairs, pair_group, centres, m_b_cint_offsets,
+        m_cbas->nshells(), order, m_cint_atm.data(), m_cint_natoms,
+        m_cint_bas.data(), m_cint_nbas, m_cint_env.data(), m_world.comm(),
+        time);
+
+    time.finish();
+    m_time.finish();
+  }
+
+  std::array<int64_t, 2> compute_k_seminumerical(
+      const std::vector<dbcsr::matrix<double>*>& p_k,
+      const std::vector<dbcsr::matrix<double>*>& k_out,
+      const std::vector<grid_batch>& batches,
+      const std::vector<double>& extents,
+      double threshold)
+  {
+    auto& time = m_time.sub("Seminumerical K");
+    m_time.start();
+    time.start();
+
+    auto out = calc_k_seminumerical(
+        p_k, k_out, batches, extents, m_b_cint_offsets, m_cbas->nshells(),
+        m_cint_atm.data(), m_cint_natoms, m_cint_bas.data(), m_cint_nbas,
+        m_cint_env.data(), m_cint_env.size(), threshold, m_world.comm(),
+        time);
+
+    time.finish();
+    m_time.finish();
+
+    return out;
+  }
+
+  void compute_grid_overlap(
+      const std::vector<grid_batch>& batches, dbcsr::matrix<double>& s_out)
+  {
+    auto& time = m_time.sub("Grid overlap");
+    m_time.start();
+    time.start();
+
+    calc_grid_overlap(
+        batches, s_out, m_b_cint_offsets, m_cbas->nshells(),
+        m_cint_atm.data(), m_cint_bas.data(), m_cint_env.data(),
+        m_world.comm(), time);
+
+    time.finish();
+    m_time.finish();
   }
 
   dbcsr::shared_matrix<double> compute_screen(
@@ -745,22 +1052,29 @@ class aofactory::impl {
       m_ints->reserve_all();
     }
 
+    auto& time = m_time.sub("Schwarz integrals");
+    m_time.start();
+    time.start();
+
     if (dim == "bbbb" && method == "schwarz") {
       calc_ints_schwarz_mn(
-          *m_ints, m_shell_offsets, m_nshells, m_intfunc, m_cint_atm.data(),
-          m_cint_natoms, m_cint_bas.data(), m_cint_nbas, m_cint_env.data(),
-          m_max_l);
+          *m_ints, m_shell_offsets, m_nshells, m_intfunc, m_intopt,
+          m_cint_atm.data(), m_cint_natoms, m_cint_bas.data(), m_cint_nbas,
+          m_cint_env.data(), m_arena, time);
     }
     else if (dim == "xx" && method == "schwarz") {
       calc_ints_schwarz_x(
-          *m_ints, m_shell_offsets, m_nshells, m_intfunc, m_cint_atm.data(),
-          m_cint_natoms, m_cint_bas.data(), m_cint_nbas, m_cint_env.data(),
-          m_max_l);
+          *m_ints, m_shell_offsets, m_nshells, m_intfunc, m_intopt,
+          m_cint_atm.data(), m_cint_natoms, m_cint_bas.data(), m_cint_nbas,
+          m_cint_env.data(), m_arena, time);
     }
     else {
       throw std::runtime_error("Unknown screening method.");
     }
 
+    time.finish();
+    m_time.finish();
+
     // dbcsr::print(*m_ints);
 
     return m_ints;
@@ -928,6 +1242,63 @@ void aofactory::ao_4c_fill(
   pimpl->compute_4_partial(t_in, blkbounds, scr);
 }
 
+std::array<int64_t, 2> aofactory::ao_4c_jk(
+    dbcsr::matrix<double>* p_j,
+    const std::vector<dbcsr::matrix<double>*>& p_k,
+    dbcsr::matrix<double>* j_out,
+    const std::vector<dbcsr::matrix<double>*>& k_out,
+    const std::vector<std::array<int, 2>>& pairs,
+    const std::vector<jk_task>& tasks,
+    const Eigen::MatrixXd& q,
+    double threshold)
+{
+  pimpl->set_center(ctr::c_4c2e);
+  pimpl->set_dim("bbbb");
+  pimpl->set_operator(op::coulomb);
+  pimpl->setup_calc();
+  return pimpl->compute_4_jk(
+      p_j, p_k, j_out, k_out, pairs, tasks, q, threshold);
+}
+
+Eigen::MatrixXd aofactory::ao_pair_multipoles(
+    dbcsr::matrix<double>& p,
+    const std::vector<std::array<int, 2>>& pairs,
+    const std::vector<int>& pair_group,
+    const std::vector<std::array<double, 3>>& centres,
+    int order)
+{
+  return pimpl->compute_pair_multipoles(
+      p, pairs, pair_group, centres, order);
+}
+
+void aofactory::ao_pair_potential(
+    const Eigen::MatrixXd& l,
+    dbcsr::matrix<double>& v_out,
+    const std::vector<std::array<int, 2>>& pairs,
+    const std::vector<int>& pair_group,
+    const std::vector<std::array<double, 3>>& centres,
+    int order)
+{
+  pimpl->compute_pair_potential(l, v_out, pairs, pair_group, centres, order);
+}
+
+std::array<int64_t, 2> aofactory::ao_k_seminumerical(
+    const std::vector<dbcsr::matrix<double>*>& p_k,
+    const std::vector<dbcsr::matrix<double>*>& k_out,
+    const std::vector<grid_batch>& batches,
+    const std::vector<double>& extents,
+    double threshold)
+{
+  return pimpl->compute_k_seminumerical(
+      p_k, k_out, batches, extents, threshold);
+}
+
+void aofactory::ao_grid_overlap(
+    const std::vector<grid_batch>& batches, dbcsr::matrix<double>& s_out)
+{
+  pimpl->compute_grid_overlap(batches, s_out);
+}
+
 dbcsr::shared_matrix<double> aofactory::ao_schwarz()
 {
   pimpl->set_name("Z_mn");
@@ -974,6 +1345,11 @@ aofactory::get_generator(shared_screener s_scr)
   return pimpl->get_generator(s_scr);
 }
 
+util::mpi_time& aofactory::get_time()
+{
+  return pimpl->get_time();
+}
+
 desc::shared_cluster_basis remove_lindep(
     world wrd,
     desc::shared_cluster_basis cbas,
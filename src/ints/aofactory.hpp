@@ -4,12 +4,16 @@
 #include <mpi.h>
 #include <dbcsr_conversions.hpp>
 #include <dbcsr_tensor.hpp>
+#include <array>
 #include <functional>
 #include <limits>
 #include <map>
 #include <string>
 #include "desc/molecule.hpp"
+#include "ints/molgrid.hpp"
+#include "ints/shellpairs.hpp"
 #include "megalochem.hpp"
+#include "utils/mpi_time.hpp"
 
 /* Loads the AO integrals
  * Op: Operator (Coulom, kinetic, ...)
@@ -28,6 +32,10 @@ struct global {
   static inline double omega = 0.1;
   static inline double qr_theta = 1e-5;
   static inline double qr_rho = 40;
+  // memory per node in GB used by the batch planner, 0 to detect
+  static inline double node_memory = 0.0;
+  // use the libcint optimizers, only turned off to time them
+  static inline bool cint_optimizers = true;
 };
 
 enum class metric { coulomb, erfc_coulomb, qr_fit, pari };
@@ -106,11 +114,69 @@ class aofactory {
       vec<vec<int>>& blkbounds,
       std::shared_ptr<screener> scr);
 
+  /* Integral-direct Coulomb and exchange matrices of the densities p_j
+   * and p_k, written into j_out and k_out without sign, from the quartets
+   * of the shell pairs in tasks, see calc_jk_direct. q holds the Schwarz
+   * bounds of the shell pairs, i.e. ao_schwarz as a dense matrix.
+   * Returns the number of computed and skipped shell quartets.
+   */
+  std::array<int64_t, 2> ao_4c_jk(
+      dbcsr::matrix<double>* p_j,
+      const std::vector<dbcsr::matrix<double>*>& p_k,
+      dbcsr::matrix<double>* j_out,
+      const std::vector<dbcsr::matrix<double>*>& k_out,
+      const std::vector<std::array<int, 2>>& pairs,
+      const std::vector<jk_task>& tasks,
+      const Eigen::MatrixXd& q,
+      double threshold);
+
+  /* Multipole moments of the density p for groups of shell pairs i >= j
+   * of the basis, about the centre of each group, up to the given order,
+   * see calc_pair_multipoles.
+   */
+  Eigen::MatrixXd ao_pair_multipoles(
+      dbcsr::matrix<double>& p,
+      const std::vector<std::array<int, 2>>& pairs,
+      const std::vector<int>& pair_group,
+      const std::vector<std::array<double, 3>>& centres,
+      int order);
+
+  /* Potential matrix of the local expansions l of the given order about
+   * the centres of the groups of shell pairs, written into v_out, see
+   * calc_pair_potential.
+   */
+  void ao_pair_potential(
+      const Eigen::MatrixXd& l,
+      dbcsr::matrix<double>& v_out,
+      const std::vector<std::array<int, 2>>& pairs,
+      const std::vector<int>& pair_group,
+      const std::vector<std::array<double, 3>>& centres,
+      int order);
+
+  /* Seminumerical exchange matrices of the densities p_k on the grid
+   * batches, not symmetrized, see calc_k_seminumerical. extents holds
+   * the extents of the shells. Returns the number of computed and skipped
+   * shell pair batches.
+   */
+  std::array<int64_t, 2> ao_k_seminumerical(
+      const std::vector<dbcsr::matrix<double>*>& p_k,
+      const std::vector<dbcsr::matrix<double>*>& k_out,
+      const std::vector<grid_batch>& batches,
+      const std::vector<double>& extents,
+      double threshold);
+
+  // overlap matrix integrated on the grid batches, written into s_out
+  void ao_grid_overlap(
+      const std::vector<grid_batch>& batches, dbcsr::matrix<double>& s_out);
+
   std::function<void(dbcsr::shared_tensor<3, double>&, vec<vec<int>>&)>
   get_generator(std::shared_ptr<screener> s_scr);
 
   desc::shared_molecule mol();
 
+  // timings of the integral kernels
+  util::mpi_time& get_time();
+
 };  // end class aofactory
 
 desc::shared_cluster_basis remove_lindep(
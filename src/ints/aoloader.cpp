@@ -3,6 +3,11 @@
 #include "math/linalg/LLT.hpp"
 #include "math/solvers/hermitian_eigen_solver.hpp"
 
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include "utils/unique.hpp"
+
 namespace megalochem {
 
 namespace ints {
@@ -10,8 +15,99 @@ namespace ints {
 using smatd = dbcsr::shared_matrix<double>;
 using sbt3 = dbcsr::sbtensor<3, double>;
 using sbt4 = dbcsr::sbtensor<4, double>;
+using reg_t = key_registry<key>;
+
+class aoloader::impl : public std::enable_shared_from_this<aoloader::impl> {
+ public:
+  world m_world;
+  dbcsr::cart m_cart;
+  desc::shared_molecule m_mol;
+  dbcsr::btype m_btype_eris;
+  dbcsr::btype m_btype_intermeds;
+  int m_nbatches_b;
+  int m_nbatches_x;
+  std::string m_screening;
+  std::string m_cache_dir;
+  double m_memory_budget;
+  // GB per rank of hybrid tensors
+  double m_hybrid_memory;
+
+  util::mpi_log LOG;
+  util::mpi_time TIME;
+
+  // kept for the screening statistics
+  ints::shared_screener m_scr;
+
+  std::shared_ptr<ints::aofactory> m_aofac;
+  std::shared_ptr<ints::dfitting> m_dfit;
+
+  // persistent cache, or scratch space for evicted entries
+  std::shared_ptr<integral_cache> m_cache;
+  std::string m_spill_dir;
+
+  impl(create_pack& p) :
+      m_world(p.p_set_world), m_cart(p.p_set_world.dbcsr_grid()),
+      m_mol(p.p_set_molecule),
+      m_btype_eris((p.p_btype_eris) ? *p.p_btype_eris : dbcsr::btype::core),
+      m_btype_intermeds(
+          (p.p_btype_intermeds) ? *p.p_btype_intermeds : dbcsr::btype::core),
+      m_nbatches_b((p.p_nbatches_b) ? *p.p_nbatches_b : 5),
+      m_nbatches_x((p.p_nbatches_x) ? *p.p_nbatches_x : 5),
+      m_screening((p.p_screening) ? *p.p_screening : "schwarz"),
+      m_cache_dir((p.p_cache_dir) ? *p.p_cache_dir : ""),
+      m_memory_budget((p.p_memory_budget) ? *p.p_memory_budget : 0.0),
+      m_hybrid_memory(
+          (p.p_hybrid_memory) ? *p.p_hybrid_memory :
+                                dbcsr::btensor_global::hybrid_memory),
+      LOG(p.p_set_world.comm(), (p.p_print) ? *p.p_print : 0),
+      TIME(p.p_set_world.comm(), "AO-loader"),
+      m_scr((p.p_screener) ? *p.p_screener : nullptr)
+  {
+  }
+
+  // the spill directory is only removed once no entry can be evicted to it
+  ~impl()
+  {
+    if (!m_spill_dir.empty() && m_world.rank() == 0) {
+      std::filesystem::remove_all(m_spill_dir);
+    }
+  }
+
+  std::pair<smatd, smatd> invert(smatd in);
+
+  sbt3 create_xbb(
+      std::string name, dbcsr::shared_pgrid<3> spgrid3, dbcsr::btype type);
+
+  sbt4 create_bbbb(
+      std::string name, dbcsr::shared_pgrid<4> spgrid4, dbcsr::btype type);
+
+  // name of the cache entry of a key, empty if the key is not cached
+  std::string cache_entry(key k);
+
+  void load_entry(key k, smatd& out, const reg_t& reg);
+  void load_entry(key k, sbt3& out, const reg_t& reg);
+  void load_entry(key k, sbt4& out, const reg_t& reg);
+  void load_entry(key k, ints::shared_screener& out, const reg_t& reg);
 
-std::pair<smatd, smatd> aoloader::invert(smatd in)
+  template <class M>
+  void save_entry(key k, const M& value);
+
+  // registers func as generator of key k in the registry. The value is
+  // read from the cache if possible and written to it once computed.
+  // Evicted values are written to the cache as well.
+  template <class M>
+  void add_lazy(
+      reg_t& reg, key k, bool keep, std::function<M(const reg_t&)> func);
+
+  void add_generator(reg_t& reg, key k, bool keep);
+
+  // sets up the integral engines, process grids and the cache
+  void setup(reg_t& reg);
+
+  void print_info();
+};
+
+std::pair<smatd, smatd> aoloader::impl::invert(smatd in)
 {
   auto m = in->row_blk_sizes();
 
@@ -31,509 +127,709 @@ std::pair<smatd, smatd> aoloader::invert(smatd in)
   return std::make_pair<smatd, smatd>(std::move(inv), std::move(inv_sqrt));
 }
 
-void aoloader::compute()
+sbt3 aoloader::impl::create_xbb(
+    std::string name, dbcsr::shared_pgrid<3> spgrid3, dbcsr::btype type)
 {
-  LOG.os<>("Loading AO quantities.\n");
+  auto b = m_mol->dims().b();
+  auto x = m_mol->dims().x();
+  arrvec<int, 3> xbb = {x, b, b};
 
-  TIME.start();
+  std::array<int, 3> bdims = {m_nbatches_x, m_nbatches_b, m_nbatches_b};
 
-  std::shared_ptr<ints::aofactory> m_aofac =
-      std::make_shared<ints::aofactory>(m_mol, m_world);
+  auto blkmap_b = m_mol->c_basis()->block_to_atom(m_mol->atoms());
+  auto blkmap_x = m_mol->c_dfbasis()->block_to_atom(m_mol->atoms());
 
-  ints::dfitting dfit(m_world, m_mol, LOG.global_plev());
+  arrvec<int, 3> blkmaps = {blkmap_x, blkmap_b, blkmap_b};
 
-  // setup all pgrids
-  dbcsr::shared_pgrid<2> spgrid2;
-  dbcsr::shared_pgrid<3> spgrid3;
-  dbcsr::shared_pgrid<4> spgrid4;
+  auto out = dbcsr::btensor<3>::create()
+                 .name(name)
+                 .set_pgrid(spgrid3)
+                 .blk_sizes(xbb)
+                 .batch_dims(bdims)
+                 .btensor_type(type)
+                 .hybrid_memory(m_hybrid_memory)
+                 .blk_maps(blkmaps)
+                 .print(LOG.global_plev())
+                 .build();
 
-  spgrid2 = dbcsr::pgrid<2>::create(m_cart.comm()).build();
-  m_reg.insert(key::pgrid2, spgrid2);
-  m_to_keep[static_cast<int>(key::pgrid2)] = true;
+  return out;
+}
 
-  int nbf = m_mol->c_basis()->nbf();
+sbt4 aoloader::impl::create_bbbb(
+    std::string name, dbcsr::shared_pgrid<4> spgrid4, dbcsr::btype type)
+{
+  auto b = m_mol->dims().b();
+  arrvec<int, 4> bbbb = {b, b, b, b};
+
+  std::array<int, 4> bdims = {
+      m_nbatches_b, m_nbatches_b, m_nbatches_b, m_nbatches_b};
+
+  auto blkmap_b = m_mol->c_basis()->block_to_atom(m_mol->atoms());
+  arrvec<int, 4> blkmaps = {blkmap_b, blkmap_b, blkmap_b, blkmap_b};
+
+  auto out = dbcsr::btensor<4>::create()
+                 .name(name)
+                 .set_pgrid(spgrid4)
+                 .blk_sizes(bbbb)
+                 .blk_maps(blkmaps)
+                 .batch_dims(bdims)
+                 .btensor_type(type)
+                 .hybrid_memory(m_hybrid_memory)
+                 .print(LOG.global_plev())
+                 .build();
+
+  return out;
+}
 
-  if (m_mol->c_dfbasis()) {
-    int naux = m_mol->c_dfbasis()->nbf();
-    std::array<int, 3> pdims3 = {naux, nbf, nbf};
-    spgrid3 =
-        dbcsr::pgrid<3>::create(m_cart.comm()).tensor_dims(pdims3).build();
-    m_reg.insert(key::pgrid3, spgrid3);
-    m_to_keep[static_cast<int>(key::pgrid3)] = true;
+std::string aoloader::impl::cache_entry(key k)
+{
+  bool eris = (m_btype_eris != dbcsr::btype::direct);
+  bool imeds = (m_btype_intermeds != dbcsr::btype::direct);
+
+  // entries depending on the metric are tagged with it, and the attenuated
+  // ones with the range-separation parameter
+  std::ostringstream erfc;
+  erfc << "_erfc_" << std::hexfloat << ints::global::omega;
+
+  auto coul = [](std::string name) { return name + "_coulomb"; };
+  auto attn = [&erfc](std::string name) { return name + erfc.str(); };
+
+  switch (k) {
+    case key::ovlp_bb: return "ovlp_bb";
+    case key::kin_bb: return "kin_bb";
+    case key::pot_bb: return "pot_bb";
+    case key::ovlp_xx: return "ovlp_xx";
+    case key::ovlp_bb_inv: return "ovlp_bb_inv";
+    case key::ovlp_xx_inv: return "ovlp_xx_inv";
+    case key::coul_xx: return coul("metric_xx");
+    case key::erfc_xx: return attn("metric_xx");
+    case key::coul_xx_inv: return coul("metric_xx_inv");
+    case key::erfc_xx_inv: return attn("metric_xx_inv");
+    case key::coul_xx_invsqrt: return coul("metric_xx_invsqrt");
+    case key::erfc_xx_invsqrt: return attn("metric_xx_invsqrt");
+    case key::coul_xbb: return (eris) ? coul("eri_xbb") : "";
+    case key::erfc_xbb: return (eris) ? attn("eri_xbb") : "";
+    case key::coul_bbbb: return (eris) ? coul("eri_bbbb") : "";
+    case key::dfit_coul_xbb: return (imeds) ? coul("dfit_xbb") : "";
+    case key::dfit_erfc_xbb: return (imeds) ? attn("dfit_xbb") : "";
+    default: return "";
   }
+}
 
-  std::array<int, 4> pdims4 = {nbf, nbf, nbf, nbf};
-  spgrid4 = dbcsr::pgrid<4>::create(m_cart.comm()).tensor_dims(pdims4).build();
-  m_reg.insert(key::pgrid4, spgrid4);
-  m_to_keep[static_cast<int>(key::pgrid4)] = true;
+void aoloader::impl::load_entry(key k, smatd& out, const reg_t&)
+{
+  out = m_cache->load_matrix(cache_entry(k));
+}
 
-  // compute s
-  if (comp(key::ovlp_bb)) {
-    LOG.os<>("Computing overlap integrals\n");
-    auto& time = TIME.sub("Overlap integrals");
-    time.start();
-    auto s = m_aofac->ao_overlap();
-    m_reg.insert(key::ovlp_bb, s);
-    time.finish();
-  }
+void aoloader::impl::load_entry(key k, sbt3& out, const reg_t& reg)
+{
+  auto spgrid3 = reg.get<dbcsr::shared_pgrid<3>>(key::pgrid3);
 
-  // compute k
-  if (comp(key::kin_bb)) {
-    LOG.os<>("Computing kinetic integrals\n");
-    auto& time = TIME.sub("Kinetic integrals");
-    time.start();
-    auto k = m_aofac->ao_kinetic();
-    m_reg.insert(key::kin_bb, k);
-    time.finish();
+  if (k == key::dfit_coul_xbb || k == key::dfit_erfc_xbb) {
+    out = create_xbb(
+        m_mol->name() + "_c_xbb_batched", spgrid3, m_btype_intermeds);
   }
-
-  // compute v
-  if (comp(key::pot_bb)) {
-    LOG.os<>("Computing nuclear integrals\n");
-    auto& time = TIME.sub("Nuclear integrals");
-    time.start();
-    auto v = m_aofac->ao_nuclear();
-    m_reg.insert(key::pot_bb, v);
-    time.finish();
+  else {
+    out = create_xbb(m_mol->name() + "_eri_batched", spgrid3, m_btype_eris);
   }
 
-  if (comp(key::ovlp_xx)) {
-    LOG.os<>("Computing auxiliary overlap integrals\n");
-    auto& time = TIME.sub("Auxiliary overlap integrals");
-    time.start();
-    auto s = m_aofac->ao_auxoverlap();
-    m_reg.insert(key::ovlp_xx, s);
-    time.finish();
-  }
+  m_cache->load(cache_entry(k), out);
+}
 
-  if (comp(key::ovlp_bb_inv)) {
-    LOG.os<>("Computing overlap inverse\n");
-    auto& time = TIME.sub("Inverting overlap matrix");
-    time.start();
-    auto s = m_reg.get<smatd>(key::ovlp_bb);
-    auto p = invert(s);
-    auto s_inv = p.first;
-    m_reg.insert(key::ovlp_bb_inv, s_inv);
-    time.finish();
-  }
+void aoloader::impl::load_entry(key k, sbt4& out, const reg_t& reg)
+{
+  auto spgrid4 = reg.get<dbcsr::shared_pgrid<4>>(key::pgrid4);
+  out = create_bbbb(m_mol->name() + "_eri_batched", spgrid4, m_btype_eris);
+  m_cache->load(cache_entry(k), out);
+}
 
-  if (comp(key::ovlp_xx_inv)) {
-    LOG.os<>("Computing auxiliary overlap inverse\n");
-    auto& time = TIME.sub("Inverting auxiliary overlap matrix");
-    time.start();
-    auto s = m_reg.get<smatd>(key::ovlp_xx);
-    auto p = invert(s);
-    auto s_inv = p.first;
-    m_reg.insert(key::ovlp_xx_inv, s_inv);
-    time.finish();
-  }
+void aoloader::impl::load_entry(
+    key k, ints::shared_screener& out, const reg_t&)
+{
+  throw std::runtime_error("Screeners are not cached");
+}
 
-  if (comp(key::coul_xx)) {
-    LOG.os<>("Computing coulomb metric\n");
-    auto& time = TIME.sub("Coulomb metric");
-    time.start();
-    auto c = m_aofac->ao_2c2e(ints::metric::coulomb);
-    m_reg.insert(key::coul_xx, c);
-    time.finish();
-  }
+template <class M>
+void aoloader::impl::save_entry(key k, const M& value)
+{
+  m_cache->save(cache_entry(k), value);
+}
 
-  if (comp(key::erfc_xx)) {
-    LOG.os<>("Computing erfc coulomb attenuated integrals\n");
+template <>
+void aoloader::impl::save_entry(key k, const ints::shared_screener& value)
+{
+  throw std::runtime_error("Screeners are not cached");
+}
 
-    auto& time = TIME.sub("Erfc-attenuated coulomb metric");
+template <class M>
+void aoloader::impl::add_lazy(
+    reg_t& reg, key k, bool keep, std::function<M(const reg_t&)> func)
+{
+  const std::string entry = cache_entry(k);
+
+  // func captures this, self keeps it alive
+  std::function<M(const reg_t&)> generator =
+      [self = shared_from_this(), k, entry, func](const reg_t& r) {
+        M out;
+
+        if (self->m_cache && !entry.empty() && self->m_cache->has(entry)) {
+          auto& time = self->TIME.sub("Loading from integral cache");
+          time.start();
+          self->load_entry(k, out, r);
+          time.finish();
+          return out;
+        }
+
+        out = func(r);
+
+        if (self->m_cache && !entry.empty() && self->m_spill_dir.empty()) {
+          auto& time = self->TIME.sub("Writing to integral cache");
+          time.start();
+          self->save_entry(k, out);
+          time.finish();
+        }
+
+        return out;
+      };
+
+  // entries without a cache entry are dropped and computed again
+  std::function<void(const M&)> spill = [self = shared_from_this(), k,
+                                         entry](const M& value) {
+    self->LOG.os<1>("Evicting key nr. ", static_cast<int>(k), '\n');
+    if (!self->m_cache || entry.empty() || self->m_cache->has(entry))
+      return;
+    auto& time = self->TIME.sub("Writing to integral cache");
     time.start();
-
-    auto c = m_aofac->ao_2c2e(metric::coulomb);
-    auto e = m_aofac->ao_2c2e(metric::erfc_coulomb);
-    auto p = invert(c);
-    auto cinv = p.first;
-
-    smatd temp = dbcsr::matrix<>::create_template(*c)
-                     .name("temp")
-                     .matrix_type(dbcsr::type::no_symmetry)
-                     .build();
-
-    dbcsr::multiply('N', 'N', 1.0, *e, *cinv, 0.0, *temp).perform();
-    dbcsr::multiply('N', 'N', 1.0, *temp, *e, 0.0, *c).perform();
-
-    m_reg.insert(key::erfc_xx, c);
-
+    self->save_entry(k, value);
     time.finish();
-  }
-
-  if (comp(key::coul_xx_inv) || comp(key::coul_xx_invsqrt)) {
-    LOG.os<>("Computing metric inverse\n");
-
-    auto& time = TIME.sub("Inverting metric");
-    time.start();
-
-    auto c = m_reg.get<smatd>(key::coul_xx);
+  };
 
-    auto p = invert(c);
-    auto cinv = p.first;
-    auto cinvsqrt = p.second;
-    if (comp(key::coul_xx_inv)) {
-      m_reg.insert(key::coul_xx_inv, cinv);
-    }
-    if (comp(key::coul_xx_invsqrt)) {
-      m_reg.insert(key::coul_xx_invsqrt, cinvsqrt);
-    }
+  reg.insert_lazy(k, generator, spill, !keep);
+}
 
-    time.finish();
-  }
+void aoloader::impl::add_generator(reg_t& reg, key k, bool keep)
+{
+  switch (k) {
+    case key::ovlp_bb:
+      add_lazy<smatd>(reg, k, keep, [this](const reg_t&) {
+        LOG.os<>("Computing overlap integrals\n");
+        auto& time = TIME.sub("Overlap integrals");
+        time.start();
+        auto s = m_aofac->ao_overlap();
+        time.finish();
+        return s;
+      });
+      break;
+
+    case key::kin_bb:
+      add_lazy<smatd>(reg, k, keep, [this](const reg_t&) {
+        LOG.os<>("Computing kinetic integrals\n");
+        auto& time = TIME.sub("Kinetic integrals");
+        time.start();
+        auto t = m_aofac->ao_kinetic();
+        time.finish();
+        return t;
+      });
+      break;
+
+    case key::pot_bb:
+      add_lazy<smatd>(reg, k, keep, [this](const reg_t&) {
+        LOG.os<>("Computing nuclear integrals\n");
+        auto& time = TIME.sub("Nuclear integrals");
+        time.start();
+        auto v = m_aofac->ao_nuclear();
+        time.finish();
+        return v;
+      });
+      break;
+
+    case key::ovlp_xx:
+      add_lazy<smatd>(reg, k, keep, [this](const reg_t&) {
+        LOG.os<>("Computing auxiliary overlap integrals\n");
+        auto& time = TIME.sub("Auxiliary overlap integrals");
+        time.start();
+        auto s = m_aofac->ao_auxoverlap();
+        time.finish();
+        return s;
+      });
+      break;
+
+    case key::ovlp_bb_inv:
+      add_lazy<smatd>(reg, k, keep, [this](const reg_t& r) {
+        auto s = r.get<smatd>(key::ovlp_bb);
+        LOG.os<>("Computing overlap inverse\n");
+        auto& time = TIME.sub("Inverting overlap matrix");
+        time.start();
+        auto s_inv = invert(s).first;
+        time.finish();
+        return s_inv;
+      });
+      break;
+
+    case key::ovlp_xx_inv:
+      add_lazy<smatd>(reg, k, keep, [this](const reg_t& r) {
+        auto s = r.get<smatd>(key::ovlp_xx);
+        LOG.os<>("Computing auxiliary overlap inverse\n");
+        auto& time = TIME.sub("Inverting auxiliary overlap matrix");
+        time.start();
+        auto s_inv = invert(s).first;
+        time.finish();
+        return s_inv;
+      });
+      break;
+
+    case key::coul_xx:
+      add_lazy<smatd>(reg, k, keep, [this](const reg_t&) {
+        LOG.os<>("Computing coulomb metric\n");
+        auto& time = TIME.sub("Coulomb metric");
+        time.start();
+        auto c = m_aofac->ao_2c2e(ints::metric::coulomb);
+        time.finish();
+        return c;
+      });
+      break;
+
+    case key::erfc_xx:
+      add_lazy<smatd>(reg, k, keep, [this](const reg_t&) {
+        LOG.os<>("Computing erfc coulomb attenuated integrals\n");
+
+        auto& time = TIME.sub("Erfc-attenuated coulomb metric");
+        time.start();
+
+        auto c = m_aofac->ao_2c2e(metric::coulomb);
+        auto e = m_aofac->ao_2c2e(metric::erfc_coulomb);
+        auto p = invert(c);
+        auto cinv = p.first;
+
+        smatd temp = dbcsr::matrix<>::create_template(*c)
+                         .name("temp")
+                         .matrix_type(dbcsr::type::no_symmetry)
+                         .build();
+
+        dbcsr::multiply('N', 'N', 1.0, *e, *cinv, 0.0, *temp).perform();
+        dbcsr::multiply('N', 'N', 1.0, *temp, *e, 0.0, *c).perform();
+
+        time.finish();
+        return c;
+      });
+      break;
+
+    case key::coul_xx_inv:
+    case key::coul_xx_invsqrt:
+    case key::erfc_xx_inv:
+    case key::erfc_xx_invsqrt:
+      add_lazy<smatd>(reg, k, keep, [this, k](const reg_t& r) {
+        bool coul = (k == key::coul_xx_inv || k == key::coul_xx_invsqrt);
+        bool sqrt = (k == key::coul_xx_invsqrt || k == key::erfc_xx_invsqrt);
+
+        auto c = r.get<smatd>((coul) ? key::coul_xx : key::erfc_xx);
+
+        LOG.os<>(
+            (coul) ? "Computing metric inverse\n" :
+                     "Computing metric (attenuated) inverse\n");
+
+        auto& time = TIME.sub(
+            (coul) ? "Inverting metric" : "Inverting attenuated metric");
+        time.start();
+        auto p = invert(c);
+        time.finish();
+
+        return (sqrt) ? p.second : p.first;
+      });
+      break;
+
+    case key::coul_bbbb:
+      add_lazy<sbt4>(reg, k, keep, [this](const reg_t& r) {
+        auto spgrid4 = r.get<dbcsr::shared_pgrid<4>>(key::pgrid4);
+
+        auto& t_ints = TIME.sub("Computing eris");
+        LOG.os<>("Computing 2e integrals.\n");
+
+        t_ints.start();
+
+        m_aofac->ao_eri_setup(metric::coulomb);
+
+        auto b = m_mol->dims().b();
+        arrvec<int, 4> bbbb = {b, b, b, b};
+
+        auto eri_batched =
+            create_bbbb(m_mol->name() + "_eri_batched", spgrid4, m_btype_eris);
+
+        auto eris_gen = dbcsr::tensor<4>::create()
+                            .name("eris_4")
+                            .set_pgrid(*spgrid4)
+                            .map1({0, 1})
+                            .map2({2, 3})
+                            .blk_sizes(bbbb)
+                            .build();
+
+        vec<int> map1 = {0, 1};
+        vec<int> map2 = {2, 3};
+        eri_batched->compress_init({2, 3}, map1, map2);
+
+        vec<vec<int>> bounds(4);
+
+        for (int imu = 0; imu != eri_batched->nbatches(2); ++imu) {
+          for (int inu = 0; inu != eri_batched->nbatches(3); ++inu) {
+            bounds[0] = eri_batched->full_blk_bounds(0);
+            bounds[1] = eri_batched->full_blk_bounds(1);
+            bounds[2] = eri_batched->blk_bounds(2, imu);
+            bounds[3] = eri_batched->blk_bounds(3, inu);
 
-  if (comp(key::erfc_xx_inv) || comp(key::erfc_xx_invsqrt)) {
-    LOG.os<>("Computing metric (attenuated) inverse\n");
+            m_aofac->ao_4c_fill(eris_gen, bounds, nullptr);
 
-    auto& time = TIME.sub("Inverting attenuated metric");
-    time.start();
+            eris_gen->filter(dbcsr::global::filter_eps);
 
-    auto c = m_reg.get<smatd>(key::erfc_xx);
-    auto p = invert(c);
-    auto cinv = p.first;
-    auto cinvsqrt = p.second;
-    if (comp(key::erfc_xx_inv)) {
-      m_reg.insert(key::erfc_xx_inv, cinv);
-    }
-    if (comp(key::coul_xx_invsqrt)) {
-      m_reg.insert(key::erfc_xx_invsqrt, cinvsqrt);
-    }
+            eri_batched->compress({imu, inu}, eris_gen);
+          }
+        }
 
-    time.finish();
-  }
+        eri_batched->compress_finalize();
 
-  if (comp(key::coul_bbbb)) {
-    auto& t_ints = TIME.sub("Computing eris");
-    LOG.os<>("Computing 2e integrals.\n");
+        t_ints.finish();
 
-    t_ints.start();
+        LOG.os<>("Done computing 2e integrals.\n\n");
+        return eri_batched;
+      });
+      break;
 
-    m_aofac->ao_eri_setup(metric::coulomb);
+    case key::scr_xbb:
+      add_lazy<ints::shared_screener>(reg, k, keep, [this](const reg_t&) {
+        LOG.os<>("Computing screener\n");
 
-    auto b = m_mol->dims().b();
-    arrvec<int, 4> bbbb = {b, b, b, b};
+        auto& time = TIME.sub("Screener for 3c2e integrals");
+        time.start();
 
-    std::array<int, 4> bdims = {
-        m_nbatches_b, m_nbatches_b, m_nbatches_b, m_nbatches_b};
+        LOG.os<1>("Screening method: ", m_screening, '\n');
 
-    auto blkmap_b = m_mol->c_basis()->block_to_atom(m_mol->atoms());
-    arrvec<int, 4> blkmaps = {blkmap_b, blkmap_b, blkmap_b, blkmap_b};
+        auto scr = ints::create_screener(m_world, m_mol, m_screening);
+        scr->compute();
+        m_scr = scr;
 
-    auto eri_batched = dbcsr::btensor<4>::create()
-                           .name(m_mol->name() + "_eri_batched")
-                           .set_pgrid(spgrid4)
-                           .blk_sizes(bbbb)
-                           .blk_maps(blkmaps)
-                           .batch_dims(bdims)
-                           .btensor_type(m_btype_eris)
-                           .print(LOG.global_plev())
-                           .build();
+        time.finish();
+        return scr;
+      });
+      break;
 
-    auto eris_gen = dbcsr::tensor<4>::create()
-                        .name("eris_4")
-                        .set_pgrid(*spgrid4)
-                        .map1({0, 1})
-                        .map2({2, 3})
-                        .blk_sizes(bbbb)
-                        .build();
+    case key::coul_xbb:
+    case key::erfc_xbb:
+      add_lazy<sbt3>(reg, k, keep, [this, k](const reg_t& r) {
+        auto spgrid3 = r.get<dbcsr::shared_pgrid<3>>(key::pgrid3);
+        auto scr = r.get<ints::shared_screener>(key::scr_xbb);
 
-    vec<int> map1 = {0, 1};
-    vec<int> map2 = {2, 3};
-    eri_batched->compress_init({2, 3}, map1, map2);
+        LOG.os<>("Computing 3c2e integrals.\n");
 
-    vec<vec<int>> bounds(4);
+        auto& t_eri_batched = TIME.sub("3c2e integrals batched");
+        auto& t_calc = t_eri_batched.sub("calc");
+        auto& t_setup = t_eri_batched.sub("setup");
+        auto& t_compress = t_eri_batched.sub("Compress");
 
-    for (int imu = 0; imu != eri_batched->nbatches(2); ++imu) {
-      for (int inu = 0; inu != eri_batched->nbatches(3); ++inu) {
-        bounds[0] = eri_batched->full_blk_bounds(0);
-        bounds[1] = eri_batched->full_blk_bounds(1);
-        bounds[2] = eri_batched->blk_bounds(2, imu);
-        bounds[3] = eri_batched->blk_bounds(3, inu);
+        t_eri_batched.start();
+        t_setup.start();
 
-        m_aofac->ao_4c_fill(eris_gen, bounds, nullptr);
+        ints::metric m = (k == key::coul_xbb) ? ints::metric::coulomb :
+                                                ints::metric::erfc_coulomb;
 
-        eris_gen->filter(dbcsr::global::filter_eps);
+        m_aofac->ao_3c2e_setup(m);
+        auto genfunc = m_aofac->get_generator(scr);
 
-        eri_batched->compress({imu, inu}, eris_gen);
-      }
-    }
+        auto b = m_mol->dims().b();
+        auto x = m_mol->dims().x();
+        arrvec<int, 3> xbb = {x, b, b};
 
-    eri_batched->compress_finalize();
+        auto eri_batched =
+            create_xbb(m_mol->name() + "_eri_batched", spgrid3, m_btype_eris);
 
-    t_ints.finish();
+        auto eris_gen = dbcsr::tensor<3>::create()
+                            .name("eris_3")
+                            .set_pgrid(*spgrid3)
+                            .map1({0})
+                            .map2({1, 2})
+                            .blk_sizes(xbb)
+                            .build();
 
-    m_reg.insert(key::coul_bbbb, eri_batched);
-    LOG.os<>("Done computing 2e integrals.\n\n");
-  }
+        eri_batched->set_generator(genfunc);
 
-  if (comp(key::scr_xbb)) {
-    LOG.os<>("Computing screener\n");
+        vec<int> map1 = {0};
+        vec<int> map2 = {1, 2};
+        eri_batched->compress_init({0}, map1, map2);
 
-    auto& time = TIME.sub("Screener for 3c2e integrals");
-    time.start();
+        vec<vec<int>> bounds(3);
 
-    std::shared_ptr<ints::screener> scr;
-    // if (comp(key::coul_xbb))
-    // if (comp(key::erfc_xbb)) scr.reset(new
-    // ints::schwarz_screener(m_aofac,"erfc_coulomb"));
-    scr.reset(new ints::schwarz_screener(m_world, m_mol));
-    scr->compute();
+        t_setup.finish();
 
-    m_reg.insert(key::scr_xbb, scr);
+        for (int ix = 0; ix != eri_batched->nbatches(0); ++ix) {
+          bounds[0] = eri_batched->blk_bounds(0, ix);
+          bounds[1] = eri_batched->full_blk_bounds(1);
+          bounds[2] = eri_batched->full_blk_bounds(2);
 
-    time.finish();
-  }
-
-  if (comp(key::coul_xbb) || comp(key::erfc_xbb)) {
-    LOG.os<>("Computing 3c2e integrals.\n");
+          t_calc.start();
+          if (m_btype_eris != dbcsr::btype::direct)
+            m_aofac->ao_3c_fill(eris_gen, bounds, scr);
+          t_calc.finish();
+          eris_gen->filter(dbcsr::global::filter_eps);
+          t_compress.start();
+          eri_batched->compress({ix}, eris_gen);
+          t_compress.finish();
+        }
 
-    // t_screen.start();
+        eri_batched->compress_finalize();
 
-    auto scr = m_reg.get<ints::shared_screener>(key::scr_xbb);
+        t_eri_batched.finish();
 
-    // t_screen.finish();
+        double eri_occupation = eri_batched->occupation() * 100;
 
-    auto& t_eri_batched = TIME.sub("3c2e integrals batched");
-    auto& t_calc = t_eri_batched.sub("calc");
-    auto& t_setup = t_eri_batched.sub("setup");
-    auto& t_compress = t_eri_batched.sub("Compress");
+        if (LOG.global_plev() > 0)
+          eri_batched->print_info();
 
-    t_eri_batched.start();
-    t_setup.start();
+        if (eri_occupation > 100)
+          throw std::runtime_error("3c2e integrals occupation more than 100%");
 
-    ints::metric m;
-    if (comp(key::coul_xbb))
-      m = ints::metric::coulomb;
-    if (comp(key::erfc_xbb))
-      m = ints::metric::erfc_coulomb;
+        return eri_batched;
+      });
+      break;
 
-    m_aofac->ao_3c2e_setup(m);
-    auto genfunc = m_aofac->get_generator(scr);
+    case key::dfit_coul_xbb:
+    case key::dfit_erfc_xbb:
+      add_lazy<sbt3>(reg, k, keep, [this, k](const reg_t& r) {
+        bool coul = (k == key::dfit_coul_xbb);
 
-    auto b = m_mol->dims().b();
-    auto x = m_mol->dims().x();
-    arrvec<int, 3> xbb = {x, b, b};
+        auto eri_batched =
+            r.get<sbt3>((coul) ? key::coul_xbb : key::erfc_xbb);
+        auto inv =
+            r.get<smatd>((coul) ? key::coul_xx_inv : key::erfc_xx_inv);
 
-    std::array<int, 3> bdims = {m_nbatches_x, m_nbatches_b, m_nbatches_b};
+        LOG.os<>("Computing fitting coefficients\n");
 
-    auto blkmap_b = m_mol->c_basis()->block_to_atom(m_mol->atoms());
-    auto blkmap_x = m_mol->c_dfbasis()->block_to_atom(m_mol->atoms());
+        auto& time = TIME.sub("Density fitting coefficients");
+        time.start();
 
-    arrvec<int, 3> blkmaps = {blkmap_x, blkmap_b, blkmap_b};
+        auto c_xbb_batched =
+            m_dfit->compute(eri_batched, inv, m_btype_intermeds);
 
-    /*std::cout << "NBATCHES A: " << bdims[0] << " " << bdims[1] << " " <<
-    bdims[2]
-            << std::endl;
+        auto mat = m_dfit->compute_idx(c_xbb_batched);
 
-    for (auto a : b) {
-            std::cout << a << " ";
-    } std::cout << std::endl;
+        if (LOG.global_plev() > 0)
+          c_xbb_batched->print_info();
 
-    for (auto a : blkmap_b) {
-            std::cout << a << " ";
-    } std::cout << std::endl;*/
+        time.finish();
+        return c_xbb_batched;
+      });
+      break;
 
-    auto eri_batched = dbcsr::btensor<3>::create()
-                           .name(m_mol->name() + "_eri_batched")
-                           .set_pgrid(spgrid3)
-                           .blk_sizes(xbb)
-                           .batch_dims(bdims)
-                           .btensor_type(m_btype_eris)
-                           .blk_maps(blkmaps)
-                           .print(LOG.global_plev())
-                           .build();
+    case key::pari_xbb:
+      add_lazy<sbt3>(reg, k, keep, [this](const reg_t& r) {
+        auto m_xx = r.get<smatd>(key::coul_xx);
+        auto scr = r.get<ints::shared_screener>(key::scr_xbb);
 
-    auto eris_gen = dbcsr::tensor<3>::create()
-                        .name("eris_3")
-                        .set_pgrid(*spgrid3)
-                        .map1({0})
-                        .map2({1, 2})
-                        .blk_sizes(xbb)
-                        .build();
+        LOG.os<>("Computing fitting coefficients (PARI)\n");
 
-    eri_batched->set_generator(genfunc);
+        auto& time = TIME.sub("Density fitting coefficients (PARI)");
+        time.start();
 
-    vec<int> map1 = {0};
-    vec<int> map2 = {1, 2};
-    eri_batched->compress_init({0}, map1, map2);
+        std::array<int, 3> bdims = {m_nbatches_x, m_nbatches_b, m_nbatches_b};
 
-    vec<vec<int>> bounds(3);
+        auto c_xbb_pari =
+            m_dfit->compute_pari(m_xx, scr, bdims, m_btype_intermeds);
 
-    t_setup.finish();
+        if (LOG.global_plev() > 0)
+          c_xbb_pari->print_info();
 
-    for (int ix = 0; ix != eri_batched->nbatches(0); ++ix) {
-      bounds[0] = eri_batched->blk_bounds(0, ix);
-      bounds[1] = eri_batched->full_blk_bounds(1);
-      bounds[2] = eri_batched->full_blk_bounds(2);
-
-      t_calc.start();
-      if (m_btype_eris != dbcsr::btype::direct)
-        m_aofac->ao_3c_fill(eris_gen, bounds, scr);
-      t_calc.finish();
-      eris_gen->filter(dbcsr::global::filter_eps);
-      t_compress.start();
-      eri_batched->compress({ix}, eris_gen);
-      t_compress.finish();
-    }
+        time.finish();
+        return c_xbb_pari;
+      });
+      break;
 
-    eri_batched->compress_finalize();
+    case key::qr_xbb:
+      add_lazy<sbt3>(reg, k, keep, [this](const reg_t& r) {
+        auto spgrid3 = r.get<dbcsr::shared_pgrid<3>>(key::pgrid3);
+        auto s_bb = r.get<smatd>(key::ovlp_bb);
+        auto m_xx = r.get<smatd>(key::coul_xx);
+        auto s_xx_inv = r.get<smatd>(key::ovlp_xx_inv);
 
-    // auto eri = eri_batched->get_work_tensor();
-    // dbcsr::print(*eri);
+        LOG.os<>("Computing fitting coefficients (QR)\n");
 
-    t_eri_batched.finish();
+        auto& time = TIME.sub("Density fitting coefficients (QR)");
+        time.start();
 
-    if (comp(key::coul_xbb))
-      m_reg.insert(key::coul_xbb, eri_batched);
-    if (comp(key::erfc_xbb))
-      m_reg.insert(key::erfc_xbb, eri_batched);
+        std::array<int, 3> bdims = {m_nbatches_x, m_nbatches_b, m_nbatches_b};
 
-    double eri_occupation = eri_batched->occupation() * 100;
+        auto c_xbb_qr = m_dfit->compute_qr_new(
+            s_bb, s_xx_inv, m_xx, spgrid3, bdims, m_btype_intermeds);
 
-    if (LOG.global_plev() > 0)
-      eri_batched->print_info();
+        auto mat = m_dfit->compute_idx(c_xbb_qr);
 
-    if (eri_occupation > 100)
-      throw std::runtime_error("3c2e integrals occupation more than 100%");
-  }
+        if (LOG.global_plev() > 0)
+          c_xbb_qr->print_info();
 
-  if (comp(key::dfit_coul_xbb) || comp(key::dfit_erfc_xbb)) {
-    LOG.os<>("Computing fitting coefficients\n");
+        time.finish();
+        return c_xbb_qr;
+      });
+      break;
 
-    auto& time = TIME.sub("Density fitting coefficients");
-    time.start();
+    case key::dfit_qr_xbb:
+    case key::dfit_pari_xbb:
+      add_lazy<sbt3>(reg, k, keep, [this, k](const reg_t& r) {
+        bool qr = (k == key::dfit_qr_xbb);
 
-    key k_eri, k_inv;
+        auto fit_batched = r.get<sbt3>((qr) ? key::qr_xbb : key::pari_xbb);
+        auto v = r.get<smatd>(key::coul_xx);
 
-    if (comp(key::dfit_coul_xbb)) {
-      k_eri = key::coul_xbb;
-      k_inv = key::coul_xx_inv;
-    }
-    if (comp(key::dfit_erfc_xbb)) {
-      k_eri = key::erfc_xbb;
-      k_inv = key::erfc_xx_inv;
-    }
+        LOG.os<>(
+            (qr) ? "Computing (P|Q) cfit_qr_Pmn\n" :
+                   "Computing (P|Q) cfit_pari_Pmn\n");
 
-    auto eri_batched = m_reg.get<sbt3>(k_eri);
-    auto inv = m_reg.get<smatd>(k_inv);
+        auto& time = TIME.sub("(P|Q) Density fitting coefficients");
+        time.start();
 
-    auto c_xbb_batched = dfit.compute(eri_batched, inv, m_btype_intermeds);
+        auto c_xbb_batched = m_dfit->compute(fit_batched, v, m_btype_intermeds);
 
-    if (comp(key::dfit_coul_xbb))
-      m_reg.insert(key::dfit_coul_xbb, c_xbb_batched);
-    if (comp(key::dfit_erfc_xbb))
-      m_reg.insert(key::dfit_erfc_xbb, c_xbb_batched);
+        if (qr)
+          m_dfit->compute_idx(c_xbb_batched);
 
-    auto mat = dfit.compute_idx(c_xbb_batched);
+        if (LOG.global_plev() > 0)
+          c_xbb_batched->print_info();
 
-    if (LOG.global_plev() > 0)
-      c_xbb_batched->print_info();
+        time.finish();
+        return c_xbb_batched;
+      });
+      break;
 
-    time.finish();
+    default: throw std::runtime_error("aoloader: cannot compute key");
   }
+}
 
-  if (comp(key::pari_xbb)) {
-    LOG.os<>("Computing fitting coefficients (PARI)\n");
-
-    auto& time = TIME.sub("Density fitting coefficients (PARI)");
-    time.start();
-
-    auto m_xx = m_reg.get<smatd>(key::coul_xx);
-    auto scr = m_reg.get<ints::shared_screener>(key::scr_xbb);
-
-    std::array<int, 3> bdims = {m_nbatches_x, m_nbatches_b, m_nbatches_b};
+void aoloader::impl::setup(reg_t& reg)
+{
+  m_aofac = std::make_shared<ints::aofactory>(m_mol, m_world);
+  m_dfit =
+      std::make_shared<ints::dfitting>(m_world, m_mol, LOG.global_plev());
 
-    auto c_xbb_pari = dfit.compute_pari(m_xx, scr, bdims, m_btype_intermeds);
+  // setup all pgrids
+  dbcsr::shared_pgrid<2> spgrid2;
+  dbcsr::shared_pgrid<3> spgrid3;
+  dbcsr::shared_pgrid<4> spgrid4;
 
-    m_reg.insert(key::pari_xbb, c_xbb_pari);
+  spgrid2 = dbcsr::pgrid<2>::create(m_cart.comm()).build();
+  reg.insert(key::pgrid2, spgrid2);
 
-    if (LOG.global_plev() > 0)
-      c_xbb_pari->print_info();
+  int nbf = m_mol->c_basis()->nbf();
 
-    time.finish();
+  if (m_mol->c_dfbasis()) {
+    int naux = m_mol->c_dfbasis()->nbf();
+    std::array<int, 3> pdims3 = {naux, nbf, nbf};
+    spgrid3 =
+        dbcsr::pgrid<3>::create(m_cart.comm()).tensor_dims(pdims3).build();
+    reg.insert(key::pgrid3, spgrid3);
   }
 
-  if (comp(key::qr_xbb)) {
-    LOG.os<>("Computing fitting coefficients (QR)\n");
-
-    auto& time = TIME.sub("Density fitting coefficients (QR)");
-    time.start();
-
-    std::array<int, 3> bdims = {m_nbatches_x, m_nbatches_b, m_nbatches_b};
-
-    // auto eri_batched = m_reg.get<sbt3>(key::coul_xbb);
-    auto s_bb = m_reg.get<smatd>(key::ovlp_bb);
-    auto m_xx = m_reg.get<smatd>(key::coul_xx);
-    auto s_xx_inv = m_reg.get<smatd>(key::ovlp_xx_inv);
-
-    auto c_xbb_qr = dfit.compute_qr_new(
-        s_bb, s_xx_inv, m_xx, spgrid3, bdims, m_btype_intermeds);
-    m_reg.insert(key::qr_xbb, c_xbb_qr);
+  std::array<int, 4> pdims4 = {nbf, nbf, nbf, nbf};
+  spgrid4 = dbcsr::pgrid<4>::create(m_cart.comm()).tensor_dims(pdims4).build();
+  reg.insert(key::pgrid4, spgrid4);
 
-    auto mat = dfit.compute_idx(c_xbb_qr);
+  // a screener computed beforehand, e.g. by the batch planner
+  if (m_scr)
+    reg.insert(key::scr_xbb, m_scr);
 
-    if (LOG.global_plev() > 0)
-      c_xbb_qr->print_info();
+  // everything besides the molecule that changes the cached quantities
+  std::string setup = "screening " + m_screening + "\nnbatches " +
+      std::to_string(m_nbatches_b) + " " + std::to_string(m_nbatches_x);
 
-    time.finish();
+  if (!m_cache_dir.empty()) {
+    m_cache = std::make_shared<integral_cache>(
+        m_world, m_mol, m_cache_dir, setup, LOG.global_plev());
+  }
+  else if (m_memory_budget > 0) {
+    // evicted entries go to a scratch directory removed at the end
+    m_spill_dir = util::unique("mega_spill", "", m_world.comm());
+    m_cache = std::make_shared<integral_cache>(
+        m_world, m_mol, m_spill_dir, setup, LOG.global_plev());
   }
 
-  if (comp(key::dfit_qr_xbb)) {
-    LOG.os<>("Computing (P|Q) cfit_qr_Pmn\n");
-
-    auto& time = TIME.sub("(P|Q) Density fitting coefficients");
-    time.start();
+  if (m_memory_budget > 0) {
+    LOG.os<>("Memory budget for AO quantities: ", m_memory_budget, " GB\n");
+    reg.set_budget((int64_t)(m_memory_budget * 1e9));
+  }
+}
 
-    // LOG.os<1>("Computing fitting coefficients.\n");
+void aoloader::impl::print_info()
+{
+  if (m_aofac)
+    TIME.insert(m_aofac->get_time());
 
-    auto qr_batched = m_reg.get<sbt3>(ints::key::qr_xbb);
-    auto v = m_reg.get<smatd>(ints::key::coul_xx);
+  TIME.print_info();
 
-    auto c_xbb_batched = dfit.compute(qr_batched, v, m_btype_intermeds);
+  if (!m_scr)
+    return;
 
-    m_reg.insert(key::dfit_qr_xbb, c_xbb_batched);
+  auto report = m_scr->report();
+  report["molecule"] = m_mol->name();
 
-    auto mat = dfit.compute_idx(c_xbb_batched);
+  if (m_world.rank() != 0)
+    return;
 
-    if (LOG.global_plev() > 0)
-      c_xbb_batched->print_info();
+  // append to the reports of previous aoloaders of the same molecule
+  const std::string filename = m_mol->name() + "_screening.json";
+  nlohmann::json reports = nlohmann::json::array();
 
-    time.finish();
+  if (std::filesystem::exists(filename)) {
+    std::ifstream in(filename);
+    reports = nlohmann::json::parse(in, nullptr, false);
+    if (!reports.is_array())
+      reports = nlohmann::json::array();
   }
 
-  if (comp(key::dfit_pari_xbb)) {
-    LOG.os<>("Computing (P|Q) cfit_pari_Pmn\n");
+  reports.push_back(report);
 
-    auto& time = TIME.sub("(P|Q) Density fitting coefficients");
-    time.start();
-
-    // LOG.os<1>("Computing fitting coefficients.\n");
-
-    auto pari_batched = m_reg.get<sbt3>(ints::key::pari_xbb);
-    auto v = m_reg.get<smatd>(ints::key::coul_xx);
+  std::ofstream out(filename);
+  out << reports.dump(2) << std::endl;
 
-    auto c_xbb_batched = dfit.compute(pari_batched, v, m_btype_intermeds);
+  LOG.os<>("Screening statistics written to ", filename, '\n');
+}
 
-    m_reg.insert(key::dfit_pari_xbb, c_xbb_batched);
+aoloader::aoloader(create_pack&& p) :
+    pimpl(std::make_shared<impl>(p)),
+    LOG(p.p_set_world.comm(), (p.p_print) ? *p.p_print : 0),
+    m_reg(p.p_set_world.comm())
+{
+  for (auto& a : m_to_compute) a = false;
+  for (auto& a : m_to_keep) a = false;
+}
 
-    if (LOG.global_plev() > 0)
-      c_xbb_batched->print_info();
+void aoloader::compute()
+{
+  LOG.os<>("Setting up AO quantities.\n");
 
-    time.finish();
-  }
+  auto& time = pimpl->TIME;
+  time.start();
 
-  TIME.finish();
-  LOG.os<>("Finished loading AO quantities.\n");
+  pimpl->setup(m_reg);
 
   for (size_t i = 0; i != m_to_compute.size(); ++i) {
-    ints::key k = static_cast<ints::key>(i);
-    if (m_reg.present(k) && !m_to_keep[i]) {
-      m_reg.erase(k);
+    key k = static_cast<key>(i);
+
+    if (m_to_compute[i] && !m_reg.registered(k)) {
+      pimpl->add_generator(m_reg, k, m_to_keep[i]);
+    }
+    else if (m_to_compute[i] && m_to_keep[i]) {
+      m_reg.set_transient(k, false);
     }
 
     m_to_compute[i] = false;
     m_to_keep[i] = false;
   }
+
+  time.finish();
+  LOG.os<>("Finished setting up AO quantities.\n");
+}
+
+aoloader::~aoloader()
+{
+}
+
+void aoloader::print_info()
+{
+  pimpl->print_info();
 }
 
 }  // namespace ints
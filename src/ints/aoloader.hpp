@@ -4,7 +4,10 @@
 #ifndef TEST_MACRO
   #include <dbcsr_common.hpp>
   #include "desc/molecule.hpp"
+  #include <functional>
   #include "ints/aofactory.hpp"
+  #include "ints/fitting.hpp"
+  #include "ints/intcache.hpp"
   #include "ints/registry.hpp"
   #include "ints/screening.hpp"
   #include "utils/mpi_time.hpp"
@@ -47,55 +50,36 @@ enum class key {
 
 class aoloader {
  private:
-  world m_world;
-  dbcsr::cart m_cart;
-  desc::shared_molecule m_mol;
-  dbcsr::btype m_btype_eris;
-  dbcsr::btype m_btype_intermeds;
-  int m_nbatches_b;
-  int m_nbatches_x;
+  // computes the registry entries. The generators in the registry hold it
+  // by shared_ptr, so that the entries stay valid after the aoloader is
+  // destroyed.
+  class impl;
+  std::shared_ptr<impl> pimpl;
 
   util::mpi_log LOG;
-  util::mpi_time TIME;
 
   ints::key_registry<key> m_reg;
 
   std::array<bool, static_cast<int>(key::NUM_KEYS)> m_to_compute;
   std::array<bool, static_cast<int>(key::NUM_KEYS)> m_to_keep;
 
-  std::pair<dbcsr::shared_matrix<double>, dbcsr::shared_matrix<double>> invert(
-      dbcsr::shared_matrix<double> mat);
-
-  bool comp(key k)
-  {
-    return m_to_compute[static_cast<int>(k)];
-  }
-
  public:
 #define AOLOADER_CREATE_LIST \
   (((world), set_world), ((desc::shared_molecule), set_molecule), \
    ((util::optional<int>), print), ((util::optional<int>), nbatches_b), \
    ((util::optional<int>), nbatches_x), \
    ((util::optional<dbcsr::btype>), btype_eris), \
-   ((util::optional<dbcsr::btype>), btype_intermeds))
+   ((util::optional<dbcsr::btype>), btype_intermeds), \
+   ((util::optional<std::string>), screening), \
+   ((util::optional<std::string>), cache_dir), \
+   ((util::optional<double>), memory_budget), \
+   ((util::optional<double>), hybrid_memory), \
+   ((util::optional<ints::shared_screener>), screener))
 
   MAKE_PARAM_STRUCT(create, AOLOADER_CREATE_LIST, ())
   MAKE_BUILDER_CLASS(aoloader, create, AOLOADER_CREATE_LIST, ())
 
-  aoloader(create_pack&& p) :
-      m_world(p.p_set_world), m_cart(p.p_set_world.dbcsr_grid()),
-      m_mol(p.p_set_molecule),
-      m_btype_eris((p.p_btype_eris) ? *p.p_btype_eris : dbcsr::btype::core),
-      m_btype_intermeds(
-          (p.p_btype_intermeds) ? *p.p_btype_intermeds : dbcsr::btype::core),
-      m_nbatches_b((p.p_nbatches_b) ? *p.p_nbatches_b : 5),
-      m_nbatches_x((p.p_nbatches_x) ? *p.p_nbatches_x : 5),
-      LOG(p.p_set_world.comm(), (p.p_print) ? *p.p_print : 0),
-      TIME(p.p_set_world.comm(), "AO-loader")
-  {
-    for (auto& a : m_to_compute) a = false;
-    for (auto& a : m_to_keep) a = false;
-  }
+  aoloader(create_pack&& p);
 
   aoloader& request(key k, bool keep)
   {
@@ -106,16 +90,17 @@ class aoloader {
     return *this;
   }
 
+  /* Sets up the requested quantities. They are computed on first access
+   * through the registry. Quantities requested without keep are only held
+   * while other quantities are computed from them.
+   */
   void compute();
 
-  ~aoloader()
-  {
-  }
+  ~aoloader();
 
-  void print_info()
-  {
-    TIME.print_info();
-  }
+  // prints timings and writes the screening statistics to
+  // <molecule>_screening.json
+  void print_info();
 
   const ints::key_registry<key> get_registry()
   {
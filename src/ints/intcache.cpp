@@ -0,0 +1,291 @@
+#include "ints/intcache.hpp"
+#include "ints/aofactory.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace megalochem {
+
+namespace ints {
+
+// FNV-1a, 64 bit
+static uint64_t hash_string(const std::string& str)
+{
+  uint64_t h = 14695981039346656037ull;
+  for (unsigned char c : str) {
+    h ^= c;
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+
+static void describe_basis(
+    std::ostream& os, std::string name, desc::shared_cluster_basis cbas)
+{
+  if (!cbas) {
+    os << name << " none\n";
+    return;
+  }
+
+  os << name << " " << cbas->size() << '\n';
+
+  for (auto& clus : *cbas) {
+    os << "cluster " << clus.shells.size() << '\n';
+    for (auto& sh : clus.shells) {
+      os << sh.l << " " << sh.pure << " " << sh.O[0] << " " << sh.O[1] << " "
+         << sh.O[2] << '\n';
+      for (auto a : sh.alpha) { os << a << " "; }
+      os << '\n';
+      for (auto c : sh.coeff) { os << c << " "; }
+      os << '\n';
+    }
+  }
+}
+
+integral_cache::integral_cache(
+    world w,
+    desc::shared_molecule mol,
+    std::string root,
+    std::string setup,
+    int print) :
+    m_world(w),
+    LOG(w.comm(), print)
+{
+  std::ostringstream desc;
+  desc << std::hexfloat;
+
+  desc << "nprocs " << m_world.size() << '\n';
+
+  for (auto& atom : mol->atoms()) {
+    desc << "atom " << atom.atomic_number << " " << atom.x << " " << atom.y
+         << " " << atom.z << '\n';
+  }
+
+  describe_basis(desc, "basis", mol->c_basis());
+  describe_basis(desc, "basis2", mol->c_basis2());
+  describe_basis(desc, "dfbasis", mol->c_dfbasis());
+
+  desc << "filter_eps " << dbcsr::global::filter_eps << '\n'
+       << "precision " << ints::global::precision << '\n'
+       << "omega " << ints::global::omega << '\n'
+       << "qr_theta " << ints::global::qr_theta << '\n'
+       << "qr_rho " << ints::global::qr_rho << '\n'
+       << "cutoff " << desc::cluster_basis::global::cutoff << '\n'
+       << "codec " << (int)dbcsr::btensor_global::codec << '\n'
+       << setup << '\n';
+
+  std::ostringstream hash;
+  hash << std::hex << hash_string(desc.str());
+
+  m_dir = root + "/" + hash.str() + "/";
+
+  if (m_world.rank() == 0) {
+    std::filesystem::create_directories(m_dir);
+    std::ofstream out(m_dir + "description.txt");
+    out << desc.str();
+  }
+
+  MPI_Barrier(m_world.comm());
+
+  LOG.os<>("Integral cache: ", m_dir, '\n');
+}
+
+void integral_cache::finish(std::string entry)
+{
+  MPI_Barrier(m_world.comm());
+
+  if (m_world.rank() == 0) {
+    std::ofstream out(path(entry) + ".done");
+  }
+
+  MPI_Barrier(m_world.comm());
+}
+
+bool integral_cache::has(std::string entry)
+{
+  // ranks might not share a file system, so every rank checks for itself
+  int found = std::filesystem::exists(path(entry) + ".done") &&
+      std::filesystem::exists(
+                  path(entry) + "." + std::to_string(m_world.rank()));
+
+  MPI_Allreduce(MPI_IN_PLACE, &found, 1, MPI_INT, MPI_LAND, m_world.comm());
+
+  return found;
+}
+
+/* Layout of the matrix files: name, type, row and column block sizes,
+ * row and column block distribution, row and column indices of the local
+ * blocks and their data.
+ */
+void integral_cache::save(std::string entry, dbcsr::shared_matrix<double> mat)
+{
+  LOG.os<>("Writing ", entry, " to integral cache\n");
+
+  std::ofstream out(
+      path(entry) + "." + std::to_string(m_world.rank()), std::ios::binary);
+
+  if (!out) {
+    throw std::runtime_error("Could not open cache entry " + entry);
+  }
+
+  auto write_vec = [&out](const vec<int>& v) {
+    int n = v.size();
+    out.write((const char*)&n, sizeof(int));
+    out.write((const char*)v.data(), n * sizeof(int));
+  };
+
+  std::string name = mat->name();
+  int namelen = name.size();
+  out.write((const char*)&namelen, sizeof(int));
+  out.write(name.data(), namelen);
+
+  char mtype = static_cast<char>(mat->matrix_type());
+  out.write(&mtype, sizeof(char));
+
+  write_vec(mat->row_blk_sizes());
+  write_vec(mat->col_blk_sizes());
+  write_vec(mat->proc_row_dist());
+  write_vec(mat->proc_col_dist());
+
+  vec<int> rows, cols;
+  vec<const double*> data;
+  vec<int> sizes;
+
+  dbcsr::iterator<double> iter(*mat);
+  iter.start();
+
+  while (iter.blocks_left()) {
+    iter.next_block();
+    rows.push_back(iter.row());
+    cols.push_back(iter.col());
+    data.push_back(&iter(0, 0));
+    sizes.push_back(iter.row_size() * iter.col_size());
+  }
+
+  iter.stop();
+
+  write_vec(rows);
+  write_vec(cols);
+
+  for (size_t i = 0; i != data.size(); ++i) {
+    out.write((const char*)data[i], sizes[i] * sizeof(double));
+  }
+
+  if (!out) {
+    throw std::runtime_error("Error while writing cache entry " + entry);
+  }
+
+  out.close();
+
+  finish(entry);
+}
+
+dbcsr::shared_matrix<double> integral_cache::load_matrix(
+    std::string entry, vec<int> row_dist, vec<int> col_dist)
+{
+  LOG.os<>("Reading ", entry, " from integral cache\n");
+
+  std::ifstream in(
+      path(entry) + "." + std::to_string(m_world.rank()), std::ios::binary);
+
+  if (!in) {
+    throw std::runtime_error("Could not open cache entry " + entry);
+  }
+
+  auto read_vec = [&in]() {
+    int n = 0;
+    in.read((char*)&n, sizeof(int));
+    vec<int> v(n);
+    in.read((char*)v.data(), n * sizeof(int));
+    return v;
+  };
+
+  int namelen = 0;
+  in.read((char*)&namelen, sizeof(int));
+  std::string name(namelen, ' ');
+  in.read(&name[0], namelen);
+
+  char mtype = 'N';
+  in.read(&mtype, sizeof(char));
+
+  auto rblksizes = read_vec();
+  auto cblksizes = read_vec();
+  auto saved_rdist = read_vec();
+  auto saved_cdist = read_vec();
+  auto rows = read_vec();
+  auto cols = read_vec();
+
+  // the blocks in this rank's file are local in the saved distribution
+  auto cart = m_world.dbcsr_grid();
+  auto saved_dist = dbcsr::dist::create()
+                        .set_cart(cart)
+                        .row_dist(saved_rdist)
+                        .col_dist(saved_cdist)
+                        .build();
+
+  auto mat = dbcsr::matrix<double>::create()
+                 .name(name)
+                 .set_dist(*saved_dist)
+                 .matrix_type(static_cast<dbcsr::type>(mtype))
+                 .row_blk_sizes(rblksizes)
+                 .col_blk_sizes(cblksizes)
+                 .build();
+
+  mat->reserve_blocks(rows, cols);
+
+  for (size_t i = 0; i != rows.size(); ++i) {
+    bool found = false;
+    double* data = mat->get_block_data(rows[i], cols[i], found);
+    if (!found) {
+      throw std::runtime_error("Cache entry " + entry + " is corrupted");
+    }
+    in.read(
+        (char*)data,
+        rblksizes[rows[i]] * cblksizes[cols[i]] * sizeof(double));
+  }
+
+  if (!in) {
+    throw std::runtime_error("Error while reading cache entry " + entry);
+  }
+
+  mat->finalize();
+
+  // redistribute into the requested distribution, the default one if none
+  // is given
+  auto dims = cart.dims();
+
+  if (row_dist.empty())
+    row_dist = dbcsr::default_dist(rblksizes.size(), dims[0], rblksizes);
+  if (col_dist.empty())
+    col_dist = dbcsr::default_dist(cblksizes.size(), dims[1], cblksizes);
+
+  if (row_dist == saved_rdist && col_dist == saved_cdist) {
+    return mat;
+  }
+
+  auto dist = dbcsr::dist::create()
+                  .set_cart(cart)
+                  .row_dist(row_dist)
+                  .col_dist(col_dist)
+                  .build();
+
+  auto out = dbcsr::matrix<double>::create()
+                 .name(name)
+                 .set_dist(*dist)
+                 .matrix_type(static_cast<dbcsr::type>(mtype))
+                 .row_blk_sizes(rblksizes)
+                 .col_blk_sizes(cblksizes)
+                 .build();
+
+  out->redistribute(*mat);
+  mat->release();
+
+  return out;
+}
+
+}  // namespace ints
+
+}  // namespace megalochem
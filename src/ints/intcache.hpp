@@ -0,0 +1,83 @@
+#ifndef INTS_INTCACHE_H
+#define INTS_INTCACHE_H
+
+#include <dbcsr_btensor.hpp>
+#include <dbcsr_matrix.hpp>
+#include <string>
+#include "desc/molecule.hpp"
+#include "megalochem.hpp"
+#include "utils/mpi_time.hpp"
+
+namespace megalochem {
+
+namespace ints {
+
+/* Persistent cache for AO integrals and fitting coefficients.
+ * Entries live in <root>/<hash>/, where the hash is computed from a
+ * canonical description of everything the integrals depend on: geometry,
+ * basis sets including their block splitting, thresholds, the number of
+ * MPI processes and any additional setup passed by the caller. Entries
+ * which depend on the metric carry it in their name.
+ * Every rank stores its local blocks in its own file, so the cache can only
+ * be reused with the same number of processes.
+ */
+class integral_cache {
+ private:
+  world m_world;
+  util::mpi_log LOG;
+  std::string m_dir;
+
+  std::string path(std::string entry) const
+  {
+    return m_dir + entry;
+  }
+
+  // marks an entry as complete once all ranks have written their files
+  void finish(std::string entry);
+
+ public:
+  integral_cache(
+      world w,
+      desc::shared_molecule mol,
+      std::string root,
+      std::string setup,
+      int print = 0);
+
+  // true if the entry was completely written by a previous save
+  bool has(std::string entry);
+
+  void save(std::string entry, dbcsr::shared_matrix<double> mat);
+
+  // loads a matrix in the given block distribution, the default one of
+  // the process grid if none is given
+  dbcsr::shared_matrix<double> load_matrix(
+      std::string entry, vec<int> row_dist = {}, vec<int> col_dist = {});
+
+  template <int N>
+  void save(std::string entry, dbcsr::sbtensor<N, double> tensor)
+  {
+    LOG.os<>("Writing ", entry, " to integral cache\n");
+    tensor->save(path(entry));
+    finish(entry);
+  }
+
+  // loads the entry into a newly created batch tensor with the same
+  // block sizes, batching and process grid as the saved one
+  template <int N>
+  void load(std::string entry, dbcsr::sbtensor<N, double> tensor)
+  {
+    LOG.os<>("Reading ", entry, " from integral cache\n");
+    tensor->load(path(entry));
+  }
+
+  std::string dir() const
+  {
+    return m_dir;
+  }
+};
+
+}  // namespace ints
+
+}  // namespace megalochem
+
+#endif
@@ -1,8 +1,14 @@
 #include "ints/integrals.hpp"
+#include "ints/scatter.hpp"
 #include <mpi.h>
 #include <omp.h>
+#include <algorithm>
+#include <cmath>
 #include <map>
+#include <limits>
 #include <stdexcept>
+#include <unordered_map>
+#include "utils/work_queue.hpp"
 
 #include <iostream>
 
@@ -14,17 +20,33 @@ namespace ints {
 //                       LIBCINT
 // =====================================================================
 
+void cint_arena::reserve(int nthreads, size_t bufsize, size_t cachesize)
+{
+  if ((int)m_bufs.size() < nthreads) {
+    m_bufs.resize(nthreads);
+    m_caches.resize(nthreads);
+  }
+
+  for (int i = 0; i != (int)m_bufs.size(); ++i) {
+    if (m_bufs[i].size() < bufsize)
+      m_bufs[i].resize(bufsize);
+    if (m_caches[i].size() < cachesize)
+      m_caches[i].resize(cachesize);
+  }
+}
+
 void calc_ints(
     dbcsr::matrix<double>& m_out,
     std::vector<std::vector<int>>& shell_offsets,
     std::vector<std::vector<int>>& nshells,
     CINTIntegralFunction* int_func,
+    CINTOpt* opt,
     int* atm,
     int natm,
     int* bas,
     int nbas,
     double* env,
-    int max_l)
+    cint_arena& arena)
 {
   // std::cout << "NATOMS/NBAS: " << natm << " " << nbas << std::endl;
 
@@ -35,16 +57,16 @@ void calc_ints(
   auto& shell_offsets0 = shell_offsets[0];
   auto& shell_offsets1 = shell_offsets[1];
 
-  int max_buf_size = pow(2 * max_l + 1, 2);
-
 #pragma omp parallel
   {
     dbcsr::iterator iter(m_out);
 
     iter.start();
 
-    double* buf = new double[max_buf_size];
-    int* shls = new int[2];
+    const int ithread = omp_get_thread_num();
+    double* buf = arena.buf(ithread);
+    double* cache = arena.cache(ithread);
+    int shls[2];
 
     while (iter.blocks_left()) {
       iter.next_block();
@@ -86,7 +108,7 @@ void calc_ints(
           // std::cout << "PROCESSING SHELL: " << s0 << " " << s1 << std::endl;
 
           int res = int_func(
-              buf, nullptr, shls, atm, natm, bas, nbas, env, nullptr, nullptr);
+              buf, nullptr, shls, atm, natm, bas, nbas, env, opt, cache);
 
           if (res != 0) {
             int idx = 0;
@@ -112,9 +134,6 @@ void calc_ints(
     iter.stop();
     m_out.finalize();
 
-    delete[] buf;
-    delete[] shls;
-
   }  // end parallel omp
 }
 
@@ -125,20 +144,19 @@ void calc_ints(
     std::vector<std::vector<int>>& shell_offsets,
     std::vector<std::vector<int>>& shell_sizes,
     CINTIntegralFunction* int_func,
+    CINTOpt* opt,
     int* atm,
     int natm,
     int* bas,
     int nbas,
     double* env,
-    int max_l)
+    cint_arena& arena)
 {
   auto& nshells0 = shell_sizes[0];
   auto& nshells1 = shell_sizes[1];
   auto& shell_offsets0 = shell_offsets[0];
   auto& shell_offsets1 = shell_offsets[1];
 
-  int max_buf_size = pow(2 * max_l + 1, 2);
-
   //#pragma omp parallel
   //{
 
@@ -148,8 +166,9 @@ void calc_ints(
   auto row_offsets = m_x.row_blk_offsets();
   auto col_offsets = m_x.col_blk_offsets();
 
-  double* buf = new double[max_buf_size * 3];
-  int* shls = new int[2];
+  double* buf = arena.buf(0);
+  double* cache = arena.cache(0);
+  int shls[2];
 
   int rtot = m_x.nblkrows_total();
   int ctot = m_x.nblkcols_total();
@@ -203,7 +222,7 @@ void calc_ints(
           // std::cout << "PROCESSING SHELL: " << s0 << " " << s1 << std::endl;
 
           int res = int_func(
-              buf, nullptr, shls, atm, natm, bas, nbas, env, nullptr, nullptr);
+              buf, nullptr, shls, atm, natm, bas, nbas, env, opt, cache);
 
           if (res != 0) {
             int idx = 0;
@@ -241,23 +260,97 @@ void calc_ints(
     }  // end for ic
   }  // end for ir
 
-  delete[] buf;
-  delete[] shls;
-
   //}//end parallel omp
 }
 
+// all shell pairs of a block pair, used if no screener is available
+static void block_shellpairs(
+    std::vector<shellpair>& pairs,
+    int soff0,
+    int nshell0,
+    int soff1,
+    int nshell1,
+    int* bas)
+{
+  const double inf = std::numeric_limits<double>::max();
+
+  pairs.clear();
+
+  int off0 = 0;
+  for (int s0 = 0; s0 != nshell0; ++s0) {
+    const int size0 = CINTcgto_spheric(soff0 + s0, bas);
+
+    int off1 = 0;
+    for (int s1 = 0; s1 != nshell1; ++s1) {
+      const int size1 = CINTcgto_spheric(soff1 + s1, bas);
+      pairs.push_back(
+          shellpair{s0, s1, off0, off1, size0, size1, inf, 0.0, {}});
+      off1 += size1;
+    }
+
+    off0 += size0;
+  }
+}
+
+// significant shell pairs of a block pair, from the screener's list if
+// available or all pairs of the blocks otherwise
+static std::pair<const shellpair*, const shellpair*> get_shellpairs(
+    const shellpair_list* spairs,
+    std::vector<shellpair>& pairs,
+    int iblk0,
+    int iblk1,
+    int soff0,
+    int nshell0,
+    int soff1,
+    int nshell1,
+    int* bas)
+{
+  if (spairs) {
+    return spairs->get(iblk0, iblk1);
+  }
+
+  block_shellpairs(pairs, soff0, nshell0, soff1, nshell1, bas);
+  return {pairs.data(), pairs.data() + pairs.size()};
+}
+
+// Frobenius norm of a block
+static double block_norm(const double* data, int64_t n)
+{
+  double sum = 0.0;
+#pragma omp simd reduction(+ : sum)
+  for (int64_t i = 0; i < n; ++i) { sum += data[i] * data[i]; }
+  return sqrt(sum);
+}
+
+// Rough cost of a libcint call: number of primitive combinations times
+// the size of the angular momentum recursion
+static double tuple_cost(const int* shls, int nshls, const int* bas)
+{
+  double nprim = 1.0;
+  int ltot = 0;
+
+  for (int i = 0; i != nshls; ++i) {
+    nprim *= bas[shls[i] * BAS_SLOTS + NPRIM_OF];
+    ltot += bas[shls[i] * BAS_SLOTS + ANG_OF];
+  }
+
+  return nprim * (ltot + 1) * (ltot + 1) * (ltot + 1);
+}
+
 void calc_ints(
     dbcsr::tensor<3, double>& m_out,
     std::vector<std::vector<int>>& shell_offsets,
     std::vector<std::vector<int>>& nshells,
     CINTIntegralFunction* int_func,
+    CINTOpt* opt,
     int* atm,
     int natm,
     int* bas,
     int nbas,
     double* env,
-    int max_l)
+    cint_arena& arena,
+    screener* scr,
+    util::mpi_time& time)
 {
   auto& nshells0 = nshells[0];
   auto& nshells1 = nshells[1];
@@ -266,107 +359,167 @@ void calc_ints(
   auto& shell_offsets1 = shell_offsets[1];
   auto& shell_offsets2 = shell_offsets[2];
 
-  int max_buf_size = pow(2 * max_l + 1, 3);
+  const shellpair_list* spairs = (scr) ? scr->shellpairs() : nullptr;
+  const double* xbounds = (scr) ? scr->shell_bounds_x() : nullptr;
+  const double threshold = (scr) ? scr->int_threshold() : 0.0;
+
+  // libcint index of the first auxiliary and basis shell
+  const int xfirst = shell_offsets0.size() ? shell_offsets0[0] : 0;
+  const int bfirst1 = shell_offsets1.size() ? shell_offsets1[0] : 0;
+  const int bfirst2 = shell_offsets2.size() ? shell_offsets2[0] : 0;
+
+  // shell triples surviving the Schwarz bound need a second check
+  const bool decay = scr && scr->distance_decay();
+
+  auto skip_triple = [&](int s0, int s1, int s2) {
+    return decay && scr->skip_xbb(s0 - xfirst, s1 - bfirst1, s2 - bfirst2);
+  };
+
+  screening_stats* stats = (scr) ? &scr->stats(m_out.name()) : nullptr;
+
+  auto get_xbound = [&](int s0) {
+    return (xbounds) ? xbounds[s0 - xfirst]
+                     : std::numeric_limits<double>::max();
+  };
+
+  // local blocks
+  std::vector<dbcsr::index<3>> blkidx, blksize;
+
+  dbcsr::iterator_t<3> iter(m_out);
+  iter.start();
+  while (iter.blocks_left()) {
+    iter.next();
+    blkidx.push_back(iter.idx());
+    blksize.push_back(iter.size());
+  }
+  iter.stop();
+
+  const int64_t nblks = blkidx.size();
+
+  // estimate block costs from the surviving shell triples
+  std::vector<double> costs(nblks, 0.0);
 
 #pragma omp parallel
   {
-    dbcsr::iterator_t<3> iter(m_out);
+    std::vector<shellpair> blkpairs;
+    int shls[3];
 
-    iter.start();
+#pragma omp for schedule(dynamic)
+    for (int64_t iblk = 0; iblk < nblks; ++iblk) {
+      auto& idx = blkidx[iblk];
+      const int soff0 = shell_offsets0[idx[0]];
 
-    double* buf = new double[max_buf_size];
-    int* shls = new int[3];
+      auto [pfirst, plast] = get_shellpairs(
+          spairs, blkpairs, idx[1], idx[2], shell_offsets1[idx[1]],
+          nshells1[idx[1]], shell_offsets2[idx[2]], nshells2[idx[2]], bas);
 
-    while (iter.blocks_left()) {
-      iter.next();
+      for (int s0 = soff0; s0 != soff0 + nshells0[idx[0]]; ++s0) {
+        const double xbound = get_xbound(s0);
+        shls[2] = s0;
 
-      auto& idx = iter.idx();
-      auto& size = iter.size();
-      auto& off = iter.offset();
+        for (auto p = pfirst; p != plast; ++p) {
+          if (p->bound * xbound <= threshold)
+            break;
+          shls[0] = shell_offsets1[idx[1]] + p->s0;
+          shls[1] = shell_offsets2[idx[2]] + p->s1;
+          if (skip_triple(s0, shls[0], shls[1]))
+            continue;
+          costs[iblk] += tuple_cost(shls, 3, bas);
+        }
+      }
+    }
+  }
 
-      // block lower bounds
-      int lb0 = off[0];
-      int lb1 = off[1];
-      int lb2 = off[2];
+  util::work_queue queue(costs);
 
-      // tensor offsets
-      int toff0 = lb0;
-      int toff1 = lb1;
-      int toff2 = lb2;
-      // local Block offsets
-      int locblkoff0 = 0;
-      int locblkoff1 = 0;
-      int locblkoff2 = 0;
+#pragma omp parallel
+  {
+    const int ithread = omp_get_thread_num();
+    double* buf = arena.buf(ithread);
+    double* cache = arena.cache(ithread);
+    int shls[3];
 
-      int& soff0 = shell_offsets0[idx[0]];
-      int& soff1 = shell_offsets1[idx[1]];
-      int& soff2 = shell_offsets2[idx[2]];
-      int& nshell0 = nshells0[idx[0]];
-      int& nshell1 = nshells1[idx[1]];
-      int& nshell2 = nshells2[idx[2]];
+    std::vector<shellpair> blkpairs;
+    screening_stats tstats;
 
-      // std::cout << "soffs: " << soff0 << " " << soff1 << std::endl;
-      // std::cout << "nshells: " << nshell0 << " " << nshell1 << std::endl;
+    int64_t iblk = 0;
 
-      dbcsr::block<3, double> blk(size);
+    while (queue.pop(ithread, iblk)) {
+      auto& idx = blkidx[iblk];
+      auto& size = blksize[iblk];
 
-      for (int s0 = soff0; s0 != soff0 + nshell0; ++s0) {
-        toff0 += locblkoff0;
-        int shellsize0 = CINTcgto_spheric(s0, bas);
-        shls[2] = s0;
+      const int soff0 = shell_offsets0[idx[0]];
+      const int soff1 = shell_offsets1[idx[1]];
+      const int soff2 = shell_offsets2[idx[2]];
+      const int nshell0 = nshells0[idx[0]];
+      const int nshell1 = nshells1[idx[1]];
+      const int nshell2 = nshells2[idx[2]];
 
-        for (int s1 = soff1; s1 != soff1 + nshell1; ++s1) {
-          toff1 += locblkoff1;
-          int shellsize1 = CINTcgto_spheric(s1, bas);
-          shls[0] = s1;
+      auto [pfirst, plast] = get_shellpairs(
+          spairs, blkpairs, idx[1], idx[2], soff1, nshell1, soff2, nshell2,
+          bas);
 
-          for (int s2 = soff2; s2 != soff2 + nshell2; ++s2) {
-            toff2 += locblkoff2;
-            int shellsize2 = CINTcgto_spheric(s2, bas);
-            shls[1] = s2;
+      dbcsr::block<3, double> blk(size);
 
-            int res = int_func(
-                buf, nullptr, shls, atm, natm, bas, nbas, env, nullptr,
-                nullptr);
+      double* blkdata = blk.data();
+      const int ld0 = size[0];
+      const int ld01 = size[0] * size[1];
 
-            if (res != 0) {
-              int iidx = 0;
+      int locblkoff0 = 0;
+      int64_t ntuples = 0;
 
-              for (int i = 0; i != shellsize0; ++i) {
-                for (int k = 0; k != shellsize2; ++k) {
-                  for (int j = 0; j != shellsize1; ++j) {
-                    blk(i + locblkoff0, j + locblkoff1, k + locblkoff2) =
-                        buf[iidx++];
-                  }
-                }
-              }  // std::cout << std::endl;
-            }
+      for (int s0 = soff0; s0 != soff0 + nshell0; ++s0) {
+        const int shellsize0 = CINTcgto_spheric(s0, bas);
+        const double xbound = get_xbound(s0);
+        shls[2] = s0;
 
-            locblkoff2 += shellsize2;
+        for (auto p = pfirst; p != plast; ++p) {
+          // pairs are sorted by decreasing bound
+          if (p->bound * xbound <= threshold)
+            break;
 
-          }  // endfor s2
+          shls[0] = soff1 + p->s0;
+          shls[1] = soff2 + p->s1;
 
-          toff2 = lb2;
-          locblkoff2 = 0;
-          locblkoff1 += shellsize1;
-        }  // endfor s1
+          if (skip_triple(s0, shls[0], shls[1]))
+            continue;
+
+          int res = int_func(
+              buf, nullptr, shls, atm, natm, bas, nbas, env, opt, cache);
+          ++ntuples;
+
+          if (res != 0) {
+            scatter_xbb(
+                buf, blkdata + locblkoff0 + p->off0 * ld0 + p->off1 * ld01,
+                shellsize0, p->size0, p->size1, ld0, ld01);
+          }
+        }  // endfor pairs
 
-        toff1 = lb1;
-        locblkoff1 = 0;
         locblkoff0 += shellsize0;
       }  // endfor s0
 
+      if (stats) {
+        tstats.tuples_computed += ntuples;
+        tstats.tuples_skipped += (int64_t)nshell0 * nshell1 * nshell2 - ntuples;
+        tstats.add_block_norms(
+            scr->estimate_block_xbb(idx[0], idx[1], idx[2]),
+            block_norm(blkdata, (int64_t)ld01 * size[2]));
+      }
+
       m_out.put_block(idx, blk);
 
     }  // end BLOCK LOOP
 
-    delete[] buf;
-    delete[] shls;
-
-    iter.stop();
     m_out.finalize();
 
+    if (stats) {
+#pragma omp critical
+      *stats += tstats;
+    }
+
   }  // end parallel omp
+
+  queue.report(time);
 }
 
 void calc_ints(
@@ -374,12 +527,15 @@ void calc_ints(
     std::vector<std::vector<int>>& shell_offsets,
     std::vector<std::vector<int>>& nshells,
     CINTIntegralFunction* int_func,
+    CINTOpt* opt,
     int* atm,
     int natm,
     int* bas,
     int nbas,
     double* env,
-    int max_l)
+    cint_arena& arena,
+    screener* scr,
+    util::mpi_time& time)
 {
   const auto& nshells0 = nshells[0];
   const auto& nshells1 = nshells[1];
@@ -390,122 +546,177 @@ void calc_ints(
   const auto& shell_offsets2 = shell_offsets[2];
   const auto& shell_offsets3 = shell_offsets[3];
 
-  int max_buf_size = pow(2 * max_l + 1, 4);
+  const shellpair_list* spairs = (scr) ? scr->shellpairs() : nullptr;
+  const double threshold = (scr) ? scr->int_threshold() : 0.0;
+
+  screening_stats* stats = (scr) ? &scr->stats(m_out.name()) : nullptr;
+
+  // local blocks
+  std::vector<dbcsr::index<4>> blkidx, blksize;
+
+  dbcsr::iterator_t<4> iter(m_out);
+  iter.start();
+  while (iter.blocks_left()) {
+    iter.next();
+    blkidx.push_back(iter.idx());
+    blksize.push_back(iter.size());
+  }
+  iter.stop();
+
+  const int64_t nblks = blkidx.size();
+
+  auto get_bra = [&](std::vector<shellpair>& pairs,
+                     const dbcsr::index<4>& idx) {
+    return get_shellpairs(
+        spairs, pairs, idx[0], idx[1], shell_offsets0[idx[0]],
+        nshells0[idx[0]], shell_offsets1[idx[1]], nshells1[idx[1]], bas);
+  };
+
+  auto get_ket = [&](std::vector<shellpair>& pairs,
+                     const dbcsr::index<4>& idx) {
+    return get_shellpairs(
+        spairs, pairs, idx[2], idx[3], shell_offsets2[idx[2]],
+        nshells2[idx[2]], shell_offsets3[idx[3]], nshells3[idx[3]], bas);
+  };
+
+  // estimate block costs from the surviving shell quartets
+  std::vector<double> costs(nblks, 0.0);
 
 #pragma omp parallel
   {
-    dbcsr::iterator_t<4> iter(m_out);
+    std::vector<shellpair> brapairs, ketpairs;
+    int shls[4];
+
+#pragma omp for schedule(dynamic)
+    for (int64_t iblk = 0; iblk < nblks; ++iblk) {
+      auto& idx = blkidx[iblk];
+
+      auto [bfirst, blast] = get_bra(brapairs, idx);
+      auto [kfirst, klast] = get_ket(ketpairs, idx);
+
+      for (auto b = bfirst; b != blast; ++b) {
+        shls[0] = shell_offsets0[idx[0]] + b->s0;
+        shls[1] = shell_offsets1[idx[1]] + b->s1;
+
+        for (auto k = kfirst; k != klast; ++k) {
+          if (b->bound * k->bound <= threshold)
+            break;
+          shls[2] = shell_offsets2[idx[2]] + k->s0;
+          shls[3] = shell_offsets3[idx[3]] + k->s1;
+          costs[iblk] += tuple_cost(shls, 4, bas);
+        }
+      }
+    }
+  }
 
-    iter.start();
+  util::work_queue queue(costs);
 
-    double* buf = new double[max_buf_size];
-    int* shls = new int[4];
+#pragma omp parallel
+  {
+    const int ithread = omp_get_thread_num();
+    double* buf = arena.buf(ithread);
+    double* cache = arena.cache(ithread);
+    int shls[4];
 
-    while (iter.blocks_left()) {
-      iter.next();
+    std::vector<shellpair> brapairs, ketpairs;
+    screening_stats tstats;
 
-      auto& idx = iter.idx();
-      auto& size = iter.size();
-      auto& off = iter.offset();
+    int64_t iblk = 0;
 
-      // block lower bounds
-      const int lb0 = off[0];
-      const int lb1 = off[1];
-      const int lb2 = off[2];
-      const int lb3 = off[3];
+    while (queue.pop(ithread, iblk)) {
+      auto& idx = blkidx[iblk];
+      auto& size = blksize[iblk];
 
-      // tensor offsets
-      int toff0 = lb0;
-      int toff1 = lb1;
-      int toff2 = lb2;
-      int toff3 = lb3;
-      // local Block offsets
-      int locblkoff0 = 0;
-      int locblkoff1 = 0;
-      int locblkoff2 = 0;
-      int locblkoff3 = 0;
-
-      const int& soff0 = shell_offsets0[idx[0]];
-      const int& soff1 = shell_offsets1[idx[1]];
-      const int& soff2 = shell_offsets2[idx[2]];
-      const int& soff3 = shell_offsets3[idx[3]];
-      const int& nshell0 = nshells0[idx[0]];
-      const int& nshell1 = nshells1[idx[1]];
-      const int& nshell2 = nshells2[idx[2]];
-      const int& nshell3 = nshells3[idx[3]];
+      const int soff0 = shell_offsets0[idx[0]];
+      const int soff1 = shell_offsets1[idx[1]];
+      const int soff2 = shell_offsets2[idx[2]];
+      const int soff3 = shell_offsets3[idx[3]];
+
+      auto [bfirst, blast] = get_bra(brapairs, idx);
+      auto [kfirst, klast] = get_ket(ketpairs, idx);
 
       dbcsr::block<4, double> blk(size);
 
-      for (int s0 = soff0; s0 != soff0 + nshell0; ++s0) {
-        toff0 += locblkoff0;
-        int shellsize0 = CINTcgto_spheric(s0, bas);
-        shls[0] = s0;
+      double* blkdata = blk.data();
+      const int ld0 = size[0];
+      const int ld01 = size[0] * size[1];
+      const int ld012 = size[0] * size[1] * size[2];
 
-        for (int s1 = soff1; s1 != soff1 + nshell1; ++s1) {
-          toff1 += locblkoff1;
-          const int shellsize1 = CINTcgto_spheric(s1, bas);
-          shls[1] = s1;
+      const double ket_max = (kfirst != klast) ? kfirst->bound : 0.0;
+      int64_t ntuples = 0;
 
-          for (int s2 = soff2; s2 != soff2 + nshell2; ++s2) {
-            toff2 += locblkoff2;
-            const int shellsize2 = CINTcgto_spheric(s2, bas);
-            shls[2] = s2;
-
-            for (int s3 = soff3; s3 != soff3 + nshell3; ++s3) {
-              toff3 += locblkoff3;
-              const int shellsize3 = CINTcgto_spheric(s3, bas);
-              shls[3] = s3;
-
-              int res = int_func(
-                  buf, nullptr, shls, atm, natm, bas, nbas, env, nullptr,
-                  nullptr);
-
-              if (res != 0) {
-                int idx = 0;
-
-                for (int l = 0; l != shellsize3; ++l) {
-                  for (int k = 0; k != shellsize2; ++k) {
-                    for (int j = 0; j != shellsize1; ++j) {
-                      for (int i = 0; i != shellsize0; ++i) {
-                        blk(i + locblkoff0, j + locblkoff1, k + locblkoff2,
-                            l + locblkoff3) = buf[idx++];
-                      }
-                    }
-                  }
-                }
-              }
+      for (auto b = bfirst; b != blast; ++b) {
+        // pairs are sorted by decreasing bound
+        if (b->bound * ket_max <= threshold)
+          break;
 
-              locblkoff3 += shellsize3;
+        shls[0] = soff0 + b->s0;
+        shls[1] = soff1 + b->s1;
 
-            }  // endfor s3
+        for (auto k = kfirst; k != klast; ++k) {
+          if (b->bound * k->bound <= threshold)
+            break;
 
-            toff3 = lb3;
-            locblkoff3 = 0;
-            locblkoff2 += shellsize2;
+          shls[2] = soff2 + k->s0;
+          shls[3] = soff3 + k->s1;
 
-          }  // endfor s2
+          int res = int_func(
+              buf, nullptr, shls, atm, natm, bas, nbas, env, opt, cache);
+          ++ntuples;
 
-          toff2 = lb2;
-          locblkoff2 = 0;
-          locblkoff1 += shellsize1;
-        }  // endfor s1
+          if (res != 0) {
+            scatter_bbbb(
+                buf,
+                blkdata + b->off0 + b->off1 * ld0 + k->off0 * ld01 +
+                    k->off1 * ld012,
+                b->size0, b->size1, k->size0, k->size1, ld0, ld01, ld012);
+          }
 
-        toff1 = lb1;
-        locblkoff1 = 0;
-        locblkoff0 += shellsize0;
-      }  // endfor s0
+        }  // endfor ket pairs
+      }  // endfor bra pairs
+
+      if (stats) {
+        const int64_t nquartets = (int64_t)nshells0[idx[0]] *
+            nshells1[idx[1]] * nshells2[idx[2]] * nshells3[idx[3]];
+        tstats.tuples_computed += ntuples;
+        tstats.tuples_skipped += nquartets - ntuples;
+        tstats.add_block_norms(
+            scr->estimate_block_bbbb(idx[0], idx[1], idx[2], idx[3]),
+            block_norm(blkdata, (int64_t)ld012 * size[3]));
+      }
 
       m_out.put_block(idx, blk);
 
     }  // end BLOCK LOOP
 
-    delete[] buf;
-    delete[] shls;
-
-    iter.stop();
     m_out.finalize();
 
+    if (stats) {
+#pragma omp critical
+      *stats += tstats;
+    }
+
   }  // end parallel omp
+
+  queue.report(time);
+}
+
+// local blocks of a matrix as (row, column) pairs
+static std::vector<std::array<int, 2>> local_blocks(dbcsr::matrix<double>& m)
+{
+  std::vector<std::array<int, 2>> blks;
+
+  dbcsr::iterator iter(m);
+  iter.start();
+
+  while (iter.blocks_left()) {
+    iter.next_block();
+    blks.push_back({iter.row(), iter.col()});
+  }
+
+  iter.stop();
+
+  return blks;
 }
 
 void calc_ints_schwarz_mn(
@@ -513,73 +724,80 @@ void calc_ints_schwarz_mn(
     std::vector<std::vector<int>>& shell_offsets,
     std::vector<std::vector<int>>& nshells,
     CINTIntegralFunction* int_func,
+    CINTOpt* opt,
     int* atm,
     int natm,
     int* bas,
     int nbas,
     double* env,
-    int max_l)
+    cint_arena& arena,
+    util::mpi_time& time)
 {
   auto& nshells0 = nshells[0];
   auto& nshells1 = nshells[1];
   auto& shell_offsets0 = shell_offsets[0];
   auto& shell_offsets1 = shell_offsets[1];
 
-  int max_buf_size = pow(2 * max_l + 1, 4);
+  auto blks = local_blocks(m_out);
+  const int64_t nblks = blks.size();
 
-#pragma omp parallel
-  {
-    dbcsr::iterator iter(m_out);
+  std::vector<double> costs(nblks, 0.0);
 
-    iter.start();
+  for (int64_t iblk = 0; iblk != nblks; ++iblk) {
+    const int r = blks[iblk][0];
+    const int c = blks[iblk][1];
+    int shls[4];
 
-    double* buf = new double[max_buf_size];
-    int* shls = new int[4];
+    for (int s0 = shell_offsets0[r]; s0 != shell_offsets0[r] + nshells0[r];
+         ++s0) {
+      for (int s1 = shell_offsets1[c]; s1 != shell_offsets1[c] + nshells1[c];
+           ++s1) {
+        shls[0] = shls[2] = s0;
+        shls[1] = shls[3] = s1;
+        costs[iblk] += tuple_cost(shls, 4, bas);
+      }
+    }
+  }
 
-    while (iter.blocks_left()) {
-      iter.next_block();
+  util::work_queue queue(costs);
 
-      int r = iter.row();
-      int c = iter.col();
+#pragma omp parallel
+  {
+    const int ithread = omp_get_thread_num();
+    double* buf = arena.buf(ithread);
+    double* cache = arena.cache(ithread);
+    int shls[4];
 
-      // std::cout << "BLOCK: " << r << " " << c << std::endl;
+    int64_t iblk = 0;
 
-      // block lower bounds
-      int lb0 = iter.row_offset();
-      int lb1 = iter.col_offset();
+    while (queue.pop(ithread, iblk)) {
+      int r = blks[iblk][0];
+      int c = blks[iblk][1];
 
-      // tensor offsets
-      int toff0 = lb0;
-      int toff1 = lb1;
-      // local Block offsets
-      int locblkoff0 = 0;
-      int locblkoff1 = 0;
+      bool found = true;
+      auto blk = m_out.get_block_p(r, c, found);
+      if (!found)
+        continue;
 
       int soff0 = shell_offsets0[r];
       int soff1 = shell_offsets1[c];
       int nshell0 = nshells0[r];
       int nshell1 = nshells1[c];
 
-      // std::cout << "nshells: " << nshell0 << " " << nshell1 << std::endl;
-
       int s0_idx = 0;
       for (int s0 = soff0; s0 != soff0 + nshell0; ++s0) {
-        toff0 += locblkoff0;
         int shellsize0 = CINTcgto_spheric(s0, bas);
         shls[0] = s0;
         shls[2] = s0;
 
         int s1_idx = 0;
         for (int s1 = soff1; s1 != soff1 + nshell1; ++s1) {
-          toff1 += locblkoff1;
           int shellsize1 = CINTcgto_spheric(s1, bas);
           shls[1] = s1;
           shls[3] = s1;
 
-          // std::cout << "PROCESSING SHELL: " << s0 << " " << s1 << std::endl;
-
           int res = int_func(
-              buf, nullptr, shls, atm, natm, bas, nbas, env, nullptr, nullptr);
+              buf, nullptr, shls, atm, natm, bas, nbas, env, opt, cache);
 
           double n = 0.0;
 
@@ -590,30 +808,24 @@ void calc_ints_schwarz_mn(
                     buf[i + j * shellsize0 + i * shellsize0 * shellsize1 +
                         j * shellsize0 * shellsize1 * shellsize0]);
               }
-            }  // std::cout << std::endl;
+            }
           }
 
-          iter(s0_idx, s1_idx) = sqrt(n);
+          blk(s0_idx, s1_idx) = sqrt(n);
 
-          locblkoff1 += shellsize1;
           ++s1_idx;
-        }  // endfor s2
+        }  // endfor s1
 
-        toff1 = lb1;
-        locblkoff1 = 0;
-        locblkoff0 += shellsize0;
         ++s0_idx;
-      }  // endfor s1
+      }  // endfor s0
 
     }  // end BLOCK LOOP
 
-    delete[] buf;
-    delete[] shls;
+  }  // end parallel omp
 
-    iter.stop();
-    m_out.finalize();
+  m_out.finalize();
 
-  }  // end parallel omp
+  queue.report(time);
 }
 
 void calc_ints_schwarz_x(
@@ -621,71 +833,1547 @@ void calc_ints_schwarz_x(
     std::vector<std::vector<int>>& shell_offsets,
     std::vector<std::vector<int>>& nshells,
     CINTIntegralFunction* int_func,
+    CINTOpt* opt,
     int* atm,
     int natm,
     int* bas,
     int nbas,
     double* env,
-    int max_l)
+    cint_arena& arena,
+    util::mpi_time& time)
 {
   auto& nshells0 = nshells[0];
   auto& shell_offsets0 = shell_offsets[0];
-  int max_buf_size = pow(2 * max_l + 1, 2);
 
-#pragma omp parallel
-  {
-    dbcsr::iterator iter(m_out);
+  auto blks = local_blocks(m_out);
+  const int64_t nblks = blks.size();
 
-    iter.start();
+  std::vector<double> costs(nblks, 0.0);
 
-    double* buf = new double[max_buf_size];
-    int* shls = new int[2];
+  for (int64_t iblk = 0; iblk != nblks; ++iblk) {
+    const int r = blks[iblk][0];
+    int shls[2];
 
-    while (iter.blocks_left()) {
-      iter.next_block();
+    for (int s0 = shell_offsets0[r]; s0 != shell_offsets0[r] + nshells0[r];
+         ++s0) {
+      shls[0] = shls[1] = s0;
+      costs[iblk] += tuple_cost(shls, 2, bas);
+    }
+  }
 
-      int r = iter.row();
+  util::work_queue queue(costs);
+
+#pragma omp parallel
+  {
+    const int ithread = omp_get_thread_num();
+    double* buf = arena.buf(ithread);
+    double* cache = arena.cache(ithread);
+    int shls[2];
+
+    int64_t iblk = 0;
 
-      // std::cout << "BLOCK: " << r << std::endl;
+    while (queue.pop(ithread, iblk)) {
+      int r = blks[iblk][0];
+      int c = blks[iblk][1];
+
+      bool found = true;
+      auto blk = m_out.get_block_p(r, c, found);
+      if (!found)
+        continue;
 
       int soff0 = shell_offsets0[r];
       int nshell0 = nshells0[r];
 
-      // std::cout << "soffs: " << soff0 << std::endl;
-      // std::cout << "nshells: " << nshell0 << std::endl;
-
       int idx = 0;
       for (int s0 = soff0; s0 != soff0 + nshell0; ++s0) {
         int shellsize0 = CINTcgto_spheric(s0, bas);
         shls[0] = s0;
         shls[1] = s0;
 
-        // std::cout << "PROCESSING SHELL: " << s0 << std::endl;
-
         int res = int_func(
-            buf, nullptr, shls, atm, natm, bas, nbas, env, nullptr, nullptr);
+            buf, nullptr, shls, atm, natm, bas, nbas, env, opt, cache);
 
         double n = 0.0;
 
         if (res != 0) {
           for (int i = 0; i != shellsize0; ++i) {
             n += fabs(buf[i + i * shellsize0]);
-          }  // std::cout << std::endl;
+          }
         }
 
-        iter(idx++, 0) = sqrt(n);
+        blk(idx++, 0) = sqrt(n);
 
-      }  // endfor s1
+      }  // endfor s0
 
     }  // end BLOCK LOOP
 
-    delete[] buf;
-    delete[] shls;
+  }  // end parallel omp
 
-    iter.stop();
-    m_out.finalize();
+  m_out.finalize();
+
+  queue.report(time);
+}
+
+// =====================================================================
+//                SHELL BLOCKS OF DBCSR MATRICES
+// =====================================================================
+
+// block, offset within the block and size of each shell of a basis, with
+// the shells numbered from 0, and the first shell of each block
+struct shell_layout {
+  int nsh = 0;
+  int max_size = 0;
+  std::vector<int> blk, off, size;
+  std::vector<int> blk_begin;
+};
+
+static shell_layout make_shell_layout(
+    const std::vector<int>& shell_offsets,
+    const std::vector<int>& nshells,
+    int* bas)
+{
+  shell_layout sl;
+
+  for (size_t iblk = 0; iblk != nshells.size(); ++iblk) {
+    sl.blk_begin.push_back(sl.blk.size());
+    int off = 0;
+    for (int s = 0; s != nshells[iblk]; ++s) {
+      const int n = CINTcgto_spheric(shell_offsets[iblk] + s, bas);
+      sl.blk.push_back(iblk);
+      sl.off.push_back(off);
+      sl.size.push_back(n);
+      sl.max_size = std::max(sl.max_size, n);
+      off += n;
+    }
+  }
+
+  sl.nsh = sl.blk.size();
+  sl.blk_begin.push_back(sl.nsh);
+
+  return sl;
+}
+
+// a shell pair block inside a matrix block, element (a, b) at
+// data[a * inc_a + b * inc_b]
+struct shell_block {
+  const double* data;
+  int inc_a, inc_b;
+
+  double operator()(int a, int b) const
+  {
+    return data[a * inc_a + b * inc_b];
+  }
+};
+
+/* Shell pair access to the local blocks of a matrix, or with replicate to
+ * a block-sparse copy of it on all ranks. Shell pairs below the diagonal
+ * of symmetric matrices are read from the transposed block, those of
+ * missing blocks read as zeros.
+ */
+class matrix_shells {
+ private:
+  const shell_layout& m_sl;
+  dbcsr::shared_matrix<double> m_rep;
+  bool m_sym;
+  int m_nblk;
+  std::vector<int> m_ld;
+  std::vector<const double*> m_blks;
+  double m_zero = 0.0;
+
+ public:
+  matrix_shells(
+      dbcsr::matrix<double>& m, const shell_layout& sl, bool replicate) :
+      m_sl(sl)
+  {
+    dbcsr::matrix<double>* src = &m;
+
+    if (replicate) {
+      m_rep = dbcsr::matrix<double>::copy(m).name("replica").build();
+      m_rep->replicate_all();
+      src = m_rep.get();
+    }
+
+    m_sym = m.has_symmetry();
+    m_nblk = m.nblkrows_total();
+    m_ld = m.row_blk_sizes();
+    m_blks.assign((size_t)m_nblk * m_nblk, nullptr);
+
+    for (auto& [r, c] : local_blocks(*src)) {
+      bool found = false;
+      m_blks[r + (size_t)c * m_nblk] = src->get_block_data(r, c, found);
+    }
+  }
+
+  shell_block operator()(int s, int t) const
+  {
+    const int r = m_sl.blk[s], c = m_sl.blk[t];
+
+    if (m_sym && r > c) {
+      const double* blk = m_blks[c + (size_t)r * m_nblk];
+      if (!blk)
+        return {&m_zero, 0, 0};
+      return {blk + m_sl.off[t] + m_sl.off[s] * m_ld[c], m_ld[c], 1};
+    }
+
+    const double* blk = m_blks[r + (size_t)c * m_nblk];
+    if (!blk)
+      return {&m_zero, 0, 0};
+    return {blk + m_sl.off[s] + m_sl.off[t] * m_ld[r], 1, m_ld[r]};
+  }
+
+  // largest absolute element of each shell pair of the present blocks,
+  // maximum with out
+  void shell_max(Eigen::MatrixXd& out) const
+  {
+    for (int c = 0; c != m_nblk; ++c) {
+      for (int r = 0; r != m_nblk; ++r) {
+        if (!m_blks[r + (size_t)c * m_nblk])
+          continue;
+
+        for (int s = m_sl.blk_begin[r]; s != m_sl.blk_begin[r + 1]; ++s) {
+          for (int t = m_sl.blk_begin[c]; t != m_sl.blk_begin[c + 1]; ++t) {
+            auto p = (*this)(s, t);
+            double m = 0.0;
+            for (int b = 0; b != m_sl.size[t]; ++b) {
+              for (int a = 0; a != m_sl.size[s]; ++a) {
+                m = std::max(m, std::fabs(p(a, b)));
+              }
+            }
+            out(s, t) = std::max(out(s, t), m);
+            if (m_sym)
+              out(t, s) = std::max(out(t, s), m);
+          }
+        }
+      }
+    }
+  }
+};
+
+// shell pair blocks (s, t) of a result, keyed by s * nsh + t, column major
+using shellpair_buffers = std::unordered_map<int64_t, std::vector<double>>;
+
+static double* shellpair_buffer(
+    shellpair_buffers& bufs, const shell_layout& sl, int s, int t)
+{
+  auto& buf = bufs[(int64_t)s * sl.nsh + t];
+  if (buf.empty())
+    buf.assign(sl.size[s] * sl.size[t], 0.0);
+  return buf.data();
+}
+
+/* Replaces out by 0.5 (B + B^T), or by B if not symmetrize, with B the
+ * sum of the shell pair buffers of all threads and ranks. Only the blocks
+ * which some buffer touches are allocated, and for symmetric matrices
+ * only the stored triangle. The buffers are emptied.
+ */
+static void flush_shellpairs(
+    std::vector<shellpair_buffers>& bufs,
+    const shell_layout& sl,
+    dbcsr::matrix<double>& out,
+    bool symmetrize,
+    MPI_Comm comm)
+{
+  const int nblk = out.nblkrows_total();
+  const bool sym = out.has_symmetry();
+
+  if (sym && !symmetrize) {
+    throw std::runtime_error(
+        "flush_shellpairs: symmetric matrices need symmetrized buffers");
+  }
+
+  // blocks touched on any rank, the replicated matrices need the same
+  // sparsity pattern everywhere
+  std::vector<unsigned char> mask((size_t)nblk * nblk, 0);
+
+  for (auto& tbufs : bufs) {
+    for (auto& [key, buf] : tbufs) {
+      const int r = sl.blk[key / sl.nsh], c = sl.blk[key % sl.nsh];
+      if (!symmetrize) {
+        mask[r + (size_t)c * nblk] = 1;
+        continue;
+      }
+      mask[std::min(r, c) + (size_t)std::max(r, c) * nblk] = 1;
+      if (!sym)
+        mask[std::max(r, c) + (size_t)std::min(r, c) * nblk] = 1;
+    }
+  }
+
+  MPI_Allreduce(
+      MPI_IN_PLACE, mask.data(), mask.size(), MPI_UNSIGNED_CHAR, MPI_MAX,
+      comm);
+
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+
+  std::vector<int> rows, cols;
+  for (int c = 0; c != nblk; ++c) {
+    for (int r = 0; r != nblk; ++r) {
+      if (mask[r + (size_t)c * nblk] && out.proc(r, c) == rank) {
+        rows.push_back(r);
+        cols.push_back(c);
+      }
+    }
+  }
+
+  out.clear();
+  out.reserve_blocks(rows, cols);
+  out.replicate_all();
+
+  auto ld = out.row_blk_sizes();
+
+  for (auto& tbufs : bufs) {
+    for (auto& [key, buf] : tbufs) {
+      const int s = key / sl.nsh, t = key % sl.nsh;
+      const int r = sl.blk[s], c = sl.blk[t];
+      const int ns = sl.size[s], nt = sl.size[t];
+      bool found = false;
+
+      // (s, t) into block (r, c), and its transpose into block (c, r),
+      // leaving out the blocks below the diagonal of symmetric matrices
+      if (!sym || r <= c) {
+        const double f = (symmetrize) ? 0.5 : 1.0;
+        double* blk = out.get_block_data(r, c, found);
+        for (int b = 0; b != nt; ++b) {
+          double* col = blk + sl.off[s] + (sl.off[t] + b) * ld[r];
+          for (int a = 0; a != ns; ++a) { col[a] += f * buf[a + b * ns]; }
+        }
+      }
+
+      if (symmetrize && (!sym || c <= r)) {
+        double* blk = out.get_block_data(c, r, found);
+        for (int a = 0; a != ns; ++a) {
+          double* col = blk + sl.off[t] + (sl.off[s] + a) * ld[c];
+          for (int b = 0; b != nt; ++b) { col[b] += 0.5 * buf[a + b * ns]; }
+        }
+      }
+    }
+
+    tbufs.clear();
+  }
+
+  out.sum_replicated();
+  out.distribute();
+}
+
+std::array<int64_t, 2> calc_jk_direct(
+    dbcsr::matrix<double>* p_j,
+    const std::vector<dbcsr::matrix<double>*>& p_k,
+    dbcsr::matrix<double>* j_out,
+    const std::vector<dbcsr::matrix<double>*>& k_out,
+    const std::vector<std::array<int, 2>>& pairs,
+    const std::vector<jk_task>& tasks,
+    const Eigen::MatrixXd& q,
+    const std::vector<int>& shell_offsets,
+    const std::vector<int>& nshells,
+    CINTIntegralFunction* int_func,
+    CINTOpt* opt,
+    int* atm,
+    int natm,
+    int* bas,
+    int nbas,
+    double* env,
+    cint_arena& arena,
+    double threshold,
+    MPI_Comm comm,
+    util::mpi_time& time)
+{
+  const auto sl = make_shell_layout(shell_offsets, nshells, bas);
+  const int nsh = sl.nsh;
+  const int ndens = p_k.size();
+  const int shell_begin = shell_offsets[0];
+
+  // block-sparse densities on all ranks, and their largest element in
+  // each shell pair
+  std::unique_ptr<matrix_shells> dj;
+  std::vector<std::unique_ptr<matrix_shells>> dk;
+
+  Eigen::MatrixXd d_j = Eigen::MatrixXd::Zero(nsh, nsh);
+  Eigen::MatrixXd d_k = Eigen::MatrixXd::Zero(nsh, nsh);
+
+  if (p_j) {
+    dj = std::make_unique<matrix_shells>(*p_j, sl, true);
+    dj->shell_max(d_j);
+  }
+
+  for (auto p : p_k) {
+    dk.push_back(std::make_unique<matrix_shells>(*p, sl, true));
+    dk.back()->shell_max(d_k);
+  }
+
+  const double d_max = std::max(d_j.maxCoeff(), d_k.maxCoeff());
+
+  std::vector<double> q_pair(pairs.size());
+  for (size_t ij = 0; ij != pairs.size(); ++ij) {
+    q_pair[ij] = q(pairs[ij][0], pairs[ij][1]);
+  }
+
+  // tasks are dealt out round-robin over the ranks. Within a task the ket
+  // pairs are sorted by their bound, so the quartets which survive the
+  // screening are a leading range of them, which sets the cost
+  int rank, nranks;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &nranks);
+
+  std::vector<int64_t> my_tasks;
+  std::vector<double> costs;
+  int64_t nskipped = 0;
+
+  for (int64_t it = rank; it < (int64_t)tasks.size(); it += nranks) {
+    auto& task = tasks[it];
+    const double q_bra = q_pair[task.bra];
+
+    auto last = std::partition_point(
+        q_pair.begin() + task.ket_begin, q_pair.begin() + task.ket_end,
+        [&](double q_ket) { return q_bra * q_ket * d_max >= threshold; });
+
+    const int64_t nket = last - (q_pair.begin() + task.ket_begin);
+    nskipped += task.ket_end - task.ket_begin - nket;
+
+    if (nket == 0)
+      continue;
+
+    const int i = pairs[task.bra][0], j = pairs[task.bra][1];
+    int shls[4] = {
+        shell_begin + i, shell_begin + j, shell_begin + i, shell_begin + j};
+
+    my_tasks.push_back(it);
+    costs.push_back(tuple_cost(shls, 4, bas) * nket);
+  }
+
+  util::work_queue queue(costs);
+
+  const int nthreads = omp_get_max_threads();
+
+  std::vector<shellpair_buffers> j_bufs(nthreads);
+  std::vector<std::vector<shellpair_buffers>> k_bufs(
+      ndens, std::vector<shellpair_buffers>(nthreads));
+
+  int64_t ncomputed = 0;
+
+#pragma omp parallel reduction(+ : ncomputed, nskipped)
+  {
+    const int ithread = omp_get_thread_num();
+    double* buf = arena.buf(ithread);
+    double* cache = arena.cache(ithread);
+    int shls[4];
+
+    int64_t itask = 0;
+
+    while (queue.pop(ithread, itask)) {
+      auto& task = tasks[my_tasks[itask]];
+      const int i = pairs[task.bra][0];
+      const int j = pairs[task.bra][1];
+      const double q_bra = q_pair[task.bra];
+
+      for (int64_t kl = task.ket_begin; kl != task.ket_end; ++kl) {
+        // all remaining ket pairs have smaller bounds
+        if (q_bra * q_pair[kl] * d_max < threshold) {
+          nskipped += task.ket_end - kl;
+          break;
+        }
+
+        const int k = pairs[kl][0];
+        const int l = pairs[kl][1];
+
+        // Schwarz bound times the density elements the quartet meets
+        double d = std::max(d_j(i, j), d_j(k, l));
+        d = std::max({d, d_k(i, k), d_k(i, l), d_k(j, k), d_k(j, l)});
+
+        if (q_bra * q_pair[kl] * d < threshold) {
+          ++nskipped;
+          continue;
+        }
+
+        shls[0] = shell_begin + i;
+        shls[1] = shell_begin + j;
+        shls[2] = shell_begin + k;
+        shls[3] = shell_begin + l;
+
+        int res = int_func(
+            buf, nullptr, shls, atm, natm, bas, nbas, env, opt, cache);
+        ++ncomputed;
+
+        if (res == 0)
+          continue;
+
+        // number of equivalent quartets under the 8-fold symmetry
+        const bool same = (i == k && j == l);
+        const double deg = ((i == j) ? 1.0 : 2.0) * ((k == l) ? 1.0 : 2.0) *
+            (same ? 1.0 : 2.0);
+
+        const int ni = sl.size[i], nj = sl.size[j];
+        const int nk = sl.size[k], nl = sl.size[l];
+
+        if (dj) {
+          auto p_ij = (*dj)(i, j);
+          auto p_kl = (*dj)(k, l);
+          double* j_ij = shellpair_buffer(j_bufs[ithread], sl, i, j);
+          double* j_kl = shellpair_buffer(j_bufs[ithread], sl, k, l);
+
+          for (int fl = 0; fl != nl; ++fl) {
+            for (int fk = 0; fk != nk; ++fk) {
+              double sum_kl = 0.0;
+              const double pkl = 0.5 * deg * p_kl(fk, fl);
+              const double* v = buf + ni * nj * (fk + nk * fl);
+              for (int fj = 0; fj != nj; ++fj) {
+                for (int fi = 0; fi != ni; ++fi) {
+                  j_ij[fi + ni * fj] += pkl * v[fi + ni * fj];
+                  sum_kl += v[fi + ni * fj] * p_ij(fi, fj);
+                }
+              }
+              j_kl[fk + nk * fl] += 0.5 * deg * sum_kl;
+            }
+          }
+        }
+
+        for (int id = 0; id != ndens; ++id) {
+          auto& p = *dk[id];
+          auto& kb = k_bufs[id][ithread];
+          auto p_jl = p(j, l), p_ik = p(i, k), p_jk = p(j, k), p_il = p(i, l);
+          double* k_ik = shellpair_buffer(kb, sl, i, k);
+          double* k_jl = shellpair_buffer(kb, sl, j, l);
+          double* k_il = shellpair_buffer(kb, sl, i, l);
+          double* k_jk = shellpair_buffer(kb, sl, j, k);
+
+          for (int fl = 0; fl != nl; ++fl) {
+            for (int fk = 0; fk != nk; ++fk) {
+              for (int fj = 0; fj != nj; ++fj) {
+                for (int fi = 0; fi != ni; ++fi) {
+                  const double v =
+                      0.25 * deg * buf[fi + ni * (fj + nj * (fk + nk * fl))];
+
+                  k_ik[fi + ni * fk] += v * p_jl(fj, fl);
+                  k_jl[fj + nj * fl] += v * p_ik(fi, fk);
+                  k_il[fi + ni * fl] += v * p_jk(fj, fk);
+                  k_jk[fj + nj * fk] += v * p_il(fi, fl);
+                }
+              }
+            }
+          }
+        }
+
+      }  // endfor ket pairs
+    }  // endfor tasks
 
   }  // end parallel omp
+
+  queue.report(time);
+
+  // the digestion above fills one of each pair of symmetric elements, the
+  // flush adds the transposes
+  if (j_out)
+    flush_shellpairs(j_bufs, sl, *j_out, true, comm);
+
+  for (int id = 0; id != ndens; ++id) {
+    flush_shellpairs(k_bufs[id], sl, *k_out[id], true, comm);
+  }
+
+  std::array<int64_t, 2> nquartets = {ncomputed, nskipped};
+  MPI_Allreduce(
+      MPI_IN_PLACE, nquartets.data(), 2, MPI_INT64_T, MPI_SUM, comm);
+
+  return nquartets;
+}
+
+std::vector<std::array<int, 3>> multipole_exponents(int order)
+{
+  std::vector<std::array<int, 3>> out;
+  for (int n = 0; n <= order; ++n) {
+    for (int t = n; t >= 0; --t) {
+      for (int u = n - t; u >= 0; --u) { out.push_back({t, u, n - t - u}); }
+    }
+  }
+  return out;
+}
+
+// buffers of pair_multipoles, one set per thread
+struct multipole_work {
+  std::vector<double> e_buf, h, powc, gauss;
+  std::array<std::vector<double>, 3> s;
+  std::vector<double> cart, tmp;
+};
+
+/* One dimension of the multipole moments of the primitive pair
+ * exp(-a x_A^2) exp(-b x_B^2):
+ * s(i, j, e) = int x_A^i x_B^j exp(-a x_A^2 - b x_B^2) x_C^e / e! dx
+ * for i <= li, j <= lj and e <= order, stored at
+ * s[e + (order + 1) * (j + (lj + 1) * i)]. The McMurchie-Davidson
+ * recurrences expand the product in Hermite gaussians Lambda_t about P,
+ * x_A^i x_B^j exp(...) = sum_t E(i, j, t) Lambda_t with
+ * E(i+1, j, t) = E(i, j, t-1) / 2p + X_PA E(i, j, t) + (t+1) E(i, j, t+1),
+ * the same with X_PB for j, and E(0, 0, 0) = exp(-ab/p X_AB^2). The
+ * moments of Lambda_t are
+ * int x_C^e / e! Lambda_t dx = sum_{k even} X_PC^(e-k-t) / (e-k-t)!
+ *   sqrt(pi/p) / ((k/2)! (4p)^(k/2)).
+ */
+static void hermite_moments(
+    int li,
+    int lj,
+    int order,
+    double a,
+    double b,
+    double xa,
+    double xb,
+    double xc,
+    multipole_work& w,
+    std::vector<double>& s)
+{
+  const double p = a + b;
+  const double xp = (a * xa + b * xb) / p;
+  const double xpa = xp - xa, xpb = xp - xb, xpc = xp - xc;
+  const int nt = li + lj + 1;
+
+  // E(i, j, t) at e_buf[t + nt * (j + (lj + 1) * i)]
+  auto& e_buf = w.e_buf;
+  e_buf.assign((size_t)(li + 1) * (lj + 1) * nt, 0.0);
+  auto e_at = [&](int i, int j, int t) -> double& {
+    return e_buf[t + nt * (j + (lj + 1) * i)];
+  };
+
+  e_at(0, 0, 0) = std::exp(-a * b / p * (xa - xb) * (xa - xb));
+
+  for (int i = 0; i <= li; ++i) {
+    if (i > 0) {
+      for (int t = 0; t <= i; ++t) {
+        double v = xpa * e_at(i - 1, 0, t);
+        if (t > 0)
+          v += e_at(i - 1, 0, t - 1) / (2.0 * p);
+        if (t + 1 < i)
+          v += (t + 1) * e_at(i - 1, 0, t + 1);
+        e_at(i, 0, t) = v;
+      }
+    }
+    for (int j = 1; j <= lj; ++j) {
+      for (int t = 0; t <= i + j; ++t) {
+        double v = (t < i + j) ? xpb * e_at(i, j - 1, t) : 0.0;
+        if (t > 0)
+          v += e_at(i, j - 1, t - 1) / (2.0 * p);
+        if (t + 1 < i + j)
+          v += (t + 1) * e_at(i, j - 1, t + 1);
+        e_at(i, j, t) = v;
+      }
+    }
+  }
+
+  // h(e, t), the moments of the Hermite gaussians
+  const int ne = order + 1;
+  auto& powc = w.powc;
+  auto& gauss = w.gauss;
+  auto& h = w.h;
+  powc.resize(ne);
+  gauss.resize(ne / 2 + 1);
+  h.assign((size_t)ne * nt, 0.0);
+
+  powc[0] = 1.0;
+  for (int n = 1; n != ne; ++n) { powc[n] = powc[n - 1] * xpc / n; }
+
+  gauss[0] = std::sqrt(M_PI / p);
+  for (int k = 1; k != (int)gauss.size(); ++k) {
+    gauss[k] = gauss[k - 1] / (4.0 * p * k);
+  }
+
+  for (int e = 0; e != ne; ++e) {
+    for (int t = 0; t <= std::min(e, nt - 1); ++t) {
+      double v = 0.0;
+      for (int k = 0; k <= e - t; k += 2) {
+        v += powc[e - k - t] * gauss[k / 2];
+      }
+      h[e + ne * t] = v;
+    }
+  }
+
+  s.assign((size_t)(li + 1) * (lj + 1) * ne, 0.0);
+
+  for (int i = 0; i <= li; ++i) {
+    for (int j = 0; j <= lj; ++j) {
+      double* sij = s.data() + ne * (j + (lj + 1) * i);
+      for (int t = 0; t <= i + j; ++t) {
+        const double et = e_at(i, j, t);
+        for (int e = t; e < ne; ++e) { sij[e] += et * h[e + ne * t]; }
+      }
+    }
+  }
+}
+
+// the angular normalization of s and p functions in libcint, that of
+// higher momenta is part of the cartesian to spherical transformation
+static double angular_factor(int l)
+{
+  switch (l) {
+    case 0:
+      return 0.282094791773878143;
+    case 1:
+      return 0.488602511902919921;
+    default:
+      return 1.0;
+  }
+}
+
+/* Multipole integrals of the shell pair (s0, s1) about origin for the
+ * exponents exps, written as nmoments blocks of n0 x n1 into out. The
+ * cartesian integrals are summed over the primitives from the Hermite
+ * moments of each dimension and transformed to spherical functions with
+ * the libcint normalization.
+ */
+static void pair_multipoles(
+    int s0,
+    int s1,
+    const std::array<double, 3>& origin,
+    const std::vector<std::array<int, 3>>& exps,
+    const int* atm,
+    const int* bas,
+    const double* env,
+    multipole_work& w,
+    double* out)
+{
+  const int* b0 = bas + s0 * BAS_SLOTS;
+  const int* b1 = bas + s1 * BAS_SLOTS;
+  const int l0 = b0[ANG_OF], l1 = b1[ANG_OF];
+  const int np0 = b0[NPRIM_OF], np1 = b1[NPRIM_OF];
+  const double* x0 = env + atm[b0[ATOM_OF] * ATM_SLOTS + PTR_COORD];
+  const double* x1 = env + atm[b1[ATOM_OF] * ATM_SLOTS + PTR_COORD];
+  const double* a0 = env + b0[PTR_EXP];
+  const double* a1 = env + b1[PTR_EXP];
+  const double* c0 = env + b0[PTR_COEFF];
+  const double* c1 = env + b1[PTR_COEFF];
+
+  // cartesian components in the libcint order
+  const auto cart0 = multipole_exponents(l0);
+  const auto cart1 = multipole_exponents(l1);
+  const int off0 = l0 * (l0 + 1) * (l0 + 2) / 6;
+  const int off1 = l1 * (l1 + 1) * (l1 + 2) / 6;
+  const int nc0 = (l0 + 1) * (l0 + 2) / 2;
+  const int nc1 = (l1 + 1) * (l1 + 2) / 2;
+  const int ncc = nc0 * nc1;
+  const int nmom = exps.size();
+
+  int order = 0;
+  for (auto& e : exps) { order = std::max(order, e[0] + e[1] + e[2]); }
+  const int ne = order + 1;
+
+  w.cart.assign((size_t)nmom * ncc, 0.0);
+
+  const double fac = angular_factor(l0) * angular_factor(l1);
+
+  for (int p0 = 0; p0 != np0; ++p0) {
+    for (int p1 = 0; p1 != np1; ++p1) {
+      const double c = fac * c0[p0] * c1[p1];
+      for (int d = 0; d != 3; ++d) {
+        hermite_moments(
+            l0, l1, order, a0[p0], a1[p1], x0[d], x1[d], origin[d], w,
+            w.s[d]);
+      }
+
+      for (int im = 0; im != nmom; ++im) {
+        auto& e = exps[im];
+        double* mc = w.cart.data() + (size_t)im * ncc;
+        for (int j = 0; j != nc1; ++j) {
+          auto& cj = cart1[off1 + j];
+          for (int i = 0; i != nc0; ++i) {
+            auto& ci = cart0[off0 + i];
+            double v = c;
+            for (int d = 0; d != 3; ++d) {
+              v *= w.s[d][e[d] + ne * (cj[d] + (l1 + 1) * ci[d])];
+            }
+            mc[i + nc0 * j] += v;
+          }
+        }
+      }
+    }
+  }
+
+  const int n0 = 2 * l0 + 1, n1 = 2 * l1 + 1;
+  w.tmp.resize((size_t)n0 * nc1);
+
+  for (int im = 0; im != nmom; ++im) {
+    double* mc = w.cart.data() + (size_t)im * ncc;
+    double* mout = out + (size_t)im * n0 * n1;
+
+    // s and p functions are the same in both forms
+    if (l0 < 2) {
+      std::copy(mc, mc + ncc, w.tmp.data());
+    } else {
+      CINTc2s_bra_sph(w.tmp.data(), nc1, mc, l0);
+    }
+
+    if (l1 < 2) {
+      std::copy(w.tmp.data(), w.tmp.data() + n0 * n1, mout);
+    } else {
+      CINTc2s_ket_sph(mout, n0, w.tmp.data(), l1);
+    }
+  }
+}
+
+/* Loops over the shell pairs my_pairs, balanced over the threads, and
+ * calls func(ithread, ipair, moments) with the multipole integrals of the
+ * pair about the centre of its group.
+ */
+template <typename Func>
+static void loop_pair_multipoles(
+    const std::vector<int64_t>& my_pairs,
+    const std::vector<std::array<int, 2>>& pairs,
+    const std::vector<int>& pair_group,
+    const std::vector<std::array<double, 3>>& centres,
+    const std::vector<std::array<int, 3>>& exps,
+    int shell_begin,
+    int* atm,
+    int* bas,
+    double* env,
+    util::mpi_time& time,
+    Func&& func)
+{
+  std::vector<double> costs;
+  int max_nn = 1;
+
+  for (auto ip : my_pairs) {
+    int shls[2] = {shell_begin + pairs[ip][0], shell_begin + pairs[ip][1]};
+    costs.push_back(tuple_cost(shls, 2, bas));
+    const int nn =
+        CINTcgto_spheric(shls[0], bas) * CINTcgto_spheric(shls[1], bas);
+    max_nn = std::max(max_nn, nn);
+  }
+
+  util::work_queue queue(costs);
+
+#pragma omp parallel
+  {
+    const int ithread = omp_get_thread_num();
+
+    multipole_work work;
+    std::vector<double> moments(max_nn * exps.size());
+
+    int64_t itask = 0;
+
+    while (queue.pop(ithread, itask)) {
+      const int64_t ip = my_pairs[itask];
+
+      pair_multipoles(
+          shell_begin + pairs[ip][0], shell_begin + pairs[ip][1],
+          centres[pair_group[ip]], exps, atm, bas, env, work,
+          moments.data());
+
+      func(ithread, ip, moments.data());
+    }
+
+  }  // end parallel omp
+
+  queue.report(time);
+}
+
+Eigen::MatrixXd calc_pair_multipoles(
+    dbcsr::matrix<double>& p,
+    const std::vector<std::array<int, 2>>& pairs,
+    const std::vector<int>& pair_group,
+    const std::vector<std::array<double, 3>>& centres,
+    const std::vector<int>& shell_offsets,
+    const std::vector<int>& nshells,
+    int order,
+    int* atm,
+    int natm,
+    int* bas,
+    int nbas,
+    double* env,
+    MPI_Comm comm,
+    util::mpi_time& time)
+{
+  const auto exps = multipole_exponents(order);
+  const int nmom = exps.size();
+  const int ngroups = centres.size();
+  const auto sl = make_shell_layout(shell_offsets, nshells, bas);
+
+  // each pair is taken by the rank which holds its density block
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+
+  const bool sym = p.has_symmetry();
+  std::vector<int64_t> my_pairs;
+
+  for (int64_t ip = 0; ip != (int64_t)pairs.size(); ++ip) {
+    int r = sl.blk[pairs[ip][0]], c = sl.blk[pairs[ip][1]];
+    if (sym && r > c)
+      std::swap(r, c);
+    if (p.proc(r, c) == rank)
+      my_pairs.push_back(ip);
+  }
+
+  const matrix_shells pm(p, sl, false);
+
+  const int nthreads = omp_get_max_threads();
+  std::vector<Eigen::MatrixXd> m_thread(
+      nthreads, Eigen::MatrixXd::Zero(nmom, ngroups));
+
+  loop_pair_multipoles(
+      my_pairs, pairs, pair_group, centres, exps, shell_offsets[0], atm,
+      bas, env, time,
+      [&](int ithread, int64_t ip, const double* moments) {
+        const int i = pairs[ip][0];
+        const int j = pairs[ip][1];
+        const int ni = sl.size[i];
+        const int nj = sl.size[j];
+        const int nn = ni * nj;
+        const double deg = (i == j) ? 1.0 : 2.0;
+
+        auto pij = pm(i, j);
+        auto& mt = m_thread[ithread];
+
+        for (int im = 0; im != nmom; ++im) {
+          const double* mom = moments + im * nn;
+          double sum = 0.0;
+          for (int fj = 0; fj != nj; ++fj) {
+            for (int fi = 0; fi != ni; ++fi) {
+              sum += pij(fi, fj) * mom[fi + ni * fj];
+            }
+          }
+          mt(im, pair_group[ip]) += deg * sum;
+        }
+      });
+
+  Eigen::MatrixXd out = Eigen::MatrixXd::Zero(nmom, ngroups);
+  for (auto& mt : m_thread) { out += mt; }
+
+  MPI_Allreduce(
+      MPI_IN_PLACE, out.data(), out.size(), MPI_DOUBLE, MPI_SUM, comm);
+
+  return out;
+}
+
+void calc_pair_potential(
+    const Eigen::MatrixXd& l,
+    dbcsr::matrix<double>& v_out,
+    const std::vector<std::array<int, 2>>& pairs,
+    const std::vector<int>& pair_group,
+    const std::vector<std::array<double, 3>>& centres,
+    const std::vector<int>& shell_offsets,
+    const std::vector<int>& nshells,
+    int order,
+    int* atm,
+    int natm,
+    int* bas,
+    int nbas,
+    double* env,
+    MPI_Comm comm,
+    util::mpi_time& time)
+{
+  const auto exps = multipole_exponents(order);
+  const int nmom = exps.size();
+  const auto sl = make_shell_layout(shell_offsets, nshells, bas);
+  const int nblk = v_out.nblkrows_total();
+  const bool sym = v_out.has_symmetry();
+
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+
+  // a pair (i, j) goes into block (r, c) and, transposed, into (c, r),
+  // leaving out those below the diagonal of symmetric matrices. Since
+  // i >= j, r >= c. Pairs are computed by the ranks holding these blocks
+  auto direct = [&](int i, int j) {
+    const int r = sl.blk[i], c = sl.blk[j];
+    return (!sym || r == c) && v_out.proc(r, c) == rank;
+  };
+
+  auto transposed = [&](int i, int j) {
+    const int r = sl.blk[i], c = sl.blk[j];
+    return i != j && v_out.proc(c, r) == rank;
+  };
+
+  std::vector<unsigned char> mask((size_t)nblk * nblk, 0);
+  std::vector<int64_t> my_pairs;
+
+  for (int64_t ip = 0; ip != (int64_t)pairs.size(); ++ip) {
+    const int i = pairs[ip][0], j = pairs[ip][1];
+    const int r = sl.blk[i], c = sl.blk[j];
+    const bool d = direct(i, j), t = transposed(i, j);
+
+    if (d)
+      mask[r + (size_t)c * nblk] = 1;
+    if (t)
+      mask[c + (size_t)r * nblk] = 1;
+    if (d || t)
+      my_pairs.push_back(ip);
+  }
+
+  std::vector<int> rows, cols;
+  for (int c = 0; c != nblk; ++c) {
+    for (int r = 0; r != nblk; ++r) {
+      if (mask[r + (size_t)c * nblk]) {
+        rows.push_back(r);
+        cols.push_back(c);
+      }
+    }
+  }
+
+  v_out.clear();
+  v_out.reserve_blocks(rows, cols);
+
+  auto ld = v_out.row_blk_sizes();
+  std::vector<double*> blks((size_t)nblk * nblk, nullptr);
+
+  for (size_t ib = 0; ib != rows.size(); ++ib) {
+    bool found = false;
+    blks[rows[ib] + (size_t)cols[ib] * nblk] =
+        v_out.get_block_data(rows[ib], cols[ib], found);
+  }
+
+  // the pairs are distinct, so the threads write to distinct elements
+  loop_pair_multipoles(
+      my_pairs, pairs, pair_group, centres, exps, shell_offsets[0], atm,
+      bas, env, time,
+      [&](int ithread, int64_t ip, const double* moments) {
+        const int i = pairs[ip][0];
+        const int j = pairs[ip][1];
+        const int r = sl.blk[i], c = sl.blk[j];
+        const int ni = sl.size[i];
+        const int nj = sl.size[j];
+        const int nn = ni * nj;
+
+        double* v_ij = (direct(i, j))
+            ? blks[r + (size_t)c * nblk] + sl.off[i] + sl.off[j] * ld[r]
+            : nullptr;
+        double* v_ji = (transposed(i, j))
+            ? blks[c + (size_t)r * nblk] + sl.off[j] + sl.off[i] * ld[c]
+            : nullptr;
+
+        for (int im = 0; im != nmom; ++im) {
+          const double lm = l(im, pair_group[ip]);
+          const double* mom = moments + im * nn;
+          for (int fj = 0; fj != nj; ++fj) {
+            for (int fi = 0; fi != ni; ++fi) {
+              const double v = lm * mom[fi + ni * fj];
+              if (v_ij)
+                v_ij[fi + fj * ld[r]] += v;
+              if (v_ji)
+                v_ji[fj + fi * ld[c]] += v;
+            }
+          }
+        }
+      });
+}
+
+/* Real solid harmonics r^l Y_lm(x, y, z) in the order of libcint, i.e.
+ * m = -l..l except for l = 1, which is x, y, z. The Y_lm are normalized
+ * on the unit sphere and carry no Condon-Shortley phase.
+ */
+static void solid_harmonics(int l, double x, double y, double z, double* out)
+{
+  if (l == 0) {
+    out[0] = 0.282094791773878143;
+    return;
+  }
+
+  if (l == 1) {
+    const double c = 0.488602511902919921;
+    out[0] = c * x;
+    out[1] = c * y;
+    out[2] = c * z;
+    return;
+  }
+
+  const double r2 = x * x + y * y + z * z;
+
+  // real and imaginary part of (x + iy)^m
+  double re = 1.0, im = 0.0;
+
+  for (int m = 0; m <= l; ++m) {
+    // Q_l^m = r^(l-m) d^m P_l/dt^m (z/r) by the recurrence of the Legendre
+    // polynomials, starting from Q_m^m = (2m-1)!!
+    double qm = 1.0;
+    for (int k = 1; k <= m; ++k) { qm *= 2 * k - 1; }
+
+    double qm_prev = 0.0;
+    for (int k = m; k != l; ++k) {
+      const double qm_next =
+          ((2 * k + 1) * z * qm - (k + m) * r2 * qm_prev) / (k - m + 1);
+      qm_prev = qm;
+      qm = qm_next;
+    }
+
+    // (l-m)! / (l+m)!
+    double ratio = 1.0;
+    for (int k = l - m + 1; k <= l + m; ++k) { ratio /= k; }
+
+    const double norm = std::sqrt((2 * l + 1) / (4.0 * M_PI) * ratio);
+
+    if (m == 0) {
+      out[l] = norm * qm;
+    }
+    else {
+      out[l + m] = std::sqrt(2.0) * norm * qm * re;
+      out[l - m] = std::sqrt(2.0) * norm * qm * im;
+    }
+
+    const double re_next = re * x - im * y;
+    im = re * y + im * x;
+    re = re_next;
+  }
+}
+
+/* Values of the basis functions of shells (numbered from 0) at the points
+ * of the batch, as libcint defines them: the coefficients in env include
+ * the radial normalization and the angular parts are solid harmonics.
+ * out is npts x nfunctions, with the shells one after the other.
+ */
+static void basis_values(
+    const grid_batch& batch,
+    const std::vector<int>& shells,
+    int shell_begin,
+    int* atm,
+    int* bas,
+    double* env,
+    Eigen::MatrixXd& out)
+{
+  int nf = 0;
+  for (int s : shells) { nf += CINTcgto_spheric(shell_begin + s, bas); }
+
+  const int npts = batch.points.size();
+  out.resize(npts, nf);
+
+  std::vector<double> ylm;
+  int col = 0;
+
+  for (int s : shells) {
+    const int* b = bas + (shell_begin + s) * BAS_SLOTS;
+    const int l = b[ANG_OF];
+    const int nprim = b[NPRIM_OF];
+    const double* alpha = env + b[PTR_EXP];
+    const double* coeff = env + b[PTR_COEFF];
+    const double* o = env + atm[b[ATOM_OF] * ATM_SLOTS + PTR_COORD];
+
+    ylm.resize(2 * l + 1);
+
+    for (int ig = 0; ig != npts; ++ig) {
+      auto& pt = batch.points[ig];
+      const double dx = pt[0] - o[0];
+      const double dy = pt[1] - o[1];
+      const double dz = pt[2] - o[2];
+      const double r2 = dx * dx + dy * dy + dz * dz;
+
+      double radial = 0.0;
+      for (int ip = 0; ip != nprim; ++ip) {
+        radial += coeff[ip] * std::exp(-alpha[ip] * r2);
+      }
+
+      solid_harmonics(l, dx, dy, dz, ylm.data());
+
+      for (int m = 0; m != 2 * l + 1; ++m) {
+        out(ig, col + m) = radial * ylm[m];
+      }
+    }
+
+    col += 2 * l + 1;
+  }
+}
+
+/* Bound on |chi(r)| of the functions of a libcint shell. The radial
+ * coefficients are normalized, the spherical harmonics are at most
+ * sqrt((2l+1)/4pi) and r^l exp(-a r^2) has its maximum at r^2 = l/2a.
+ */
+static double shell_max_value(const int* b, const double* env)
+{
+  const int l = b[ANG_OF];
+  const double* a = env + b[PTR_EXP];
+  const double* c = env + b[PTR_COEFF];
+
+  double out = 0.0;
+  for (int p = 0; p != b[NPRIM_OF]; ++p) {
+    out += std::fabs(c[p]) * std::pow(l / (2.0 * M_E * a[p]), 0.5 * l);
+  }
+  return std::sqrt((2 * l + 1) / (4.0 * M_PI)) * out;
+}
+
+std::array<int64_t, 2> calc_k_seminumerical(
+    const std::vector<dbcsr::matrix<double>*>& p_k,
+    const std::vector<dbcsr::matrix<double>*>& k_out,
+    const std::vector<grid_batch>& batches,
+    const std::vector<double>& extents,
+    const std::vector<int>& shell_offsets,
+    const std::vector<int>& nshells,
+    int* atm,
+    int natm,
+    int* bas,
+    int nbas,
+    double* env,
+    int nenv,
+    double threshold,
+    MPI_Comm comm,
+    util::mpi_time& time)
+{
+  const auto sl = make_shell_layout(shell_offsets, nshells, bas);
+  const int nsh = sl.nsh;
+  const int ndens = p_k.size();
+  const int shell_begin = shell_offsets[0];
+
+  // block-sparse densities on all ranks, and their largest element in
+  // each shell pair
+  std::vector<std::unique_ptr<matrix_shells>> dk;
+  Eigen::MatrixXd d = Eigen::MatrixXd::Zero(nsh, nsh);
+
+  for (auto p : p_k) {
+    dk.push_back(std::make_unique<matrix_shells>(*p, sl, true));
+    dk.back()->shell_max(d);
+  }
+
+  std::vector<std::array<double, 3>> centres(nsh);
+  std::vector<double> sup(nsh);
+  for (int s = 0; s != nsh; ++s) {
+    const int* b = bas + (shell_begin + s) * BAS_SLOTS;
+    const double* o = env + atm[b[ATOM_OF] * ATM_SLOTS + PTR_COORD];
+    centres[s] = {o[0], o[1], o[2]};
+    sup[s] = shell_max_value(b, env);
+  }
+
+  // bound on the potential integrals A_ns(g) at any point
+  Eigen::MatrixXd a_bound(nsh, nsh);
+  for (int s = 0; s != nsh; ++s) {
+    for (int n = 0; n != nsh; ++n) {
+      a_bound(n, s) = 1.5 * std::cbrt(4.0 * M_PI * sup[n] * sup[s]);
+    }
+  }
+
+  auto distance = [](const std::array<double, 3>& a, const double* b) {
+    const double dx = a[0] - b[0], dy = a[1] - b[1], dz = a[2] - b[2];
+    return std::sqrt(dx * dx + dy * dy + dz * dz);
+  };
+
+  // the product of a shell pair lives in the sphere of the shell with the
+  // smaller extent
+  auto pair_shell = [&extents](int n, int s) {
+    return (extents[n] < extents[s]) ? n : s;
+  };
+
+  // partners n of each shell s with keep(n, s) by decreasing m(n, s), so
+  // that the loops below can stop at the first small one
+  auto sorted_partners = [nsh](const Eigen::MatrixXd& m, auto&& keep) {
+    std::vector<std::vector<int>> out(nsh);
+    for (int s = 0; s != nsh; ++s) {
+      for (int n = 0; n != nsh; ++n) {
+        if (m(n, s) > 0.0 && keep(n, s))
+          out[s].push_back(n);
+      }
+      std::sort(out[s].begin(), out[s].end(), [&m, s](int a, int b) {
+        return m(a, s) > m(b, s);
+      });
+    }
+    return out;
+  };
+
+  const auto d_partners = sorted_partners(d, [](int, int) { return true; });
+
+  // shell pairs whose spheres of extent do not overlap vanish
+  const auto a_partners = sorted_partners(a_bound, [&](int n, int s) {
+    return distance(centres[n], centres[s].data()) <=
+        extents[n] + extents[s];
+  });
+
+  const double a_max_all = a_bound.maxCoeff();
+
+  // batches are dealt out round-robin over the ranks
+  int rank, nranks;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &nranks);
+
+  std::vector<int64_t> tasks;
+  std::vector<double> costs;
+
+  for (int64_t ib = rank; ib < (int64_t)batches.size(); ib += nranks) {
+    tasks.push_back(ib);
+    costs.push_back(
+        (double)batches[ib].points.size() * batches[ib].shells.size());
+  }
+
+  util::work_queue queue(costs);
+
+  const int nthreads = omp_get_max_threads();
+  std::vector<std::vector<shellpair_buffers>> k_bufs(
+      ndens, std::vector<shellpair_buffers>(nthreads));
+
+  int64_t ncomputed = 0, nskipped = 0;
+
+#pragma omp parallel reduction(+ : ncomputed, nskipped)
+  {
+    const int ithread = omp_get_thread_num();
+
+    std::vector<double> env_t(env, env + nenv);
+    std::vector<double> buf(sl.max_size * sl.max_size);
+
+    Eigen::MatrixXd x, xw, psub, f_pts, kb;
+    Eigen::VectorXd xw_pts;
+    std::vector<Eigen::MatrixXd> f(ndens), g(ndens);
+
+    // column offsets of the shells in F and G, -1 if absent
+    std::vector<int> f_off(nsh, -1), g_off(nsh, -1);
+    std::vector<int> f_shells, g_shells;
+
+    // shell pairs (n, s) of the potential integrals, with the column of s
+    // in f_pts
+    std::vector<std::array<int, 3>> pairs;
+
+    int64_t itask = 0;
+
+    while (queue.pop(ithread, itask)) {
+      auto& batch = batches[tasks[itask]];
+      auto& shells = batch.shells;
+      const int npts = batch.points.size();
+      const int nshb = shells.size();
+
+      basis_values(batch, shells, shell_begin, atm, bas, env, x);
+
+      xw = x;
+      for (int ig = 0; ig != npts; ++ig) { xw.row(ig) *= batch.weights[ig]; }
+
+      xw_pts = xw.cwiseAbs().rowwise().maxCoeff();
+      const double xw_max = (npts) ? xw_pts.maxCoeff() : 0.0;
+
+      std::vector<int> x_off(nshb + 1, 0);
+      std::vector<double> x_max(nshb);
+      for (int ii = 0; ii != nshb; ++ii) {
+        const int n = sl.size[shells[ii]];
+        x_off[ii + 1] = x_off[ii] + n;
+        x_max[ii] = x.middleCols(x_off[ii], n).cwiseAbs().maxCoeff();
+      }
+
+      // shells s of F_sg, coupled to the shells of the batch by the density
+      f_shells.clear();
+      for (int ii = 0; ii != nshb; ++ii) {
+        for (int s : d_partners[shells[ii]]) {
+          if (x_max[ii] * d(s, shells[ii]) * a_max_all * xw_max < threshold)
+            break;
+          if (f_off[s] < 0) {
+            f_off[s] = 0;
+            f_shells.push_back(s);
+          }
+        }
+      }
+
+      std::sort(f_shells.begin(), f_shells.end());
+      int nf = 0;
+      for (int s : f_shells) {
+        f_off[s] = nf;
+        nf += sl.size[s];
+      }
+
+      // F_sg = sum_l P_sl chi_l(g)
+      psub.resize(x.cols(), nf);
+
+      for (int id = 0; id != ndens; ++id) {
+        for (int ii = 0; ii != nshb; ++ii) {
+          const int l = shells[ii];
+          for (int s : f_shells) {
+            auto p = (*dk[id])(l, s);
+            for (int b = 0; b != sl.size[s]; ++b) {
+              for (int a = 0; a != sl.size[l]; ++a) {
+                psub(x_off[ii] + a, f_off[s] + b) = p(a, b);
+              }
+            }
+          }
+        }
+        f[id] = x * psub;
+      }
+
+      // largest F_sg of each shell s at each point
+      f_pts = Eigen::MatrixXd::Zero(npts, f_shells.size());
+      for (int id = 0; id != ndens; ++id) {
+        for (size_t is = 0; is != f_shells.size(); ++is) {
+          const int s = f_shells[is];
+          f_pts.col(is) = f_pts.col(is).cwiseMax(
+              f[id].middleCols(f_off[s], sl.size[s])
+                  .cwiseAbs()
+                  .rowwise()
+                  .maxCoeff());
+        }
+      }
+
+      // shell pairs (n, s), bounded by a_bound and, if the batch lies
+      // outside the sphere of the pair, by the inverse distance
+      pairs.clear();
+      g_shells.clear();
+
+      for (size_t is = 0; is != f_shells.size(); ++is) {
+        const int s = f_shells[is];
+        const double fx_max = f_pts.col(is).maxCoeff() * xw_max;
+
+        int64_t ntaken = 0;
+        for (int n : a_partners[s]) {
+          if (a_bound(n, s) * fx_max < threshold)
+            break;
+
+          const int c = pair_shell(n, s);
+          const double r = distance(batch.centre, centres[c].data()) -
+              extents[c] - batch.radius;
+
+          if (r > 0.0 && fx_max < threshold * r)
+            continue;
+
+          pairs.push_back({n, s, (int)is});
+          ++ntaken;
+          if (g_off[n] < 0) {
+            g_off[n] = 0;
+            g_shells.push_back(n);
+          }
+        }
+        nskipped += a_partners[s].size() - ntaken;
+      }
+
+      std::sort(g_shells.begin(), g_shells.end());
+      int ng = 0;
+      for (int n : g_shells) {
+        g_off[n] = ng;
+        ng += sl.size[n];
+      }
+
+      for (int id = 0; id != ndens; ++id) {
+        g[id] = Eigen::MatrixXd::Zero(npts, ng);
+      }
+
+      // G_ng = sum_s A_ns(g) F_sg, with the same bounds for each point
+      for (auto& [n, s, is] : pairs) {
+        int shls[2] = {shell_begin + n, shell_begin + s};
+        const int nn = sl.size[n], ns = sl.size[s];
+        const int c = pair_shell(n, s);
+        const double a_ns = a_bound(n, s);
+
+        for (int ig = 0; ig != npts; ++ig) {
+          auto& pt = batch.points[ig];
+          const double r = distance(centres[c], pt.data()) - extents[c];
+          const double a_max = (r > 0.0) ? std::min(a_ns, 1.0 / r) : a_ns;
+
+          if (a_max * f_pts(ig, is) * xw_pts[ig] < threshold)
+            continue;
+
+          for (int k = 0; k != 3; ++k) { env_t[PTR_RINV_ORIG + k] = pt[k]; }
+
+          int res = int1e_rinv_sph(
+              buf.data(), nullptr, shls, atm, natm, bas, nbas, env_t.data(),
+              nullptr, nullptr);
+
+          if (res == 0)
+            continue;
+
+          for (int id = 0; id != ndens; ++id) {
+            for (int fs = 0; fs != ns; ++fs) {
+              const double fval = f[id](ig, f_off[s] + fs);
+              for (int fn = 0; fn != nn; ++fn) {
+                g[id](ig, g_off[n] + fn) += buf[fn + nn * fs] * fval;
+              }
+            }
+          }
+        }
+
+        ++ncomputed;
+      }
+
+      // K_mn += sum_g w_g chi_m(g) G_ng, into the shell pairs whose block
+      // is above threshold
+      for (int id = 0; id != ndens; ++id) {
+        kb.noalias() = xw.transpose() * g[id];
+        for (int ii = 0; ii != nshb; ++ii) {
+          const int m = shells[ii];
+          for (int n : g_shells) {
+            auto blk = kb.block(x_off[ii], g_off[n], sl.size[m], sl.size[n]);
+            if (blk.cwiseAbs().maxCoeff() < threshold)
+              continue;
+
+            double* k_mn = shellpair_buffer(k_bufs[id][ithread], sl, m, n);
+            Eigen::Map<Eigen::MatrixXd>(k_mn, sl.size[m], sl.size[n]) += blk;
+          }
+        }
+      }
+
+      for (int s : f_shells) { f_off[s] = -1; }
+      for (int n : g_shells) { g_off[n] = -1; }
+
+    }  // end batch loop
+
+  }  // end parallel omp
+
+  queue.report(time);
+
+  for (int id = 0; id != ndens; ++id) {
+    flush_shellpairs(k_bufs[id], sl, *k_out[id], false, comm);
+  }
+
+  std::array<int64_t, 2> npairs = {ncomputed, nskipped};
+  MPI_Allreduce(MPI_IN_PLACE, npairs.data(), 2, MPI_INT64_T, MPI_SUM, comm);
+
+  return npairs;
+}
+
+void calc_grid_overlap(
+    const std::vector<grid_batch>& batches,
+    dbcsr::matrix<double>& s_out,
+    const std::vector<int>& shell_offsets,
+    const std::vector<int>& nshells,
+    int* atm,
+    int* bas,
+    double* env,
+    MPI_Comm comm,
+    util::mpi_time& time)
+{
+  const auto sl = make_shell_layout(shell_offsets, nshells, bas);
+  const int shell_begin = shell_offsets[0];
+
+  int rank, nranks;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &nranks);
+
+  std::vector<int64_t> tasks;
+  std::vector<double> costs;
+
+  for (int64_t ib = rank; ib < (int64_t)batches.size(); ib += nranks) {
+    const double nsh = batches[ib].shells.size();
+    tasks.push_back(ib);
+    costs.push_back(batches[ib].points.size() * nsh * nsh);
+  }
+
+  util::work_queue queue(costs);
+
+  const int nthreads = omp_get_max_threads();
+  std::vector<shellpair_buffers> s_bufs(nthreads);
+
+#pragma omp parallel
+  {
+    const int ithread = omp_get_thread_num();
+
+    Eigen::MatrixXd x, xw, sb;
+    int64_t itask = 0;
+
+    while (queue.pop(ithread, itask)) {
+      auto& batch = batches[tasks[itask]];
+      auto& shells = batch.shells;
+      const int nshb = shells.size();
+
+      basis_values(batch, shells, shell_begin, atm, bas, env, x);
+
+      xw = x;
+      for (size_t ig = 0; ig != batch.weights.size(); ++ig) {
+        xw.row(ig) *= batch.weights[ig];
+      }
+
+      sb.noalias() = xw.transpose() * x;
+
+      std::vector<int> x_off(nshb + 1, 0);
+      for (int ii = 0; ii != nshb; ++ii) {
+        x_off[ii + 1] = x_off[ii] + sl.size[shells[ii]];
+      }
+
+      // the upper shell pairs only, the flush symmetrizes, so the ones
+      // off the diagonal count twice
+      for (int jj = 0; jj != nshb; ++jj) {
+        const int j = shells[jj];
+        for (int ii = 0; ii <= jj; ++ii) {
+          const int i = shells[ii];
+          const double f = (i == j) ? 1.0 : 2.0;
+          double* s_ij = shellpair_buffer(s_bufs[ithread], sl, i, j);
+          Eigen::Map<Eigen::MatrixXd>(s_ij, sl.size[i], sl.size[j]) +=
+              f * sb.block(x_off[ii], x_off[jj], sl.size[i], sl.size[j]);
+        }
+      }
+    }
+
+  }  // end parallel omp
+
+  queue.report(time);
+
+  flush_shellpairs(s_bufs, sl, s_out, true, comm);
 }
 
 }  // namespace ints
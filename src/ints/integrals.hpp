@@ -4,9 +4,13 @@
 #include <mpi.h>
 #include <dbcsr_matrix.hpp>
 #include <dbcsr_tensor.hpp>
+#include <array>
 #include <vector>
 #include "desc/basis.hpp"
+#include "ints/molgrid.hpp"
 #include "ints/screening.hpp"
+#include "ints/shellpairs.hpp"
+#include "utils/mpi_time.hpp"
 
 // =====================================================================
 //                       LIBCINT
@@ -23,6 +27,32 @@ CINTIntegralFunction int3c1e_sph;
 CINTIntegralFunction int4c1e_sph;
 
 CINTIntegralFunction int2c2e_sph;
+
+CINTIntegralFunction int1e_rr_sph;
+
+CINTIntegralFunction int1e_rrr_sph;
+
+CINTIntegralFunction int1e_rrrr_sph;
+
+CINTIntegralFunction int1e_rinv_sph;
+
+CINTOptimizerFunction int1e_ovlp_optimizer;
+
+CINTOptimizerFunction int1e_kin_optimizer;
+
+CINTOptimizerFunction int1e_nuc_optimizer;
+
+CINTOptimizerFunction int1e_r_optimizer;
+
+CINTOptimizerFunction int3c2e_optimizer;
+
+CINTOptimizerFunction int3c1e_optimizer;
+
+CINTOptimizerFunction int4c1e_optimizer;
+
+CINTOptimizerFunction int2c2e_optimizer;
+
+CINTOptimizerFunction int2e_optimizer;
 }
 
 namespace megalochem {
@@ -31,17 +61,55 @@ namespace ints {
 
 typedef void (*GeneralFunctionPtr)(void*);
 
+/* Scratch memory for libcint: an output buffer and an integral cache for
+ * each OpenMP thread. The arena only grows, so it can be kept around and
+ * reused for all blocks, batches and calls of an integral type.
+ */
+class cint_arena {
+ private:
+  std::vector<std::vector<double>> m_bufs;
+  std::vector<std::vector<double>> m_caches;
+
+ public:
+  cint_arena()
+  {
+  }
+
+  void reserve(int nthreads, size_t bufsize, size_t cachesize);
+
+  double* buf(int ithread)
+  {
+    return m_bufs[ithread].data();
+  }
+
+  double* cache(int ithread)
+  {
+    return m_caches[ithread].data();
+  }
+
+  size_t buf_size() const
+  {
+    return (m_bufs.size() == 0) ? 0 : m_bufs[0].size();
+  }
+
+  size_t cache_size() const
+  {
+    return (m_caches.size() == 0) ? 0 : m_caches[0].size();
+  }
+};
+
 void calc_ints(
     dbcsr::matrix<double>& m_out,
     std::vector<std::vector<int>>& shell_offsets,
     std::vector<std::vector<int>>& shell_sizes,
     CINTIntegralFunction* int_func,
+    CINTOpt* opt,
     int* atm,
     int natm,
     int* bas,
     int nbas,
     double* env,
-    int max_l);
+    cint_arena& arena);
 
 void calc_ints(
     dbcsr::matrix<double>& m_x,
@@ -50,60 +118,214 @@ void calc_ints(
     std::vector<std::vector<int>>& shell_offsets,
     std::vector<std::vector<int>>& shell_sizes,
     CINTIntegralFunction* int_func,
+    CINTOpt* opt,
     int* atm,
     int natm,
     int* bas,
     int nbas,
     double* env,
-    int max_l);
+    cint_arena& arena);
 
 void calc_ints(
     dbcsr::tensor<3, double>& m_out,
     std::vector<std::vector<int>>& shell_offsets,
     std::vector<std::vector<int>>& shell_sizes,
-    CINTIntegralFunction* nt_func,
+    CINTIntegralFunction* int_func,
+    CINTOpt* opt,
     int* atm,
     int natm,
     int* bas,
     int nbas,
     double* env,
-    int max_l);
+    cint_arena& arena,
+    screener* scr,
+    util::mpi_time& time);
 
 void calc_ints(
     dbcsr::tensor<4, double>& m_out,
     std::vector<std::vector<int>>& shell_offsets,
     std::vector<std::vector<int>>& shell_sizes,
     CINTIntegralFunction* int_func,
+    CINTOpt* opt,
     int* atm,
     int natm,
     int* bas,
     int nbas,
     double* env,
-    int max_l);
+    cint_arena& arena,
+    screener* scr,
+    util::mpi_time& time);
 
 void calc_ints_schwarz_mn(
     dbcsr::matrix<double>& m_out,
     std::vector<std::vector<int>>& shell_offsets,
     std::vector<std::vector<int>>& shell_sizes,
     CINTIntegralFunction* int_func,
+    CINTOpt* opt,
     int* atm,
     int natm,
     int* bas,
     int nbas,
     double* env,
-    int max_l);
+    cint_arena& arena,
+    util::mpi_time& time);
 
 void calc_ints_schwarz_x(
     dbcsr::matrix<double>& m_out,
     std::vector<std::vector<int>>& shell_offsets,
     std::vector<std::vector<int>>& shell_sizes,
     CINTIntegralFunction* int_func,
+    CINTOpt* opt,
+    int* atm,
+    int natm,
+    int* bas,
+    int nbas,
+    double* env,
+    cint_arena& arena,
+    util::mpi_time& time);
+
+/* Integral-direct Coulomb and exchange matrices with the 8-fold
+ * permutational symmetry of the 4c2e integrals. p_j is the density for J
+ * (nullptr to skip J), p_k the densities for K. They are replicated
+ * block-sparse on all ranks. J = (mn|ls) P_ls and K = (ml|ns) P_ls are
+ * accumulated in shell pair blocks and written into j_out and k_out,
+ * without sign, replacing their content.
+ * pairs holds shell pairs i >= j (numbered from 0), each task the quartets
+ * of a bra pair with a range of ket pairs, and every quartet may be met
+ * only once. As the ket pairs are sorted by their bound, a task stops at
+ * the first ket pair whose Schwarz bound q(i,j) q(k,l) times the largest
+ * density element falls below threshold. Other quartets are skipped if
+ * the bound times the density elements they are contracted with is below
+ * threshold. shell_offsets and nshells give the libcint index of the first
+ * shell and the number of shells of each block of the basis.
+ * Returns the number of computed and skipped quartets over all ranks.
+ */
+std::array<int64_t, 2> calc_jk_direct(
+    dbcsr::matrix<double>* p_j,
+    const std::vector<dbcsr::matrix<double>*>& p_k,
+    dbcsr::matrix<double>* j_out,
+    const std::vector<dbcsr::matrix<double>*>& k_out,
+    const std::vector<std::array<int, 2>>& pairs,
+    const std::vector<jk_task>& tasks,
+    const Eigen::MatrixXd& q,
+    const std::vector<int>& shell_offsets,
+    const std::vector<int>& nshells,
+    CINTIntegralFunction* int_func,
+    CINTOpt* opt,
+    int* atm,
+    int natm,
+    int* bas,
+    int nbas,
+    double* env,
+    cint_arena& arena,
+    double threshold,
+    MPI_Comm comm,
+    util::mpi_time& time);
+
+// highest order of the cartesian multipole integrals
+const int MAX_MULTIPOLE_ORDER = 15;
+
+/* Cartesian exponents (t, u, v) of the multipole moments up to the given
+ * order, sorted by the order t + u + v.
+ */
+std::vector<std::array<int, 3>> multipole_exponents(int order);
+
+/* Multipole moments of the density p, resolved by groups of shell pairs:
+ * M_n(g) = sum P_mn m_n(mn) over the pairs of group g, with
+ * m_tuv(mn) = <m| (x-C_x)^t (y-C_y)^u (z-C_z)^v / (t! u! v!) |n>
+ * about the centre C of the group, for the exponents of
+ * multipole_exponents(order), order <= MAX_MULTIPOLE_ORDER, computed
+ * analytically with the McMurchie-Davidson recurrences. pairs holds shell
+ * pairs i >= j (numbered from 0), the pair (j, i) is included through the
+ * symmetry of p. Each pair is computed by the rank which holds its block
+ * of p. shell_offsets and nshells give the libcint index of the first
+ * shell and the number of shells of each block of the basis.
+ * Returns M (nmoments x ngroups), summed over all ranks of comm.
+ */
+Eigen::MatrixXd calc_pair_multipoles(
+    dbcsr::matrix<double>& p,
+    const std::vector<std::array<int, 2>>& pairs,
+    const std::vector<int>& pair_group,
+    const std::vector<std::array<double, 3>>& centres,
+    const std::vector<int>& shell_offsets,
+    const std::vector<int>& nshells,
+    int order,
+    int* atm,
+    int natm,
+    int* bas,
+    int nbas,
+    double* env,
+    MPI_Comm comm,
+    util::mpi_time& time);
+
+/* Potential matrix V_mn = sum_n L_n(g) m_n(mn) of the local expansions L
+ * (nmoments x ngroups) of the given order about the group centres, for
+ * the shell pairs of calc_pair_multipoles and their transposes. v_out is
+ * cleared, and each rank fills the blocks it holds which the pairs touch,
+ * so no data is exchanged.
+ */
+void calc_pair_potential(
+    const Eigen::MatrixXd& l,
+    dbcsr::matrix<double>& v_out,
+    const std::vector<std::array<int, 2>>& pairs,
+    const std::vector<int>& pair_group,
+    const std::vector<std::array<double, 3>>& centres,
+    const std::vector<int>& shell_offsets,
+    const std::vector<int>& nshells,
+    int order,
     int* atm,
     int natm,
     int* bas,
     int nbas,
     double* env,
-    int max_l);
+    MPI_Comm comm,
+    util::mpi_time& time);
+
+/* Seminumerical exchange in the chain-of-spheres form. For each grid
+ * point g: F_sg = sum_l P_sl chi_l(g), G_ng = sum_s A_ns(g) F_sg with the
+ * potential integrals A_ns(g) = (n| 1/|r-g| |s), and
+ * K_mn = sum_g w_g chi_m(g) G_ng. The densities p_k are replicated
+ * block-sparse, k_out (no symmetry) get the blocks of K which the batches
+ * touch, summed over all ranks of comm and not symmetrized.
+ * Only shell pairs (n, s) whose spheres of extent overlap are taken. With
+ * the product f = chi_n chi_s of two normalized functions, |f|_1 <= 1 and
+ * |f|_inf <= |chi_n|_inf |chi_s|_inf, A_ns is bounded everywhere by
+ * 3/2 (4 pi |f|_inf)^(1/3) |f|_1^(2/3), and outside the sphere of the
+ * pair by |f|_1 / distance. A pair is skipped for a batch, and for each
+ * of its points, if that bound times the largest F_sg and w_g chi_m(g) is
+ * below threshold.
+ * Returns the number of computed and skipped shell pair batches.
+ */
+std::array<int64_t, 2> calc_k_seminumerical(
+    const std::vector<dbcsr::matrix<double>*>& p_k,
+    const std::vector<dbcsr::matrix<double>*>& k_out,
+    const std::vector<grid_batch>& batches,
+    const std::vector<double>& extents,
+    const std::vector<int>& shell_offsets,
+    const std::vector<int>& nshells,
+    int* atm,
+    int natm,
+    int* bas,
+    int nbas,
+    double* env,
+    int nenv,
+    double threshold,
+    MPI_Comm comm,
+    util::mpi_time& time);
+
+/* Overlap matrix S_mn = sum_g w_g chi_m(g) chi_n(g) on the grid, written
+ * into s_out, which is cleared and gets the blocks the batches touch.
+ */
+void calc_grid_overlap(
+    const std::vector<grid_batch>& batches,
+    dbcsr::matrix<double>& s_out,
+    const std::vector<int>& shell_offsets,
+    const std::vector<int>& nshells,
+    int* atm,
+    int* bas,
+    double* env,
+    MPI_Comm comm,
+    util::mpi_time& time);
 
 }  // namespace ints
 
@@ -0,0 +1,295 @@
+#include "ints/molgrid.hpp"
+
+#include <omp.h>
+#include <Eigen/Core>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <map>
+
+namespace megalochem {
+
+namespace ints {
+
+// points are batched by cubes of this edge length (bohr), cubes with more
+// than MAX_BATCH points are split
+static const double BATCH_BOX = 2.0;
+static const size_t MAX_BATCH = 128;
+
+// parameter of the partitioning of Stratmann, Scuseria and Frisch
+static const double SSF_A = 0.64;
+
+static const double ANGSTROM = 1.0 / 0.52917721092;
+
+// Bragg-Slater radii (angstrom) of H to Kr, others are taken as 1.5
+static const double BRAGG_RADII[] = {
+    0.35, 1.40, 1.45, 1.05, 0.85, 0.70, 0.65, 0.60, 0.50, 1.50,
+    1.80, 1.50, 1.25, 1.10, 1.00, 1.00, 1.00, 1.80, 2.20, 1.80,
+    1.60, 1.40, 1.35, 1.40, 1.40, 1.40, 1.35, 1.35, 1.35, 1.35,
+    1.30, 1.25, 1.15, 1.15, 1.15, 1.90};
+
+using point = std::array<double, 3>;
+
+static double dist(const point& a, const point& b)
+{
+  double dx = a[0] - b[0], dy = a[1] - b[1], dz = a[2] - b[2];
+  return std::sqrt(dx * dx + dy * dy + dz * dz);
+}
+
+// midpoint of the radial grid: half the Bragg radius, except for hydrogen
+static double radial_midpoint(int z)
+{
+  const int nradii = sizeof(BRAGG_RADII) / sizeof(double);
+  double r = (z >= 1 && z <= nradii) ? BRAGG_RADII[z - 1] : 1.5;
+  return ((z == 1) ? r : 0.5 * r) * ANGSTROM;
+}
+
+std::vector<std::array<double, 4>> lebedev_50()
+{
+  std::vector<std::array<double, 4>> out;
+
+  // all sign combinations of the nonzero coordinates of x
+  auto add_signs = [&out](point x, double w) {
+    for (int s = 0; s != 8; ++s) {
+      point y = x;
+      bool valid = true;
+      for (int c = 0; c != 3; ++c) {
+        if (s & (1 << c)) {
+          if (x[c] == 0.0)
+            valid = false;
+          y[c] = -x[c];
+        }
+      }
+      if (valid)
+        out.push_back({y[0], y[1], y[2], w});
+    }
+  };
+
+  const double a2 = 1.0 / std::sqrt(2.0);
+  const double a3 = 1.0 / std::sqrt(3.0);
+  const double l = 1.0 / std::sqrt(11.0);
+  const double m = 3.0 / std::sqrt(11.0);
+
+  for (int c = 0; c != 3; ++c) {
+    point e = {0.0, 0.0, 0.0};
+    e[c] = 1.0;
+    add_signs(e, 4.0 / 315.0);
+  }
+
+  for (int c = 0; c != 3; ++c) {
+    point e = {a2, a2, a2};
+    e[c] = 0.0;
+    add_signs(e, 64.0 / 2835.0);
+  }
+
+  add_signs({a3, a3, a3}, 27.0 / 1280.0);
+
+  for (int c = 0; c != 3; ++c) {
+    point e = {l, l, l};
+    e[c] = m;
+    add_signs(e, 14641.0 / 725760.0);
+  }
+
+  return out;
+}
+
+// SSF step function s(mu) of the cell functions
+static double ssf_step(double mu)
+{
+  if (mu <= -SSF_A)
+    return 1.0;
+  if (mu >= SSF_A)
+    return 0.0;
+
+  const double x = mu / SSF_A;
+  const double x2 = x * x;
+  const double g =
+      x * (35.0 + x2 * (-35.0 + x2 * (21.0 - 5.0 * x2))) / 16.0;
+
+  return 0.5 * (1.0 - g);
+}
+
+// distance at which the shell falls below eps, by its most diffuse
+// primitive
+static double shell_extent(const desc::Shell& shell, double eps)
+{
+  double out = 0.0;
+
+  for (size_t ip = 0; ip != shell.alpha.size(); ++ip) {
+    const double a = shell.alpha[ip];
+    const double c = std::fabs(shell.coeff[ip]);
+
+    // r^l exp(-a r^2) decreases beyond its maximum
+    double r = std::sqrt(0.5 * shell.l / a);
+    while (c * std::pow(r, shell.l) * std::exp(-a * r * r) > eps) {
+      r += 0.1;
+    }
+
+    out = std::max(out, r);
+  }
+
+  return out;
+}
+
+void molecular_grid::compute()
+{
+  auto atoms = m_mol->atoms();
+  const int natoms = atoms.size();
+
+  std::vector<point> centres(natoms);
+  for (int a = 0; a != natoms; ++a) {
+    centres[a] = {atoms[a].x, atoms[a].y, atoms[a].z};
+  }
+
+  Eigen::MatrixXd rab = Eigen::MatrixXd::Zero(natoms, natoms);
+  std::vector<double> nearest(natoms, std::numeric_limits<double>::max());
+
+  for (int a = 0; a != natoms; ++a) {
+    for (int b = 0; b != natoms; ++b) {
+      rab(a, b) = dist(centres[a], centres[b]);
+      if (a != b)
+        nearest[a] = std::min(nearest[a], rab(a, b));
+    }
+  }
+
+  // atomic grids
+  const auto angular = lebedev_50();
+
+  std::vector<point> points;
+  std::vector<double> weights;
+  std::vector<int> owner;
+
+  for (int a = 0; a != natoms; ++a) {
+    const double rm = radial_midpoint(atoms[a].atomic_number);
+    const int n = m_nradial;
+
+    for (int i = 1; i <= n; ++i) {
+      const double theta = i * M_PI / (n + 1);
+      const double x = std::cos(theta);
+      const double r = rm * (1.0 + x) / (1.0 - x);
+      const double dr = 2.0 * rm / ((1.0 - x) * (1.0 - x));
+      const double wr = M_PI / (n + 1) * std::sin(theta) * dr * r * r;
+
+      for (auto& ang : angular) {
+        points.push_back(
+            {centres[a][0] + r * ang[0], centres[a][1] + r * ang[1],
+             centres[a][2] + r * ang[2]});
+        weights.push_back(4.0 * M_PI * wr * ang[3]);
+        owner.push_back(a);
+      }
+    }
+  }
+
+  const int64_t npts = points.size();
+
+  // partitioning: w_A(r) = P_A(r) / sum_B P_B(r) with the cell functions
+  // P_B = prod_C s(mu_BC). P_B vanishes unless r_B < r_A (1+a)/(1-a), and
+  // s(mu_BC) = 1 unless r_C < r_B (1+a)/(1-a)
+  const double reach = (1.0 + SSF_A) / (1.0 - SSF_A);
+
+#pragma omp parallel
+  {
+    std::vector<double> r(natoms);
+    std::vector<int> cands, near;
+
+#pragma omp for schedule(dynamic, 256)
+    for (int64_t ip = 0; ip < npts; ++ip) {
+      const int a = owner[ip];
+
+      for (int b = 0; b != natoms; ++b) { r[b] = dist(points[ip], centres[b]); }
+
+      if (natoms == 1 || r[a] <= 0.5 * (1.0 - SSF_A) * nearest[a])
+        continue;
+
+      cands.clear();
+      near.clear();
+
+      for (int b = 0; b != natoms; ++b) {
+        if (r[b] < r[a] * reach)
+          cands.push_back(b);
+        if (r[b] < r[a] * reach * reach)
+          near.push_back(b);
+      }
+
+      double p_a = 0.0, p_sum = 0.0;
+
+      for (int b : cands) {
+        double p_b = 1.0;
+        for (int c : near) {
+          if (c == b)
+            continue;
+          p_b *= ssf_step((r[b] - r[c]) / rab(b, c));
+          if (p_b == 0.0)
+            break;
+        }
+        p_sum += p_b;
+        if (b == a)
+          p_a = p_b;
+      }
+
+      weights[ip] *= (p_sum > 0.0) ? p_a / p_sum : 0.0;
+    }
+  }
+
+  // shells with their extents
+  std::vector<point> sh_centres;
+  m_shell_extents.clear();
+
+  for (auto& cltr : *m_mol->c_basis()) {
+    for (auto& shell : cltr.shells) {
+      sh_centres.push_back(shell.O);
+      m_shell_extents.push_back(shell_extent(shell, m_eps));
+    }
+  }
+
+  // batches by boxes in space
+  std::map<std::array<int, 3>, std::vector<int64_t>> boxes;
+
+  for (int64_t ip = 0; ip != npts; ++ip) {
+    if (std::fabs(weights[ip]) < m_eps)
+      continue;
+
+    std::array<int, 3> key;
+    for (int c = 0; c != 3; ++c) {
+      key[c] = (int)std::floor(points[ip][c] / BATCH_BOX);
+    }
+    boxes[key].push_back(ip);
+  }
+
+  m_batches.clear();
+
+  for (auto& [key, idx] : boxes) {
+    for (size_t start = 0; start < idx.size(); start += MAX_BATCH) {
+      const size_t end = std::min(start + MAX_BATCH, idx.size());
+
+      grid_batch batch;
+      point centre = {0.0, 0.0, 0.0};
+
+      for (size_t i = start; i != end; ++i) {
+        batch.points.push_back(points[idx[i]]);
+        batch.weights.push_back(weights[idx[i]]);
+        for (int c = 0; c != 3; ++c) { centre[c] += points[idx[i]][c]; }
+      }
+
+      for (int c = 0; c != 3; ++c) { centre[c] /= (end - start); }
+
+      batch.centre = centre;
+      batch.radius = 0.0;
+      for (auto& p : batch.points) {
+        batch.radius = std::max(batch.radius, dist(p, centre));
+      }
+
+      for (size_t s = 0; s != sh_centres.size(); ++s) {
+        if (dist(sh_centres[s], centre) - batch.radius <= m_shell_extents[s])
+          batch.shells.push_back(s);
+      }
+
+      if (!batch.shells.empty())
+        m_batches.push_back(std::move(batch));
+    }
+  }
+}
+
+}  // namespace ints
+
+}  // namespace megalochem
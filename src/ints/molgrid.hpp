@@ -0,0 +1,77 @@
+#ifndef INTS_MOLGRID_H
+#define INTS_MOLGRID_H
+
+#include <array>
+#include <cstdint>
+#include <vector>
+#include "desc/molecule.hpp"
+
+namespace megalochem {
+
+namespace ints {
+
+/* 50 point Lebedev grid on the unit sphere, exact up to degree 11, as
+ * (x, y, z, w) with weights summing to 1
+ */
+std::vector<std::array<double, 4>> lebedev_50();
+
+// a spatially compact batch of grid points
+struct grid_batch {
+  std::vector<std::array<double, 3>> points;
+  std::vector<double> weights;
+  // sphere around the points
+  std::array<double, 3> centre;
+  double radius;
+  // shells of the basis (numbered from 0) which do not vanish on the points
+  std::vector<int> shells;
+};
+
+/* Atom-centred molecular integration grid: a radial grid with Becke's
+ * mapping of the Gauss-Chebyshev points, times the 50 point Lebedev grid,
+ * around each atom. The atomic grids are combined with the partitioning
+ * of Stratmann, Scuseria and Frisch. Points are grouped into batches by
+ * boxes in space, and each batch keeps the shells which reach it.
+ */
+class molecular_grid {
+ private:
+  desc::shared_molecule m_mol;
+  int m_nradial;
+  double m_eps;
+
+  std::vector<grid_batch> m_batches;
+  std::vector<double> m_shell_extents;
+
+ public:
+  // nradial: radial points per atom
+  // eps: threshold for basis function values and weights
+  molecular_grid(desc::shared_molecule mol, int nradial, double eps) :
+      m_mol(mol), m_nradial(nradial), m_eps(eps)
+  {
+  }
+
+  void compute();
+
+  const std::vector<grid_batch>& batches() const
+  {
+    return m_batches;
+  }
+
+  // distance from its centre beyond which each shell falls below eps
+  const std::vector<double>& shell_extents() const
+  {
+    return m_shell_extents;
+  }
+
+  int64_t npoints() const
+  {
+    int64_t n = 0;
+    for (auto& b : m_batches) { n += b.points.size(); }
+    return n;
+  }
+};
+
+}  // namespace ints
+
+}  // namespace megalochem
+
+#endif
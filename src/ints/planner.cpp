@@ -0,0 +1,378 @@
+#include "ints/planner.hpp"
+
+#include <unistd.h>
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+
+namespace megalochem {
+
+namespace ints {
+
+// number of copies of the largest batch held during a contraction: the
+// batch itself, its reordered copy and the result
+static const int64_t BATCH_COPIES = 3;
+
+// fraction of the node memory the planner hands out
+static const double MEMORY_FRACTION = 0.8;
+
+static double to_gb(int64_t bytes)
+{
+  return (double)bytes / 1e9;
+}
+
+void batch_planner::reduce(profile& p)
+{
+  MPI_Comm comm = m_world.comm();
+  MPI_Allreduce(
+      MPI_IN_PLACE, p.bytes_x.data(), p.bytes_x.size(), MPI_INT64_T, MPI_SUM,
+      comm);
+  MPI_Allreduce(
+      MPI_IN_PLACE, p.bytes_b.data(), p.bytes_b.size(), MPI_INT64_T, MPI_SUM,
+      comm);
+  MPI_Allreduce(MPI_IN_PLACE, &p.total, 1, MPI_INT64_T, MPI_SUM, comm);
+}
+
+void batch_planner::compute_xbb(shared_screener scr)
+{
+  auto xsizes = m_mol->c_dfbasis()->cluster_sizes();
+  auto bsizes = m_mol->c_basis()->cluster_sizes();
+
+  const int nx = xsizes.size();
+  const int nb = bsizes.size();
+  const int64_t naux = m_mol->c_dfbasis()->nbf();
+
+  m_xbb.bytes_x.assign(nx, 0);
+  m_xbb.bytes_b.assign(nb, 0);
+  m_fit.bytes_x.assign(nx, 0);
+  m_fit.bytes_b.assign(nb, 0);
+
+  // the block pairs mn are distributed over the ranks
+  for (int m = m_world.rank(); m < nb; m += m_world.size()) {
+    for (int n = 0; n != nb; ++n) {
+      const int64_t mn = (int64_t)bsizes[m] * bsizes[n] * sizeof(double);
+      bool significant = false;
+
+      for (int x = 0; x != nx; ++x) {
+        if (scr->skip_block_xbb(x, m, n))
+          continue;
+
+        const int64_t bytes = xsizes[x] * mn;
+        m_xbb.bytes_x[x] += bytes;
+        m_xbb.bytes_b[m] += bytes;
+        m_xbb.total += bytes;
+        significant = true;
+      }
+
+      if (!significant)
+        continue;
+
+      for (int x = 0; x != nx; ++x) { m_fit.bytes_x[x] += xsizes[x] * mn; }
+      m_fit.bytes_b[m] += naux * mn;
+      m_fit.total += naux * mn;
+    }
+  }
+
+  reduce(m_xbb);
+  reduce(m_fit);
+}
+
+/* A quartet ijkl survives if the product of the Schwarz norms of the pairs
+ * ij and kl is above the block threshold. With the pairs sorted by norm the
+ * partners of ij are a prefix of the list, so all combinations are counted
+ * with a binary search per pair. The Schwarz norm of a pair is taken from
+ * the estimate of the quartet ijij, which no screener bounds tighter.
+ */
+void batch_planner::compute_bbbb(shared_screener scr)
+{
+  auto bsizes = m_mol->c_basis()->cluster_sizes();
+  const int nb = bsizes.size();
+  const double threshold = scr->blk_threshold();
+
+  struct pair {
+    int i;
+    int64_t elems;
+    double norm;
+  };
+
+  std::vector<pair> pairs;
+  for (int i = 0; i != nb; ++i) {
+    for (int j = 0; j != nb; ++j) {
+      const double norm = std::sqrt(scr->estimate_block_bbbb(i, j, i, j));
+      if (norm * norm > threshold) {
+        pairs.push_back({i, (int64_t)bsizes[i] * bsizes[j], norm});
+      }
+    }
+  }
+
+  std::sort(pairs.begin(), pairs.end(), [](const pair& p0, const pair& p1) {
+    return p0.norm > p1.norm;
+  });
+
+  // elements of the first n pairs
+  vec<int64_t> prefix(pairs.size() + 1, 0);
+  for (size_t n = 0; n != pairs.size(); ++n) {
+    prefix[n + 1] = prefix[n] + pairs[n].elems;
+  }
+
+  m_bbbb.bytes_b.assign(nb, 0);
+  m_bbbb.total = 0;
+
+  for (auto& p : pairs) {
+    auto end = std::partition_point(
+        pairs.begin(), pairs.end(),
+        [&](const pair& q) { return p.norm * q.norm > threshold; });
+
+    const int64_t bytes =
+        p.elems * prefix[end - pairs.begin()] * sizeof(double);
+    m_bbbb.bytes_b[p.i] += bytes;
+    m_bbbb.total += bytes;
+  }
+}
+
+static int64_t max_slice(
+    const vec<int64_t>& bytes, const vec<vec<int>>& bounds)
+{
+  int64_t out = 0;
+  for (auto& b : bounds) {
+    int64_t sum = 0;
+    for (int i = b[0]; i <= b[1]; ++i) { sum += bytes[i]; }
+    out = std::max(out, sum);
+  }
+  return out;
+}
+
+int64_t batch_planner::max_batch_b(const profile& p, int nbatches)
+{
+  if (p.bytes_b.empty())
+    return 0;
+
+  auto cbas = m_mol->c_basis();
+  auto bounds = dbcsr::make_blk_bounds(
+      cbas->cluster_sizes(), nbatches, cbas->block_to_atom(m_mol->atoms()));
+
+  return max_slice(p.bytes_b, bounds) / m_world.size();
+}
+
+int64_t batch_planner::max_batch_x(const profile& p, int nbatches)
+{
+  if (p.bytes_x.empty())
+    return 0;
+
+  auto cdfbas = m_mol->c_dfbasis();
+  auto bounds = dbcsr::make_blk_bounds(
+      cdfbas->cluster_sizes(), nbatches,
+      cdfbas->block_to_atom(m_mol->atoms()));
+
+  return max_slice(p.bytes_x, bounds) / m_world.size();
+}
+
+batch_plan batch_planner::plan(
+    bool xbb,
+    bool bbbb,
+    std::string eris,
+    std::string intermeds,
+    int nbatches_b,
+    int nbatches_x)
+{
+  LOG.os<>("Planning batches and storage of the AO tensors.\n");
+
+  if (xbb && !m_mol->c_dfbasis()) {
+    throw std::runtime_error("Batch planner: 3c2e integrals without dfbasis");
+  }
+
+  // memory available to each rank
+  MPI_Comm node_comm;
+  MPI_Comm_split_type(
+      m_world.comm(), MPI_COMM_TYPE_SHARED, m_world.rank(), MPI_INFO_NULL,
+      &node_comm);
+  int ranks_per_node = 1;
+  MPI_Comm_size(node_comm, &ranks_per_node);
+  MPI_Comm_free(&node_comm);
+
+  int64_t node_memory = (global::node_memory > 0) ?
+      (int64_t)(global::node_memory * 1e9) :
+      (int64_t)sysconf(_SC_PHYS_PAGES) * (int64_t)sysconf(_SC_PAGE_SIZE);
+
+  // disk tensors go to node-local scratch if selected, or all into the
+  // working directory
+  const bool local_scratch = !dbcsr::btensor_global::scratch.empty();
+  std::filesystem::path disk_path = (local_scratch) ?
+      std::filesystem::path(dbcsr::btensor_global::scratch) :
+      std::filesystem::current_path();
+
+  // the scratch directory is only created by the tensors
+  while (!std::filesystem::exists(disk_path) && disk_path.has_parent_path() &&
+         disk_path != disk_path.parent_path()) {
+    disk_path = disk_path.parent_path();
+  }
+
+  int64_t disk = (int64_t)std::filesystem::space(disk_path).available;
+
+  MPI_Allreduce(
+      MPI_IN_PLACE, &ranks_per_node, 1, MPI_INT, MPI_MAX, m_world.comm());
+  MPI_Allreduce(
+      MPI_IN_PLACE, &node_memory, 1, MPI_INT64_T, MPI_MIN, m_world.comm());
+  MPI_Allreduce(MPI_IN_PLACE, &disk, 1, MPI_INT64_T, MPI_MIN, m_world.comm());
+
+  const int64_t memory =
+      (int64_t)(MEMORY_FRACTION * node_memory) / ranks_per_node;
+
+  LOG.os<>(
+      "Memory per node: ", to_gb(node_memory), " GB, ranks per node: ",
+      ranks_per_node, ", usable memory per rank: ", to_gb(memory), " GB\n");
+  LOG.os<>(
+      "Free disk space: ", to_gb(disk), " GB",
+      (local_scratch) ? " per node in " : " in ", disk_path.string(), '\n');
+
+  if ((xbb || bbbb) && !m_scr) {
+    throw std::runtime_error("Batch planner: no screener given");
+  }
+
+  if (xbb)
+    compute_xbb(m_scr);
+  if (bbbb)
+    compute_bbbb(m_scr);
+
+  const int nproc = m_world.size();
+  const int64_t eris_rank = (m_xbb.total + m_bbbb.total) / nproc;
+  const int64_t fit_rank = m_fit.total / nproc;
+
+  // bytes written to the disk of one node, or to the shared disk
+  auto on_disk = [&](int64_t total) {
+    return (local_scratch) ? total / nproc * ranks_per_node : total;
+  };
+
+  const int64_t eris_disk = on_disk(m_xbb.total + m_bbbb.total);
+  const int64_t fit_disk = on_disk(m_fit.total);
+
+  if (xbb) {
+    LOG.os<>(
+        "Screened 3c2e integrals: ", to_gb(m_xbb.total),
+        " GB, fitting coefficients: ", to_gb(m_fit.total), " GB\n");
+  }
+  if (bbbb) {
+    LOG.os<>("Screened 4c2e integrals: ", to_gb(m_bbbb.total), " GB\n");
+  }
+
+  // batches: the working set has to fit into half of the memory
+  const bool auto_b = (nbatches_b <= 0);
+  const bool auto_x = (nbatches_x <= 0);
+  const int nblk_b = m_mol->c_basis()->cluster_sizes().size();
+  const int nblk_x =
+      (m_mol->c_dfbasis()) ? m_mol->c_dfbasis()->cluster_sizes().size() : 1;
+
+  int nb = (auto_b) ? 1 : nbatches_b;
+  int nx = (auto_x) ? 1 : nbatches_x;
+
+  auto largest_b = [&](int b) {
+    return std::max(
+        {max_batch_b(m_xbb, b), max_batch_b(m_fit, b), max_batch_b(m_bbbb, b)});
+  };
+
+  auto largest_x = [&](int x) {
+    return std::max(max_batch_x(m_xbb, x), max_batch_x(m_fit, x));
+  };
+
+  auto working_set = [&](int b, int x) {
+    return BATCH_COPIES * std::max(largest_b(b), largest_x(x));
+  };
+
+  const int64_t batch_memory = memory / 2;
+
+  while (working_set(nb, nx) > batch_memory) {
+    // split the dimension which holds the largest batch, if allowed
+    if (largest_b(nb) >= largest_x(nx) && auto_b && nb < nblk_b) {
+      ++nb;
+    }
+    else if (largest_x(nx) > largest_b(nb) && auto_x && nx < nblk_x) {
+      ++nx;
+    }
+    else {
+      break;
+    }
+  }
+
+  const int64_t working = working_set(nb, nx);
+
+  LOG.os<>(
+      "Batches: ", nb, " (b) ", nx, " (x)", (auto_b || auto_x) ? " chosen" : "",
+      ", working set per rank: ", to_gb(working), " GB\n");
+
+  if (working > batch_memory) {
+    LOG.os<>(
+        "WARNING: the largest batch does not fit into half of the memory, "
+        "the calculation may run out of memory.\n");
+  }
+
+  int64_t free_memory = std::max(memory - working, (int64_t)0);
+  int64_t free_disk = (int64_t)(MEMORY_FRACTION * disk);
+
+  batch_plan out;
+  out.nbatches_b = nb;
+  out.nbatches_x = nx;
+  out.hybrid_memory = dbcsr::btensor_global::hybrid_memory;
+
+  // intermediates are used in every iteration and cannot be recomputed,
+  // so they get the memory first
+  if (intermeds == "auto") {
+    if (fit_rank <= free_memory) {
+      out.intermeds = dbcsr::btype::core;
+      free_memory -= fit_rank;
+      LOG.os<>("Intermediates: core, ", to_gb(fit_rank), " GB per rank\n");
+    }
+    else {
+      out.intermeds = dbcsr::btype::disk;
+      free_disk -= fit_disk;
+      LOG.os<>(
+          "Intermediates: disk, ", to_gb(fit_rank),
+          " GB per rank do not fit into the remaining ",
+          to_gb(free_memory), " GB\n");
+    }
+  }
+  else {
+    out.intermeds = dbcsr::get_btype(intermeds);
+    if (out.intermeds == dbcsr::btype::core)
+      free_memory -= fit_rank;
+    if (out.intermeds == dbcsr::btype::disk)
+      free_disk -= fit_disk;
+  }
+
+  if (eris == "auto") {
+    if (eris_rank <= free_memory) {
+      out.eris = dbcsr::btype::core;
+      LOG.os<>("Integrals: core, ", to_gb(eris_rank), " GB per rank\n");
+    }
+    else if (eris_disk <= free_disk && free_memory > 0) {
+      // keep what fits in memory, read or recompute the rest
+      out.eris = dbcsr::btype::hybrid;
+      out.hybrid_memory = to_gb(free_memory);
+      LOG.os<>(
+          "Integrals: hybrid, ", to_gb(free_memory), " of ", to_gb(eris_rank),
+          " GB per rank in memory, the rest on disk\n");
+    }
+    else if (eris_disk <= free_disk) {
+      out.eris = dbcsr::btype::disk;
+      LOG.os<>(
+          "Integrals: disk, ", to_gb(eris_rank),
+          " GB per rank do not fit into the remaining ",
+          to_gb(std::max(free_memory, (int64_t)0)), " GB\n");
+    }
+    else {
+      out.eris = dbcsr::btype::direct;
+      LOG.os<>(
+          "Integrals: direct, ", to_gb(eris_disk), " GB",
+          (local_scratch) ? " per node" : "",
+          " fit neither into memory nor on disk\n");
+    }
+  }
+  else {
+    out.eris = dbcsr::get_btype(eris);
+  }
+
+  return out;
+}
+
+}  // namespace ints
+
+}  // namespace megalochem
@@ -0,0 +1,96 @@
+#ifndef INTS_PLANNER_H
+#define INTS_PLANNER_H
+
+#include <dbcsr_btensor.hpp>
+#include <cstdint>
+#include <string>
+#include "desc/molecule.hpp"
+#include "ints/screening.hpp"
+#include "megalochem.hpp"
+#include "utils/mpi_time.hpp"
+
+namespace megalochem {
+
+namespace ints {
+
+struct batch_plan {
+  int nbatches_b;
+  int nbatches_x;
+  dbcsr::btype eris;
+  dbcsr::btype intermeds;
+  // memory (GB per rank) of hybrid integral tensors, to be passed to the
+  // aoloader. dbcsr::btensor_global::hybrid_memory unless planned
+  double hybrid_memory;
+};
+
+/* Chooses the number of batches and the storage type of the batched
+ * integral tensors. The sizes of the 3c2e and 4c2e integrals and of the
+ * fitting coefficients are estimated from the blocks which survive
+ * screening, i.e. the same blocks the aofactory reserves, the 4c2e ones
+ * from the Schwarz bounds of all combinations of two block pairs. The
+ * fitting coefficients are taken to be dense in the auxiliary index.
+ * Batches are made small enough that a few copies of the largest batch fit
+ * into half of the memory per rank, the rest is used to keep intermediates
+ * and then integrals in core. Integrals which only partly fit are stored
+ * as hybrid tensors, with batch_plan::hybrid_memory set to the remaining
+ * memory. What does not fit is put on disk, or recomputed if there is not
+ * enough disk space either. Disk tensors go to one file in the working
+ * directory, which has to hold all of them, or to node-local scratch
+ * (dbcsr::btensor_global::scratch), which holds the share of one node.
+ * The memory per node is taken from global::node_memory, or the physical
+ * memory if it is not set.
+ */
+class batch_planner {
+ private:
+  world m_world;
+  desc::shared_molecule m_mol;
+  shared_screener m_scr;
+  util::mpi_log LOG;
+
+  // bytes of the screened blocks, summed over all but one block index
+  struct profile {
+    vec<int64_t> bytes_x;
+    vec<int64_t> bytes_b;
+    int64_t total = 0;
+  };
+
+  profile m_xbb, m_fit, m_bbbb;
+
+  // sums the profile over all ranks
+  void reduce(profile& p);
+
+  void compute_xbb(shared_screener scr);
+  void compute_bbbb(shared_screener scr);
+
+  // largest batch along a b or x dimension, in bytes per rank
+  int64_t max_batch_b(const profile& p, int nbatches);
+  int64_t max_batch_x(const profile& p, int nbatches);
+
+ public:
+  // scr: the computed screener which is then passed on to the aoloader,
+  // only needed if integral tensors are planned
+  batch_planner(
+      world w, desc::shared_molecule mol, shared_screener scr, int print = 0) :
+      m_world(w), m_mol(mol), m_scr(scr), LOG(w.comm(), print)
+  {
+  }
+
+  /* xbb: 3c2e integrals and fitting coefficients are needed
+   * bbbb: 4c2e integrals are needed
+   * Storage types given as "auto" and batch numbers given as 0 are chosen
+   * by the planner, all others are kept.
+   */
+  batch_plan plan(
+      bool xbb,
+      bool bbbb,
+      std::string eris,
+      std::string intermeds,
+      int nbatches_b,
+      int nbatches_x);
+};
+
+}  // namespace ints
+
+}  // namespace megalochem
+
+#endif
@@ -1,9 +1,12 @@
 #ifndef INTS_REGISTRY_H
 #define INTS_REGISTRY_H
 
+#include <mpi.h>
 #include <any>
+#include <cstdint>
 #include <dbcsr_btensor.hpp>
 #include <dbcsr_tensor_ops.hpp>
+#include <functional>
 #include <map>
 #include <stdexcept>
 #include "ints/screening.hpp"
@@ -131,17 +134,193 @@ template <typename T>
 struct is_shared_ptr<std::shared_ptr<T>> : std::true_type {
 };
 
+// memory held by a registry item on this process, in bytes
+template <class M>
+int64_t item_bytes(const M&)
+{
+  return 0;
+}
+
+template <typename T>
+int64_t item_bytes(const dbcsr::smatrix<T>& mat)
+{
+  if (!mat)
+    return 0;
+  return (int64_t)mat->data_size() * sizeof(T);
+}
+
+template <int N, typename T>
+int64_t item_bytes(const dbcsr::sbtensor<N, T>& tensor)
+{
+  if (!tensor)
+    return 0;
+  return tensor->local_memory();
+}
+
+/* Registry of shared objects, indexed by an enum class KEY.
+ * Entries are either inserted directly or lazily through a generator,
+ * which is called on the first get() with the registry to take other
+ * entries from. Copies of a registry share their entries.
+ * If a memory budget is set, the least recently used lazy entries are
+ * evicted once the resident entries exceed it on any process. Evicted
+ * entries are handed to their spill function first (e.g. to write them to
+ * disk) and are regenerated on the next get(). Entries still referenced
+ * outside of the registry on any process are never evicted, since that
+ * would not free any memory.
+ * All processes have to call get() in the same order, as generators and
+ * spill functions are collective. The processes agree on every eviction.
+ */
 template <class KEY>
 class key_registry {
  private:
-  std::array<std::any, static_cast<const int>(KEY::NUM_KEYS)> m_array;
+  static constexpr int NKEYS = static_cast<int>(KEY::NUM_KEYS);
+
+  struct entry {
+    std::any value;
+    std::function<std::any(const key_registry&)> generator;
+    std::function<void(const std::any&)> spill;
+    std::function<int64_t(const std::any&)> bytes;
+    std::function<long(const std::any&)> use_count;
+    int64_t size = 0;
+    uint64_t last_use = 0;
+    bool transient = false;
+  };
+
+  struct state {
+    MPI_Comm comm;
+    std::array<entry, NKEYS> entries;
+    int64_t budget = 0;  // 0: no limit
+    int64_t resident = 0;
+    uint64_t clock = 0;
+    int depth = 0;  // nesting level of generator calls
+  };
+
+  std::shared_ptr<state> m_state;
 
   template <class KEY2>
   friend class key_registry;
 
+  template <class M>
+  static void set_item_functions(entry& e)
+  {
+    e.bytes = [](const std::any& a) { return item_bytes(std::any_cast<M>(a)); };
+    e.use_count = [](const std::any& a) {
+      return std::any_cast<M>(&a)->use_count();
+    };
+  }
+
+  void set_value(int pos, std::any value) const
+  {
+    auto& e = m_state->entries[pos];
+    e.value = std::move(value);
+    e.size = (e.bytes) ? e.bytes(e.value) : 0;
+    e.last_use = ++m_state->clock;
+    m_state->resident += e.size;
+  }
+
+  void drop_value(int pos) const
+  {
+    auto& e = m_state->entries[pos];
+    e.value.reset();
+    m_state->resident -= e.size;
+    e.size = 0;
+  }
+
+  // an entry can be evicted if it can be regenerated and nobody else
+  // holds a reference to it
+  bool evictable(int pos) const
+  {
+    auto& e = m_state->entries[pos];
+    return e.value.has_value() && e.generator && e.use_count &&
+        e.use_count(e.value) == 1;
+  }
+
+  // entries which are evictable on all processes, except pos_keep
+  std::array<int, NKEYS> agreed_evictable(int pos_keep) const
+  {
+    std::array<int, NKEYS> out;
+    for (int pos = 0; pos != NKEYS; ++pos) {
+      out[pos] = (pos != pos_keep && evictable(pos));
+    }
+
+    MPI_Allreduce(
+        MPI_IN_PLACE, out.data(), NKEYS, MPI_INT, MPI_LAND, m_state->comm);
+
+    return out;
+  }
+
+  void evict(int pos) const
+  {
+    auto& e = m_state->entries[pos];
+    if (e.spill)
+      e.spill(e.value);
+    drop_value(pos);
+  }
+
+  // evicts least recently used entries until the budget is met on all
+  // processes. The access clocks are the same everywhere, so all processes
+  // pick the same entries.
+  void enforce_budget(int pos_keep) const
+  {
+    if (m_state->budget <= 0)
+      return;
+
+    auto candidates = agreed_evictable(pos_keep);
+
+    while (true) {
+      int over = (m_state->resident > m_state->budget);
+      MPI_Allreduce(MPI_IN_PLACE, &over, 1, MPI_INT, MPI_LOR, m_state->comm);
+
+      if (!over)
+        break;
+
+      int pos_evict = -1;
+      for (int pos = 0; pos != NKEYS; ++pos) {
+        if (!candidates[pos])
+          continue;
+        if (pos_evict < 0 ||
+            m_state->entries[pos].last_use <
+                m_state->entries[pos_evict].last_use) {
+          pos_evict = pos;
+        }
+      }
+
+      if (pos_evict < 0)
+        break;
+
+      evict(pos_evict);
+      candidates[pos_evict] = 0;
+    }
+  }
+
+  void generate(int pos) const
+  {
+    auto& e = m_state->entries[pos];
+
+    ++m_state->depth;
+    auto value = e.generator(*this);
+    --m_state->depth;
+
+    set_value(pos, value);
+
+    // transient entries are only kept while other entries are generated
+    if (m_state->depth == 0) {
+      auto candidates = agreed_evictable(pos);
+      for (int p = 0; p != NKEYS; ++p) {
+        if (m_state->entries[p].transient && candidates[p]) {
+          drop_value(p);
+        }
+      }
+    }
+
+    enforce_budget(pos);
+  }
+
  public:
-  key_registry()
+  // comm: the processes sharing the entries
+  key_registry(MPI_Comm comm) : m_state(std::make_shared<state>())
   {
+    m_state->comm = comm;
   }
 
   template <class M>
@@ -149,15 +328,47 @@ class key_registry {
       KEY name, M& m)
   {
     int pos = static_cast<int>(name);
-    std::any in = std::any(m);
-    if (this->present(name)) {
+    if (registered(name)) {
       std::string msg = "Key nr. " + std::to_string(pos) + " of type " +
           typeid(name).name() + " already present!";
       throw std::runtime_error(msg);
     }
     else {
-      m_array[pos] = in;
+      set_item_functions<M>(m_state->entries[pos]);
+      set_value(pos, std::any(m));
+      enforce_budget(pos);
+    }
+  }
+
+  /* Registers a generator for the key, which is called on first access.
+   * Transient entries are dropped again once the outermost generator call
+   * returns, e.g. for intermediates that are only needed to compute other
+   * entries.
+   */
+  template <class M>
+  typename std::enable_if<is_shared_ptr<M>::value == true, void>::type
+  insert_lazy(
+      KEY name,
+      std::function<M(const key_registry&)> generator,
+      std::function<void(const M&)> spill = nullptr,
+      bool transient = false)
+  {
+    int pos = static_cast<int>(name);
+    if (registered(name)) {
+      std::string msg = "Key nr. " + std::to_string(pos) + " of type " +
+          typeid(name).name() + " already present!";
+      throw std::runtime_error(msg);
     }
+
+    auto& e = m_state->entries[pos];
+    set_item_functions<M>(e);
+    e.generator = [generator](const key_registry& reg) {
+      return std::any(generator(reg));
+    };
+    if (spill) {
+      e.spill = [spill](const std::any& a) { spill(std::any_cast<M>(a)); };
+    }
+    e.transient = transient;
   }
 
   template <class M>
@@ -166,14 +377,19 @@ class key_registry {
   {
     M out;
     int pos = static_cast<int>(name);
-    if (this->present(name)) {
-      if (typeid(out).name() != m_array[pos].type().name()) {
+    if (registered(name)) {
+      auto& e = m_state->entries[pos];
+      if (!e.value.has_value()) {
+        generate(pos);
+      }
+      if (typeid(out).name() != e.value.type().name()) {
         auto badtype = std::string(typeid(out).name());
-        auto goodtype = std::string(m_array[pos].type().name());
+        auto goodtype = std::string(e.value.type().name());
         throw std::runtime_error(
             "Registry: Bad cast from " + badtype + " to " + goodtype);
       }
-      out = std::any_cast<M>(m_array[pos]);
+      out = std::any_cast<M>(e.value);
+      e.last_use = ++m_state->clock;
     }
     else {
       std::string msg = "Key nr. " + std::to_string(pos) + " of type " +
@@ -185,19 +401,58 @@ class key_registry {
 
   void clear()
   {
-    for (auto& a : m_array) a = nullptr;
+    for (int pos = 0; pos != NKEYS; ++pos) {
+      m_state->entries[pos] = entry();
+    }
+    m_state->resident = 0;
   }
 
   void erase(KEY key)
   {
     int pos = static_cast<int>(key);
-    m_array[pos].reset();
+    drop_value(pos);
+    m_state->entries[pos] = entry();
   }
 
+  // true if the key has a value or can be generated, not counting
+  // transient entries
   bool present(KEY key) const
   {
     int pos = static_cast<int>(key);
-    return (m_array[pos].has_value()) ? true : false;
+    auto& e = m_state->entries[pos];
+    return e.value.has_value() || (e.generator && !e.transient);
+  }
+
+  // true if the key has a value or can be generated
+  bool registered(KEY key) const
+  {
+    int pos = static_cast<int>(key);
+    auto& e = m_state->entries[pos];
+    return e.value.has_value() || e.generator;
+  }
+
+  void set_transient(KEY key, bool transient)
+  {
+    m_state->entries[static_cast<int>(key)].transient = transient;
+  }
+
+  // true if the value is currently held in memory
+  bool resident(KEY key) const
+  {
+    int pos = static_cast<int>(key);
+    return m_state->entries[pos].value.has_value();
+  }
+
+  // memory budget in bytes per process, 0 for no limit. Collective.
+  void set_budget(int64_t bytes)
+  {
+    m_state->budget = bytes;
+    enforce_budget(-1);
+  }
+
+  int64_t resident_bytes() const
+  {
+    return m_state->resident;
   }
 
   template <class REG, class KEY2>
@@ -205,7 +460,26 @@ class key_registry {
   {
     int pos_old = static_cast<int>(old_key);
     int pos_new = static_cast<int>(new_key);
-    m_array[pos_new] = registry_in.m_array[pos_old];
+    drop_value(pos_new);
+
+    auto& e_old = registry_in.m_state->entries[pos_old];
+    auto& e_new = m_state->entries[pos_new];
+
+    e_new.value = e_old.value;
+    e_new.spill = e_old.spill;
+    e_new.bytes = e_old.bytes;
+    e_new.use_count = e_old.use_count;
+    e_new.size = e_old.size;
+    e_new.last_use = e_old.last_use;
+    e_new.transient = e_old.transient;
+
+    // the generator takes its dependencies from the original registry
+    if (e_old.generator) {
+      e_new.generator = [registry_in, gen = e_old.generator](
+                            const key_registry&) { return gen(registry_in); };
+    }
+
+    m_state->resident += e_new.size;
   }
 
   ~key_registry()
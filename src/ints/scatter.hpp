@@ -0,0 +1,191 @@
+#ifndef INTS_SCATTER_H
+#define INTS_SCATTER_H
+
+#include <array>
+#include <cstddef>
+#include <utility>
+
+/* Kernels that write the output buffer of a single libcint call into the
+ * contiguous (column-major) storage of a DBCSR tensor block.
+ * For all combinations of spherical s, p, d, f and g shells the loop bounds
+ * are known at compile time, so the loops are fully unrolled and the
+ * innermost one is vectorized. Larger shells use the generic version.
+ */
+
+namespace megalochem {
+
+namespace ints {
+
+namespace scatter_detail {
+
+// number of specialized shell sizes: 1, 3, 5, 7, 9 (s to g)
+constexpr int NSIZES = 5;
+
+constexpr int size_index(int n)
+{
+  return (n % 2 == 1 && n <= 2 * NSIZES - 1) ? n / 2 : -1;
+}
+
+// libcint buffer (j,k,i) of the shell triple (b1 b2|x) -> block (i,j,k)
+template <int N0, int N1, int N2>
+void xbb_fixed(
+    const double* __restrict buf, double* __restrict dst, int ld0, int ld01)
+{
+  for (int k = 0; k != N2; ++k) {
+    for (int j = 0; j != N1; ++j) {
+#pragma omp simd
+      for (int i = 0; i != N0; ++i) {
+        dst[i + j * ld0 + k * ld01] = buf[j + k * N1 + i * N1 * N2];
+      }
+    }
+  }
+}
+
+inline void xbb_generic(
+    const double* __restrict buf,
+    double* __restrict dst,
+    int n0,
+    int n1,
+    int n2,
+    int ld0,
+    int ld01)
+{
+  for (int k = 0; k != n2; ++k) {
+    for (int j = 0; j != n1; ++j) {
+#pragma omp simd
+      for (int i = 0; i != n0; ++i) {
+        dst[i + j * ld0 + k * ld01] = buf[j + k * n1 + i * n1 * n2];
+      }
+    }
+  }
+}
+
+// libcint buffer (i,j,k,l) of the shell quartet (b0 b1|b2 b3) -> block
+template <int N0, int N1, int N2, int N3>
+void bbbb_fixed(
+    const double* __restrict buf,
+    double* __restrict dst,
+    int ld0,
+    int ld01,
+    int ld012)
+{
+  for (int l = 0; l != N3; ++l) {
+    for (int k = 0; k != N2; ++k) {
+      for (int j = 0; j != N1; ++j) {
+        const double* src = buf + N0 * (j + N1 * (k + N2 * l));
+        double* out = dst + j * ld0 + k * ld01 + l * ld012;
+#pragma omp simd
+        for (int i = 0; i != N0; ++i) { out[i] = src[i]; }
+      }
+    }
+  }
+}
+
+inline void bbbb_generic(
+    const double* __restrict buf,
+    double* __restrict dst,
+    int n0,
+    int n1,
+    int n2,
+    int n3,
+    int ld0,
+    int ld01,
+    int ld012)
+{
+  for (int l = 0; l != n3; ++l) {
+    for (int k = 0; k != n2; ++k) {
+      for (int j = 0; j != n1; ++j) {
+        const double* src = buf + n0 * (j + n1 * (k + n2 * l));
+        double* out = dst + j * ld0 + k * ld01 + l * ld012;
+#pragma omp simd
+        for (int i = 0; i != n0; ++i) { out[i] = src[i]; }
+      }
+    }
+  }
+}
+
+using xbb_func = void (*)(const double*, double*, int, int);
+using bbbb_func = void (*)(const double*, double*, int, int, int);
+
+template <std::size_t... Is>
+constexpr std::array<xbb_func, sizeof...(Is)> make_xbb_table(
+    std::index_sequence<Is...>)
+{
+  return {{&xbb_fixed<
+      2 * (Is / (NSIZES * NSIZES)) + 1, 2 * ((Is / NSIZES) % NSIZES) + 1,
+      2 * (Is % NSIZES) + 1>...}};
+}
+
+template <std::size_t... Is>
+constexpr std::array<bbbb_func, sizeof...(Is)> make_bbbb_table(
+    std::index_sequence<Is...>)
+{
+  return {{&bbbb_fixed<
+      2 * (Is / (NSIZES * NSIZES * NSIZES)) + 1,
+      2 * ((Is / (NSIZES * NSIZES)) % NSIZES) + 1,
+      2 * ((Is / NSIZES) % NSIZES) + 1, 2 * (Is % NSIZES) + 1>...}};
+}
+
+inline constexpr auto xbb_table =
+    make_xbb_table(std::make_index_sequence<NSIZES * NSIZES * NSIZES>{});
+
+inline constexpr auto bbbb_table = make_bbbb_table(
+    std::make_index_sequence<NSIZES * NSIZES * NSIZES * NSIZES>{});
+
+}  // namespace scatter_detail
+
+/* Writes the integrals (b1 b2|x) of shells with n1, n2 and n0 functions
+ * into a 3-index block with leading dimensions ld0 and ld01, starting at
+ * dst (i.e. dst already points to the shell sub-block).
+ */
+inline void scatter_xbb(
+    const double* buf, double* dst, int n0, int n1, int n2, int ld0, int ld01)
+{
+  using namespace scatter_detail;
+
+  const int i0 = size_index(n0);
+  const int i1 = size_index(n1);
+  const int i2 = size_index(n2);
+
+  if (i0 >= 0 && i1 >= 0 && i2 >= 0) {
+    xbb_table[(i0 * NSIZES + i1) * NSIZES + i2](buf, dst, ld0, ld01);
+  }
+  else {
+    xbb_generic(buf, dst, n0, n1, n2, ld0, ld01);
+  }
+}
+
+/* Same as scatter_xbb for the integrals (b0 b1|b2 b3) and a 4-index block
+ */
+inline void scatter_bbbb(
+    const double* buf,
+    double* dst,
+    int n0,
+    int n1,
+    int n2,
+    int n3,
+    int ld0,
+    int ld01,
+    int ld012)
+{
+  using namespace scatter_detail;
+
+  const int i0 = size_index(n0);
+  const int i1 = size_index(n1);
+  const int i2 = size_index(n2);
+  const int i3 = size_index(n3);
+
+  if (i0 >= 0 && i1 >= 0 && i2 >= 0 && i3 >= 0) {
+    bbbb_table[((i0 * NSIZES + i1) * NSIZES + i2) * NSIZES + i3](
+        buf, dst, ld0, ld01, ld012);
+  }
+  else {
+    bbbb_generic(buf, dst, n0, n1, n2, n3, ld0, ld01, ld012);
+  }
+}
+
+}  // namespace ints
+
+}  // namespace megalochem
+
+#endif
@@ -1,10 +1,115 @@
 #include "ints/screening.hpp"
 #include <dbcsr_matrix_ops.hpp>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
 
 namespace megalochem {
 
 namespace ints {
 
+// bin of x in a histogram of decades [10^minexp, 10^(minexp+nbins)),
+// values outside are added to the first/last bin
+static int decade_bin(double x, int minexp, int nbins)
+{
+  if (!(x > 0.0))
+    return 0;
+
+  const int e = (int)std::floor(std::log10(x)) - minexp;
+  return std::clamp(e, 0, nbins - 1);
+}
+
+void screening_stats::add_block_norms(double estimate, double actual)
+{
+  hist_estimate[decade_bin(estimate, MINEXP, NBINS)] += 1;
+  hist_actual[decade_bin(actual, MINEXP, NBINS)] += 1;
+
+  if (estimate > 0.0) {
+    const double ratio = actual / estimate;
+    hist_ratio[decade_bin(ratio, 1 - NBINS, NBINS)] += 1;
+    max_ratio = std::max(max_ratio, ratio);
+  }
+}
+
+screening_stats& screening_stats::operator+=(const screening_stats& s)
+{
+  blocks_considered += s.blocks_considered;
+  blocks_skipped += s.blocks_skipped;
+  tuples_computed += s.tuples_computed;
+  tuples_skipped += s.tuples_skipped;
+
+  for (int i = 0; i != NBINS; ++i) {
+    hist_estimate[i] += s.hist_estimate[i];
+    hist_actual[i] += s.hist_actual[i];
+    hist_ratio[i] += s.hist_ratio[i];
+  }
+
+  max_ratio = std::max(max_ratio, s.max_ratio);
+
+  return *this;
+}
+
+void screening_stats::reduce(MPI_Comm comm)
+{
+  std::vector<int64_t> counts = {
+      blocks_considered, blocks_skipped, tuples_computed, tuples_skipped};
+
+  counts.insert(counts.end(), hist_estimate.begin(), hist_estimate.end());
+  counts.insert(counts.end(), hist_actual.begin(), hist_actual.end());
+  counts.insert(counts.end(), hist_ratio.begin(), hist_ratio.end());
+
+  MPI_Allreduce(
+      MPI_IN_PLACE, counts.data(), counts.size(), MPI_INT64_T, MPI_SUM, comm);
+  MPI_Allreduce(MPI_IN_PLACE, &max_ratio, 1, MPI_DOUBLE, MPI_MAX, comm);
+
+  blocks_considered = counts[0];
+  blocks_skipped = counts[1];
+  tuples_computed = counts[2];
+  tuples_skipped = counts[3];
+
+  auto iter = counts.begin() + 4;
+  std::copy(iter, iter + NBINS, hist_estimate.begin());
+  std::copy(iter + NBINS, iter + 2 * NBINS, hist_actual.begin());
+  std::copy(iter + 2 * NBINS, iter + 3 * NBINS, hist_ratio.begin());
+}
+
+nlohmann::json screening_stats::to_json() const
+{
+  std::vector<int> exps(NBINS), ratio_exps(NBINS);
+  for (int i = 0; i != NBINS; ++i) {
+    exps[i] = MINEXP + i;
+    ratio_exps[i] = 1 - NBINS + i;
+  }
+
+  return {{"blocks_considered", blocks_considered},
+          {"blocks_skipped", blocks_skipped},
+          {"tuples_computed", tuples_computed},
+          {"tuples_skipped", tuples_skipped},
+          {"norm_log10_bins", exps},
+          {"norm_estimated", hist_estimate},
+          {"norm_actual", hist_actual},
+          {"ratio_log10_bins", ratio_exps},
+          {"ratio_actual_estimated", hist_ratio},
+          {"max_ratio_actual_estimated", max_ratio}};
+}
+
+nlohmann::json screener::report()
+{
+  nlohmann::json tensors = nlohmann::json::object();
+
+  for (auto& [name, s] : m_stats) {
+    screening_stats tot = s;
+    tot.reduce(m_world.comm());
+    tensors[name] = tot.to_json();
+  }
+
+  return {{"method", m_method},
+          {"block_threshold", m_blk_threshold},
+          {"integral_threshold", m_int_threshold},
+          {"tensors", tensors}};
+}
+
 void schwarz_screener::compute()
 {
   auto z_mn_dist = m_fac.ao_schwarz();
@@ -18,6 +123,16 @@ void schwarz_screener::compute()
 
   z_mn_dist->release();
   z_x_dist->release();
+
+  // a pair can only contribute if its bound times the largest bound on the
+  // other side of the integral is above the threshold. The bound is
+  // clamped, all-zero bounds (e.g. ghost atoms only) would give inf or NaN
+  const double max_partner = std::max(
+      {m_z_mn.maxCoeff(), m_z_x.maxCoeff(),
+       std::numeric_limits<double>::min()});
+
+  m_shellpairs = std::make_shared<shellpair_list>(
+      *m_mol->c_basis(), m_z_mn, m_int_threshold / max_partner);
 }
 
 bool schwarz_screener::skip_block_xbb(int i, int j, int k)
@@ -38,6 +153,16 @@ bool schwarz_screener::skip_block_bbbb(int i, int j, int k, int l)
   return true;
 }
 
+double schwarz_screener::estimate_block_xbb(int i, int j, int k)
+{
+  return m_blk_norms_mn(j, k) * m_blk_norms_x(i, 0);
+}
+
+double schwarz_screener::estimate_block_bbbb(int i, int j, int k, int l)
+{
+  return m_blk_norms_mn(i, j) * m_blk_norms_mn(k, l);
+}
+
 bool schwarz_screener::skip_xbb(int i, int j, int k)
 {
   if (m_z_mn(j, k) * m_z_x(i, 0) > m_int_threshold) {
@@ -56,6 +181,320 @@ bool schwarz_screener::skip_bbbb(int i, int j, int k, int l)
   return true;
 }
 
+// int_0^inf r^n exp(-alpha r^2) dr
+static double gaussian_int(int n, double alpha)
+{
+  const double n1 = (n + 1) * 0.5;
+  return std::tgamma(n1) / (2.0 * std::pow(alpha, n1));
+}
+
+static double binomial(int n, int k)
+{
+  double out = 1.0;
+  for (int i = 1; i <= k; ++i) { out *= double(n - k + i) / i; }
+  return out;
+}
+
+static double distance(
+    const std::array<double, 4>& sph0, const std::array<double, 4>& sph1)
+{
+  return std::sqrt(
+      std::pow(sph0[0] - sph1[0], 2) + std::pow(sph0[1] - sph1[1], 2) +
+      std::pow(sph0[2] - sph1[2], 2));
+}
+
+// largest absolute value of the angular part of a function in the shell.
+// libcint normalizes spherical harmonics on the unit sphere, and cartesian
+// functions with l > 1 are plain monomials x^i y^j z^k
+static double angular_max(const desc::Shell& s)
+{
+  return (s.pure || s.l < 2) ? std::sqrt((2 * s.l + 1) / (4.0 * M_PI)) : 1.0;
+}
+
+// true if all functions in the shell have an L2 norm of one
+static bool unit_norm(const desc::Shell& s)
+{
+  return s.pure || s.l < 2;
+}
+
+// coefficients c_p of the radial part r^l sum_p c_p exp(-a_p r^2),
+// normalized the same way as in the aofactory
+static std::vector<double> radial_coeffs(const desc::Shell& s)
+{
+  const int l = s.l;
+  const size_t nprim = s.nprim();
+  std::vector<double> c(nprim);
+
+  for (size_t p = 0; p != nprim; ++p) {
+    c[p] = s.coeff[p] / std::sqrt(gaussian_int(2 * l + 2, 2 * s.alpha[p]));
+  }
+
+  double norm = 0.0;
+  for (size_t p = 0; p != nprim; ++p) {
+    for (size_t q = 0; q != nprim; ++q) {
+      norm += c[p] * c[q] * gaussian_int(2 * l + 2, s.alpha[p] + s.alpha[q]);
+    }
+  }
+
+  for (auto& cp : c) { cp /= std::sqrt(norm); }
+  return c;
+}
+
+// radius outside of which all functions of the shell are below the cutoff.
+// The search starts behind the maxima of r^l exp(-a_p r^2), from where on
+// the radial part decreases
+static double shell_extent(const desc::Shell& s, const std::vector<double>& c)
+{
+  using cglobal = desc::cluster_basis::global;
+
+  auto value = [&](double r) {
+    double v = 0.0;
+    for (size_t p = 0; p != c.size(); ++p) {
+      v += std::fabs(c[p]) * std::exp(-s.alpha[p] * r * r);
+    }
+    return angular_max(s) * std::pow(r, s.l) * v;
+  };
+
+  double r = 0.0;
+  for (auto a : s.alpha) { r = std::max(r, std::sqrt(s.l / (2.0 * a))); }
+
+  for (int i = 0; i != cglobal::maxiter && !(value(r) < cglobal::cutoff);
+       ++i) {
+    r += cglobal::step;
+  }
+
+  return r;
+}
+
+// bound on the L1 norm of a function in the shell
+static double function_l1(const desc::Shell& s, const std::vector<double>& c)
+{
+  double out = 0.0;
+  for (size_t p = 0; p != c.size(); ++p) {
+    out += std::fabs(c[p]) * gaussian_int(s.l + 2, s.alpha[p]);
+  }
+  return 4.0 * M_PI * angular_max(s) * out;
+}
+
+/* Bound on the L1 norm of the product of two functions of the shells.
+ * A primitive product is exp(-mu R_AB^2) exp(-p r_P^2) around the Gaussian
+ * product centre P, with r_A <= r_P + |P - A| and the same for B.
+ * If both functions are normalized the bound is at most one.
+ */
+static double pair_l1(
+    const desc::Shell& s0,
+    const std::vector<double>& c0,
+    const desc::Shell& s1,
+    const std::vector<double>& c1)
+{
+  const int l0 = s0.l;
+  const int l1 = s1.l;
+  const double rab = std::sqrt(
+      std::pow(s0.O[0] - s1.O[0], 2) + std::pow(s0.O[1] - s1.O[1], 2) +
+      std::pow(s0.O[2] - s1.O[2], 2));
+
+  double out = 0.0;
+
+  for (size_t p = 0; p != c0.size(); ++p) {
+    for (size_t q = 0; q != c1.size(); ++q) {
+      const double a = s0.alpha[p];
+      const double b = s1.alpha[q];
+      const double ab = a + b;
+      const double da = b * rab / ab;
+      const double db = a * rab / ab;
+
+      double sum = 0.0;
+      for (int i = 0; i <= l0; ++i) {
+        for (int j = 0; j <= l1; ++j) {
+          sum += binomial(l0, i) * binomial(l1, j) * std::pow(da, l0 - i) *
+              std::pow(db, l1 - j) * gaussian_int(i + j + 2, ab);
+        }
+      }
+
+      out += std::fabs(c0[p] * c1[q]) * std::exp(-a * b / ab * rab * rab) *
+          sum;
+    }
+  }
+
+  out *= 4.0 * M_PI * angular_max(s0) * angular_max(s1);
+
+  return (unit_norm(s0) && unit_norm(s1)) ? std::min(out, 1.0) : out;
+}
+
+void qqr_screener::compute()
+{
+  schwarz_screener::compute();
+
+  // spheres of the shells and clusters, normalized coefficients per shell
+  auto get_spheres = [](desc::cluster_basis& cbas,
+                        std::vector<std::array<double, 4>>& shell_spheres,
+                        std::vector<std::array<double, 4>>& spheres,
+                        std::vector<std::vector<double>>& coeffs) {
+    shell_spheres.clear();
+    spheres.clear();
+    coeffs.clear();
+
+    for (size_t iblk = 0; iblk != cbas.size(); ++iblk) {
+      const auto& c = cbas[iblk];
+      std::array<double, 4> sph = {c.O[0], c.O[1], c.O[2], 0.0};
+
+      for (auto& s : c.shells) {
+        coeffs.push_back(radial_coeffs(s));
+        shell_spheres.push_back(
+            {s.O[0], s.O[1], s.O[2], shell_extent(s, coeffs.back())});
+        sph[3] = std::max(
+            sph[3], distance(sph, shell_spheres.back()) +
+                shell_spheres.back()[3]);
+      }
+
+      spheres.push_back(sph);
+    }
+  };
+
+  auto& cbas = *m_mol->c_basis();
+  std::vector<std::vector<double>> coeffs_b;
+  get_spheres(cbas, m_shell_spheres_b, m_spheres_b, coeffs_b);
+
+  std::vector<desc::Shell> shells_b;
+  for (auto& c : cbas) {
+    shells_b.insert(shells_b.end(), c.shells.begin(), c.shells.end());
+  }
+
+  const int nshells_b = shells_b.size();
+  m_l1_mn.resize(nshells_b, nshells_b);
+
+  for (int s0 = 0; s0 != nshells_b; ++s0) {
+    for (int s1 = s0; s1 != nshells_b; ++s1) {
+      m_l1_mn(s0, s1) =
+          pair_l1(shells_b[s0], coeffs_b[s0], shells_b[s1], coeffs_b[s1]);
+      m_l1_mn(s1, s0) = m_l1_mn(s0, s1);
+    }
+  }
+
+  auto offsets_b = cbas.shell_offsets();
+  const int nblks_b = cbas.size();
+  m_blk_l1_mn.resize(nblks_b, nblks_b);
+
+  // Frobenius norms over all function pairs of two blocks
+  for (int i = 0; i != nblks_b; ++i) {
+    for (int j = 0; j != nblks_b; ++j) {
+      double sum = 0.0;
+      for (size_t s0 = 0; s0 != cbas[i].shells.size(); ++s0) {
+        for (size_t s1 = 0; s1 != cbas[j].shells.size(); ++s1) {
+          sum += cbas[i].shells[s0].size() * cbas[j].shells[s1].size() *
+              std::pow(m_l1_mn(offsets_b[i] + s0, offsets_b[j] + s1), 2);
+        }
+      }
+      m_blk_l1_mn(i, j) = std::sqrt(sum);
+    }
+  }
+
+  if (!m_mol->c_dfbasis())
+    return;
+
+  auto& xbas = *m_mol->c_dfbasis();
+  std::vector<std::vector<double>> coeffs_x;
+  get_spheres(xbas, m_shell_spheres_x, m_spheres_x, coeffs_x);
+
+  m_l1_x.resize(coeffs_x.size());
+  m_blk_l1_x.resize(xbas.size());
+
+  auto offsets_x = xbas.shell_offsets();
+
+  for (size_t i = 0; i != xbas.size(); ++i) {
+    double sum = 0.0;
+    int s = offsets_x[i];
+
+    for (auto& shell : xbas[i].shells) {
+      m_l1_x(s) = function_l1(shell, coeffs_x[s]);
+      sum += shell.size() * std::pow(m_l1_x(s), 2);
+      ++s;
+    }
+
+    m_blk_l1_x(i) = std::sqrt(sum);
+  }
+}
+
+// the product of two functions vanishes outside the smaller sphere
+static const std::array<double, 4>& pair_sphere(
+    const std::array<double, 4>& sph0, const std::array<double, 4>& sph1)
+{
+  return (sph0[3] < sph1[3]) ? sph0 : sph1;
+}
+
+// bound l0 * l1 / R' on the Coulomb interaction of two distributions with
+// the L1 norms l0 and l1 inside the spheres, infinite if they overlap
+static double distance_bound(
+    const std::array<double, 4>& sph0,
+    const std::array<double, 4>& sph1,
+    double l0,
+    double l1)
+{
+  const double rprime = distance(sph0, sph1) - sph0[3] - sph1[3];
+
+  return (rprime > 0.0) ? l0 * l1 / rprime
+                        : std::numeric_limits<double>::infinity();
+}
+
+double qqr_screener::estimate_block_xbb(int i, int j, int k)
+{
+  return std::min(
+      schwarz_screener::estimate_block_xbb(i, j, k),
+      distance_bound(
+          m_spheres_x[i], pair_sphere(m_spheres_b[j], m_spheres_b[k]),
+          m_blk_l1_x(i), m_blk_l1_mn(j, k)));
+}
+
+double qqr_screener::estimate_block_bbbb(int i, int j, int k, int l)
+{
+  return std::min(
+      schwarz_screener::estimate_block_bbbb(i, j, k, l),
+      distance_bound(
+          pair_sphere(m_spheres_b[i], m_spheres_b[j]),
+          pair_sphere(m_spheres_b[k], m_spheres_b[l]), m_blk_l1_mn(i, j),
+          m_blk_l1_mn(k, l)));
+}
+
+bool qqr_screener::skip_block_xbb(int i, int j, int k)
+{
+  if (schwarz_screener::skip_block_xbb(i, j, k))
+    return true;
+
+  return !(estimate_block_xbb(i, j, k) > m_blk_threshold);
+}
+
+bool qqr_screener::skip_block_bbbb(int i, int j, int k, int l)
+{
+  if (schwarz_screener::skip_block_bbbb(i, j, k, l))
+    return true;
+
+  return !(estimate_block_bbbb(i, j, k, l) > m_blk_threshold);
+}
+
+bool qqr_screener::skip_xbb(int i, int j, int k)
+{
+  const double f = std::min(
+      m_z_mn(j, k) * m_z_x(i, 0),
+      distance_bound(
+          m_shell_spheres_x[i],
+          pair_sphere(m_shell_spheres_b[j], m_shell_spheres_b[k]), m_l1_x(i),
+          m_l1_mn(j, k)));
+
+  return !(f > m_int_threshold);
+}
+
+bool qqr_screener::skip_bbbb(int i, int j, int k, int l)
+{
+  const double f = std::min(
+      m_z_mn(i, j) * m_z_mn(k, l),
+      distance_bound(
+          pair_sphere(m_shell_spheres_b[i], m_shell_spheres_b[j]),
+          pair_sphere(m_shell_spheres_b[k], m_shell_spheres_b[l]),
+          m_l1_mn(i, j), m_l1_mn(k, l)));
+
+  return !(f > m_int_threshold);
+}
+
 void atomic_screener::compute()
 {
   m_schwarz.compute();
@@ -125,6 +564,16 @@ bool atomic_screener::skip_bbbb(
   return false;
 }
 
+shared_screener create_screener(
+    world w, desc::shared_molecule mol, std::string method)
+{
+  if (method == "schwarz")
+    return std::make_shared<schwarz_screener>(w, mol);
+  if (method == "qqr")
+    return std::make_shared<qqr_screener>(w, mol);
+  throw std::runtime_error("Invalid screening method: " + method);
+}
+
 }  // namespace ints
 
 }  // namespace megalochem
@@ -2,10 +2,17 @@
 #define INTS_SCREENING_H
 
 #include "ints/aofactory.hpp"
+#include "ints/shellpairs.hpp"
 
+#include <mpi.h>
 #include <Eigen/Core>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <map>
 #include <string>
 #include <utility>
+#include "utils/json.hpp"
 
 // screening classes, inspired by MPQC
 
@@ -13,6 +20,35 @@ namespace megalochem {
 
 namespace ints {
 
+/* Counters of one screened tensor. Block norms (estimated by the screener
+ * and actually computed) are binned by decade, from 10^MINEXP upwards.
+ * The ratio actual/estimated is binned the same way, from 10^-(NBINS-1) to
+ * 1; ratios above 1 mean the estimate was not an upper bound.
+ */
+struct screening_stats {
+  static constexpr int NBINS = 20;
+  static constexpr int MINEXP = -16;
+
+  int64_t blocks_considered = 0;
+  int64_t blocks_skipped = 0;
+  int64_t tuples_computed = 0;
+  int64_t tuples_skipped = 0;
+
+  std::array<int64_t, NBINS> hist_estimate = {};
+  std::array<int64_t, NBINS> hist_actual = {};
+  std::array<int64_t, NBINS> hist_ratio = {};
+  double max_ratio = 0.0;
+
+  void add_block_norms(double estimate, double actual);
+
+  screening_stats& operator+=(const screening_stats& s);
+
+  // sums the counters over all ranks of comm
+  void reduce(MPI_Comm comm);
+
+  nlohmann::json to_json() const;
+};
+
 class screener {
  protected:
   world m_world;
@@ -20,6 +56,9 @@ class screener {
   desc::shared_molecule m_mol;
   std::string m_method;
 
+  // statistics per tensor name
+  std::map<std::string, screening_stats> m_stats;
+
   aofactory m_fac;
 
   double m_blk_threshold = dbcsr::global::filter_eps;
@@ -40,6 +79,69 @@ class screener {
   virtual bool skip_block_bbbb(int i, int j, int k, int l) = 0;
   virtual bool skip_bbbb(int i, int j, int k, int l) = 0;
 
+  // estimated norm of a block, used for the statistics
+  virtual double estimate_block_xbb(
+      [[maybe_unused]] int i, [[maybe_unused]] int j, [[maybe_unused]] int k)
+  {
+    return std::numeric_limits<double>::max();
+  }
+
+  virtual double estimate_block_bbbb(
+      [[maybe_unused]] int i,
+      [[maybe_unused]] int j,
+      [[maybe_unused]] int k,
+      [[maybe_unused]] int l)
+  {
+    return std::numeric_limits<double>::max();
+  }
+
+  // shell-level data for the integral kernels, nullptr if not available
+  virtual const shellpair_list* shellpairs()
+  {
+    return nullptr;
+  }
+
+  // Schwarz bounds of the auxiliary shells, indexed by global shell number
+  virtual const double* shell_bounds_x()
+  {
+    return nullptr;
+  }
+
+  // true if skip_xbb screens tighter than the Schwarz bounds above, so the
+  // integral kernels have to call it for each shell triple
+  virtual bool distance_decay() const
+  {
+    return false;
+  }
+
+  double int_threshold() const
+  {
+    return m_int_threshold;
+  }
+
+  double blk_threshold() const
+  {
+    return m_blk_threshold;
+  }
+
+  std::string method() const
+  {
+    return m_method;
+  }
+
+  /* Statistics for tensor name. Not thread safe, threads should accumulate
+   * into a local screening_stats and add it in a critical section.
+   */
+  screening_stats& stats(std::string name)
+  {
+    return m_stats[name];
+  }
+
+  /* Statistics of all tensors, summed over all ranks. Has to be called by
+   * every rank, and all ranks have to have seen the same tensors.
+   */
+  nlohmann::json report();
+
   ~screener()
   {
   }
@@ -52,6 +154,13 @@ class schwarz_screener : public screener {
   Eigen::MatrixXd m_z_mn;
   Eigen::MatrixXd m_z_x;
 
+  shared_shellpair_list m_shellpairs;
+
+  schwarz_screener(world w, desc::shared_molecule mol, std::string method) :
+      screener(w, mol, method)
+  {
+  }
+
  public:
   schwarz_screener(world w, desc::shared_molecule mol) :
       screener(w, mol, "schwarz")
@@ -66,11 +175,81 @@ class schwarz_screener : public screener {
   bool skip_block_bbbb(int i, int j, int k, int l) override;
   bool skip_bbbb(int i, int j, int k, int l) override;
 
+  double estimate_block_xbb(int i, int j, int k) override;
+  double estimate_block_bbbb(int i, int j, int k, int l) override;
+
+  const shellpair_list* shellpairs() override
+  {
+    return m_shellpairs.get();
+  }
+
+  const double* shell_bounds_x() override
+  {
+    return m_z_x.data();
+  }
+
   ~schwarz_screener()
   {
   }
 };
 
+/* Schwarz screening with distance decay (QQR, Maurer et al. 2012).
+ * Two charge distributions inside non-overlapping spheres at a distance
+ * R' = R - r_0 - r_1 interact by at most ||rho_0||_1 ||rho_1||_1 / R'.
+ * The L1 norms are bounded analytically from the primitives: for an
+ * auxiliary function by the integral over its radial part, for a product
+ * of two basis functions by expanding it around the Gaussian product
+ * centre, which includes the overlap decay exp(-mu R_AB^2). The spheres
+ * enclose the functions down to cluster_basis::global::cutoff, a product
+ * lies inside the smaller sphere of its two shells, a cluster sphere
+ * encloses the spheres of all its shells.
+ * The estimate is the smaller of this bound and the Schwarz bound, for
+ * overlapping spheres it is the Schwarz bound.
+ */
+class qqr_screener : public schwarz_screener {
+ protected:
+  // spheres (x, y, z, radius) of the shells and of the clusters
+  std::vector<std::array<double, 4>> m_shell_spheres_b;
+  std::vector<std::array<double, 4>> m_shell_spheres_x;
+  std::vector<std::array<double, 4>> m_spheres_b;
+  std::vector<std::array<double, 4>> m_spheres_x;
+
+  // bounds on the L1 norms of each function of an auxiliary shell and of
+  // each product of two basis functions of a shell pair
+  Eigen::VectorXd m_l1_x;
+  Eigen::MatrixXd m_l1_mn;
+
+  // the same for all functions of a block, as Frobenius norms
+  Eigen::VectorXd m_blk_l1_x;
+  Eigen::MatrixXd m_blk_l1_mn;
+
+ public:
+  qqr_screener(world w, desc::shared_molecule mol) :
+      schwarz_screener(w, mol, "qqr")
+  {
+  }
+
+  void compute() override;
+
+  bool skip_block_xbb(int i, int j, int k) override;
+  bool skip_xbb(int i, int j, int k) override;
+
+  bool skip_block_bbbb(int i, int j, int k, int l) override;
+  bool skip_bbbb(int i, int j, int k, int l) override;
+
+  double estimate_block_xbb(int i, int j, int k) override;
+  double estimate_block_bbbb(int i, int j, int k, int l) override;
+
+  bool distance_decay() const override
+  {
+    return true;
+  }
+
+  ~qqr_screener()
+  {
+  }
+};
+
 class atomic_screener : public screener {
  protected:
   std::vector<int> m_atom_list;
@@ -94,6 +273,26 @@ class atomic_screener : public screener {
   bool skip_block_bbbb(int i, int j, int k, int l) override;
   bool skip_bbbb(int i, int j, int k, int l) override;
 
+  double estimate_block_xbb(int i, int j, int k) override
+  {
+    return m_schwarz.estimate_block_xbb(i, j, k);
+  }
+
+  double estimate_block_bbbb(int i, int j, int k, int l) override
+  {
+    return m_schwarz.estimate_block_bbbb(i, j, k, l);
+  }
+
+  const shellpair_list* shellpairs() override
+  {
+    return m_schwarz.shellpairs();
+  }
+
+  const double* shell_bounds_x() override
+  {
+    return m_schwarz.shell_bounds_x();
+  }
+
   std::vector<bool> blklist_b()
   {
     return m_blklist_b;
@@ -110,6 +309,10 @@ class atomic_screener : public screener {
 
 using shared_screener = std::shared_ptr<screener>;
 
+// creates a screener by name: "schwarz" or "qqr"
+shared_screener create_screener(
+    world w, desc::shared_molecule mol, std::string method);
+
 }  // namespace ints
 
 }  // namespace megalochem
@@ -0,0 +1,131 @@
+#include "ints/shellpairs.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace megalochem {
+
+namespace ints {
+
+// Extent of the product distribution of two shells: the radius around the
+// centre of the most diffuse primitive product beyond which the Gaussian
+// product prefactor times exp(-p r^2) drops below the threshold
+static void pair_extent(
+    const desc::Shell& sh0,
+    const desc::Shell& sh1,
+    double threshold,
+    std::array<double, 3>& centre,
+    double& extent)
+{
+  const auto& A = sh0.O;
+  const auto& B = sh1.O;
+
+  double ab2 = 0.0;
+  for (int i = 0; i != 3; ++i) { ab2 += (A[i] - B[i]) * (A[i] - B[i]); }
+
+  extent = 0.0;
+  double pmin = std::numeric_limits<double>::max();
+
+  for (auto a : sh0.alpha) {
+    for (auto b : sh1.alpha) {
+      const double p = a + b;
+      const double kab = exp(-a * b / p * ab2);
+
+      const double r =
+          (kab > threshold) ? sqrt(log(kab / threshold) / p) : 0.0;
+
+      if (r > extent || (extent == 0.0 && p < pmin)) {
+        extent = r;
+        pmin = p;
+        for (int i = 0; i != 3; ++i) { centre[i] = (a * A[i] + b * B[i]) / p; }
+      }
+    }
+  }
+}
+
+shellpair_list::shellpair_list(
+    const desc::cluster_basis& cbas,
+    const Eigen::MatrixXd& z_mn,
+    double threshold) :
+    m_nblks(cbas.size()),
+    m_max_bound(0.0)
+{
+  auto shell_offsets = cbas.shell_offsets();
+
+  m_row_ptr.reserve(m_nblks + 1);
+  m_row_ptr.push_back(0);
+  m_pair_ptr.push_back(0);
+
+  for (int iblk0 = 0; iblk0 != m_nblks; ++iblk0) {
+    const auto& shells0 = cbas[iblk0].shells;
+
+    for (int iblk1 = 0; iblk1 != m_nblks; ++iblk1) {
+      const auto& shells1 = cbas[iblk1].shells;
+      const size_t first = m_pairs.size();
+
+      int off0 = 0;
+      for (int s0 = 0; s0 != (int)shells0.size(); ++s0) {
+        const auto& sh0 = shells0[s0];
+        const int size0 = sh0.size();
+
+        int off1 = 0;
+        for (int s1 = 0; s1 != (int)shells1.size(); ++s1) {
+          const auto& sh1 = shells1[s1];
+          const int size1 = sh1.size();
+
+          const double bound =
+              z_mn(shell_offsets[iblk0] + s0, shell_offsets[iblk1] + s1);
+
+          if (bound > threshold) {
+            shellpair sp{s0, s1, off0, off1, size0, size1, bound, 0.0, {}};
+            pair_extent(sh0, sh1, threshold, sp.centre, sp.extent);
+            m_pairs.push_back(sp);
+            m_max_bound = std::max(m_max_bound, bound);
+          }
+
+          off1 += size1;
+        }
+
+        off0 += size0;
+      }
+
+      if (m_pairs.size() == first)
+        continue;
+
+      std::sort(
+          m_pairs.begin() + first, m_pairs.end(),
+          [](const shellpair& a, const shellpair& b) {
+            return a.bound > b.bound;
+          });
+
+      m_blk_cols.push_back(iblk1);
+      m_pair_ptr.push_back(m_pairs.size());
+    }
+
+    m_row_ptr.push_back(m_blk_cols.size());
+  }
+
+  m_pairs.shrink_to_fit();
+}
+
+std::pair<const shellpair*, const shellpair*> shellpair_list::get(
+    int iblk0, int iblk1) const
+{
+  auto first = m_blk_cols.begin() + m_row_ptr[iblk0];
+  auto last = m_blk_cols.begin() + m_row_ptr[iblk0 + 1];
+
+  auto iter = std::lower_bound(first, last, iblk1);
+
+  if (iter == last || *iter != iblk1) {
+    return {nullptr, nullptr};
+  }
+
+  const size_t ipos = iter - m_blk_cols.begin();
+
+  return {m_pairs.data() + m_pair_ptr[ipos],
+          m_pairs.data() + m_pair_ptr[ipos + 1]};
+}
+
+}  // namespace ints
+
+}  // namespace megalochem
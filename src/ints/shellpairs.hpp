@@ -0,0 +1,85 @@
+#ifndef INTS_SHELLPAIRS_H
+#define INTS_SHELLPAIRS_H
+
+#include <Eigen/Core>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "desc/basis.hpp"
+
+namespace megalochem {
+
+namespace ints {
+
+/* Significant pair of shells (s0,s1) inside a block pair (iblk0,iblk1).
+ * Shell indices and function offsets are local to the respective blocks.
+ */
+struct shellpair {
+  int s0, s1;
+  int off0, off1;
+  int size0, size1;
+  double bound;  // Schwarz bound sqrt(|(s0 s1|s0 s1)|)
+  double extent;  // radius of the product distribution around centre
+  std::array<double, 3> centre;
+};
+
+/* Compact list of all significant shell pairs of a cluster basis.
+ * Pairs are grouped by block pair (compressed sparse row over the blocks)
+ * and sorted by decreasing Schwarz bound within each group, so the
+ * integral kernels can stop as soon as a bound product becomes negligible.
+ */
+class shellpair_list {
+ private:
+  int m_nblks;
+
+  std::vector<size_t> m_row_ptr;
+  std::vector<int> m_blk_cols;
+  std::vector<size_t> m_pair_ptr;
+  std::vector<shellpair> m_pairs;
+
+  double m_max_bound;
+
+ public:
+  shellpair_list(
+      const desc::cluster_basis& cbas,
+      const Eigen::MatrixXd& z_mn,
+      double threshold);
+
+  // range [first, last) of pairs in block pair (iblk0, iblk1)
+  std::pair<const shellpair*, const shellpair*> get(
+      int iblk0, int iblk1) const;
+
+  size_t npairs() const
+  {
+    return m_pairs.size();
+  }
+
+  int nblks() const
+  {
+    return m_nblks;
+  }
+
+  double max_bound() const
+  {
+    return m_max_bound;
+  }
+};
+
+using shared_shellpair_list = std::shared_ptr<shellpair_list>;
+
+/* Work item of the integral-direct J/K kernel: the quartets of the bra
+ * pair with the ket pairs [ket_begin, ket_end) of a pair list. The ket
+ * pairs of a task are sorted by decreasing Schwarz bound.
+ */
+struct jk_task {
+  int64_t bra;
+  int64_t ket_begin, ket_end;
+};
+
+}  // namespace ints
+
+}  // namespace megalochem
+
+#endif
@@ -163,15 +163,6 @@ int main(int argc, char** argv)
 
   LOG.os<>("========== FINISHED WITHOUT CRASHING ! =========\n");
 
-#ifdef DO_TESTING
-  LOG.os<>("Now comparing reference to output\n");
-  std::string output_ref(argv[3]);
-
-  if (mega_world.rank() == 0) {
-    // something
-  }
-#endif
-
   MPI_Finalize();
 
   return 0;
@@ -163,6 +163,12 @@ class davidson {
       LOG.os<>("SUBSPACE: ", m_subspace, " PREV: ", prev_subspace, '\n');
 
       LOG.os<>("Computing MV products.\n");
+
+      // all new vectors at once, so that the factory can share work
+      std::vector<smat> new_vecs(m_vecs.begin() + prev_subspace, m_vecs.end());
+      auto new_sigmas = (m_pseudo) ? m_fac->compute_block(new_vecs, *omega) :
+                                     m_fac->compute_block(new_vecs);
+
       for (int i = prev_subspace; i != m_subspace; ++i) {
         // std::cout << "GUESS VECTOR: " << i << std::endl;
         if (LOG.global_plev() > 2) {
@@ -170,8 +176,7 @@ class davidson {
           dbcsr::print(*m_vecs[i]);
         }
 
-        auto Av_i = (m_pseudo) ? m_fac->compute(m_vecs[i], *omega) :
-                                 m_fac->compute(m_vecs[i]);
+        auto Av_i = new_sigmas[i - prev_subspace];
         m_sigmas.push_back(Av_i);
 
         // std::cout << "SIGMA VECTOR: " << i << std::endl;
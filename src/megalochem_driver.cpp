@@ -32,6 +32,14 @@ static const nlohmann::json valid_globals = {
     {"integral_omega", 0.1},
     {"qr_T", 1e-6},
     {"qr_R", 40},
+    {"node_memory", 0.0},  // memory per node in GB, 0 to detect
+    {"cint_optimizers", true},  // libcint optimizers, off for timing only
+    {"disk_prefetch", false},  // read ahead one batch of disk tensors
+    {"local_scratch", "string"},  // node-local directory for disk tensors
+    {"hybrid_memory", 0.0},  // GB per process for batches of hybrid tensors
+    {"btensor_precision", "double"},  // double/single/mixed storage
+    {"mixed_threshold", 1e-6},  // single precision below this block norm
+    {"disk_codec", "none"},  // none/lossless/lossy compression on disk
     {"_required", {"type"}}};
 
 static const nlohmann::json valid_basis = {
@@ -81,15 +89,21 @@ static const nlohmann::json valid_hfwfn = {
     {"diis_min_vecs", 2u},  // minimum number of diis vectors in subspace
     {"diis_start", 0u},  // at what iteration to start diis
     {"diis_beta", true},  // whether to use separate coeficients for beta
+    {"incremental_fock", false},  // build J/K from density differences
+    {"fock_rebuild", 8u},  // incremental builds between full builds
     {"build_J", "exact"},  // how Coulomb matrix is constructed
     {"build_K", "exact"},  // how Exchange matrix is constructed
-    {"eris", "direct"},  // how eris are held in memory (core/disk/direct)
-    {"intermeds", "core"},  // how intermediates are held in memory (core/disk)
+    {"fuse_JK", false},  // build J and K in one pass if possible
+    {"eris", "direct"},  // how eris are held (core/disk/hybrid/direct/auto)
+    {"intermeds", "core"},  // how intermediates are held (core/disk/auto)
     {"df_metric", "coulomb"},  // which metric to use for batchdf
+    {"screening", "schwarz"},  // integral screening (schwarz/qqr)
+    {"int_cache", "string"},  // directory of the persistent integral cache
+    {"int_memory", 0.0},  // memory budget for AO quantities in GB per rank
     {"print",
      0u},  // print level (0, 1 or 2 at the moment, -1 for silent output)
-    {"nbatches_x", 4u},
-    {"nbatches_b", 4u},
+    {"nbatches_x", 4u},  // number or "auto"
+    {"nbatches_b", 4u},  // number or "auto"
     {"occ_nbatches", 2u},
     {"read", false},  // skip hartree fock and read from files
     {"max_iter", 10u},
@@ -107,7 +121,9 @@ static const nlohmann::json valid_mpwfn = {
     {"nbatches_b", 3u},      {"nbatches_x", 3u},
     {"df_basis", "basis"},   {"c_os", 1.3},
     {"eris", "core"},        {"intermeds", "core"},
-    {"build_Z", "LLMPFULL"}, {"_required", {"tag", "type", "wfn", "df_basis"}}};
+    {"build_Z", "LLMPFULL"}, {"screening", "schwarz"},
+    {"int_cache", "string"},  {"int_memory", 0.0},
+    {"_required", {"tag", "type", "wfn", "df_basis"}}};
 
 static const nlohmann::json valid_adcwfn = {
     {"tag", "string"},
@@ -127,6 +143,9 @@ static const nlohmann::json valid_adcwfn = {
     {"do_adc1", true},
     {"do_adc2", true},
     {"df_metric", "string"},
+    {"screening", "schwarz"},
+    {"int_cache", "string"},
+    {"int_memory", 0.0},
     {"conv", 1e-5},
     {"build_J", "dfao"},
     {"build_K", "dfao"},
@@ -167,6 +186,16 @@ std::optional<T> json_optional(nlohmann::json& j, std::string key)
   return out;
 }
 
+// batch numbers given as "auto" are passed as 0 and chosen by the planner
+void auto_nbatches(nlohmann::json& j)
+{
+  for (std::string key : {"nbatches_b", "nbatches_x"}) {
+    if (j.find(key) != j.end() && j[key] == "auto") {
+      j[key] = 0;
+    }
+  }
+}
+
 void validate(
     std::string section,
     const nlohmann::json& j_in,
@@ -280,6 +309,14 @@ void driver::parse_globals(nlohmann::json& jdata)
   auto omega = json_optional<double>(jdata, "integral_omega");
   auto qrT = json_optional<double>(jdata, "qr_T");
   auto qrR = json_optional<double>(jdata, "qr_R");
+  auto node_mem = json_optional<double>(jdata, "node_memory");
+  auto cint_opt = json_optional<bool>(jdata, "cint_optimizers");
+  auto prefetch = json_optional<bool>(jdata, "disk_prefetch");
+  auto scratch = json_optional<std::string>(jdata, "local_scratch");
+  auto hybrid_mem = json_optional<double>(jdata, "hybrid_memory");
+  auto precision = json_optional<std::string>(jdata, "btensor_precision");
+  auto mixed_t = json_optional<double>(jdata, "mixed_threshold");
+  auto codec = json_optional<std::string>(jdata, "disk_codec");
 
   if (block_t)
     dbcsr::global::filter_eps = *block_t;
@@ -289,6 +326,22 @@ void driver::parse_globals(nlohmann::json& jdata)
     ints::global::qr_theta = *qrT;
   if (qrR)
     ints::global::qr_rho = *qrR;
+  if (node_mem)
+    ints::global::node_memory = *node_mem;
+  if (cint_opt)
+    ints::global::cint_optimizers = *cint_opt;
+  if (prefetch)
+    dbcsr::btensor_global::prefetch = *prefetch;
+  if (scratch)
+    dbcsr::btensor_global::scratch = *scratch;
+  if (hybrid_mem)
+    dbcsr::btensor_global::hybrid_memory = *hybrid_mem;
+  if (precision)
+    dbcsr::btensor_global::precision = dbcsr::get_bprecision(*precision);
+  if (mixed_t)
+    dbcsr::btensor_global::mixed_threshold = *mixed_t;
+  if (codec)
+    dbcsr::btensor_global::codec = dbcsr::get_bcodec(*codec);
 }
 
 void driver::parse_atoms(nlohmann::json& jdata)
@@ -601,6 +654,8 @@ void driver::run_hfmod(megajob& job)
     dfbas2 = get<desc::shared_cluster_basis>(job.jdata["df_basis2"]);
   }
 
+  auto_nbatches(job.jdata);
+
   auto myhfmod = hf::hfmod::create()
                      .set_world(m_world)
                      .set_molecule(mol)
@@ -625,6 +680,8 @@ void driver::run_mpmod(megajob& job)
     dfbas = get<desc::shared_cluster_basis>(job.jdata["df_basis"]);
   }
 
+  auto_nbatches(job.jdata);
+
   auto mympmod = mp::mpmod::create()
                      .set_world(m_world)
                      .set_wfn(wfn)
@@ -654,6 +711,8 @@ void driver::run_adcmod(megajob& job)
     adc::MVP_AORISOSADC2::USE_DOUBLES_OB = job.jdata["use_doubles_ob"];
   }
 
+  auto_nbatches(job.jdata);
+
   auto myadcmod = adc::adcmod::create()
                       .set_world(m_world)
                       .set_wfn(wfn)
@@ -3,6 +3,7 @@
 #include <dbcsr_matrix_ops.hpp>
 #include <dbcsr_tensor_ops.hpp>
 #include "ints/aoloader.hpp"
+#include "ints/planner.hpp"
 #include "math/laplace/minimax.hpp"
 #include "math/linalg/LLT.hpp"
 #include "math/linalg/piv_cd.hpp"
@@ -107,6 +108,28 @@ desc::shared_wavefunction mpmod::compute()
 
   // integral machine
 
+  // the screener and the memory of hybrid tensors of the planner are
+  // passed on to the aoloader
+  ints::shared_screener scr;
+  double hybrid_memory = dbcsr::btensor_global::hybrid_memory;
+
+  // storage types given as "auto" and batch numbers of 0 are planned
+  if (m_eris == "auto" || m_imeds == "auto" || m_nbatches_b <= 0 ||
+      m_nbatches_x <= 0) {
+    scr = ints::create_screener(m_world, mol, m_screening);
+    scr->compute();
+
+    ints::batch_planner planner(m_world, mol, scr, LOG.global_plev());
+    auto plan =
+        planner.plan(true, false, m_eris, m_imeds, m_nbatches_b, m_nbatches_x);
+
+    m_eris = dbcsr::btype_name(plan.eris);
+    m_imeds = dbcsr::btype_name(plan.intermeds);
+    m_nbatches_b = plan.nbatches_b;
+    m_nbatches_x = plan.nbatches_x;
+    hybrid_memory = plan.hybrid_memory;
+  }
+
   dbcsr::btype btype_e = dbcsr::get_btype(m_eris);
   dbcsr::btype btype_i = dbcsr::get_btype(m_imeds);
 
@@ -118,6 +141,11 @@ desc::shared_wavefunction mpmod::compute()
                                            .nbatches_x(m_nbatches_x)
                                            .btype_eris(btype_e)
                                            .btype_intermeds(btype_i)
+                                           .screening(m_screening)
+                                           .cache_dir(m_int_cache)
+                                           .memory_budget(m_int_memory)
+                                           .hybrid_memory(hybrid_memory)
+                                           .screener(scr)
                                            .build();
 
   auto zmeth = str_to_zmethod(m_build_Z);
@@ -21,6 +21,9 @@ namespace mp {
 #define MPMOD_OPTLIST \
   (((util::optional<int>), print, 0), \
    ((util::optional<std::string>), df_metric, "coulomb"), \
+   ((util::optional<std::string>), screening, "schwarz"), \
+   ((util::optional<std::string>), int_cache, ""), \
+   ((util::optional<double>), int_memory, 0.0), \
    ((util::optional<int>), nlap, 5), ((util::optional<int>), nbatches_b, 5), \
    ((util::optional<int>), nbatches_x, 5), \
    ((util::optional<double>), c_os, 1.3), \
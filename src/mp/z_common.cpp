@@ -28,24 +28,14 @@ SMatrixXi get_shellpairs(dbcsr::sbtensor<3, double> eri_batched)
     iter.stop();
   };
 
-#ifndef _CORE_VECTOR
-  if (eri_batched->get_type() == dbcsr::btype::core) {
+  eri_batched->decompress_init({0}, vec<int>{0}, vec<int>{1, 2});
+
+  for (int ix = 0; ix != eri_batched->nbatches(0); ++ix) {
+    eri_batched->decompress({ix});
     add_idx(eri_batched->get_work_tensor());
   }
-  else {
-#endif
-
-    eri_batched->decompress_init({0}, vec<int>{0}, vec<int>{1, 2});
 
-    for (int ix = 0; ix != eri_batched->nbatches(0); ++ix) {
-      eri_batched->decompress({ix});
-      add_idx(eri_batched->get_work_tensor());
-    }
-
-    eri_batched->decompress_finalize();
-#ifndef _CORE_VECTOR
-  }
-#endif
+  eri_batched->decompress_finalize();
 
   MPI_Allreduce(
       idx_loc.data(), idx_tot.data(), nblkb * nblkb, MPI_INT, MPI_LOR,
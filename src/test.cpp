@@ -1,4 +1,64 @@
-int main()
+#include <mpi.h>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "megalochem.hpp"
+#include "tests/testing.hpp"
+
+using namespace megalochem;
+
+// Usage: ./chem_test [test_name ...]
+// Runs the given tests, or all registered tests if none are given.
+int main(int argc, char** argv)
 {
-  return 0;
+  MPI_Init(&argc, &argv);
+  MPI_Comm comm = MPI_COMM_WORLD;
+
+  util::mpi_log LOG(comm, 0);
+
+  megalochem::init(comm, ".");
+
+  auto& tests = testing::registry();
+
+  std::vector<std::string> names;
+  for (int i = 1; i < argc; ++i) { names.push_back(argv[i]); }
+
+  if (names.empty()) {
+    for (auto& [name, func] : tests) { names.push_back(name); }
+  }
+
+  int nfailed = 0;
+
+  for (auto& name : names) {
+    auto it = tests.find(name);
+
+    if (it == tests.end()) {
+      LOG.os<>("Unknown test: ", name, '\n');
+      ++nfailed;
+      continue;
+    }
+
+    LOG.os<>("Running ", name, "...\n");
+
+    int failed = 0;
+    try {
+      it->second(comm);
+    }
+    catch (std::exception& e) {
+      std::cout << name << ": " << e.what() << std::endl;
+      failed = 1;
+    }
+
+    MPI_Allreduce(MPI_IN_PLACE, &failed, 1, MPI_INT, MPI_MAX, comm);
+
+    LOG.os<>(name, (failed) ? " FAILED\n" : " passed\n");
+    nfailed += failed;
+  }
+
+  megalochem::finalize();
+
+  MPI_Finalize();
+
+  return (nfailed == 0) ? 0 : 1;
 }
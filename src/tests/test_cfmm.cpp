@@ -0,0 +1,84 @@
+#include <dbcsr_conversions.hpp>
+#include "fock/cfmm.hpp"
+#include "fock/jkbuilder.hpp"
+#include "ints/aofactory.hpp"
+#include "ints/aoloader.hpp"
+#include "tests/testing.hpp"
+#include "tests/water.hpp"
+#include "utils/constants.hpp"
+
+using namespace megalochem;
+using megalochem::testing::check;
+
+// distance of the two water molecules in angstrom, far enough apart for
+// the CFMM tree to put them into well separated boxes
+static const double WATER_DISTANCE = 50.0;
+
+// largest error of an element of J
+static const double CFMM_TOL = 1e-8;
+
+// J from CFMM agrees with the exact J from the stored 4c2e integrals to
+// CFMM_TOL. The expansion order follows from the filter threshold, the
+// truncation error THETA^(p + 1) Q / R is then far below CFMM_TOL while
+// the far field Q / R itself is far above it
+MEGALOCHEM_TEST(cfmm)
+{
+  util::mpi_log LOG(comm, 0);
+  world w(comm);
+
+  auto input = testing::water_pair_input(WATER_DISTANCE);
+  auto mol = testing::water_get<desc::shared_molecule>(comm, "mol", input);
+
+  // the overlap matrix as density, a positive charge distribution with
+  // all blocks of the basis
+  ints::aofactory fac(mol, w);
+  auto p = fac.ao_overlap();
+
+  auto aoload = ints::aoloader::create()
+                    .set_world(w)
+                    .set_molecule(mol)
+                    .nbatches_b(2)
+                    .nbatches_x(2)
+                    .btype_eris(dbcsr::btype::core)
+                    .btype_intermeds(dbcsr::btype::core)
+                    .build();
+
+  fock::load_jints(fock::jmethod::exact, ints::metric::coulomb, *aoload);
+  aoload->compute();
+
+  auto build_j = [&](fock::jmethod method) {
+    auto jbuilder = fock::create_j()
+                        .set_world(w)
+                        .molecule(mol)
+                        .aoloader(*aoload)
+                        .method(method)
+                        .metric(ints::metric::coulomb)
+                        .build();
+    jbuilder->init();
+    jbuilder->set_density_alpha(p);
+    jbuilder->compute_J();
+    return jbuilder->get_J();
+  };
+
+  auto j_exact = build_j(fock::jmethod::exact);
+  auto j_cfmm = build_j(fock::jmethod::cfmm);
+
+  auto err = dbcsr::matrix<>::copy(*j_cfmm).name("J error").build();
+  err->add(1.0, -1.0, *j_exact);
+  const double max_err = err->norm(dbcsr_norm_maxabs);
+
+  // the builders take the closed shell density 2 P, each molecule holds
+  // half of its charge 2 tr(P S) = 2 |S|^2
+  auto s_dense = dbcsr::matrix_to_eigen(*p);
+  const double q = s_dense.squaredNorm();
+  const double r = WATER_DISTANCE / BOHR_RADIUS;
+
+  const int order = fock::cfmm::expansion_order(dbcsr::global::filter_eps);
+
+  LOG.os<>(
+      "CFMM J: order ", order, ", max error ", max_err, ", far field ", q / r,
+      ", tolerance ", CFMM_TOL, '\n');
+
+  check(q / r > CFMM_TOL, "far field above the tolerance");
+  check(max_err <= CFMM_TOL, "CFMM J equals exact J");
+}
@@ -0,0 +1,176 @@
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+#include "fock/cfmm.hpp"
+#include "ints/integrals.hpp"
+#include "tests/testing.hpp"
+
+using namespace megalochem;
+using fock::cfmm::exponents;
+using fock::cfmm::point;
+using megalochem::testing::check;
+using megalochem::testing::check_close;
+
+struct charge {
+  point r;
+  double q;
+};
+
+static point diff(const point& a, const point& b)
+{
+  return {a[0] - b[0], a[1] - b[1], a[2] - b[2]};
+}
+
+static double norm(const point& a)
+{
+  return std::sqrt(a[0] * a[0] + a[1] * a[1] + a[2] * a[2]);
+}
+
+// moments M_n = sum q (r-c)^n / n! of point charges about c
+static std::vector<double> moments(
+    const std::vector<charge>& charges,
+    const point& c,
+    const std::vector<exponents>& exps)
+{
+  std::vector<double> m(exps.size(), 0.0);
+  for (auto& ch : charges) {
+    for (size_t in = 0; in != exps.size(); ++in) {
+      m[in] += ch.q * fock::cfmm::scaled_power(diff(ch.r, c), exps[in]);
+    }
+  }
+  return m;
+}
+
+static double potential(const std::vector<charge>& charges, const point& x)
+{
+  double v = 0.0;
+  for (auto& ch : charges) { v += ch.q / norm(diff(x, ch.r)); }
+  return v;
+}
+
+// local expansion l about c at x
+static double local_value(
+    const std::vector<double>& l,
+    const point& c,
+    const point& x,
+    const std::vector<exponents>& exps)
+{
+  double v = 0.0;
+  for (size_t ik = 0; ik != exps.size(); ++ik) {
+    v += l[ik] * fock::cfmm::scaled_power(diff(x, c), exps[ik]);
+  }
+  return v;
+}
+
+// M2M and L2L are exact translations of truncated expansions, and the
+// potential of an M2L expansion of order p between well separated spheres
+// stays within the THETA^(p + 1) error of the truncation, for the lowest
+// and the highest order
+static void check_operators(int order)
+{
+  using namespace fock::cfmm;
+
+  const auto exps = ints::multipole_exponents(order);
+  const std::string tag = " (order " + std::to_string(order) + ")";
+
+  std::mt19937 gen(7);
+  std::uniform_real_distribution<double> dist(-1.0, 1.0);
+
+  auto random_point = [&](const point& c, double radius) {
+    point x;
+    do {
+      x = {dist(gen), dist(gen), dist(gen)};
+    } while (norm(x) > 1.0);
+    return point{
+        c[0] + radius * x[0], c[1] + radius * x[1], c[2] + radius * x[2]};
+  };
+
+  // positive charges, like an electron density, in a sphere around a
+  // child box centre
+  const point child = {0.3, -0.5, 0.2};
+  const double r_child = 1.5;
+
+  std::vector<charge> charges;
+  double q_abs = 0.0;
+  for (int i = 0; i != 20; ++i) {
+    charges.push_back({random_point(child, r_child), 1.0 + dist(gen)});
+    q_abs += std::fabs(charges.back().q);
+  }
+
+  // M2M: moments about the parent centre
+  const point parent = {1.0, 0.25, -0.5};
+  const auto m_child = moments(charges, child, exps);
+  const auto m_ref = moments(charges, parent, exps);
+
+  std::vector<double> m_parent(exps.size(), 0.0);
+  m2m(m_child.data(), diff(child, parent), exps, m_parent.data());
+
+  for (size_t in = 0; in != exps.size(); ++in) {
+    check_close(
+        m_parent[in], m_ref[in], 1e-12 * (1.0 + std::fabs(m_ref[in])),
+        "M2M moment " + std::to_string(in) + tag);
+  }
+
+  // M2L: local expansions about target centres at and beyond the well
+  // separated distance, the error bound (ratio of the radii to the
+  // distance)^(order + 1) falls off fast enough to catch wrong higher
+  // orders
+  double r_source = 0.0;
+  for (auto& ch : charges) {
+    r_source = std::max(r_source, norm(diff(ch.r, parent)));
+  }
+
+  const double r_target = 1.0;
+
+  std::vector<double> l_target, d;
+  point target;
+  std::vector<point> probes;
+
+  for (double f : {4.0, 2.0, 1.0}) {
+    const double ratio = THETA / f;
+    const double sep = (r_source + r_target) / ratio;
+    target = {parent[0] + 0.6 * sep, parent[1] - 0.8 * sep, parent[2]};
+
+    l_target.assign(exps.size(), 0.0);
+    m2l(m_parent.data(), diff(target, parent), exps, d, l_target.data());
+
+    const double tol = (std::pow(ratio, order + 1) + 1e-12) * q_abs /
+        (sep - r_source - r_target);
+
+    probes.clear();
+    for (int i = 0; i != 50; ++i) {
+      probes.push_back(random_point(target, r_target));
+    }
+
+    for (auto& x : probes) {
+      check_close(
+          local_value(l_target, target, x, exps), potential(charges, x), tol,
+          "M2L potential at THETA / " + std::to_string(f) + tag);
+    }
+  }
+
+  // L2L: the same expansion about a child centre of the target box
+  const point target_child = {target[0] + 0.25, target[1] - 0.3,
+                              target[2] + 0.4};
+
+  std::vector<double> l_child(exps.size(), 0.0);
+  l2l(l_target.data(), diff(target_child, target), exps, l_child.data());
+
+  for (auto& x : probes) {
+    const double ref = local_value(l_target, target, x, exps);
+    check_close(
+        local_value(l_child, target_child, x, exps), ref,
+        1e-12 * (1.0 + std::fabs(ref)), "L2L potential" + tag);
+  }
+}
+
+MEGALOCHEM_TEST(cfmm_operators)
+{
+  for (int order : {4, fock::cfmm::MAX_ORDER}) { check_operators(order); }
+
+  check(
+      fock::cfmm::expansion_order(1e-8) == fock::cfmm::MAX_ORDER,
+      "expansion order for 1e-8");
+  check(fock::cfmm::expansion_order(1e-2) == 4, "expansion order for 1e-2");
+}
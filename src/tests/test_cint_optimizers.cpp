@@ -0,0 +1,76 @@
+#include <mpi.h>
+#include "fock/jkbuilder.hpp"
+#include "ints/aofactory.hpp"
+#include "ints/aoloader.hpp"
+#include "tests/testing.hpp"
+#include "tests/water.hpp"
+
+using namespace megalochem;
+using megalochem::testing::check;
+
+// wall time of the AO-loader for the DF-J integrals of water
+static double aoloader_time(world w, desc::shared_molecule mol)
+{
+  auto aoload = ints::aoloader::create()
+                    .set_world(w)
+                    .set_molecule(mol)
+                    .nbatches_b(2)
+                    .nbatches_x(2)
+                    .btype_eris(dbcsr::btype::core)
+                    .btype_intermeds(dbcsr::btype::core)
+                    .build();
+
+  fock::load_jints(fock::jmethod::dfao, ints::metric::coulomb, *aoload);
+
+  MPI_Barrier(w.comm());
+  const double t0 = MPI_Wtime();
+  aoload->compute();
+  MPI_Barrier(w.comm());
+
+  return MPI_Wtime() - t0;
+}
+
+// largest difference of two matrices
+static double max_diff(dbcsr::matrix<double>& a, dbcsr::matrix<double>& b)
+{
+  auto d = dbcsr::matrix<>::copy(a).name("difference").build();
+  d->add(1.0, -1.0, b);
+  return d->norm(dbcsr_norm_maxabs);
+}
+
+// the libcint optimizers leave the integrals unchanged. The AO-loader
+// times with and without them are logged, the speedup is not checked as
+// it depends on the machine
+MEGALOCHEM_TEST(cint_optimizers)
+{
+  util::mpi_log LOG(comm, 0);
+  world w(comm);
+
+  auto mol = testing::water_molecule(comm);
+  auto dfbas = testing::water_get<desc::shared_cluster_basis>(comm, "dfbasis");
+  mol->set_cluster_dfbasis(dfbas);
+
+  std::array<dbcsr::shared_matrix<double>, 2> v_xx, z_bb;
+  std::array<double, 2> t_load;
+
+  for (int use_opt : {0, 1}) {
+    ints::global::cint_optimizers = use_opt;
+
+    ints::aofactory fac(mol, w);
+    v_xx[use_opt] = fac.ao_2c2e(ints::metric::coulomb);
+    z_bb[use_opt] = fac.ao_schwarz();
+
+    t_load[use_opt] = aoloader_time(w, mol);
+  }
+
+  ints::global::cint_optimizers = true;
+
+  LOG.os<>(
+      "AO-loader without optimizers: ", t_load[0], " s, with: ", t_load[1],
+      " s, speedup ", t_load[0] / t_load[1], '\n');
+
+  check(
+      max_diff(*v_xx[0], *v_xx[1]) <= 1e-12, "2c2e integrals with optimizers");
+  check(
+      max_diff(*z_bb[0], *z_bb[1]) <= 1e-12, "Schwarz bounds with optimizers");
+}
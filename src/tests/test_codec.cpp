@@ -0,0 +1,97 @@
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "tests/testing.hpp"
+#include "utils/codec.hpp"
+
+using megalochem::testing::check;
+
+// encodes and decodes a block, and checks that the data is unchanged
+static std::vector<char> round_trip(const std::vector<double>& data)
+{
+  std::vector<char> enc;
+  util::codec::encode(
+      (const char*)data.data(), data.size(), sizeof(double), enc);
+
+  std::vector<double> dec(data.size());
+  util::codec::decode(
+      enc.data(), enc.size(), data.size(), sizeof(double),
+      (char*)dec.data());
+
+  check(
+      std::memcmp(data.data(), dec.data(), data.size() * sizeof(double)) == 0,
+      "decoded block equals input (" + std::to_string(data.size()) +
+          " elements)");
+
+  return enc;
+}
+
+// lossless round trips for blocks that do and do not compress, lossy round
+// trips within the quantisation error, and detection of broken blocks
+MEGALOCHEM_TEST(codec)
+{
+  std::mt19937_64 gen(42);
+  std::uniform_real_distribution<double> dist(-1.0, 1.0);
+
+  // random bits do not compress and are stored raw
+  std::vector<double> bits(1000);
+  for (auto& x : bits) {
+    uint64_t v = gen();
+    std::memcpy(&x, &v, sizeof(double));
+  }
+  auto enc = round_trip(bits);
+  check(enc[0] == util::codec::raw, "random block is stored raw");
+
+  std::vector<double> noise(1000);
+  for (auto& x : noise) { x = dist(gen); }
+  round_trip(noise);
+
+  // decaying integrals with repeated exponents compress
+  std::vector<double> decay(4096);
+  for (size_t i = 0; i != decay.size(); ++i) {
+    decay[i] = std::exp(-0.01 * (i % 512));
+  }
+  enc = round_trip(decay);
+  check(enc[0] == util::codec::shuffle_lz, "smooth block is compressed");
+  check(
+      enc.size() < decay.size() * sizeof(double), "smooth block shrinks");
+
+  // the hash table is reused between blocks, a block encodes the same
+  // after other blocks
+  round_trip(noise);
+  check(round_trip(decay) == enc, "encoding does not depend on earlier blocks");
+
+  // edge cases: empty, single element, all zero
+  round_trip({});
+  round_trip({3.14});
+  round_trip(std::vector<double>(777, 0.0));
+
+  // lossy: quantised data round trips exactly, within eps of the input
+  for (double eps : {1e-6, 1e-10, 1e-14}) {
+    auto q = noise;
+    util::codec::quantise(q.data(), q.size(), eps);
+    for (size_t i = 0; i != q.size(); ++i) {
+      check(
+          std::fabs(q[i] - noise[i]) <= eps,
+          "quantisation error within " + std::to_string(eps));
+    }
+    round_trip(q);
+  }
+
+  // truncated blocks are rejected
+  enc = round_trip(decay);
+  enc.resize(enc.size() / 2);
+  std::vector<double> dec(decay.size());
+  bool thrown = false;
+  try {
+    util::codec::decode(
+        enc.data(), enc.size(), decay.size(), sizeof(double),
+        (char*)dec.data());
+  }
+  catch (std::runtime_error&) {
+    thrown = true;
+  }
+  check(thrown, "truncated block is rejected");
+}
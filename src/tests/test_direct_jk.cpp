@@ -0,0 +1,94 @@
+#include <dbcsr_conversions.hpp>
+#include <algorithm>
+#include "fock/jkbuilder.hpp"
+#include "ints/aofactory.hpp"
+#include "ints/aoloader.hpp"
+#include "tests/testing.hpp"
+#include "tests/water.hpp"
+
+using namespace megalochem;
+using megalochem::testing::check;
+
+static double max_diff(dbcsr::matrix<double>& a, dbcsr::matrix<double>& b)
+{
+  auto d = dbcsr::matrix<>::copy(a).name("difference").build();
+  d->add(1.0, -1.0, b);
+  return d->norm(dbcsr_norm_maxabs);
+}
+
+/* The integral-direct J and K agree with J and K from the stored 4c2e
+ * integrals. Both drop integrals: the direct builder quartets whose bound
+ * times the density element is below the integral threshold, the stored
+ * tensor blocks below the block threshold. Each element of J or K sums
+ * nbf^2 quartets, so it differs by at most nbf^2 times the larger
+ * threshold times the largest element of the closed shell density 2 P.
+ */
+MEGALOCHEM_TEST(direct_jk)
+{
+  util::mpi_log LOG(comm, 0);
+  world w(comm);
+
+  auto mol = testing::water_molecule(comm);
+
+  // the overlap matrix as density, symmetric and with all blocks
+  ints::aofactory fac(mol, w);
+  auto p = fac.ao_overlap();
+
+  auto aoload = ints::aoloader::create()
+                    .set_world(w)
+                    .set_molecule(mol)
+                    .nbatches_b(2)
+                    .nbatches_x(2)
+                    .btype_eris(dbcsr::btype::core)
+                    .btype_intermeds(dbcsr::btype::core)
+                    .build();
+
+  fock::load_jints(fock::jmethod::exact, ints::metric::coulomb, *aoload);
+  fock::load_kints(fock::kmethod::exact, ints::metric::coulomb, *aoload);
+  aoload->compute();
+
+  auto build_j = [&](fock::jmethod method) {
+    auto jbuilder = fock::create_j()
+                        .set_world(w)
+                        .molecule(mol)
+                        .aoloader(*aoload)
+                        .method(method)
+                        .metric(ints::metric::coulomb)
+                        .build();
+    jbuilder->init();
+    jbuilder->set_density_alpha(p);
+    jbuilder->compute_J();
+    return jbuilder->get_J();
+  };
+
+  auto build_k = [&](fock::kmethod method) {
+    auto kbuilder = fock::create_k()
+                        .set_world(w)
+                        .molecule(mol)
+                        .aoloader(*aoload)
+                        .method(method)
+                        .metric(ints::metric::coulomb)
+                        .build();
+    kbuilder->init();
+    kbuilder->set_density_alpha(p);
+    kbuilder->compute_K();
+    return kbuilder->get_K_A();
+  };
+
+  const double j_err = max_diff(
+      *build_j(fock::jmethod::direct), *build_j(fock::jmethod::exact));
+  const double k_err = max_diff(
+      *build_k(fock::kmethod::direct), *build_k(fock::kmethod::exact));
+
+  const double nbf = mol->c_basis()->nbf();
+  const double tol = 2.0 * nbf * nbf *
+      std::max(dbcsr::global::filter_eps, ints::global::precision) *
+      p->norm(dbcsr_norm_maxabs);
+
+  LOG.os<>(
+      "Direct J/K: max error J ", j_err, ", K ", k_err, ", tolerance ", tol,
+      '\n');
+
+  check(j_err <= tol, "direct J equals exact J");
+  check(k_err <= tol, "direct K equals exact K");
+}
@@ -0,0 +1,41 @@
+#include <string>
+#include "tests/testing.hpp"
+#include "tests/water.hpp"
+
+using namespace megalochem;
+using megalochem::testing::check_close;
+
+// HF energy of water with the given J/K builders, with or without
+// incremental Fock builds
+static double hf_energy(MPI_Comm comm, std::string jk, bool incremental)
+{
+  auto hf = nlohmann::json::parse(R"({
+    "type": "hfwfn", "tag": "hfwfn", "molecule": "mol", "guess": "SAD",
+    "scf_thresh": 1e-8, "max_iter": 50, "df_basis": "dfbasis",
+    "df_metric": "coulomb", "eris": "core", "intermeds": "core",
+    "nbatches_x": 2, "nbatches_b": 2, "fock_rebuild": 4
+  })");
+
+  hf["build_J"] = jk;
+  hf["build_K"] = jk;
+  hf["incremental_fock"] = incremental;
+
+  auto wfns = testing::run_water(comm, nlohmann::json::array({hf}));
+  return wfns["hfwfn"]->hf_wfn->wfn_energy();
+}
+
+// SCF with Fock matrices built from density differences converges to the
+// same energy as with full builds
+MEGALOCHEM_TEST(incremental_fock)
+{
+  util::mpi_log LOG(comm, 0);
+
+  for (std::string jk : {"dfao", "exact"}) {
+    double e_full = hf_energy(comm, jk, false);
+    double e_incr = hf_energy(comm, jk, true);
+
+    LOG.os<>("J/K ", jk, ": dE(incremental - full) = ", e_incr - e_full, '\n');
+
+    check_close(e_incr, e_full, 1e-7, "incremental HF energy (" + jk + ")");
+  }
+}
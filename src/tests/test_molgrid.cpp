@@ -0,0 +1,88 @@
+#include <cmath>
+#include <string>
+#include "ints/molgrid.hpp"
+#include "tests/testing.hpp"
+#include "tests/water.hpp"
+
+using namespace megalochem;
+using megalochem::testing::check_close;
+
+// (n-1)!! for even n, 1 for n = 0
+static double double_factorial(int n)
+{
+  double out = 1.0;
+  for (int k = n - 1; k > 1; k -= 2) { out *= k; }
+  return out;
+}
+
+// the Lebedev grid averages the monomials x^a y^b z^c up to degree 11
+// exactly over the unit sphere, and the molecular grid with its atomic
+// partitioning integrates normalized gaussians on each atom of water to
+// one each. The small angular grid leaves errors of about 1e-3 where the
+// cells of the atoms meet, an unpartitioned grid would count each
+// gaussian on all three atoms
+MEGALOCHEM_TEST(molgrid)
+{
+  const auto lebedev = ints::lebedev_50();
+
+  double wsum = 0.0;
+  for (auto& p : lebedev) {
+    check_close(
+        p[0] * p[0] + p[1] * p[1] + p[2] * p[2], 1.0, 1e-14,
+        "Lebedev point on the unit sphere");
+    wsum += p[3];
+  }
+  check_close(wsum, 1.0, 1e-14, "Lebedev weights");
+
+  for (int a = 0; a <= 11; ++a) {
+    for (int b = 0; a + b <= 11; ++b) {
+      for (int c = 0; a + b + c <= 11; ++c) {
+        double avg = 0.0;
+        for (auto& p : lebedev) {
+          avg += p[3] * std::pow(p[0], a) * std::pow(p[1], b) *
+              std::pow(p[2], c);
+        }
+
+        double ref = 0.0;
+        if (a % 2 == 0 && b % 2 == 0 && c % 2 == 0) {
+          ref = double_factorial(a) * double_factorial(b) *
+              double_factorial(c) / double_factorial(a + b + c + 2);
+        }
+
+        check_close(
+            avg, ref, 1e-14,
+            "Lebedev average of x^" + std::to_string(a) + " y^" +
+                std::to_string(b) + " z^" + std::to_string(c));
+      }
+    }
+  }
+
+  auto mol = testing::water_molecule(comm);
+  auto atoms = mol->atoms();
+
+  ints::molecular_grid grid(mol, 30, 1e-10);
+  grid.compute();
+
+  // tight and diffuse gaussians, the latter reach into the cells of the
+  // other atoms
+  for (double alpha : {4.0, 0.3}) {
+    const double norm = std::pow(alpha / M_PI, 1.5);
+    double sum = 0.0;
+
+    for (auto& batch : grid.batches()) {
+      for (size_t ig = 0; ig != batch.points.size(); ++ig) {
+        auto& pt = batch.points[ig];
+        for (auto& at : atoms) {
+          const double dx = pt[0] - at.x, dy = pt[1] - at.y,
+                       dz = pt[2] - at.z;
+          sum += batch.weights[ig] * norm *
+              std::exp(-alpha * (dx * dx + dy * dy + dz * dz));
+        }
+      }
+    }
+
+    check_close(
+        sum, atoms.size(), 1e-2,
+        "integral of gaussians with exponent " + std::to_string(alpha));
+  }
+}
@@ -0,0 +1,66 @@
+#include <dbcsr_btensor.hpp>
+#include <cfloat>
+#include <cmath>
+#include <string>
+#include "tests/testing.hpp"
+#include "tests/water.hpp"
+
+using namespace megalochem;
+using megalochem::testing::check_close;
+
+// returns the DF-HF and SOS-MP2 energies with core tensors stored with
+// precision p
+static std::pair<double, double> water_energies(
+    MPI_Comm comm, dbcsr::bprecision p)
+{
+  auto save = dbcsr::btensor_global::precision;
+  dbcsr::btensor_global::precision = p;
+
+  auto wfns = testing::run_water(comm, nlohmann::json::parse(R"([
+    {"type": "hfwfn", "tag": "hfwfn", "molecule": "mol", "guess": "SAD",
+     "scf_thresh": 1e-8, "max_iter": 50, "build_J": "dfao",
+     "build_K": "dfao", "df_basis": "dfbasis", "df_metric": "coulomb",
+     "eris": "core", "intermeds": "core", "nbatches_x": 2,
+     "nbatches_b": 2},
+    {"type": "mpwfn", "tag": "mpwfn", "wfn": "hfwfn",
+     "df_basis": "dfbasis", "df_metric": "coulomb", "eris": "core",
+     "intermeds": "core", "nbatches_x": 2, "nbatches_b": 2}
+  ])"));
+
+  dbcsr::btensor_global::precision = save;
+
+  return {
+      wfns["hfwfn"]->hf_wfn->wfn_energy(), wfns["mpwfn"]->mp_wfn->mp_energy()};
+}
+
+/* The energies with 3c2e tensors stored in single and mixed precision stay
+ * close to the double precision reference. Rounding to float changes each
+ * stored element by at most FLT_EPSILON/2 relative, and both energies are
+ * first order in the integrals, so their errors are of the order of
+ * FLT_EPSILON/2 times the two-electron energy. The tolerance is
+ * FLT_EPSILON |E(HF)|, which is larger. Mixed precision only rounds the
+ * small blocks and stays below single precision.
+ */
+MEGALOCHEM_TEST(btensor_precision)
+{
+  util::mpi_log LOG(comm, 0);
+
+  auto [hf_ref, mp_ref] = water_energies(comm, dbcsr::bprecision::full);
+
+  const double tol = FLT_EPSILON * std::fabs(hf_ref);
+
+  const std::pair<dbcsr::bprecision, std::string> modes[] = {
+      {dbcsr::bprecision::single, "single"},
+      {dbcsr::bprecision::mixed, "mixed"}};
+
+  for (auto& [p, name] : modes) {
+    auto [hf, mp] = water_energies(comm, p);
+
+    LOG.os<>(
+        "Precision ", name, ": dE(HF) = ", hf - hf_ref,
+        " dE(MP2) = ", mp - mp_ref, " tolerance ", tol, '\n');
+
+    check_close(hf, hf_ref, tol, "HF energy in " + name + " precision");
+    check_close(mp, mp_ref, tol, "MP2 energy in " + name + " precision");
+  }
+}
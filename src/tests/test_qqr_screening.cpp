@@ -0,0 +1,205 @@
+#include <dbcsr_conversions.hpp>
+#include <Eigen/Dense>
+#include <cmath>
+#include "ints/aofactory.hpp"
+#include "ints/screening.hpp"
+#include "tests/testing.hpp"
+#include "tests/water.hpp"
+
+using namespace megalochem;
+using megalochem::testing::check;
+
+// distance of the two water molecules in angstrom, close enough for most
+// pairs to survive the Schwarz bound and far enough for the spheres of the
+// distributions on different molecules to be apart
+static const double WATER_DISTANCE = 8.0;
+
+// the 3c2e integrals of the water pair over all blocks, screened with scr
+// or unscreened for nullptr
+static dbcsr::shared_tensor<3> water_xbb(
+    world w,
+    desc::shared_molecule mol,
+    dbcsr::shared_pgrid<3> spgrid3,
+    ints::shared_screener scr,
+    std::string name)
+{
+  auto x = mol->dims().x();
+  auto b = mol->dims().b();
+  arrvec<int, 3> xbb = {x, b, b};
+
+  auto t = dbcsr::tensor<3>::create()
+               .name(name)
+               .set_pgrid(*spgrid3)
+               .map1({0})
+               .map2({1, 2})
+               .blk_sizes(xbb)
+               .build();
+
+  vec<vec<int>> bounds = {
+      {0, (int)x.size() - 1}, {0, (int)b.size() - 1}, {0, (int)b.size() - 1}};
+
+  ints::aofactory fac(mol, w);
+  fac.ao_3c2e_setup(ints::metric::coulomb);
+  fac.ao_3c_fill(t, bounds, scr);
+
+  return t;
+}
+
+static std::vector<int> offsets(const std::vector<int>& sizes)
+{
+  std::vector<int> out(sizes.size(), 0);
+  for (size_t i = 1; i != sizes.size(); ++i) {
+    out[i] = out[i - 1] + sizes[i - 1];
+  }
+  return out;
+}
+
+// c_x = sum_mn (x|mn) P_mn, summed over all ranks
+static Eigen::VectorXd fit_coeffs(
+    MPI_Comm comm,
+    dbcsr::tensor<3>& t,
+    const Eigen::MatrixXd& p_bb,
+    desc::shared_molecule mol)
+{
+  auto off_x = offsets(mol->dims().x());
+  auto off_b = offsets(mol->dims().b());
+
+  Eigen::VectorXd c = Eigen::VectorXd::Zero(mol->c_dfbasis()->nbf());
+
+  dbcsr::iterator_t<3> iter(t);
+  iter.start();
+
+  while (iter.blocks_left()) {
+    iter.next();
+    auto& idx = iter.idx();
+    auto& size = iter.size();
+
+    bool found = false;
+    auto blk = t.get_block(idx, size, found);
+    if (!found)
+      continue;
+
+    for (int k = 0; k != size[2]; ++k) {
+      for (int j = 0; j != size[1]; ++j) {
+        for (int i = 0; i != size[0]; ++i) {
+          c(off_x[idx[0]] + i) += blk(i, j, k) *
+              p_bb(off_b[idx[1]] + j, off_b[idx[2]] + k);
+        }
+      }
+    }
+  }
+
+  iter.stop();
+
+  MPI_Allreduce(MPI_IN_PLACE, c.data(), c.size(), MPI_DOUBLE, MPI_SUM, comm);
+
+  return c;
+}
+
+/* The QQR screener drops at most blocks with a norm below the block
+ * threshold and shell triples below the integral threshold, so every
+ * element of the screened (x|mn) differs from the unscreened one by at most
+ * the larger of the two. The error dc of c_x = sum_mn (x|mn) P_mn with the
+ * overlap as P is then at most that times sum |P_mn|, and the error of the
+ * DF-J energy E = 1/2 c^T V^-1 c at most
+ * ||dc|| ||V^-1 c|| + 1/2 ||dc||^2 / lambda_min(V).
+ */
+MEGALOCHEM_TEST(qqr_screening)
+{
+  util::mpi_log LOG(comm, 0);
+  world w(comm);
+
+  auto input = testing::water_pair_input(WATER_DISTANCE);
+  auto mol = testing::water_get<desc::shared_molecule>(comm, "mol", input);
+  auto dfbas =
+      testing::water_get<desc::shared_cluster_basis>(comm, "dfbasis", input);
+  mol->set_cluster_dfbasis(dfbas);
+
+  std::array<int, 3> pdims3 = {
+      (int)mol->c_dfbasis()->nbf(), (int)mol->c_basis()->nbf(),
+      (int)mol->c_basis()->nbf()};
+  auto spgrid3 = dbcsr::pgrid<3>::create(comm).tensor_dims(pdims3).build();
+
+  auto schwarz = ints::create_screener(w, mol, "schwarz");
+  auto qqr = ints::create_screener(w, mol, "qqr");
+  schwarz->compute();
+  qqr->compute();
+
+  auto t_full = water_xbb(w, mol, spgrid3, nullptr, "xbb_full");
+  auto t_schwarz = water_xbb(w, mol, spgrid3, schwarz, "xbb_schwarz");
+  auto t_qqr = water_xbb(w, mol, spgrid3, qqr, "xbb_qqr");
+
+  const double eps =
+      std::max(dbcsr::global::filter_eps, ints::global::precision);
+
+  // largest error of an element
+  double max_err = 0.0;
+
+  dbcsr::iterator_t<3> iter(*t_full);
+  iter.start();
+
+  while (iter.blocks_left()) {
+    iter.next();
+    auto& idx = iter.idx();
+    auto& size = iter.size();
+
+    bool found_full = false, found_qqr = false;
+    auto blk_full = t_full->get_block(idx, size, found_full);
+    auto blk_qqr = t_qqr->get_block(idx, size, found_qqr);
+
+    for (int i = 0; i != blk_full.ntot(); ++i) {
+      const double ref = blk_full.data()[i];
+      const double val = (found_qqr) ? blk_qqr.data()[i] : 0.0;
+      max_err = std::max(max_err, std::fabs(ref - val));
+    }
+  }
+
+  iter.stop();
+
+  MPI_Allreduce(MPI_IN_PLACE, &max_err, 1, MPI_DOUBLE, MPI_MAX, comm);
+
+  auto skipped = [&](ints::screener& scr, std::string name) {
+    auto s = scr.stats(name);
+    s.reduce(comm);
+    return s.blocks_skipped + s.tuples_skipped;
+  };
+
+  const int64_t nskip_schwarz = skipped(*schwarz, "xbb_schwarz");
+  const int64_t nskip_qqr = skipped(*qqr, "xbb_qqr");
+
+  ints::aofactory fac(mol, w);
+  Eigen::MatrixXd p_bb = dbcsr::matrix_to_eigen(*fac.ao_overlap());
+  Eigen::MatrixXd v_xx =
+      dbcsr::matrix_to_eigen(*fac.ao_2c2e(ints::metric::coulomb));
+
+  auto c_full = fit_coeffs(comm, *t_full, p_bb, mol);
+  auto c_qqr = fit_coeffs(comm, *t_qqr, p_bb, mol);
+
+  Eigen::LLT<Eigen::MatrixXd> v_llt(v_xx);
+  Eigen::VectorXd d_full = v_llt.solve(c_full);
+  Eigen::VectorXd d_qqr = v_llt.solve(c_qqr);
+
+  const double e_full = 0.5 * c_full.dot(d_full);
+  const double e_qqr = 0.5 * c_qqr.dot(d_qqr);
+
+  const double lambda_min =
+      Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd>(v_xx)
+          .eigenvalues()
+          .minCoeff();
+  const double dc =
+      std::sqrt((double)c_full.size()) * eps * p_bb.cwiseAbs().sum();
+  const double de_bound = dc * d_full.norm() + 0.5 * dc * dc / lambda_min;
+
+  LOG.os<>(
+      "QQR screening: skipped ", nskip_qqr, " blocks and shell triples, ",
+      "Schwarz ", nskip_schwarz, ", largest error ", max_err, '\n');
+  LOG.os<>(
+      "DF-J energy: ", e_full, " unscreened, ", e_qqr, " screened, error ",
+      e_qqr - e_full, " bound ", de_bound, '\n');
+
+  check(max_err <= eps, "screened integrals within the threshold");
+  check(nskip_qqr >= nskip_schwarz, "QQR screens at least as much as Schwarz");
+  check(
+      std::fabs(e_qqr - e_full) <= de_bound,
+      "screened DF-J energy within the bound");
+}
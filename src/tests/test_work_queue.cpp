@@ -0,0 +1,48 @@
+#include <omp.h>
+#include <vector>
+#include "tests/testing.hpp"
+#include "utils/work_queue.hpp"
+
+using megalochem::testing::check;
+
+// every task is handed out exactly once, also when threads steal
+MEGALOCHEM_TEST(work_queue)
+{
+  const int ntasks = 1000;
+  const int nthreads = 4;
+
+  std::vector<double> costs(ntasks);
+  for (int i = 0; i != ntasks; ++i) { costs[i] = (i * 37) % 101 + 1.0; }
+
+  util::work_queue queue(costs, nthreads);
+  std::vector<int> count(ntasks, 0);
+
+#pragma omp parallel num_threads(nthreads)
+  {
+    int64_t task;
+    // thread 0 sleeps first, so that the others steal its tasks
+    if (omp_get_thread_num() == 0) {
+      double t0 = omp_get_wtime();
+      while (omp_get_wtime() - t0 < 0.01) {}
+    }
+
+    while (queue.pop(omp_get_thread_num(), task)) {
+#pragma omp atomic
+      count[task] += 1;
+    }
+  }
+
+  for (int i = 0; i != ntasks; ++i) {
+    check(count[i] == 1, "task " + std::to_string(i) + " taken once");
+  }
+
+  // with one thread the most expensive tasks come first
+  util::work_queue serial(costs, 1);
+  int64_t task;
+  double last = 1e100;
+
+  while (serial.pop(0, task)) {
+    check(costs[task] <= last, "tasks ordered by decreasing cost");
+    last = costs[task];
+  }
+}
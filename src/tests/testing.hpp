@@ -0,0 +1,57 @@
+#ifndef TESTS_TESTING_H
+#define TESTS_TESTING_H
+
+#include <mpi.h>
+#include <cmath>
+#include <functional>
+#include <map>
+#include <stdexcept>
+#include <string>
+
+// minimal registry for the unit tests run by chem_test
+
+namespace megalochem {
+
+namespace testing {
+
+using test_function = std::function<void(MPI_Comm)>;
+
+inline std::map<std::string, test_function>& registry()
+{
+  static std::map<std::string, test_function> tests;
+  return tests;
+}
+
+struct register_test {
+  register_test(std::string name, test_function func)
+  {
+    registry()[name] = func;
+  }
+};
+
+inline void check(bool condition, std::string what)
+{
+  if (!condition)
+    throw std::runtime_error("check failed: " + what);
+}
+
+inline void check_close(double a, double b, double tol, std::string what)
+{
+  if (!(std::fabs(a - b) <= tol)) {
+    throw std::runtime_error(
+        "check failed: " + what + " (" + std::to_string(a) + " vs " +
+        std::to_string(b) + ", tolerance " + std::to_string(tol) + ")");
+  }
+}
+
+}  // namespace testing
+
+}  // namespace megalochem
+
+#define MEGALOCHEM_TEST(name)                                   \
+  static void test_##name(MPI_Comm comm);                       \
+  static megalochem::testing::register_test register_##name(    \
+      #name, test_##name);                                      \
+  static void test_##name([[maybe_unused]] MPI_Comm comm)
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef TESTS_WATER_H
+#define TESTS_WATER_H
+
+#include <mpi.h>
+#include <filesystem>
+#include <map>
+#include <string>
+#include "desc/wfn.hpp"
+#include "megalochem_driver.hpp"
+
+// water in cc-pVDZ with the cc-pVDZ-RI fitting basis, for tests which run
+// whole calculations through the driver
+
+namespace megalochem {
+
+namespace testing {
+
+// the input sections of water, without wavefunctions
+inline nlohmann::json water_input()
+{
+  return nlohmann::json::parse(R"({
+    "megalochem": [
+      {
+        "type": "atoms", "tag": "xyz", "unit": "angstrom",
+        "geometry": [0.00000,  0.00000,  0.11779,
+                     0.00000,  0.75545, -0.47116,
+                     0.00000, -0.75545, -0.47116],
+        "symbols": ["O", "H", "H"]
+      },
+      {"type": "basis", "tag": "basis1", "atoms": "xyz", "name": "cc-pvdz"},
+      {"type": "basis", "tag": "dfbasis", "atoms": "xyz",
+       "name": "cc-pvdz-ri"},
+      {"type": "molecule", "tag": "mol", "atoms": "xyz", "basis": "basis1",
+       "mult": 1, "charge": 0, "mo_split": 5}
+    ]
+  })");
+}
+
+// the input of two water molecules, the second shifted by distance
+// (angstrom) along z
+inline nlohmann::json water_pair_input(double distance)
+{
+  auto input = water_input();
+  auto& geometry = input["megalochem"][0]["geometry"];
+  auto& symbols = input["megalochem"][0]["symbols"];
+
+  for (int i = 0; i != 9; i += 3) {
+    geometry.push_back(geometry[i]);
+    geometry.push_back(geometry[i + 1]);
+    geometry.push_back(geometry[i + 2].get<double>() + distance);
+    symbols.push_back(symbols[i / 3]);
+  }
+
+  return input;
+}
+
+/* Runs the given wavefunction sections (hfwfn, mpwfn, ...) for water and
+ * returns the wavefunctions by tag. The molecule is "mol" and the fitting
+ * basis "dfbasis". The output file of the run is removed.
+ */
+inline std::map<std::string, desc::shared_wavefunction> run_water(
+    MPI_Comm comm, nlohmann::json wfns)
+{
+  auto input = water_input();
+
+  for (auto& w : wfns) { input["megalochem"].push_back(w); }
+
+  std::string hdf5file = "test_water.hdf5";
+  auto dh_out = std::make_shared<filio::data_handler>(
+      hdf5file, filio::create_mode::truncate, comm);
+  filio::data_io fh = {nullptr, dh_out};
+
+  std::map<std::string, desc::shared_wavefunction> out;
+
+  {
+    driver d(world(comm), fh);
+    d.parse_json(input);
+    d.run();
+
+    for (auto& w : wfns) {
+      std::string tag = w["tag"];
+      out[tag] = d.get<desc::shared_wavefunction>(tag);
+    }
+  }
+
+  fh.output_fh.reset();
+  dh_out.reset();
+
+  int rank = 0;
+  MPI_Comm_rank(comm, &rank);
+  if (rank == 0)
+    std::filesystem::remove(hdf5file);
+  MPI_Barrier(comm);
+
+  return out;
+}
+
+/* Parses the water input (or another input with the same tags) and returns
+ * the object with the given tag, e.g. the molecule "mol" or the basis
+ * "dfbasis", without running anything. The output file is removed.
+ */
+template <typename T>
+inline T water_get(
+    MPI_Comm comm, std::string tag, nlohmann::json input = water_input())
+{
+  std::string hdf5file = "test_water_get.hdf5";
+  auto dh_out = std::make_shared<filio::data_handler>(
+      hdf5file, filio::create_mode::truncate, comm);
+  filio::data_io fh = {nullptr, dh_out};
+
+  T out;
+
+  {
+    driver d(world(comm), fh);
+    d.parse_json(input);
+    out = d.get<T>(tag);
+  }
+
+  fh.output_fh.reset();
+  dh_out.reset();
+
+  int rank = 0;
+  MPI_Comm_rank(comm, &rank);
+  if (rank == 0)
+    std::filesystem::remove(hdf5file);
+  MPI_Barrier(comm);
+
+  return out;
+}
+
+inline desc::shared_molecule water_molecule(MPI_Comm comm)
+{
+  return water_get<desc::shared_molecule>(comm, "mol");
+}
+
+}  // namespace testing
+
+}  // namespace megalochem
+
+#endif
@@ -0,0 +1,252 @@
+#ifndef UTIL_CODEC_H
+#define UTIL_CODEC_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+// block codec for floating point data: byte shuffle followed by a simple
+// LZ77 compression, optionally after an error-bounded quantisation
+
+namespace util {
+
+namespace codec {
+
+// first byte of an encoded block
+enum method : uint8_t { raw = 0, shuffle_lz = 1 };
+
+// groups byte i of all n elements of the given width together
+inline void shuffle(const char* in, size_t n, size_t width, char* out)
+{
+  for (size_t i = 0; i != n; ++i) {
+    for (size_t b = 0; b != width; ++b) { out[b * n + i] = in[i * width + b]; }
+  }
+}
+
+inline void unshuffle(const char* in, size_t n, size_t width, char* out)
+{
+  for (size_t i = 0; i != n; ++i) {
+    for (size_t b = 0; b != width; ++b) { out[i * width + b] = in[b * n + i]; }
+  }
+}
+
+/* Rounds the mantissa of each value such that the absolute error is at most
+ * eps. The dropped bits are zero, which the byte shuffle turns into long
+ * runs of zeros.
+ */
+inline void quantise(double* data, size_t n, double eps)
+{
+  if (eps <= 0.0)
+    return;
+
+  const int eps_exp = std::ilogb(eps);
+
+  for (size_t i = 0; i != n; ++i) {
+    double x = data[i];
+
+    if (std::fabs(x) < eps) {
+      data[i] = 0.0;
+      continue;
+    }
+
+    // spacing of the kept mantissa: 2^(ilogb(x) - 52 + drop) <= eps
+    int drop = eps_exp - std::ilogb(x) + 52;
+    if (drop <= 0)
+      continue;
+    drop = std::min(drop, 52);
+
+    uint64_t bits;
+    std::memcpy(&bits, &x, sizeof(double));
+    uint64_t half = uint64_t(1) << (drop - 1);
+    uint64_t mask = ~((uint64_t(1) << drop) - 1);
+    bits = (bits + half) & mask;
+    std::memcpy(&data[i], &bits, sizeof(double));
+  }
+}
+
+inline void put_varint(std::vector<char>& out, uint64_t v)
+{
+  while (v >= 0x80) {
+    out.push_back((char)(v | 0x80));
+    v >>= 7;
+  }
+  out.push_back((char)v);
+}
+
+inline uint64_t get_varint(const char*& in, const char* end)
+{
+  uint64_t v = 0;
+  int shift = 0;
+  while (in != end) {
+    uint8_t c = *in++;
+    v |= (uint64_t)(c & 0x7f) << shift;
+    if (!(c & 0x80))
+      return v;
+    shift += 7;
+  }
+  throw std::runtime_error("codec: truncated block");
+}
+
+// hash table of lz_compress, empty entries are -1. The entries set by a
+// call are listed in touched and reset at its end, so that small blocks do
+// not pay for clearing the whole table
+struct lz_table {
+  static constexpr int hash_bits = 14;
+
+  std::vector<int64_t> slots = std::vector<int64_t>(size_t(1) << hash_bits, -1);
+  std::vector<uint32_t> touched;
+
+  void reset()
+  {
+    for (auto h : touched) { slots[h] = -1; }
+    touched.clear();
+  }
+};
+
+/* LZ77 with a hash table of 4-byte sequences. The output is a list of
+ * (literal length, literals, match length, match offset), the last entry
+ * has no match. The table is reused by all calls of a thread.
+ */
+inline void lz_compress(const char* in, size_t n, std::vector<char>& out)
+{
+  const int hash_bits = lz_table::hash_bits;
+  const size_t min_match = 4;
+
+  thread_local lz_table lzt;
+  auto& table = lzt.slots;
+
+  // stale entries would point into the previous block, also after a throw
+  struct reset_guard {
+    lz_table& t;
+    ~reset_guard()
+    {
+      t.reset();
+    }
+  } guard{lzt};
+
+  auto hash = [&](size_t pos) {
+    uint32_t v;
+    std::memcpy(&v, in + pos, sizeof(uint32_t));
+    return (v * 2654435761u) >> (32 - hash_bits);
+  };
+
+  size_t lit_start = 0;
+  size_t pos = 0;
+
+  while (pos + min_match <= n) {
+    uint32_t h = hash(pos);
+    int64_t cand = table[h];
+    table[h] = pos;
+
+    if (cand < 0) {
+      lzt.touched.push_back(h);
+      ++pos;
+      continue;
+    }
+
+    if (std::memcmp(in + cand, in + pos, min_match) != 0) {
+      ++pos;
+      continue;
+    }
+
+    size_t len = min_match;
+    while (pos + len < n && in[cand + len] == in[pos + len]) { ++len; }
+
+    put_varint(out, pos - lit_start);
+    out.insert(out.end(), in + lit_start, in + pos);
+    put_varint(out, len);
+    put_varint(out, pos - cand);
+
+    pos += len;
+    lit_start = pos;
+  }
+
+  put_varint(out, n - lit_start);
+  out.insert(out.end(), in + lit_start, in + n);
+  put_varint(out, 0);
+}
+
+inline void lz_decompress(const char* in, size_t n, char* out, size_t nout)
+{
+  const char* end = in + n;
+  size_t pos = 0;
+
+  while (true) {
+    size_t nlit = get_varint(in, end);
+    if (nlit > (size_t)(end - in) || pos + nlit > nout) {
+      throw std::runtime_error("codec: corrupted block");
+    }
+    std::memcpy(out + pos, in, nlit);
+    in += nlit;
+    pos += nlit;
+
+    size_t len = get_varint(in, end);
+    if (len == 0)
+      break;
+
+    size_t off = get_varint(in, end);
+    if (off == 0 || off > pos || pos + len > nout) {
+      throw std::runtime_error("codec: corrupted block");
+    }
+    // matches may overlap their source
+    for (size_t i = 0; i != len; ++i, ++pos) { out[pos] = out[pos - off]; }
+  }
+
+  if (pos != nout) {
+    throw std::runtime_error("codec: corrupted block");
+  }
+}
+
+/* Appends one encoded block of n elements of the given width to out. Falls
+ * back to storing the block as it is if compression does not pay off.
+ */
+inline void encode(
+    const char* in, size_t n, size_t width, std::vector<char>& out)
+{
+  size_t nbytes = n * width;
+  size_t start = out.size();
+
+  std::vector<char> shuffled(nbytes);
+  shuffle(in, n, width, shuffled.data());
+
+  out.push_back(shuffle_lz);
+  lz_compress(shuffled.data(), nbytes, out);
+
+  if (out.size() - start > nbytes + 1) {
+    out.resize(start);
+    out.push_back(raw);
+    out.insert(out.end(), in, in + nbytes);
+  }
+}
+
+// decodes a block of n elements of the given width written by encode
+inline void decode(
+    const char* in, size_t nin, size_t n, size_t width, char* out)
+{
+  if (nin == 0) {
+    throw std::runtime_error("codec: empty block");
+  }
+
+  size_t nbytes = n * width;
+
+  if ((uint8_t)in[0] == raw) {
+    if (nin - 1 != nbytes) {
+      throw std::runtime_error("codec: corrupted block");
+    }
+    std::memcpy(out, in + 1, nbytes);
+    return;
+  }
+
+  std::vector<char> shuffled(nbytes);
+  lz_decompress(in + 1, nin - 1, shuffled.data(), nbytes);
+  unshuffle(shuffled.data(), n, width, out);
+}
+
+}  // namespace codec
+
+}  // namespace util
+
+#endif
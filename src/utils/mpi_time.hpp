@@ -76,6 +76,13 @@ class mpi_time {
     tot += time_fin - time_ini;
   }
 
+  // adds time measured elsewhere, e.g. accumulated inside a thread
+  void add(double t)
+  {
+    tot += t;
+    ++nproc;
+  }
+
   mpi_time& sub(std::string subname)
   {
     if (subprocs.find(subname) == subprocs.end()) {
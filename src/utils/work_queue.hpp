@@ -0,0 +1,136 @@
+#ifndef UTIL_WORK_QUEUE_H
+#define UTIL_WORK_QUEUE_H
+
+#include <omp.h>
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <string>
+#include <vector>
+#include "utils/mpi_time.hpp"
+
+namespace util {
+
+/* Work-stealing task queue for OpenMP parallel regions.
+ * Tasks are dealt out by decreasing estimated cost, each to the thread with
+ * the smallest load so far. Inside the parallel region every thread takes
+ * tasks from the front of its own queue (most expensive first) and steals
+ * from the back of the other queues once its own queue is empty.
+ */
+class work_queue {
+ private:
+  struct thread_queue {
+    std::mutex mtx;
+    std::deque<int64_t> tasks;
+  };
+
+  int m_nthreads;
+  std::vector<std::unique_ptr<thread_queue>> m_queues;
+
+  // time at which the queue was set up and at which each thread ran out
+  // of work
+  double m_tstart;
+  std::vector<double> m_tfinish;
+
+  bool take(int iqueue, bool front, int64_t& task)
+  {
+    auto& q = *m_queues[iqueue];
+    std::lock_guard<std::mutex> lock(q.mtx);
+
+    if (q.tasks.empty())
+      return false;
+
+    if (front) {
+      task = q.tasks.front();
+      q.tasks.pop_front();
+    }
+    else {
+      task = q.tasks.back();
+      q.tasks.pop_back();
+    }
+
+    return true;
+  }
+
+ public:
+  work_queue(
+      const std::vector<double>& costs, int nthreads = omp_get_max_threads()) :
+      m_nthreads(nthreads), m_tfinish(nthreads, 0.0)
+  {
+    for (int i = 0; i != m_nthreads; ++i) {
+      m_queues.push_back(std::make_unique<thread_queue>());
+    }
+
+    std::vector<int64_t> order(costs.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(
+        order.begin(), order.end(),
+        [&costs](int64_t a, int64_t b) { return costs[a] > costs[b]; });
+
+    std::vector<double> load(m_nthreads, 0.0);
+
+    for (auto itask : order) {
+      int imin = std::min_element(load.begin(), load.end()) - load.begin();
+      m_queues[imin]->tasks.push_back(itask);
+      load[imin] += costs[itask];
+    }
+
+    m_tstart = omp_get_wtime();
+    std::fill(m_tfinish.begin(), m_tfinish.end(), m_tstart);
+  }
+
+  /* Gets the next task for thread ithread. Returns false once all queues
+   * are empty. The clock is only read when a thread runs out of work, not
+   * per task.
+   */
+  bool pop(int ithread, int64_t& task)
+  {
+    if (ithread >= m_nthreads)
+      return false;
+
+    bool found = take(ithread, true, task);
+
+    for (int i = 1; i != m_nthreads && !found; ++i) {
+      found = take((ithread + i) % m_nthreads, false, task);
+    }
+
+    if (!found)
+      m_tfinish[ithread] = omp_get_wtime();
+
+    return found;
+  }
+
+  /* Adds the busy and idle time of each thread to the timer, as
+   * "Thread <i>/busy" and "Thread <i>/idle", and the load imbalance, the
+   * average time the threads wait between running out of work and the last
+   * thread finishing, as "Thread idle". A thread is busy from the setup of
+   * the queue until it runs out of work. Call after the parallel region.
+   */
+  void report(mpi_time& time)
+  {
+    const double tend = *std::max_element(m_tfinish.begin(), m_tfinish.end());
+
+    double idle_sum = 0.0;
+
+    for (int i = 0; i != m_nthreads; ++i) {
+      const double tfinish = std::max(m_tfinish[i], m_tstart);
+      const double busy = tfinish - m_tstart;
+      const double idle = tend - tfinish;
+
+      auto& tthread = time.sub("Thread " + std::to_string(i));
+      tthread.sub("busy").add(busy);
+      tthread.sub("idle").add(idle);
+
+      idle_sum += idle;
+    }
+
+    time.sub("Thread idle").add(idle_sum / m_nthreads);
+  }
+};
+
+}  // end namespace util
+
+#endif